@@ -12,6 +12,7 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 TARGET = Phoenard_Toolkit
 TEMPLATE = app
+CONFIG += c++11
 
 win32:RC_ICONS += App_Icon.ico
 
@@ -43,6 +44,12 @@ SOURCES += main.cpp\
     stk500/tasks/stk500savefiles.cpp \
     stk500/tasks/stk500upload.cpp \
     stk500/tasks/stk500updateregisters.cpp \
+    stk500/tasks/stk500sampleanalog.cpp \
+    stk500/tasks/stk500capturepins.cpp \
+    stk500/tasks/stk500runtestsequence.cpp \
+    stk500/tasks/stk500monitorram.cpp \
+    stk500/tasks/stk500profileram.cpp \
+    stk500/tasks/stk500readflash.cpp \
     imaging/quantize.cpp \
     controls/colorselect.cpp \
     controls/menubutton.cpp \
@@ -62,7 +69,29 @@ SOURCES += main.cpp\
     controls/chipcontrolwidget.cpp \
     controls/portselectbox.cpp \
     stk500/stk500port.cpp \
-    controls/phnbutton.cpp
+    controls/phnbutton.cpp \
+    stk500/stk500ringbuffer.cpp \
+    stk500/stk500seriallog.cpp \
+    controls/serialoutputview.cpp \
+    stk500/stk500serialindex.cpp \
+    dialogs/serialsearchdialog.cpp \
+    stk500/stk500screendecoder.cpp \
+    imaging/screenrecorder.cpp \
+    stk500/stk500samplebuffer.cpp \
+    controls/sampleplot.cpp \
+    dialogs/analogcapturedialog.cpp \
+    stk500/stk500pincapture.cpp \
+    dialogs/pincapturedialog.cpp \
+    controls/chipregistermodel.cpp \
+    controls/ramhexmodel.cpp \
+    stk500/stk500registerlog.cpp \
+    stk500/stk500testsequence.cpp \
+    stk500/stk500rammonitor.cpp \
+    stk500/elfsymbols.cpp \
+    stk500/stk500ramprofile.cpp \
+    dialogs/registertimelinedialog.cpp \
+    dialogs/raminspectordialog.cpp \
+    dialogs/ramprofiledialog.cpp
 
 HEADERS  += mainwindow.h \
     stk500/stk500.h \
@@ -97,7 +126,29 @@ HEADERS  += mainwindow.h \
     stk500/programdata.h \
     controls/portselectbox.h \
     stk500/stk500port.h \
-    controls/phnbutton.h
+    controls/phnbutton.h \
+    stk500/stk500ringbuffer.h \
+    stk500/stk500seriallog.h \
+    controls/serialoutputview.h \
+    stk500/stk500serialindex.h \
+    dialogs/serialsearchdialog.h \
+    stk500/stk500screendecoder.h \
+    imaging/screenrecorder.h \
+    stk500/stk500samplebuffer.h \
+    controls/sampleplot.h \
+    dialogs/analogcapturedialog.h \
+    stk500/stk500pincapture.h \
+    dialogs/pincapturedialog.h \
+    controls/chipregistermodel.h \
+    controls/ramhexmodel.h \
+    stk500/stk500registerlog.h \
+    stk500/stk500testsequence.h \
+    stk500/stk500rammonitor.h \
+    stk500/elfsymbols.h \
+    stk500/stk500ramprofile.h \
+    dialogs/registertimelinedialog.h \
+    dialogs/raminspectordialog.h \
+    dialogs/ramprofiledialog.h
 
 FORMS    += mainwindow.ui \
     dialogs/progressdialog.ui \
@@ -107,9 +158,32 @@ FORMS    += mainwindow.ui \
     controls/serialmonitorwidget.ui \
     controls/sketchlistwidget.ui \
     dialogs/asknamedialog.ui \
-    controls/chipcontrolwidget.ui
+    controls/chipcontrolwidget.ui \
+    dialogs/serialsearchdialog.ui \
+    dialogs/analogcapturedialog.ui \
+    dialogs/pincapturedialog.ui \
+    dialogs/registertimelinedialog.ui \
+    dialogs/raminspectordialog.ui \
+    dialogs/ramprofiledialog.ui
 
-OTHER_FILES +=
+OTHER_FILES += \
+    data/chiptables.py \
+    data/registers.csv \
+    data/pinmapping.csv \
+    data/commands.csv
+
+# Register, pin map and command tables are generated from the CSV files at build time
+CHIPTABLES_PYTHON = python3
+win32:CHIPTABLES_PYTHON = python
+CHIPTABLES_DATA = $$PWD/data/registers.csv $$PWD/data/pinmapping.csv $$PWD/data/commands.csv
+chiptables.input = CHIPTABLES_DATA
+chiptables.output = $$OUT_PWD/chiptables.h
+chiptables.commands = $$CHIPTABLES_PYTHON $$PWD/data/chiptables.py ${QMAKE_FILE_IN} ${QMAKE_FILE_OUT}
+chiptables.depends = $$PWD/data/chiptables.py
+chiptables.CONFIG += combine target_predeps no_link
+chiptables.variable_out = GENERATED_FILES
+QMAKE_EXTRA_COMPILERS += chiptables
+INCLUDEPATH += $$OUT_PWD
 
 RESOURCES += \
     resources.qrc
@@ -1,5 +1,11 @@
 #include "chipcontrolwidget.h"
 #include "ui_chipcontrolwidget.h"
+#include "analogcapturedialog.h"
+#include "pincapturedialog.h"
+#include "registertimelinedialog.h"
+#include "raminspectordialog.h"
+#include "ramprofiledialog.h"
+#include <QMenu>
 
 #define PINMAP_COL_READ   4
 #define PINMAP_COL_MODE   5
@@ -13,9 +19,21 @@ ChipControlWidget::ChipControlWidget(QWidget *parent) :
     ui->setupUi(this);
 
     _active = false;
-    _ignoreChanges = false;
     _forceRefresh = false;
+    _recording = false;
+    _updateStartTime = 0;
     lastTask = NULL;
+
+    _updateTimer.setSingleShot(true);
+    connect(&_updateTimer, SIGNAL(timeout()), this, SLOT(startUpdating()));
+
+    ui->pinmapTable->setContextMenuPolicy(Qt::CustomContextMenu);
+    ui->registerTable->setContextMenuPolicy(Qt::CustomContextMenu);
+
+    _regModel = new ChipRegisterModel(&_reg, this);
+    _bitDelegate = new ChipRegisterBitDelegate(this);
+    connect(_regModel, SIGNAL(registerEdited()), this, SLOT(updateNow()));
+    setupRegisterTable();
 }
 
 ChipControlWidget::~ChipControlWidget()
@@ -37,7 +55,8 @@ void ChipControlWidget::setActive(bool active) {
                     this, SLOT(serialTaskFinished(stk500Task*)), Qt::UniqueConnection);
         }
     }
-    if (active && !serial->isExecuting()) {
+    if (active && !serial->isExecuting() && !_updateTimer.isActive()) {
+        _poller.reset();
         startUpdating();
     }
 }
@@ -53,7 +72,10 @@ bool ChipControlWidget::showRegisters() {
 
 void ChipControlWidget::startUpdating() {
     // Start a new asynchronous task while active
-    if (_active) {
+    if (_active && (lastTask == NULL)) {
+        updateVisibleRegisters();
+        _updateStartTime = QDateTime::currentMSecsSinceEpoch();
+        _poller.select(_reg, _updateStartTime);
         lastTask = new stk500UpdateRegisters(_reg);
         lastTask->readADC = !showRegisters();
         serial->execute(*lastTask, true);
@@ -61,6 +83,30 @@ void ChipControlWidget::startUpdating() {
     }
 }
 
+void ChipControlWidget::updateVisibleRegisters() {
+    _poller.clearVisible();
+    QTableView *tab = showRegisters() ? (QTableView*) ui->registerTable : (QTableView*) ui->pinmapTable;
+    int rowCount = tab->model()->rowCount();
+    if (rowCount == 0) {
+        return;
+    }
+    int firstRow = qMax(0, tab->rowAt(0));
+    int lastRow = tab->rowAt(tab->viewport()->height() - 1);
+    if (lastRow == -1) {
+        lastRow = rowCount - 1;
+    }
+    for (int row = firstRow; row <= lastRow; row++) {
+        if (showRegisters()) {
+            _poller.setVisible(_reg.infoByIndex(row).addressValue);
+        } else {
+            const PinMapInfo &info = _reg.pinmap()[row];
+            _poller.setVisible(info.addr_pin);
+            _poller.setVisible(info.addr_ddr);
+            _poller.setVisible(info.addr_port);
+        }
+    }
+}
+
 void ChipControlWidget::serialTaskFinished(stk500Task *task) {
     // Check if this is our task containing updated registers
     if (task != lastTask) return;
@@ -82,6 +128,13 @@ void ChipControlWidget::serialTaskFinished(stk500Task *task) {
         newReg = _reg;
         newReg.resetUserChanges();
         forceItemUpdate = true;
+    } else {
+        _poller.update(newReg, QDateTime::currentMSecsSinceEpoch());
+
+        // Record the registers as read, before user changes are applied
+        if (_recording) {
+            _regLog.record(QDateTime::currentMSecsSinceEpoch(), newReg.data(0));
+        }
     }
     delete lastTask;
     lastTask = NULL;
@@ -90,92 +143,14 @@ void ChipControlWidget::serialTaskFinished(stk500Task *task) {
     newReg.applyUserChanges(_reg);
     _reg = newReg;
 
-    // Start updating with the current changes
-    startUpdating();
+    // Start updating with the current changes after a delay, keeping the link
+    // free for other use for as long as the update took. User changes go out right away.
+    qint64 duration = QDateTime::currentMSecsSinceEpoch() - _updateStartTime;
+    qint64 delay = duration * (100 - REGISTER_POLL_LINK_SHARE) / REGISTER_POLL_LINK_SHARE;
+    _updateTimer.start((int) qBound((qint64) REGISTER_POLL_MIN_DELAY, delay, (qint64) CHIPREG_POLL_MAX_INTERVAL));
 
     if (ui->stackedWidget->currentWidget() == ui->registerPage) {
-        QTableWidget *tab = ui->registerTable;
-        if (tab->rowCount() == 0) {
-
-            // While initializing the table, do not fire events
-            _ignoreChanges = true;
-
-            // Set up the column header; exclude first element (is vertical header)
-            const int columns = CHIPREG_DATA_COLUMNS - 1;
-            const int header_padding = 12;
-            const ChipRegisterInfo &headerInfo = _reg.infoHeader();
-            int* columnWidths = new int[columns];
-            QFontMetrics fontMetrics(tab->font());
-
-            // Go by all columns and refresh the header values
-            tab->setSelectionMode(QAbstractItemView::SingleSelection);
-            tab->setColumnCount(columns);
-            for (int col = 0; col < columns; col++) {
-                QString colHeader = headerInfo.values[col + 1];
-                columnWidths[col] = fontMetrics.width(colHeader) + header_padding;
-                tab->setHorizontalHeaderItem(col, new QTableWidgetItem(colHeader));
-            }
-
-            // Fill the table with the initial items
-            tab->setRowCount(_reg.count());
-            int moduleRowStart = 0;
-            for (int row = 0; row < _reg.count(); row++) {
-
-                // Read the information
-                const ChipRegisterInfo &info = _reg.infoByIndex(row);
-
-                // Setup the vertical header item
-                tab->setVerticalHeaderItem(row, new QTableWidgetItem(info.address));
-
-                // Create the full row of columns
-                for (int col = 0; col < columns; col++) {
-
-                    // Update and add the cell item
-                    QTableWidgetItem *item = new QTableWidgetItem(info.values[col+1]);
-                    item->setBackgroundColor(QColor(Qt::white));
-                    if (col != 3) {
-                        item->setFlags((item->flags() & ~Qt::ItemIsEditable));
-                    }
-                    if (col >= 2) {
-                        item->setTextAlignment(Qt::AlignCenter);
-                    }
-                    item->setFlags((item->flags() & ~Qt::ItemIsUserCheckable));
-                    tab->setItem(row, col, item);
-
-                    // Increase the column width as needed
-                    int colWidth = fontMetrics.width(item->text()) + header_padding;
-                    if (columnWidths[col] < colWidth) {
-                        columnWidths[col] = colWidth;
-                    }
-                }
-
-                // If module name is the same as the row above; merge
-                if (row > 0 && (_reg.infoByIndex(moduleRowStart).module == info.module) && (info.module != "-")) {
-                    tab->setSpan(moduleRowStart, 0, row-moduleRowStart+1, 1);
-                } else {
-                    moduleRowStart = row;
-                }
-            }
-
-            // Apply column widths
-            for (int col = 0; col < columns; col++) {
-                tab->setColumnWidth(col, columnWidths[col]);
-            }
-            delete[] columnWidths;
-
-            // Next, refresh all the cells
-            forceItemUpdate = true;
-
-            // Done.
-            _ignoreChanges = false;
-        }
-
-        // Update all the cells displayed
-        for (int row = 0; row < ui->registerTable->rowCount(); row++) {
-            for (int col = 0; col < ui->registerTable->columnCount(); col++) {
-                updateItem(ui->registerTable->item(row, col), forceItemUpdate);
-            }
-        }
+        _regModel->refresh(forceItemUpdate);
 
     } else if (ui->stackedWidget->currentWidget() == ui->pinmapPage) {
 
@@ -313,166 +288,163 @@ void ChipControlWidget::updatePinRow(int row, bool forcedUpdate) {
     }
 
     // Refresh the ADC value for A# items
-    QString name = info.name;
-    if (name.startsWith("A")) {
-        bool succ = false;
-        int analogPin = name.remove(0, 1).toInt(&succ, 10);
-        if (succ && (analogPin >= 0) && (analogPin < ANALOG_PIN_COUNT)) {
-            quint16 adc_value = _reg.analog(analogPin);
-            QString text = QString::number(adc_value);
-            text += " (";
-            text += QString::number((double) adc_value / 1023.0 * 3.3, '.', 2);
-            text += "v)";
-
-            QTableWidgetItem *adcItem = ui->pinmapTable->item(row, PINMAP_COL_ADC);
-            adcItem->setText(text);
-        }
+    int analogPin = getAnalogPin(row);
+    if (analogPin != -1) {
+        quint16 adc_value = _reg.analog(analogPin);
+        QString text = QString::number(adc_value);
+        text += " (";
+        text += QString::number((double) adc_value / 1023.0 * 3.3, '.', 2);
+        text += "v)";
+
+        QTableWidgetItem *adcItem = ui->pinmapTable->item(row, PINMAP_COL_ADC);
+        adcItem->setText(text);
     }
 }
 
-void ChipControlWidget::updateItem(QTableWidgetItem *item, bool forcedUpdate) {
-    // While updating, do not cause any events
-    _ignoreChanges = true;
-
-    // Check if there are any changes or if it is forced to update
-    int address = getItemAddress(item);
-    bool valueError = _reg.error(address);
-    bool valueChanged = _reg.changed(address);
-    bool refreshNeeded = (valueChanged || valueError || forcedUpdate);
-
-    // If it has a bit mask, it is a bit item. Update it as such.
-    int bitMask = getItemBitMask(item);
-    if (bitMask && refreshNeeded) {
-        bool isSet = ((_reg[address] & bitMask) == bitMask);
-
-        // Update background color to reflect state
-        item->setBackgroundColor(QColor(isSet ? Qt::yellow : Qt::white));
-
-        // For checkable items, refresh checkbox
-        if (item->flags() & Qt::ItemIsUserCheckable) {
-            item->setCheckState(isSet ? Qt::Checked : Qt::Unchecked);
-        } else {
-            item->setData(Qt::CheckStateRole, QVariant(QVariant::Invalid));
+void ChipControlWidget::setupRegisterTable() {
+    QTableView *tab = ui->registerTable;
+    tab->setModel(_regModel);
+    tab->setSelectionMode(QAbstractItemView::SingleSelection);
+    for (int col = 0; col < CHIPREG_MODEL_COLUMNS; col++) {
+        if (ChipRegisterModel::bitMask(col)) {
+            tab->setItemDelegateForColumn(col, _bitDelegate);
         }
+    }
 
-        // For items displaying 0/1, update the text
-        QString text = item->text();
-        if ((text == "0") || (text == "1")) {
-            item->setText(isSet ? "1" : "0");
+    // Size the columns to fit the header and all cells
+    const int header_padding = 12;
+    QFontMetrics fontMetrics(tab->font());
+    for (int col = 0; col < CHIPREG_MODEL_COLUMNS; col++) {
+        int columnWidth = fontMetrics.width(_regModel->headerData(col, Qt::Horizontal).toString()) + header_padding;
+        for (int row = 0; row < _regModel->rowCount(); row++) {
+            int cellWidth = fontMetrics.width(_regModel->index(row, col).data().toString()) + header_padding;
+            columnWidth = qMax(columnWidth, cellWidth);
         }
+        tab->setColumnWidth(col, columnWidth);
     }
 
-    // Update the displayed text in the value column
-    if (item->column() == 3) {
-        if (valueError) {
-            item->setBackgroundColor(QColor(Qt::red));
-        } else if (valueChanged) {
-            item->setBackgroundColor(QColor(Qt::yellow));
-        }
-        if (refreshNeeded) {
-            item->setText(stk500::getHexText((uint) _reg[address]));
+    // If module name is the same as the row above; merge
+    int moduleRowStart = 0;
+    for (int row = 0; row < _regModel->rowCount(); row++) {
+        const ChipRegisterInfo &info = _reg.infoByIndex(row);
+        if (row > 0 && (_reg.infoByIndex(moduleRowStart).module == info.module) && (info.module != "-")) {
+            tab->setSpan(moduleRowStart, 0, row-moduleRowStart+1, 1);
         } else {
-            // Fade the value cell to white if it is colored
-            QColor c = item->backgroundColor();
-            if (c != QColor(Qt::white)) {
-                int r = c.red(), g = c.green(), b = c.blue();
-                r += 16;
-                g += 16;
-                b += 16;
-                if (r > 255) r = 255;
-                if (g > 255) g = 255;
-                if (b > 255) b = 255;
-                item->setBackgroundColor(QColor::fromRgb(r, g, b));
-            }
+            moduleRowStart = row;
         }
     }
+}
 
-    // We are done.
-    _ignoreChanges = false;
+void ChipControlWidget::on_registerTable_doubleClicked(const QModelIndex &index)
+{
+    _regModel->toggleBit(index);
 }
 
-void ChipControlWidget::on_registerTable_currentItemChanged(QTableWidgetItem *current, QTableWidgetItem *previous)
+void ChipControlWidget::on_pinmapTable_cellDoubleClicked(int row, int column)
 {
-    if (previous) {
-        previous->setFlags(previous->flags() & ~Qt::ItemIsUserCheckable);
-        updateItem(previous, true);
+    const PinMapInfo &info = _reg.pinmap()[row];
+    if (column == PINMAP_COL_MODE) {
+        _reg.setXor(info.addr_ddr, info.addr_mask);
     }
-    int currentBitMask = getItemBitMask(current);
-    if (currentBitMask) {
-        current->setFlags(current->flags() | Qt::ItemIsUserCheckable);
-        updateItem(current, true);
+    if (column == PINMAP_COL_WRITE) {
+        _reg.setXor(info.addr_port, info.addr_mask);
     }
+    updateNow();
 }
 
-void ChipControlWidget::on_registerTable_itemChanged(QTableWidgetItem *item)
+void ChipControlWidget::on_pinmapTable_customContextMenuRequested(const QPoint &pos)
 {
-    if (_ignoreChanges) return;
-
-    int address = getItemAddress(item);
-    if (item->column() == 3) {
-        // The value text item was changed
-        // Compare against the actual value and check for differences
-        QString text = item->text();
-        QString expectedText = stk500::getHexText((uint) _reg[address]);
-        if (expectedText != text) {
-            // Attempt to parse this value
-            int value;
-            bool succ = false;
-            if (text.startsWith("0x", Qt::CaseInsensitive)) {
-                value = text.toInt(&succ, 16);
-            } else {
-                value = text.toInt(&succ, 10);
-            }
-            if (succ) {
-                _reg.set(address, value);
-            } else {
-                item->setText(expectedText);
+    QMenu menu(this);
+    QAction *sampleAction = menu.addAction("Sample analog inputs...");
+    QAction *captureAction = menu.addAction("Capture pin states...");
+    sampleAction->setEnabled(serial && serial->isOpen());
+    captureAction->setEnabled(serial && serial->isOpen());
+    menu.addSeparator();
+    addRecordingActions(menu);
+    QAction *action = menu.exec(ui->pinmapTable->viewport()->mapToGlobal(pos));
+    if (action == NULL) {
+        return;
+    }
+
+    QList<int> rows;
+    QList<QTableWidgetItem*> items = ui->pinmapTable->selectedItems();
+    for (int i = 0; i < items.count(); i++) {
+        if (!rows.contains(items[i]->row())) {
+            rows.append(items[i]->row());
+        }
+    }
+    if (action == sampleAction) {
+        // Sample the analog pins of the selected rows
+        QList<int> channels;
+        for (int i = 0; i < rows.count(); i++) {
+            int analogPin = getAnalogPin(rows[i]);
+            if ((analogPin != -1) && !channels.contains(analogPin)) {
+                channels.append(analogPin);
             }
         }
+        AnalogCaptureDialog dialog(serial, channels, this);
+        dialog.exec();
+    } else if (action == captureAction) {
+        PinCaptureDialog dialog(serial, _reg.pinmap(), rows, this);
+        dialog.exec();
+    }
+}
 
+void ChipControlWidget::on_registerTable_customContextMenuRequested(const QPoint &pos)
+{
+    QMenu menu(this);
+    addRecordingActions(menu);
+    menu.addSeparator();
+    QAction *inspectAction = menu.addAction("Inspect SRAM...");
+    QAction *profileAction = menu.addAction("Profile stack and heap...");
+    inspectAction->setEnabled(serial && serial->isOpen());
+    profileAction->setEnabled(serial && serial->isOpen());
+    QAction *action = menu.exec(ui->registerTable->viewport()->mapToGlobal(pos));
+    if (action == inspectAction) {
+        RamInspectorDialog dialog(serial, this);
+        dialog.exec();
+    } else if (action == profileAction) {
+        RamProfileDialog dialog(serial, this);
+        dialog.exec();
+    }
+}
+
+void ChipControlWidget::addRecordingActions(QMenu &menu) {
+    if (_recording) {
+        menu.addAction(QString("Stop recording (%1 states)").arg(_regLog.count()), this, SLOT(toggleRecording()));
     } else {
-        // Read the bitmask for the item. If there is one, stop.
-        int bitMask = getItemBitMask(item);
-        if (!bitMask) return;
-
-        // Check that the item is checkable
-        if (item->data(Qt::CheckStateRole).type() == QVariant::Invalid) return;
-
-        // Toggle the bit if needed
-        bool bitWasSet = (_reg[address] & bitMask) == bitMask;
-        bool itemChecked = (item->checkState() == Qt::Checked);
-        if (bitWasSet != itemChecked) {
-            _reg.setXor(address, bitMask);
-        }
+        menu.addAction("Start recording registers", this, SLOT(toggleRecording()));
     }
+    menu.addAction("Show register timeline...", this, SLOT(showTimeline()));
 }
 
-int ChipControlWidget::getItemBitMask(QTableWidgetItem *item) {
-    if (item == NULL) return 0;
-    int bitIndex = (11 - item->column());
-    return ((bitIndex >= 0) && (bitIndex < 8)) ? (1 << bitIndex) : 0;
+void ChipControlWidget::toggleRecording() {
+    _recording = !_recording;
+    if (_recording) {
+        _regLog.clear();
+    }
 }
 
-int ChipControlWidget::getItemAddress(QTableWidgetItem *item) {
-    if (item == NULL) return -1;
-    return _reg.infoByIndex(item->row()).addressValue;
+void ChipControlWidget::showTimeline() {
+    RegisterTimelineDialog dialog(_regLog, this);
+    dialog.exec();
 }
 
-void ChipControlWidget::on_registerTable_itemDoubleClicked(QTableWidgetItem *item)
-{
-    int bitMask = getItemBitMask(item);
-    if (bitMask) {
-        _reg.setXor(getItemAddress(item), bitMask);
+int ChipControlWidget::getAnalogPin(int row) {
+    QString name = _reg.pinmap()[row].name;
+    if (name.startsWith("A")) {
+        bool succ = false;
+        int analogPin = name.remove(0, 1).toInt(&succ, 10);
+        if (succ && (analogPin >= 0) && (analogPin < ANALOG_PIN_COUNT)) {
+            return analogPin;
+        }
     }
+    return -1;
 }
 
-void ChipControlWidget::on_pinmapTable_cellDoubleClicked(int row, int column)
-{
-    const PinMapInfo &info = _reg.pinmap()[row];
-    if (column == PINMAP_COL_MODE) {
-        _reg.setXor(info.addr_ddr, info.addr_mask);
-    }
-    if (column == PINMAP_COL_WRITE) {
-        _reg.setXor(info.addr_port, info.addr_mask);
+void ChipControlWidget::updateNow() {
+    // Skip the remaining delay so user changes are written out right away
+    if (_updateTimer.isActive()) {
+        _updateTimer.start(0);
     }
 }
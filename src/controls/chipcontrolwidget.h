@@ -7,6 +7,16 @@
 #include <QMessageBox>
 #include <QComboBox>
 #include <QStackedWidget>
+#include <QTimer>
+#include "chipregistermodel.h"
+#include "../stk500/stk500registerlog.h"
+
+class QMenu;
+
+// Share of the link time (in percent) spent on polling registers
+#define REGISTER_POLL_LINK_SHARE  50
+// Minimal time (in ms) between two register updates
+#define REGISTER_POLL_MIN_DELAY   10
 
 namespace Ui {
 class ChipControlWidget;
@@ -25,34 +35,50 @@ public:
 
 private slots:
     void serialTaskFinished(stk500Task *task);
+    /// Triggers the automatic update loop
+    void startUpdating();
 
-    void on_registerTable_currentItemChanged(QTableWidgetItem *current, QTableWidgetItem *previous);
-
-    void on_registerTable_itemChanged(QTableWidgetItem *item);
+    /// Starts the next update right away, instead of waiting
+    void updateNow();
 
-    void on_registerTable_itemDoubleClicked(QTableWidgetItem *item);
+    void on_registerTable_doubleClicked(const QModelIndex &index);
 
     void on_pinmapTable_cellDoubleClicked(int row, int column);
 
+    void on_pinmapTable_customContextMenuRequested(const QPoint &pos);
+
+    void on_registerTable_customContextMenuRequested(const QPoint &pos);
+
+    /// Starts or stops recording the registers read into the register log
+    void toggleRecording();
+    /// Shows the timeline of the registers recorded
+    void showTimeline();
+
 private:
-    /// Triggers the automatic update loop
-    void startUpdating();
-    /// Refreshes the state of a single item
-    void updateItem(QTableWidgetItem *item, bool forcedUpdate);
-    /// Gets the bit mask for an item; returns 0 when not a bit column item
-    int getItemBitMask(QTableWidgetItem *item);
-    /// Gets the address associated with the row of an item
-    int getItemAddress(QTableWidgetItem *item);
+    /// Marks the registers backing the rows in view to be polled
+    void updateVisibleRegisters();
+    /// Sets up the register table view on the register model
+    void setupRegisterTable();
+    /// Adds the register recording actions to a context menu
+    void addRecordingActions(QMenu &menu);
 
+    /// Gets the analog input number of a pinmapping row; returns -1 when not an A# pin
+    int getAnalogPin(int row);
     /// Refreshes a single pinmapping row
     void updatePinRow(int row, bool forcedUpdate);
 
     Ui::ChipControlWidget *ui;
     stk500UpdateRegisters *lastTask;
     bool _active;
-    bool _ignoreChanges;
     bool _forceRefresh;
     ChipRegisters _reg;
+    ChipRegisterModel *_regModel;
+    ChipRegisterBitDelegate *_bitDelegate;
+    ChipRegisterPoller _poller;
+    stk500RegisterLog _regLog;
+    bool _recording;
+    QTimer _updateTimer;
+    qint64 _updateStartTime;
 };
 
 #endif // CHIPCONTROLWIDGET_H
@@ -0,0 +1,259 @@
+#include "chipregistermodel.h"
+#include <QApplication>
+#include <QPainter>
+#include <QMouseEvent>
+#include <QKeyEvent>
+
+ChipRegisterModel::ChipRegisterModel(ChipRegisters *reg, QObject *parent) :
+    QAbstractTableModel(parent)
+{
+    this->reg = reg;
+    this->highlightCount = 0;
+    for (int addr = 0; addr < CHIPREG_BUFFSIZE; addr++) {
+        addressRow[addr] = -1;
+        valueColor[addr] = QColor(Qt::white);
+    }
+    for (int row = 0; row < reg->count(); row++) {
+        addressRow[address(row)] = row;
+    }
+}
+
+int ChipRegisterModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : reg->count();
+}
+
+int ChipRegisterModel::columnCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : CHIPREG_MODEL_COLUMNS;
+}
+
+int ChipRegisterModel::address(int row) const {
+    return reg->infoByIndex(row).addressValue;
+}
+
+/* Gets the bit mask for a column; returns 0 when not a bit column */
+int ChipRegisterModel::bitMask(int column) {
+    int bitIndex = (CHIPREG_MODEL_COLUMNS - 1 - column);
+    return ((bitIndex >= 0) && (bitIndex < 8)) ? (1 << bitIndex) : 0;
+}
+
+QVariant ChipRegisterModel::data(const QModelIndex &index, int role) const {
+    if (!index.isValid()) {
+        return QVariant();
+    }
+    const ChipRegisterInfo &info = reg->infoByIndex(index.row());
+    int addr = info.addressValue;
+    int col = index.column();
+    int mask = bitMask(col);
+    bool isSet = mask && ((reg->get(addr) & mask) == mask);
+
+    switch (role) {
+    case Qt::DisplayRole:
+    case Qt::EditRole:
+        if (col == CHIPREG_MODEL_COL_VALUE) {
+            return stk500::getHexText((uint) reg->get(addr));
+        } else {
+            // Bits without a name display their value
+            QString text = info.values[col + 1];
+            if (mask && ((text == "0") || (text == "1"))) {
+                text = isSet ? "1" : "0";
+            }
+            return text;
+        }
+    case Qt::TextAlignmentRole:
+        return (col >= 2) ? QVariant(Qt::AlignCenter) : QVariant();
+    case Qt::BackgroundRole:
+        if (col == CHIPREG_MODEL_COL_VALUE) {
+            return valueColor[addr];
+        }
+        return QColor(isSet ? Qt::yellow : Qt::white);
+    case Qt::CheckStateRole:
+        return mask ? QVariant(isSet ? Qt::Checked : Qt::Unchecked) : QVariant();
+    }
+    return QVariant();
+}
+
+QVariant ChipRegisterModel::headerData(int section, Qt::Orientation orientation, int role) const {
+    if (role != Qt::DisplayRole) {
+        return QVariant();
+    }
+    if (orientation == Qt::Horizontal) {
+        return reg->infoHeader().values[section + 1];
+    } else {
+        return reg->infoByIndex(section).address;
+    }
+}
+
+Qt::ItemFlags ChipRegisterModel::flags(const QModelIndex &index) const {
+    Qt::ItemFlags flags = Qt::ItemIsEnabled | Qt::ItemIsSelectable;
+    if (index.column() == CHIPREG_MODEL_COL_VALUE) {
+        flags |= Qt::ItemIsEditable;
+    }
+    return flags;
+}
+
+bool ChipRegisterModel::setData(const QModelIndex &index, const QVariant &value, int role) {
+    if (!index.isValid()) {
+        return false;
+    }
+    int addr = address(index.row());
+    int col = index.column();
+    int mask = bitMask(col);
+
+    if ((col == CHIPREG_MODEL_COL_VALUE) && (role == Qt::EditRole)) {
+        // Attempt to parse the value entered
+        QString text = value.toString().trimmed();
+        int newValue;
+        bool succ = false;
+        if (text.startsWith("0x", Qt::CaseInsensitive)) {
+            newValue = text.toInt(&succ, 16);
+        } else {
+            newValue = text.toInt(&succ, 10);
+        }
+        if (!succ) {
+            return false;
+        }
+        if (newValue != reg->get(addr)) {
+            reg->set(addr, (quint8) newValue);
+            emit dataChanged(this->index(index.row(), CHIPREG_MODEL_COL_VALUE),
+                             this->index(index.row(), CHIPREG_MODEL_COLUMNS - 1));
+            emit registerEdited();
+        }
+        return true;
+    }
+    if (mask && (role == Qt::CheckStateRole)) {
+        bool bitWasSet = ((reg->get(addr) & mask) == mask);
+        if (bitWasSet != (value.toInt() == Qt::Checked)) {
+            toggleBit(index);
+        }
+        return true;
+    }
+    return false;
+}
+
+/* Toggles the bit of a bit cell; returns false when not a bit cell */
+bool ChipRegisterModel::toggleBit(const QModelIndex &index) {
+    int mask = bitMask(index.column());
+    if (!index.isValid() || !mask) {
+        return false;
+    }
+    reg->setXor(address(index.row()), mask);
+    emit dataChanged(this->index(index.row(), CHIPREG_MODEL_COL_VALUE),
+                     this->index(index.row(), CHIPREG_MODEL_COLUMNS - 1));
+    emit registerEdited();
+    return true;
+}
+
+/*
+ * Updates the view after the registers were read
+ * Only the rows of registers that changed, failed to write or still have their
+ * value highlighted are reported. When nothing changed since the last read and
+ * nothing is highlighted, this does nothing at all.
+ */
+void ChipRegisterModel::refresh(bool forced) {
+    if (!forced && !highlightCount && !reg->hasChanges()) {
+        return;
+    }
+
+    QList<int> changedRows;
+    QList<int> fadingRows;
+    highlightCount = 0;
+    for (int addr = CHIPREG_ADDR_START; addr < CHIPREG_BUFFSIZE; addr++) {
+        int row = addressRow[addr];
+        if (row == -1) {
+            continue;
+        }
+        bool valueError = reg->error(addr);
+        bool valueChanged = reg->changed(addr);
+        QColor &c = valueColor[addr];
+        if (valueError) {
+            c = QColor(Qt::red);
+        } else if (valueChanged) {
+            c = QColor(Qt::yellow);
+        }
+        if (valueChanged || valueError || forced) {
+            changedRows.append(row);
+        } else if (c != QColor(Qt::white)) {
+            // Fade the value cell to white if it is colored
+            c = QColor::fromRgb(qMin(255, c.red() + CHIPREG_MODEL_FADE_STEP),
+                                qMin(255, c.green() + CHIPREG_MODEL_FADE_STEP),
+                                qMin(255, c.blue() + CHIPREG_MODEL_FADE_STEP));
+            fadingRows.append(row);
+        }
+        if (c != QColor(Qt::white)) {
+            highlightCount++;
+        }
+    }
+    refreshRows(changedRows, CHIPREG_MODEL_COL_VALUE, CHIPREG_MODEL_COLUMNS - 1);
+    refreshRows(fadingRows, CHIPREG_MODEL_COL_VALUE, CHIPREG_MODEL_COL_VALUE);
+}
+
+/* Reports rows as changed, joining consecutive rows into a single range */
+void ChipRegisterModel::refreshRows(const QList<int> &rows, int firstColumn, int lastColumn) {
+    QList<int> sorted = rows;
+    qSort(sorted);
+    int i = 0;
+    while (i < sorted.count()) {
+        int first = sorted[i];
+        int last = first;
+        while (((i + 1) < sorted.count()) && (sorted[i + 1] == (last + 1))) {
+            last = sorted[++i];
+        }
+        emit dataChanged(index(first, firstColumn), index(last, lastColumn));
+        i++;
+    }
+}
+
+/* Register bit cell painting and editing */
+
+static QRect bitCheckRect(const QStyleOptionViewItem &option) {
+    QStyle *style = option.widget ? option.widget->style() : QApplication::style();
+    return style->subElementRect(QStyle::SE_ItemViewItemCheckIndicator, &option, option.widget);
+}
+
+void ChipRegisterBitDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const {
+    QStyleOptionViewItem opt = option;
+    initStyleOption(&opt, index);
+    bool isSet = (index.data(Qt::CheckStateRole).toInt() == Qt::Checked);
+
+    painter->save();
+    painter->fillRect(opt.rect, isSet ? Qt::yellow : Qt::white);
+    if (opt.state & QStyle::State_Selected) {
+        painter->setPen(opt.palette.color(QPalette::Highlight));
+        painter->drawRect(opt.rect.adjusted(0, 0, -1, -1));
+    }
+
+    // Only the current cell shows a check indicator
+    QRect textRect = opt.rect;
+    if (opt.state & QStyle::State_HasFocus) {
+        QStyleOptionViewItem check = opt;
+        check.rect = bitCheckRect(opt);
+        check.state = QStyle::State_Enabled | (isSet ? QStyle::State_On : QStyle::State_Off);
+        QStyle *style = opt.widget ? opt.widget->style() : QApplication::style();
+        style->drawPrimitive(QStyle::PE_IndicatorViewItemCheck, &check, painter, opt.widget);
+        textRect.setLeft(check.rect.right() + 1);
+    }
+    painter->setPen(opt.palette.color(QPalette::Text));
+    painter->drawText(textRect, Qt::AlignCenter, opt.text);
+    painter->restore();
+}
+
+bool ChipRegisterBitDelegate::editorEvent(QEvent *event, QAbstractItemModel *model, const QStyleOptionViewItem &option, const QModelIndex &index) {
+    if (!(option.state & QStyle::State_HasFocus)) {
+        return false;
+    }
+    bool toggle = false;
+    if (event->type() == QEvent::MouseButtonRelease) {
+        QMouseEvent *mouseEvent = static_cast<QMouseEvent*>(event);
+        QStyleOptionViewItem opt = option;
+        initStyleOption(&opt, index);
+        toggle = (mouseEvent->button() == Qt::LeftButton) && bitCheckRect(opt).contains(mouseEvent->pos());
+    } else if (event->type() == QEvent::KeyPress) {
+        int key = static_cast<QKeyEvent*>(event)->key();
+        toggle = (key == Qt::Key_Space) || (key == Qt::Key_Select);
+    }
+    if (!toggle) {
+        return false;
+    }
+    bool isSet = (index.data(Qt::CheckStateRole).toInt() == Qt::Checked);
+    return model->setData(index, isSet ? Qt::Unchecked : Qt::Checked, Qt::CheckStateRole);
+}
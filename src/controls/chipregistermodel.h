@@ -0,0 +1,61 @@
+#ifndef CHIPREGISTERMODEL_H
+#define CHIPREGISTERMODEL_H
+
+#include <QAbstractTableModel>
+#include <QStyledItemDelegate>
+#include <QColor>
+#include "../stk500/stk500registers.h"
+
+#define CHIPREG_MODEL_COLUMNS     (CHIPREG_DATA_COLUMNS - 1)  // Columns shown, the address is the row header
+#define CHIPREG_MODEL_COL_VALUE   3                           // Column with the register value
+#define CHIPREG_MODEL_FADE_STEP   16                          // Fading of the value highlight per refresh
+
+/*
+ * Table model showing the registers of a ChipRegisters instance, one register per row
+ *
+ * The model reads the registers directly. After every refresh, only the rows of
+ * registers that changed or still fade out are reported as changed to the view.
+ */
+class ChipRegisterModel : public QAbstractTableModel
+{
+    Q_OBJECT
+public:
+    explicit ChipRegisterModel(ChipRegisters *reg, QObject *parent = 0);
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
+    Qt::ItemFlags flags(const QModelIndex &index) const;
+    bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole);
+    void refresh(bool forced);
+    bool toggleBit(const QModelIndex &index);
+    int address(int row) const;
+    static int bitMask(int column);
+
+signals:
+    /// Emitted when the user changed a register value
+    void registerEdited();
+
+private:
+    void refreshRows(const QList<int> &rows, int firstColumn, int lastColumn);
+
+    ChipRegisters *reg;
+    int addressRow[CHIPREG_BUFFSIZE];
+    QColor valueColor[CHIPREG_BUFFSIZE];
+    int highlightCount;
+};
+
+/*
+ * Paints the bit cells of the register table: a yellow background for set bits,
+ * and a check indicator on the current cell that toggles the bit when clicked
+ */
+class ChipRegisterBitDelegate : public QStyledItemDelegate
+{
+    Q_OBJECT
+public:
+    explicit ChipRegisterBitDelegate(QObject *parent = 0) : QStyledItemDelegate(parent) {}
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const;
+    bool editorEvent(QEvent *event, QAbstractItemModel *model, const QStyleOptionViewItem &option, const QModelIndex &index);
+};
+
+#endif // CHIPREGISTERMODEL_H
@@ -0,0 +1,98 @@
+#include "ramhexmodel.h"
+#include <QColor>
+#include <QFont>
+
+RamHexModel::RamHexModel(QObject *parent) :
+    QAbstractTableModel(parent)
+{
+    memset(ram, 0, sizeof(ram));
+    memset(known, 0, sizeof(known));
+    memset(highlight, 0, sizeof(highlight));
+}
+
+int RamHexModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : ((RAM_MONITOR_SIZE - RAM_MONITOR_START) / RAM_HEX_MODEL_BYTES);
+}
+
+int RamHexModel::columnCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : (RAM_HEX_MODEL_BYTES + 1);
+}
+
+QVariant RamHexModel::data(const QModelIndex &index, int role) const {
+    if (!index.isValid()) {
+        return QVariant();
+    }
+    int addr = address(index.row()) + index.column();
+    bool isText = (index.column() == RAM_HEX_MODEL_BYTES);
+
+    switch (role) {
+    case Qt::DisplayRole:
+        if (isText) {
+            // Printable characters of the whole row
+            QString text;
+            for (int i = 0; i < RAM_HEX_MODEL_BYTES; i++) {
+                int charAddr = address(index.row()) + i;
+                char c = (char) ram[charAddr];
+                text += !known[charAddr] ? '?' : ((c >= 0x20) && (c < 0x7F)) ? QChar(c) : QChar('.');
+            }
+            return text;
+        }
+        return known[addr] ? QString("%1").arg(ram[addr], 2, 16, QChar('0')).toUpper() : QString("??");
+    case Qt::TextAlignmentRole:
+        return isText ? QVariant() : QVariant(Qt::AlignCenter);
+    case Qt::BackgroundRole:
+        if (isText || !highlight[addr]) {
+            return QVariant();
+        }
+        return QColor(255, 255, 255 - highlight[addr]);
+    case Qt::FontRole:
+    {
+        QFont font("Inconsolata");
+        font.setStyleHint(QFont::Monospace);
+        return font;
+    }
+    }
+    return QVariant();
+}
+
+QVariant RamHexModel::headerData(int section, Qt::Orientation orientation, int role) const {
+    if (role != Qt::DisplayRole) {
+        return QVariant();
+    }
+    if (orientation == Qt::Horizontal) {
+        return (section == RAM_HEX_MODEL_BYTES) ? QString("Text") : QString::number(section, 16).toUpper();
+    } else {
+        return "0x" + QString("%1").arg(address(section), 4, 16, QChar('0')).toUpper();
+    }
+}
+
+/* Takes over the latest RAM copy of the monitor, and reports the rows that changed or still fade */
+void RamHexModel::refresh(stk500RamMonitor &monitor) {
+    quint8 newRam[RAM_MONITOR_SIZE];
+    bool newKnown[RAM_MONITOR_SIZE];
+    monitor.snapshot(newRam, newKnown);
+
+    int firstRow = -1;
+    int lastRow = -1;
+    for (int addr = RAM_MONITOR_START; addr < RAM_MONITOR_SIZE; addr++) {
+        bool changed = (newKnown[addr] != known[addr]) || (newRam[addr] != ram[addr]);
+        if (changed && known[addr]) {
+            highlight[addr] = 255;
+        } else if (highlight[addr]) {
+            highlight[addr] = (quint8) qMax(0, highlight[addr] - RAM_HEX_MODEL_FADE_STEP);
+            changed = true;
+        }
+        if (changed) {
+            int row = (addr - RAM_MONITOR_START) / RAM_HEX_MODEL_BYTES;
+            if (firstRow == -1) {
+                firstRow = row;
+            }
+            lastRow = row;
+        }
+    }
+    memcpy(ram, newRam, sizeof(ram));
+    memcpy(known, newKnown, sizeof(known));
+    if (firstRow != -1) {
+        emit dataChanged(index(firstRow, 0), index(lastRow, RAM_HEX_MODEL_BYTES));
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef RAMHEXMODEL_H
+#define RAMHEXMODEL_H
+
+#include <QAbstractTableModel>
+#include "../stk500/stk500rammonitor.h"
+
+#define RAM_HEX_MODEL_BYTES      16   // Bytes shown per row, followed by a text column
+#define RAM_HEX_MODEL_FADE_STEP  32   // Fading of the change highlight per refresh
+
+/*
+ * Table model showing the RAM copy of a monitor as a hex dump, 16 bytes per row
+ *
+ * Bytes not read yet are shown as question marks. Bytes that changed since the
+ * previous refresh are highlighted, the highlight fading out over time.
+ */
+class RamHexModel : public QAbstractTableModel
+{
+    Q_OBJECT
+public:
+    explicit RamHexModel(QObject *parent = 0);
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
+    void refresh(stk500RamMonitor &monitor);
+    const quint8 *ramData() const { return ram; }
+    int address(int row) const { return RAM_MONITOR_START + row * RAM_HEX_MODEL_BYTES; }
+
+private:
+    quint8 ram[RAM_MONITOR_SIZE];
+    bool known[RAM_MONITOR_SIZE];
+    quint8 highlight[RAM_MONITOR_SIZE];
+};
+
+#endif // RAMHEXMODEL_H
@@ -0,0 +1,65 @@
+#include "sampleplot.h"
+#include <QPainter>
+#include <QPainterPath>
+#include <QMap>
+
+SamplePlot::SamplePlot(QWidget *parent) : QWidget(parent) {
+    buffer = NULL;
+    setMinimumHeight(120);
+    setAutoFillBackground(false);
+}
+
+QColor SamplePlot::channelColor(int channel) {
+    return QColor::fromHsv((channel * 67) % 360, 220, 200);
+}
+
+void SamplePlot::refresh() {
+    if (buffer == NULL) {
+        shown.clear();
+    } else {
+        shown = buffer->latest(SAMPLE_PLOT_WINDOW);
+    }
+    update();
+}
+
+void SamplePlot::paintEvent(QPaintEvent *) {
+    QPainter painter(this);
+    painter.fillRect(rect(), Qt::white);
+
+    // Horizontal grid lines every quarter of the range
+    painter.setPen(QColor(220, 220, 220));
+    for (int i = 1; i < 4; i++) {
+        int y = height() * i / 4;
+        painter.drawLine(0, y, width(), y);
+    }
+    painter.setPen(Qt::gray);
+    painter.drawRect(0, 0, width() - 1, height() - 1);
+    if (shown.isEmpty()) {
+        return;
+    }
+
+    // Build a line for every channel, newest samples at the right
+    qint64 endTime = shown.last().time;
+    QMap<int, QPainterPath> paths;
+    for (int i = 0; i < shown.count(); i++) {
+        const AnalogSample &sample = shown[i];
+        qreal x = width() - 1 - (qreal) (endTime - sample.time) * (width() - 1) / SAMPLE_PLOT_WINDOW;
+        qreal y = (height() - 1) - (qreal) sample.value * (height() - 1) / SAMPLE_PLOT_MAX;
+        QMap<int, QPainterPath>::iterator path = paths.find(sample.channel);
+        if (path == paths.end()) {
+            paths[sample.channel].moveTo(x, y);
+        } else {
+            path.value().lineTo(x, y);
+        }
+    }
+
+    painter.setRenderHint(QPainter::Antialiasing);
+    int labelY = 14;
+    QMap<int, QPainterPath>::const_iterator it;
+    for (it = paths.constBegin(); it != paths.constEnd(); ++it) {
+        painter.setPen(channelColor(it.key()));
+        painter.drawPath(it.value());
+        painter.drawText(6, labelY, QString("A%1").arg(it.key()));
+        labelY += 14;
+    }
+}
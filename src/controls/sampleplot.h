@@ -0,0 +1,33 @@
+#ifndef SAMPLEPLOT_H
+#define SAMPLEPLOT_H
+
+#include <QWidget>
+#include "../stk500/stk500samplebuffer.h"
+
+#define SAMPLE_PLOT_WINDOW  5000000   // Time span (in us) of the samples shown
+#define SAMPLE_PLOT_MAX     1023      // Highest value an analog sample can have
+
+/*
+ * Plots the most recent samples of a sample buffer, one line per channel
+ * The plot is only redrawn when refresh() is called.
+ */
+class SamplePlot : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit SamplePlot(QWidget *parent = 0);
+    void setBuffer(stk500SampleBuffer *buffer) { this->buffer = buffer; }
+    static QColor channelColor(int channel);
+
+public slots:
+    void refresh();
+
+protected:
+    void paintEvent(QPaintEvent *event);
+
+private:
+    stk500SampleBuffer *buffer;
+    QVector<AnalogSample> shown;
+};
+
+#endif // SAMPLEPLOT_H
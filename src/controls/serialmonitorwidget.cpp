@@ -1,9 +1,12 @@
 #include "serialmonitorwidget.h"
 #include "ui_serialmonitorwidget.h"
-#include <QScrollBar>
 #include <QMenu>
 #include <QAction>
 #include <QClipboard>
+#include <QShortcut>
+#include <QInputDialog>
+#include <QFileDialog>
+#include <QMessageBox>
 
 serialmonitorwidget::serialmonitorwidget(QWidget *parent) :
     QWidget(parent),
@@ -11,19 +14,25 @@ serialmonitorwidget::serialmonitorwidget(QWidget *parent) :
 {
     ui->setupUi(this);
 
-    this->updateTimer = new QTimer(this);
-    connect(this->updateTimer, SIGNAL(timeout()), this, SLOT(readSerialOutput()));
-    this->updateTimer->start(20);
-
     this->mode = STK500::SKETCH;
-    this->screen.cmd_len = 0;
     this->screenEnabled = false;
+    this->logIndex = NULL;
+    this->recorder = new ScreenRecorder(this);
+    this->searchDialog = NULL;
+    this->pacing.chunkSize = 0;
+    this->pacing.chunkDelay = 0;
+    this->pacing.matchBaud = false;
+    this->pacing.flowControl = false;
+    this->sendStartBytes = 0;
+    ui->sendProgress->setVisible(false);
+    ui->stopSendButton->setVisible(false);
     ui->outputImage->setVisible(false);
     resetScreen();
 
     // Setup fonts
     QFont serialFont("Inconsolata", 10);
     ui->outputText->setFont(serialFont);
+    ui->outputText->setAutoScroll(ui->autoScrollCheck->isChecked());
     ui->messageTxt->setFont(serialFont);
 
     // Attach right-click menu to the output log text edit
@@ -35,20 +44,48 @@ serialmonitorwidget::serialmonitorwidget(QWidget *parent) :
     ui->outputImage->setContextMenuPolicy(Qt::CustomContextMenu);
     connect(ui->outputImage, SIGNAL(customContextMenuRequested(const QPoint&)),
         this, SLOT(showImageContextMenu(const QPoint&)));
+
+    // Update the progress of sending a file while it is being sent out
+    connect(&sendProgressTimer, SIGNAL(timeout()), this, SLOT(updateSendProgress()));
+
+    // Search the output using Ctrl+F
+    QShortcut *findShortcut = new QShortcut(QKeySequence::Find, this);
+    connect(findShortcut, SIGNAL(activated()), this, SLOT(showSearchDialog()));
 }
 
 serialmonitorwidget::~serialmonitorwidget()
 {
+    if (logIndex != NULL) {
+        logIndex->stop();
+    }
+    stopRecording();
     delete ui;
 }
 
 void serialmonitorwidget::setSerial(stk500Serial *serial)
 {
     this->serial = serial;
+    ui->outputText->setLog(&serial->log());
+
+    // Index all received data in the background so it can be searched quickly
+    logIndex = new stk500SerialIndex(&serial->log(), this);
+    logIndex->start(QThread::LowPriority);
 
     connect(serial, SIGNAL(serialOpened()),
             this,    SLOT(clearOutputText()),
             Qt::QueuedConnection);
+
+    connect(serial, SIGNAL(dataReceived()),
+            this,    SLOT(readSerialOutput()),
+            Qt::QueuedConnection);
+
+    connect(serial, SIGNAL(dataWritable()),
+            this,    SLOT(writeSerialInput()),
+            Qt::QueuedConnection);
+
+    connect(serial, SIGNAL(screenUpdated()),
+            this,    SLOT(updateScreen()),
+            Qt::QueuedConnection);
 }
 
 void serialmonitorwidget::setScreenShare(bool enabled)
@@ -72,6 +109,10 @@ void serialmonitorwidget::setMode(STK500::State mode)
 
 void serialmonitorwidget::openSerial()
 {
+    // Data not yet sent out is discarded when switching
+    this->sendBuff.clear();
+    stopFileSend();
+
     if (!ui->runSketchCheck->isChecked()) {
         serial->closeSerial();
     } else if (this->screenEnabled) {
@@ -84,6 +125,8 @@ void serialmonitorwidget::openSerial()
         }
         serial->openSerial(baudSel.toInt(), this->mode);
     }
+    serial->setSerialPacing(this->pacing);
+    serial->setScreenDecoding(this->screenEnabled);
 }
 
 void serialmonitorwidget::showImageContextMenu(const QPoint& pos) {
@@ -93,6 +136,12 @@ void serialmonitorwidget::showImageContextMenu(const QPoint& pos) {
     // Show a right-click menu with options for the image
     QMenu menu;
     QAction* copyClip = menu.addAction("Copy to clipboard");
+    QAction* recordAct;
+    if (recorder->isRecording()) {
+        recordAct = menu.addAction(QString("Stop recording (%1 frames)").arg(recorder->framesRecorded()));
+    } else {
+        recordAct = menu.addAction("Start recording...");
+    }
     QAction* selected = menu.exec(globalPos);
 
     // Execute selected actions
@@ -100,6 +149,49 @@ void serialmonitorwidget::showImageContextMenu(const QPoint& pos) {
         QClipboard *clipboard = QApplication::clipboard();
         QPixmap pixmap = ui->outputImage->image().pixmap();
         clipboard->setPixmap(pixmap);
+    } else if (selected == recordAct) {
+        if (recorder->isRecording()) {
+            stopRecording();
+        } else {
+            startRecording();
+        }
+    }
+}
+
+/* Asks where to record screen share to, and starts recording */
+void serialmonitorwidget::startRecording() {
+    QString pngFilter = "PNG image sequence (*.png)";
+    QString gifFilter = "Animated GIF (*.gif)";
+    QString rawFilter = "Raw RGB565 frames (*.raw)";
+    QString selectedFilter = gifFilter;
+    QString filePath = QFileDialog::getSaveFileName(
+            this,
+            "Record the shared screen to a file",
+            "",
+            pngFilter + ";;" + gifFilter + ";;" + rawFilter,
+            &selectedFilter
+    );
+    if (filePath.isEmpty()) {
+        return;
+    }
+
+    ScreenRecorder::Format format = ScreenRecorder::ANIMATED_GIF;
+    if (selectedFilter == pngFilter) {
+        format = ScreenRecorder::PNG_SEQUENCE;
+    } else if (selectedFilter == rawFilter) {
+        format = ScreenRecorder::RAW565;
+    }
+    if (!recorder->startRecording(filePath, format)) {
+        QMessageBox::critical(this, "Recording failed", "The file to record to could not be created.");
+        return;
+    }
+    serial->setScreenSink(recorder);
+}
+
+void serialmonitorwidget::stopRecording() {
+    if (recorder->isRecording()) {
+        serial->setScreenSink(NULL);
+        recorder->stopRecording();
     }
 }
 
@@ -107,15 +199,84 @@ void serialmonitorwidget::showOutputContextMenu(const QPoint& pos) {
     // Map the point to a point on the screen
     QPoint globalPos = ui->outputText->mapToGlobal(pos);
 
-    // Create a standard context menu, and append additional actions
-    QMenu* menu = ui->outputText->createStandardContextMenu();
-    menu->addSeparator();
-    QAction* clearAct = menu->addAction("Clear");
-    QAction* selected = menu->exec(globalPos);
+    // Create a context menu with the actions for the output
+    QMenu menu;
+    QAction* copyAct = menu.addAction("Copy");
+    copyAct->setEnabled(ui->outputText->hasSelection());
+    QAction* clearAct = menu.addAction("Clear");
+    QAction* findAct = menu.addAction("Find...");
+    menu.addSeparator();
+    QAction* timeAct = menu.addAction("Show timestamps");
+    timeAct->setCheckable(true);
+    timeAct->setChecked(ui->outputText->showTimestamps());
+    QAction* hexAct = menu.addAction("Hex view");
+    hexAct->setCheckable(true);
+    hexAct->setChecked(ui->outputText->hexMode());
+    QAction* batchAct = menu.addAction("High throughput mode");
+    batchAct->setCheckable(true);
+    batchAct->setChecked(serial->serialBatchSize() > 0);
+    QMenu* paceMenu = menu.addMenu("Send pacing");
+    QAction* noPaceAct = paceMenu->addAction("None");
+    noPaceAct->setCheckable(true);
+    noPaceAct->setChecked(!pacing.matchBaud && (pacing.chunkSize == 0));
+    QAction* baudPaceAct = paceMenu->addAction("Match baud rate");
+    baudPaceAct->setCheckable(true);
+    baudPaceAct->setChecked(pacing.matchBaud);
+    QString chunkText = "Chunks with delay...";
+    if (pacing.chunkSize > 0) {
+        chunkText = QString("Chunks with delay (%1 bytes, %2 ms)...").arg(pacing.chunkSize).arg(pacing.chunkDelay);
+    }
+    QAction* chunkPaceAct = paceMenu->addAction(chunkText);
+    chunkPaceAct->setCheckable(true);
+    chunkPaceAct->setChecked(pacing.chunkSize > 0);
+    paceMenu->addSeparator();
+    QAction* flowAct = paceMenu->addAction("XON/XOFF flow control");
+    flowAct->setCheckable(true);
+    flowAct->setChecked(pacing.flowControl);
+    QString countText = QString("Received: %1, Sent: %2")
+            .arg(stk500::getSizeText(serial->serialBytesReceived()))
+            .arg(stk500::getSizeText(serial->serialBytesSent()));
+    menu.addAction(countText)->setEnabled(false);
+    QAction* selected = menu.exec(globalPos);
 
     // Execute selected actions
-    if (selected == clearAct) {
+    if (selected == copyAct) {
+        ui->outputText->copy();
+    } else if (selected == clearAct) {
+        serial->log().clear();
         this->clearOutputText();
+    } else if (selected == findAct) {
+        this->showSearchDialog();
+    } else if (selected == timeAct) {
+        ui->outputText->setShowTimestamps(timeAct->isChecked());
+    } else if (selected == hexAct) {
+        ui->outputText->setHexMode(hexAct->isChecked());
+    } else if (selected == batchAct) {
+        serial->setSerialBatchSize(batchAct->isChecked() ? SERIAL_BATCH_SIZE : 0);
+    } else if ((selected == noPaceAct) || (selected == baudPaceAct)) {
+        SerialPacing newPacing = pacing;
+        newPacing.matchBaud = (selected == baudPaceAct);
+        newPacing.chunkSize = 0;
+        setPacing(newPacing);
+    } else if (selected == chunkPaceAct) {
+        SerialPacing newPacing = pacing;
+        bool ok;
+        newPacing.chunkSize = QInputDialog::getInt(this, "Send pacing", "Bytes to send at once:",
+                                                   (pacing.chunkSize > 0) ? pacing.chunkSize : 64,
+                                                   1, SERIAL_WRITE_BUFFER_SIZE, 1, &ok);
+        if (ok) {
+            newPacing.chunkDelay = QInputDialog::getInt(this, "Send pacing", "Delay after every chunk (ms):",
+                                                        (pacing.chunkSize > 0) ? pacing.chunkDelay : 10,
+                                                        0, 10000, 1, &ok);
+        }
+        if (ok) {
+            newPacing.matchBaud = false;
+            setPacing(newPacing);
+        }
+    } else if (selected == flowAct) {
+        SerialPacing newPacing = pacing;
+        newPacing.flowControl = flowAct->isChecked();
+        setPacing(newPacing);
     }
 }
 
@@ -125,6 +286,33 @@ void serialmonitorwidget::on_runSketchCheck_toggled(bool)
     openSerial();
 }
 
+void serialmonitorwidget::showSearchDialog()
+{
+    if (logIndex == NULL) {
+        return;
+    }
+    if (searchDialog == NULL) {
+        searchDialog = new SerialSearchDialog(logIndex, this);
+        connect(searchDialog, SIGNAL(jumpToOffset(qint64)), this, SLOT(jumpToLogOffset(qint64)));
+    }
+    searchDialog->show();
+    searchDialog->raise();
+    searchDialog->activateWindow();
+}
+
+/* Shows the line holding the data received at an offset in the Serial log */
+void serialmonitorwidget::jumpToLogOffset(qint64 offset)
+{
+    ui->autoScrollCheck->setChecked(false);
+    ui->outputText->scrollToLine(ui->outputText->lineAtOffset(offset));
+}
+
+/* Keep showing the newest output while autoscroll is checked */
+void serialmonitorwidget::on_autoScrollCheck_toggled(bool checked)
+{
+    ui->outputText->setAutoScroll(checked);
+}
+
 /* Re-open Serial in the right baud rate when rate is changed */
 void serialmonitorwidget::on_baudrateBox_activated(int)
 {
@@ -156,230 +344,133 @@ void serialmonitorwidget::on_sendButton_clicked()
     }
 
     // Send it to Serial
-    serial->write(message);
+    sendData(message.toLatin1());
 }
 
 /* Clear output text - when serial opens */
 void serialmonitorwidget::clearOutputText() {
     ui->outputText->clear();
-    this->recData.clear();
     resetScreen();
 }
 
-/* Save all data in the receive buffer to a file */
+/* Save all data received to a file */
 bool serialmonitorwidget::saveReceivedData(const QString &filePath) {
-    QFile file(filePath);
-    if (!file.open(QIODevice::WriteOnly)) {
-        return false;
-    }
-
-    file.write(this->recData);
-    file.close();
-    return true;
+    return serial->log().save(filePath);
 }
 
 /* Writes raw data to the device */
 void serialmonitorwidget::sendData(const QByteArray &data) {
-    serial->write(data.data(), data.length());
+    this->sendBuff.append(data);
+    writeSerialInput();
 }
 
-/* Reads data contained in a file and writes it to the device */
+/* Moves data waiting to be sent into the Serial buffer, as far as it fits */
+void serialmonitorwidget::writeSerialInput()
+{
+    while (true) {
+        // Read the next part of the file being sent once all before is sent
+        // At the end the file is closed, progress is shown until all of it is sent out
+        if (this->sendBuff.isEmpty() && this->sendFile.isOpen()) {
+            this->sendBuff = this->sendFile.read(SERIAL_SEND_CHUNK_SIZE);
+            if (this->sendBuff.isEmpty()) {
+                this->sendFile.close();
+            }
+        }
+        if (this->sendBuff.isEmpty()) {
+            break;
+        }
+
+        int written = serial->write(this->sendBuff.data(), this->sendBuff.length());
+        if (!serial->isSerialOpen()) {
+            this->sendBuff.clear();
+            stopFileSend();
+            break;
+        }
+        this->sendBuff.remove(0, written);
+        if (!this->sendBuff.isEmpty()) {
+            break;
+        }
+    }
+    updateSendProgress();
+}
+
+/* Streams the data contained in a file to the device */
 bool serialmonitorwidget::sendFileData(const QString &filePath) {
-    QFile file(filePath);
-    if (!file.open(QIODevice::ReadOnly)) {
+    stopFileSend();
+    this->sendFile.setFileName(filePath);
+    if (!this->sendFile.open(QIODevice::ReadOnly)) {
         return false;
     }
 
-    QByteArray data = file.readAll();
-    file.close();
-
-    sendData(data);
+    // Data written before the file is sent out first
+    this->sendStartBytes = serial->serialBytesSent() + serial->serialBytesPending() + this->sendBuff.length();
+    this->sendTimer.start();
+    this->sendProgressTimer.start(SERIAL_SEND_PROGRESS_INTERVAL);
+    ui->sendProgress->setValue(0);
+    ui->sendProgress->setVisible(true);
+    ui->stopSendButton->setVisible(true);
+    writeSerialInput();
     return true;
 }
 
-/* Read Serial output and display it in the text area */
-void serialmonitorwidget::readSerialOutput()
-{
-    char buff[1024];
-    int len = serial->read(buff, sizeof(buff));
-    if (len) {
-
-        // Append data received to the output buffer, in case we want to save
-        this->recData.append(buff, len);
-
-        // Handle the incoming data
-        if (this->screenEnabled) {
-            for (int i = 0; i < len; i++) {
-                receiveScreen(buff[i]);
-            }
-        } else {
-            // First filter out invalid characters from the string
-            for (int i = 0; i < len; i++) {
-                if (buff[i] == 0) buff[i] = ' ';
-            }
+/* Stops sending a file, data of it not yet in the Serial buffer is discarded */
+void serialmonitorwidget::stopFileSend() {
+    if (this->sendFile.isOpen()) {
+        this->sendFile.close();
+        this->sendBuff.clear();
+    }
+    this->sendProgressTimer.stop();
+    ui->sendProgress->setVisible(false);
+    ui->stopSendButton->setVisible(false);
+}
 
-            QString myString = QString::fromLatin1(buff, len);
-            myString = myString.remove('\r');
-
-            if (ui->autoScrollCheck->isChecked()) {
-
-                ui->outputText->moveCursor (QTextCursor::End);
-                ui->outputText->insertPlainText(myString);
-                ui->outputText->moveCursor (QTextCursor::End);
-            } else {
-                int old_scroll = ui->outputText->verticalScrollBar()->value();
-                QTextCursor old_cursor = ui->outputText->textCursor();
-                ui->outputText->moveCursor (QTextCursor::End);
-                ui->outputText->insertPlainText(myString);
-                ui->outputText->setTextCursor(old_cursor);
-                ui->outputText->verticalScrollBar()->setValue(old_scroll);
-            }
-        }
+/* Shows how much of the file is sent out to the device, and how fast */
+void serialmonitorwidget::updateSendProgress() {
+    if (!this->sendProgressTimer.isActive()) {
+        return;
     }
+    qint64 total = this->sendFile.size();
+    qint64 sent = qBound((qint64) 0, serial->serialBytesSent() - this->sendStartBytes, total);
+    if (!this->sendFile.isOpen() && (sent >= total)) {
+        stopFileSend();
+        return;
+    }
+    qint64 elapsed = qMax((qint64) 1, this->sendTimer.elapsed());
+    ui->sendProgress->setValue((total == 0) ? 0 : (int) (sent * 1000 / total));
+    ui->sendProgress->setFormat(QString("%1 of %2 (%3/s)")
+                                .arg(stk500::getSizeText(sent))
+                                .arg(stk500::getSizeText(total))
+                                .arg(stk500::getSizeText(sent * 1000 / elapsed)));
 }
 
-/* Resets the screen to all black */
-void serialmonitorwidget::resetScreen() {
-    ui->outputImage->image().create(320, 240);
+void serialmonitorwidget::setPacing(const SerialPacing &pacing) {
+    this->pacing = pacing;
+    serial->setSerialPacing(pacing);
 }
 
-/* Receives a single byte as part of the screen serial protocol */
-void serialmonitorwidget::receiveScreen(quint8 byte)
+void serialmonitorwidget::on_stopSendButton_clicked()
 {
-    if (this->screen.cmd_len) {
-        // Refresh buffer
-        this->screen.cmd_buff[this->screen.cmd_buff_index++] = byte;
-        if (this->screen.cmd_buff_index == this->screen.cmd_len) {
-            quint16 data = *((quint16*) this->screen.cmd_buff);
-            quint32 data_cnt = 1;
-            if (this->screen.cmd_len == 6) {
-                data_cnt = *((quint32*) (this->screen.cmd_buff + 2));
-
-                // Make sure to limit it to the amount of pixels we have
-                // In case it glitches, we won't be stuck in a loop
-                if (data_cnt > (320*240)) data_cnt = (320*240);
-            }
-            this->screen.cmd_len = 0;
-            // Process the command with the data known
-            switch (this->screen.cmd) {
-            case 0x22:
-                // CGRAM read/write
-                for (quint32 i = 0; i < data_cnt; i++) {
-                    receivePixel(data);
-                }
-                break;
-            case 0x03:
-                // Read entrymode
-                this->screen.entrymode = data;
-                break;
-            case 0x50:
-                // Horizontal start viewport
-                this->screen.view_vb = 239 - data;
-                break;
-            case 0x51:
-                // Horizontal end viewport
-                this->screen.view_va = 239 - data;
-                break;
-            case 0x52:
-                // Vertical start viewport
-                this->screen.view_hb = 319 - data;
-                break;
-            case 0x53:
-                // Vertical end viewport
-                this->screen.view_ha = 319 - data;
-                break;
-            case 0x20:
-                // Horizontal cursor (y)
-                this->screen.cur_y = 239 - data;
-                break;
-            case 0x21:
-                // Vertical cursor (z)
-                this->screen.cur_x = 319 - data;
-                break;
-
-            default:
-                // Do nothing
-                qDebug() << "SCREEN ERROR " << screen.cmd;
-                break;
-            }
-        }
-    } else {
-        this->screen.cmd_buff_index = 0;
-        this->screen.cmd_len = 0;
-        if (byte == 0x00) {
-            // Screen reset
-            this->screen.view_ha = 0;
-            this->screen.view_hb = 319;
-            this->screen.view_va = 0;
-            this->screen.view_vb = 239;
-            this->resetScreen();
-        } else if (byte == 0xFF) {
-            this->screen.cmd_len = 2;
-        } else if (byte == 0xFE) {
-            this->screen.cmd_len = 6;
-        } else {
-            this->screen.cmd = byte;
-        }
-    }
+    stopFileSend();
 }
 
-/* Receives a single pixel */
-void serialmonitorwidget::receivePixel(quint16 color)
+/* Read Serial output and display it in the text area */
+void serialmonitorwidget::readSerialOutput()
 {
-    // Write pixel to the screen image
-    this->ui->outputImage->image().setPixel(screen.cur_x, screen.cur_y, color565_to_rgb(color));
-
-    // Next pixel - use entrymode and view port
-    switch (screen.entrymode) {
-    case 0x1008:
-        if (moveCursor_x(1)) moveCursor_y(1);
-        break;
-    case 0x1020:
-        if (moveCursor_y(1)) moveCursor_x(-1);
-        break;
-    case 0x1038:
-        if (moveCursor_x(-1)) moveCursor_y(1);
-        break;
-    case 0x1010:
-        if (moveCursor_y(-1)) moveCursor_x(1);
-        break;
-    case 0x1018:
-        if (moveCursor_x(1)) moveCursor_y(-1);
-        break;
-    case 0x1000:
-        if (moveCursor_y(1)) moveCursor_x(1);
-        break;
-    case 0x1028:
-        if (moveCursor_x(-1)) moveCursor_y(-1);
-        break;
-    case 0x1030:
-        if (moveCursor_y(-1)) moveCursor_x(-1);
-        break;
-    }
+    // Text is displayed straight from the Serial log
+    serial->dataHandled();
+    ui->outputText->dataReceived();
 }
 
-bool serialmonitorwidget::moveCursor_x(qint8 dx) {
-    screen.cur_x += dx;
-    if (screen.cur_x > screen.view_hb) {
-        screen.cur_x = screen.view_ha;
-        return true;
-    } else if (screen.cur_x < screen.view_ha) {
-        screen.cur_x = screen.view_hb;
-        return true;
-    } else {
-        return false;
+/* Shows the screen share frame decoded by the process thread; only the changed area is drawn */
+void serialmonitorwidget::updateScreen()
+{
+    QRect dirtyRect;
+    if (serial->takeScreenFrame(screenFrame, dirtyRect)) {
+        ui->outputImage->image().drawImage(screenFrame, dirtyRect);
     }
 }
 
-bool serialmonitorwidget::moveCursor_y(qint8 dy) {
-    screen.cur_y += dy;
-    if (screen.cur_y > screen.view_vb) {
-        screen.cur_y = screen.view_va;
-        return true;
-    } else if (screen.cur_y < screen.view_va) {
-        screen.cur_y = screen.view_vb;
-        return true;
-    } else {
-        return false;
-    }
+/* Resets the screen to all black */
+void serialmonitorwidget::resetScreen() {
+    ui->outputImage->image().create(320, 240);
 }
@@ -4,27 +4,28 @@
 #include <QWidget>
 #include <QDebug>
 #include <QByteArray>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QTimer>
 #include "imageviewer.h"
 #include "mainmenutab.h"
+#include "../stk500/stk500serialindex.h"
+#include "../dialogs/serialsearchdialog.h"
+#include "../imaging/screenrecorder.h"
+
+// Amount of bytes collected before forwarding in high throughput mode
+#define SERIAL_BATCH_SIZE 4096
+
+// Amount of bytes read from a file at once while sending it
+#define SERIAL_SEND_CHUNK_SIZE 4096
+
+// Interval (in ms) at which the progress of sending a file is updated
+#define SERIAL_SEND_PROGRESS_INTERVAL 100
 
 namespace Ui {
 class serialmonitorwidget;
 }
 
-typedef struct {
-    quint16 cur_x;
-    quint16 cur_y;
-    quint16 entrymode;
-    quint16 view_ha;
-    quint16 view_hb;
-    quint16 view_va;
-    quint16 view_vb;
-    quint8 cmd;
-    quint8 cmd_len;
-    quint8 cmd_buff[50];
-    quint8 cmd_buff_index;
-} ScreenRegisters;
-
 class serialmonitorwidget : public QWidget, public MainMenuTab
 {
     Q_OBJECT
@@ -36,37 +37,52 @@ public:
     void setScreenShare(bool enabled);
     void setMode(STK500::State mode);
     virtual void setSerial(stk500Serial *serial);
-    QByteArray &receivedData() { return recData; }
     bool saveReceivedData(const QString &filePath);
     void sendData(const QByteArray &data);
     bool sendFileData(const QString &filePath);
 
 private:
     void resetScreen();
-    void receiveScreen(quint8 byte);
-    void receivePixel(quint16 color);
-    bool moveCursor_x(qint8 dx);
-    bool moveCursor_y(qint8 dy);
+    void startRecording();
+    void stopRecording();
+    void stopFileSend();
+    void setPacing(const SerialPacing &pacing);
 
 private slots:
     void readSerialOutput();
+    void updateScreen();
+    void writeSerialInput();
+    void updateSendProgress();
     void clearOutputText();
     void showImageContextMenu(const QPoint& pos);
     void showOutputContextMenu(const QPoint& pos);
+    void showSearchDialog();
+    void jumpToLogOffset(qint64 offset);
 
     void on_runSketchCheck_toggled(bool checked);
 
+    void on_autoScrollCheck_toggled(bool checked);
+
     void on_baudrateBox_activated(int index);
 
     void on_messageTxt_returnPressed();
 
     void on_sendButton_clicked();
 
+    void on_stopSendButton_clicked();
+
 private:
     Ui::serialmonitorwidget *ui;
-    QTimer *updateTimer;
-    QByteArray recData;
-    ScreenRegisters screen;
+    QByteArray sendBuff;
+    QFile sendFile;
+    QElapsedTimer sendTimer;
+    QTimer sendProgressTimer;
+    qint64 sendStartBytes;
+    SerialPacing pacing;
+    stk500SerialIndex *logIndex;
+    SerialSearchDialog *searchDialog;
+    QImage screenFrame;
+    ScreenRecorder *recorder;
     STK500::State mode;
     bool screenEnabled;
 };
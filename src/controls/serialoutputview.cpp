@@ -0,0 +1,381 @@
+#include "serialoutputview.h"
+#include <QPainter>
+#include <QPaintEvent>
+#include <QMouseEvent>
+#include <QKeyEvent>
+#include <QScrollBar>
+#include <QApplication>
+#include <QClipboard>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <climits>
+
+// Maximum time (in ms) spent processing data in a single frame, so the view stays responsive
+#define SERIAL_VIEW_MAX_SCAN_TIME 4
+
+// Amount of data read from the log at once; logging new data waits while it is read
+#define SERIAL_VIEW_SCAN_CHUNK 16384
+
+SerialOutputView::SerialOutputView(QWidget *parent) :
+    QAbstractScrollArea(parent)
+{
+    this->log = NULL;
+    this->_autoScroll = true;
+    this->_showTimestamps = false;
+    this->_hexMode = false;
+
+    this->frameTimer = new QTimer(this);
+    this->frameTimer->setSingleShot(true);
+    this->frameTimer->setInterval(SERIAL_VIEW_FRAME_TIME);
+    connect(this->frameTimer, SIGNAL(timeout()), this, SLOT(updateData()));
+
+    setFocusPolicy(Qt::StrongFocus);
+    resetIndex();
+}
+
+void SerialOutputView::setLog(stk500SerialLog *log) {
+    this->log = log;
+    resetIndex();
+    updateData();
+}
+
+void SerialOutputView::setAutoScroll(bool autoScroll) {
+    _autoScroll = autoScroll;
+    if (_autoScroll) {
+        verticalScrollBar()->setValue(verticalScrollBar()->maximum());
+    }
+}
+
+void SerialOutputView::setShowTimestamps(bool show) {
+    _showTimestamps = show;
+    updateScrollBars();
+    viewport()->update();
+}
+
+void SerialOutputView::setHexMode(bool hexMode) {
+    if (_hexMode != hexMode) {
+        _hexMode = hexMode;
+        selectStart = selectEnd = -1;
+        updateScrollBars();
+        if (_autoScroll) {
+            verticalScrollBar()->setValue(verticalScrollBar()->maximum());
+        }
+        viewport()->update();
+    }
+}
+
+/* Called when new data was added to the log; it is displayed with the next frame */
+void SerialOutputView::dataReceived() {
+    if (!frameTimer->isActive()) {
+        frameTimer->start();
+    }
+}
+
+/* Starts over displaying the log from the beginning */
+void SerialOutputView::clear() {
+    resetIndex();
+    dataReceived();
+}
+
+void SerialOutputView::resetIndex() {
+    logGeneration = (log == NULL) ? 0 : log->generation();
+    scannedSize = 0;
+    textLineCount = 1;
+    currentLineLength = 0;
+    maxLineLength = 0;
+    lineChecks.clear();
+    lineChecks.append(0);
+    lineTimes.clear();
+    selectStart = selectEnd = -1;
+    updateScrollBars();
+    viewport()->update();
+}
+
+void SerialOutputView::updateData() {
+    if (log == NULL) {
+        return;
+    }
+    if (log->generation() != logGeneration) {
+        resetIndex();
+    }
+
+    /* Find the start of all new lines in the data received since last time, for as long as a frame allows */
+    qint64 size = log->size();
+    QElapsedTimer scanTimer;
+    scanTimer.start();
+    char buff[SERIAL_VIEW_SCAN_CHUNK];
+    while ((scannedSize < size) && !scanTimer.hasExpired(SERIAL_VIEW_MAX_SCAN_TIME)) {
+        int len = log->read(scannedSize, buff, (int) qMin((qint64) sizeof(buff), size - scannedSize));
+        if (len <= 0) {
+            break;
+        }
+        for (int i = 0; i < len; i++) {
+            currentLineLength++;
+            if ((buff[i] == '\n') || (currentLineLength >= SERIAL_VIEW_MAX_LINE_LENGTH)) {
+                maxLineLength = qMax(maxLineLength, currentLineLength);
+                if ((textLineCount % SERIAL_VIEW_LINES_PER_CHECK) == 0) {
+                    lineChecks.append(scannedSize + i + 1);
+                }
+                textLineCount++;
+                currentLineLength = 0;
+            }
+        }
+        scannedSize += len;
+    }
+    maxLineLength = qMax(maxLineLength, currentLineLength);
+
+    /* Continue next frame if not everything could be processed */
+    if (scannedSize < size) {
+        dataReceived();
+    }
+
+    updateScrollBars();
+    if (_autoScroll) {
+        verticalScrollBar()->setValue(verticalScrollBar()->maximum());
+    }
+    viewport()->update();
+}
+
+qint64 SerialOutputView::lineCount() {
+    if (_hexMode) {
+        return (scannedSize + SERIAL_VIEW_HEX_WIDTH - 1) / SERIAL_VIEW_HEX_WIDTH;
+    } else {
+        return textLineCount;
+    }
+}
+
+qint64 SerialOutputView::lineOffset(qint64 line) {
+    if (_hexMode) {
+        return line * SERIAL_VIEW_HEX_WIDTH;
+    }
+
+    /* Start at the closest line with a known offset, then skip the lines in between */
+    qint64 check = qBound((qint64) 0, line / SERIAL_VIEW_LINES_PER_CHECK, (qint64) lineChecks.count() - 1);
+    qint64 offset = lineChecks[check];
+    qint64 skip = line - check * SERIAL_VIEW_LINES_PER_CHECK;
+    int lineLength = 0;
+    char buff[4096];
+    while ((skip > 0) && (offset < scannedSize)) {
+        int len = log->read(offset, buff, (int) qMin((qint64) sizeof(buff), scannedSize - offset));
+        if (len <= 0) {
+            break;
+        }
+        int i;
+        for (i = 0; (i < len) && (skip > 0); i++) {
+            lineLength++;
+            if ((buff[i] == '\n') || (lineLength >= SERIAL_VIEW_MAX_LINE_LENGTH)) {
+                lineLength = 0;
+                skip--;
+            }
+        }
+        offset += i;
+    }
+    return offset;
+}
+
+qint64 SerialOutputView::lineAtOffset(qint64 offset) {
+    if (_hexMode) {
+        return offset / SERIAL_VIEW_HEX_WIDTH;
+    }
+
+    /* Find the last line with a known offset before it, then count the lines in between */
+    int check = (int) (std::upper_bound(lineChecks.begin(), lineChecks.end(), offset) - lineChecks.begin()) - 1;
+    qint64 line = (qint64) qMax(0, check) * SERIAL_VIEW_LINES_PER_CHECK;
+    qint64 pos = lineChecks[qMax(0, check)];
+    while (pos < offset) {
+        QByteArray data;
+        qint64 next = readLine(pos, data);
+        if ((next > offset) || (next == pos)) {
+            break;
+        }
+        pos = next;
+        line++;
+    }
+    return line;
+}
+
+/* Reads a single line starting at an offset, and returns the offset of the line following it */
+qint64 SerialOutputView::readLine(qint64 offset, QByteArray &line) {
+    int maxLength = _hexMode ? SERIAL_VIEW_HEX_WIDTH : SERIAL_VIEW_MAX_LINE_LENGTH;
+    line.resize((int) qBound((qint64) 0, scannedSize - offset, (qint64) maxLength));
+    line.resize(log->read(offset, line.data(), line.length()));
+    if (_hexMode) {
+        return offset + line.length();
+    }
+    int end = line.indexOf('\n');
+    if (end == -1) {
+        return offset + line.length();
+    }
+    line.truncate(end);
+    return offset + end + 1;
+}
+
+QString SerialOutputView::formatLine(qint64 offset, const QByteArray &line, qint64 time) {
+    QString text;
+    if (_showTimestamps) {
+        text += QDateTime::fromMSecsSinceEpoch(time).toString("[hh:mm:ss.zzz] ");
+    }
+    if (_hexMode) {
+        text += QString("%1  ").arg(offset, 8, 16, QChar('0')).toUpper();
+        QString ascii;
+        for (int i = 0; i < SERIAL_VIEW_HEX_WIDTH; i++) {
+            if (i < line.length()) {
+                uchar c = (uchar) line[i];
+                text += QString("%1 ").arg((uint) c, 2, 16, QChar('0')).toUpper();
+                ascii += ((c >= 32) && (c < 127)) ? QChar(c) : QChar('.');
+            } else {
+                text += "   ";
+            }
+        }
+        text += ' ';
+        text += ascii;
+    } else {
+        // Filter out invalid characters from the string
+        QString lineText = QString::fromLatin1(line);
+        lineText.replace(QChar('\0'), QChar(' '));
+        lineText.remove('\r');
+        text += lineText;
+    }
+    return text;
+}
+
+int SerialOutputView::timestampWidth() {
+    return fontMetrics().horizontalAdvance("[00:00:00.000] ");
+}
+
+void SerialOutputView::updateScrollBars() {
+    int lineHeight = fontMetrics().height();
+    int visibleLines = qMax(1, viewport()->height() / lineHeight);
+    qint64 lines = lineCount();
+    verticalScrollBar()->setPageStep(visibleLines);
+    verticalScrollBar()->setSingleStep(1);
+    verticalScrollBar()->setRange(0, (int) qMin((qint64) INT_MAX, qMax((qint64) 0, lines - visibleLines)));
+
+    int columns = _hexMode ? (10 + 4 * SERIAL_VIEW_HEX_WIDTH + 1) : maxLineLength;
+    int width = columns * fontMetrics().horizontalAdvance(QChar('0')) + (_showTimestamps ? timestampWidth() : 0) + 8;
+    horizontalScrollBar()->setPageStep(viewport()->width());
+    horizontalScrollBar()->setSingleStep(fontMetrics().horizontalAdvance(QChar('0')) * 4);
+    horizontalScrollBar()->setRange(0, qMax(0, width - viewport()->width()));
+}
+
+void SerialOutputView::scrollToLine(qint64 line) {
+    int visibleLines = qMax(1, viewport()->height() / fontMetrics().height());
+    verticalScrollBar()->setValue((int) qMax((qint64) 0, line - visibleLines / 2));
+    selectStart = selectEnd = line;
+    viewport()->update();
+}
+
+void SerialOutputView::paintEvent(QPaintEvent *event) {
+    QPainter painter(viewport());
+    painter.fillRect(event->rect(), palette().base());
+    if (log == NULL) {
+        return;
+    }
+
+    /* Only read and draw the lines that are visible */
+    int lineHeight = fontMetrics().height();
+    int visibleLines = viewport()->height() / lineHeight + 1;
+    int x = 4 - horizontalScrollBar()->value();
+    qint64 firstLine = verticalScrollBar()->value();
+    qint64 lines = lineCount();
+    qint64 selectMin = qMin(selectStart, selectEnd);
+    qint64 selectMax = qMax(selectStart, selectEnd);
+    qint64 offset = lineOffset(firstLine);
+    QByteArray data;
+    QHash<qint64, qint64> visibleTimes;
+    for (int i = 0; (i < visibleLines) && ((firstLine + i) < lines); i++) {
+        qint64 line = firstLine + i;
+        qint64 nextOffset = readLine(offset, data);
+
+        /* The time of a line only changes while it has no data yet, so only then it is not kept */
+        qint64 time = 0;
+        if (_showTimestamps) {
+            time = lineTimes.value(offset, -1);
+            if (time < 0) {
+                time = log->timeAt(offset);
+            }
+            if (!data.isEmpty()) {
+                visibleTimes.insert(offset, time);
+            }
+        }
+        QRect lineRect(0, i * lineHeight, viewport()->width(), lineHeight);
+        if ((selectMin >= 0) && (line >= selectMin) && (line <= selectMax)) {
+            painter.fillRect(lineRect, palette().highlight());
+            painter.setPen(palette().highlightedText().color());
+        } else {
+            painter.setPen(palette().text().color());
+        }
+        painter.drawText(x, lineRect.top() + fontMetrics().ascent(), formatLine(offset, data, time));
+        offset = nextOffset;
+    }
+    lineTimes.swap(visibleTimes);
+}
+
+void SerialOutputView::resizeEvent(QResizeEvent *event) {
+    QAbstractScrollArea::resizeEvent(event);
+    updateScrollBars();
+    if (_autoScroll) {
+        verticalScrollBar()->setValue(verticalScrollBar()->maximum());
+    }
+}
+
+qint64 SerialOutputView::lineAtPosition(const QPoint &pos) {
+    qint64 line = verticalScrollBar()->value() + pos.y() / fontMetrics().height();
+    return qBound((qint64) 0, line, lineCount() - 1);
+}
+
+void SerialOutputView::mousePressEvent(QMouseEvent *event) {
+    if (event->button() == Qt::LeftButton) {
+        selectStart = selectEnd = lineAtPosition(event->pos());
+        viewport()->update();
+    }
+    QAbstractScrollArea::mousePressEvent(event);
+}
+
+void SerialOutputView::mouseMoveEvent(QMouseEvent *event) {
+    if (event->buttons() & Qt::LeftButton) {
+        selectEnd = lineAtPosition(event->pos());
+        viewport()->update();
+    }
+    QAbstractScrollArea::mouseMoveEvent(event);
+}
+
+void SerialOutputView::keyPressEvent(QKeyEvent *event) {
+    if (event->matches(QKeySequence::Copy)) {
+        copy();
+    } else if (event->matches(QKeySequence::SelectAll)) {
+        selectStart = 0;
+        selectEnd = lineCount() - 1;
+        viewport()->update();
+    } else {
+        QAbstractScrollArea::keyPressEvent(event);
+    }
+}
+
+QString SerialOutputView::selectedText() {
+    QString text;
+    if ((log == NULL) || (selectStart < 0)) {
+        return text;
+    }
+    qint64 line = qMin(selectStart, selectEnd);
+    qint64 lastLine = qMax(selectStart, selectEnd);
+    qint64 offset = lineOffset(line);
+    QByteArray data;
+    for (; (line <= lastLine) && (text.length() < SERIAL_VIEW_MAX_COPY); line++) {
+        qint64 nextOffset = readLine(offset, data);
+        if (!text.isEmpty()) {
+            text += '\n';
+        }
+        text += formatLine(offset, data, _showTimestamps ? log->timeAt(offset) : 0);
+        offset = nextOffset;
+    }
+    return text;
+}
+
+void SerialOutputView::copy() {
+    QString text = selectedText();
+    if (!text.isEmpty()) {
+        QApplication::clipboard()->setText(text);
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef SERIALOUTPUTVIEW_H
+#define SERIALOUTPUTVIEW_H
+
+#include <QAbstractScrollArea>
+#include <QVector>
+#include <QHash>
+#include <QTimer>
+#include "../stk500/stk500seriallog.h"
+
+#define SERIAL_VIEW_MAX_LINE_LENGTH   4096   // Lines longer than this are broken up
+#define SERIAL_VIEW_LINES_PER_CHECK     64   // Amount of lines between two stored line offsets
+#define SERIAL_VIEW_FRAME_TIME          16   // Time (in ms) between two view updates while receiving
+#define SERIAL_VIEW_HEX_WIDTH           16   // Amount of bytes displayed per line in hex mode
+#define SERIAL_VIEW_MAX_COPY       1048576   // Maximum amount of bytes copied to the clipboard
+
+/*
+ * Displays the data stored in a Serial log as text or as a hex dump
+ *
+ * Only the lines currently visible are read from the log and drawn. To find
+ * them quickly, the offset of every so many lines is stored while the data
+ * is received. Newly received data is processed at most once per frame.
+ * The times of the lines in view are kept, so they are looked up only once.
+ */
+class SerialOutputView : public QAbstractScrollArea
+{
+    Q_OBJECT
+public:
+    explicit SerialOutputView(QWidget *parent = 0);
+    void setLog(stk500SerialLog *log);
+    void setAutoScroll(bool autoScroll);
+    bool autoScroll() const { return _autoScroll; }
+    void setShowTimestamps(bool show);
+    bool showTimestamps() const { return _showTimestamps; }
+    void setHexMode(bool hexMode);
+    bool hexMode() const { return _hexMode; }
+    qint64 lineCount();
+    qint64 lineOffset(qint64 line);
+    qint64 lineAtOffset(qint64 offset);
+    void scrollToLine(qint64 line);
+    bool hasSelection() const { return selectStart >= 0; }
+    QString selectedText();
+
+public slots:
+    void dataReceived();
+    void clear();
+    void copy();
+
+protected:
+    void paintEvent(QPaintEvent *event);
+    void resizeEvent(QResizeEvent *event);
+    void mousePressEvent(QMouseEvent *event);
+    void mouseMoveEvent(QMouseEvent *event);
+    void keyPressEvent(QKeyEvent *event);
+
+private slots:
+    void updateData();
+
+private:
+    void resetIndex();
+    void updateScrollBars();
+    qint64 lineAtPosition(const QPoint &pos);
+    qint64 readLine(qint64 offset, QByteArray &line);
+    QString formatLine(qint64 offset, const QByteArray &line, qint64 time);
+    int timestampWidth();
+
+    stk500SerialLog *log;
+    QTimer *frameTimer;
+    int logGeneration;
+    qint64 scannedSize;
+    qint64 textLineCount;
+    int currentLineLength;
+    int maxLineLength;
+    QVector<qint64> lineChecks;
+    QHash<qint64, qint64> lineTimes;
+    qint64 selectStart;
+    qint64 selectEnd;
+    bool _autoScroll;
+    bool _showTimestamps;
+    bool _hexMode;
+};
+
+#endif // SERIALOUTPUTVIEW_H
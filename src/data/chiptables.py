@@ -0,0 +1,242 @@
+#!/usr/bin/env python
+#
+# Generates the register, pin map and command tables from the CSV files
+# in this directory as a C++ header, so no parsing happens at runtime.
+#
+# Usage: chiptables.py registers.csv pinmapping.csv commands.csv output.h
+#
+# All text is stored once in a single UTF-16 string pool, which QString
+# uses directly without copying. Register names and pin module/function
+# pairs are found through a perfect hash table: every name ends up in a
+# slot of its own, so a lookup costs two hashes and one string compare.
+
+import os
+import sys
+
+REGISTER_COLUMNS = 13
+PIN_COLUMNS = 5
+
+
+def read_csv(path):
+    with open(path, 'r') as f:
+        return [line.rstrip('\r\n').split(',') for line in f if line.strip()]
+
+
+def pad(values, count):
+    return (values + ['-'] * count)[:count]
+
+
+def parse_int(text, base):
+    try:
+        return int(text, base)
+    except ValueError:
+        return -1
+
+
+def name_hash(text, seed):
+    # FNV-1a over the UTF-16 code units, must match chipNameHash() in stk500registers.cpp
+    h = (2166136261 ^ seed) & 0xFFFFFFFF
+    for c in text:
+        h ^= ord(c)
+        h = (h * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def perfect_hash(keys):
+    # Hash and displace: keys are grouped into buckets by their unseeded hash, and
+    # every bucket gets the seed that puts all its keys into free slots
+    size = 1
+    while size < len(keys) * 2:
+        size *= 2
+    bucket_count = size // 4
+    buckets = [[] for _ in range(bucket_count)]
+    for i, key in enumerate(keys):
+        buckets[name_hash(key, 0) & (bucket_count - 1)].append(i)
+    seeds = [0] * bucket_count
+    slots = [-1] * size
+    for b in sorted(range(bucket_count), key=lambda b: -len(buckets[b])):
+        if not buckets[b]:
+            break
+        for seed in range(1, 1000000):
+            taken = [name_hash(keys[i], seed) & (size - 1) for i in buckets[b]]
+            if len(set(taken)) == len(taken) and all(slots[t] == -1 for t in taken):
+                break
+        else:
+            raise Exception('No perfect hash seed found')
+        seeds[b] = seed
+        for i, t in zip(buckets[b], taken):
+            slots[t] = i
+    return seeds, slots
+
+
+class StringPool:
+    def __init__(self):
+        self.offsets = {'': 0}
+        self.strings = ['']
+        self.length = 1
+
+    def add(self, text):
+        if text not in self.offsets:
+            self.offsets[text] = self.length
+            self.strings.append(text)
+            self.length += len(text) + 1
+        return self.offsets[text]
+
+    def literal(self):
+        lines = []
+        for text in self.strings[1:]:
+            escaped = ''
+            for c in text:
+                if c in '\\"':
+                    escaped += '\\' + c
+                elif ord(c) < 0x20 or ord(c) > 0x7E:
+                    escaped += '\\u%04x' % ord(c)
+                else:
+                    escaped += c
+            lines.append('    u"%s\\0"' % escaped)
+        return 'u"\\0"\n' + '\n'.join(lines)
+
+
+def main(argv):
+    if len(argv) != 5:
+        sys.stderr.write('Usage: chiptables.py registers.csv pinmapping.csv commands.csv output.h\n')
+        return 1
+    registers = read_csv(argv[1])
+    pins = read_csv(argv[2])
+    commands = read_csv(argv[3])
+    pool = StringPool()
+
+    # Registers: the first row is the header, the OTHER row holds the defaults
+    register_header = pad(registers[0], REGISTER_COLUMNS)
+    register_default = pad(['OTHER'], REGISTER_COLUMNS)
+    register_rows = []
+    for row in registers[1:]:
+        row = pad(row, REGISTER_COLUMNS)
+        if row[0] == 'OTHER':
+            register_default = row
+        elif parse_int(row[0], 16) != -1:
+            register_rows.append(row)
+    register_names = []
+    register_slot_rows = []
+    for i, row in enumerate(register_rows):
+        if row[3] not in register_names:
+            register_names.append(row[3])
+            register_slot_rows.append(i)
+    register_seeds, register_slots = perfect_hash(register_names)
+
+    # Pin map: the first row is the header
+    register_addresses = dict((row[3], parse_int(row[0], 16)) for row in reversed(register_rows))
+    pin_header = pad(pins[0], PIN_COLUMNS)
+    pin_rows = [pad(row, PIN_COLUMNS) for row in pins[1:] if parse_int(pad(row, PIN_COLUMNS)[4], 10) != -1]
+    pin_keys = []
+    pin_slot_rows = []
+    for i, row in enumerate(pin_rows):
+        key = row[1] + '\x1f' + row[2]
+        if key not in pin_keys:
+            pin_keys.append(key)
+            pin_slot_rows.append(i)
+    pin_seeds, pin_slots = perfect_hash(pin_keys)
+
+    # Command names by command code
+    command_names = [0] * 256
+    for row in commands:
+        if len(row) == 2:
+            code = parse_int(row[1], 16)
+            if 0 <= code < 256:
+                command_names[code] = pool.add(row[0])
+
+    def register_entry(row):
+        values = ', '.join(str(pool.add(v)) for v in row)
+        return '{ %d, { %s } }' % (parse_int(row[0], 16), values)
+
+    def pin_entry(row):
+        port = row[0]
+        addr_pin = addr_ddr = addr_port = -1
+        addr_mask = 0
+        if len(port) == 2:
+            addr_mask = 1 << max(0, parse_int(port[1], 10))
+            addr_pin = register_addresses.get('PIN' + port[0], -1)
+            addr_ddr = register_addresses.get('DDR' + port[0], -1)
+            addr_port = register_addresses.get('PORT' + port[0], -1)
+        values = ', '.join(str(pool.add(v)) for v in row)
+        return '{ %d, %d, %d, %d, %d, { %s } }' % (parse_int(row[4], 10), addr_pin, addr_ddr,
+                                                   addr_port, addr_mask, values)
+
+    register_header_entry = register_entry(register_header)
+    register_default_entry = register_entry(register_default)
+    register_entries = [register_entry(row) for row in register_rows]
+    pin_header_entry = pin_entry(pin_header)
+    pin_entries = [pin_entry(row) for row in pin_rows]
+
+    def slot_list(slots, rows):
+        return ', '.join(str(rows[s] if s != -1 else -1) for s in slots)
+
+    def wrap(items, per_line):
+        return ',\n'.join('    ' + ', '.join(items[i:i + per_line]) for i in range(0, len(items), per_line))
+
+    out = []
+    out.append('// Generated by %s from %s - do not edit' % (
+        os.path.basename(argv[0]), ', '.join(os.path.basename(p) for p in argv[1:4])))
+    out.append('#ifndef CHIPTABLES_H')
+    out.append('#define CHIPTABLES_H')
+    out.append('')
+    out.append('#define CHIPTABLE_REGISTER_COUNT     %d' % len(register_entries))
+    out.append('#define CHIPTABLE_REGISTER_SLOTS     %d' % len(register_slots))
+    out.append('#define CHIPTABLE_REGISTER_BUCKETS   %d' % len(register_seeds))
+    out.append('#define CHIPTABLE_PIN_COUNT          %d' % len(pin_entries))
+    out.append('#define CHIPTABLE_PIN_SLOTS          %d' % len(pin_slots))
+    out.append('#define CHIPTABLE_PIN_BUCKETS        %d' % len(pin_seeds))
+    out.append('')
+    out.append('typedef struct ChipRegisterEntry {')
+    out.append('    int address;')
+    out.append('    unsigned short values[%d];' % REGISTER_COLUMNS)
+    out.append('} ChipRegisterEntry;')
+    out.append('')
+    out.append('typedef struct ChipPinEntry {')
+    out.append('    int pin;')
+    out.append('    int addr_pin;')
+    out.append('    int addr_ddr;')
+    out.append('    int addr_port;')
+    out.append('    int addr_mask;')
+    out.append('    unsigned short values[%d];' % PIN_COLUMNS)
+    out.append('} ChipPinEntry;')
+    out.append('')
+    out.append('static constexpr char16_t chipStringPool[] =')
+    out.append('    ' + pool.literal() + ';')
+    out.append('')
+    out.append('static constexpr ChipRegisterEntry chipRegisterHeader = %s;' % register_header_entry)
+    out.append('static constexpr ChipRegisterEntry chipRegisterDefault = %s;' % register_default_entry)
+    out.append('static constexpr ChipRegisterEntry chipRegisters[CHIPTABLE_REGISTER_COUNT] = {')
+    out.append(',\n'.join('    ' + e for e in register_entries))
+    out.append('};')
+    out.append('static constexpr unsigned int chipRegisterSeeds[CHIPTABLE_REGISTER_BUCKETS] = {')
+    out.append(wrap([str(n) for n in register_seeds], 16))
+    out.append('};')
+    out.append('static constexpr short chipRegisterSlots[CHIPTABLE_REGISTER_SLOTS] = {')
+    out.append(wrap(slot_list(register_slots, register_slot_rows).split(', '), 16))
+    out.append('};')
+    out.append('')
+    out.append('static constexpr ChipPinEntry chipPinHeader = %s;' % pin_header_entry)
+    out.append('static constexpr ChipPinEntry chipPins[CHIPTABLE_PIN_COUNT] = {')
+    out.append(',\n'.join('    ' + e for e in pin_entries))
+    out.append('};')
+    out.append('static constexpr unsigned int chipPinSeeds[CHIPTABLE_PIN_BUCKETS] = {')
+    out.append(wrap([str(n) for n in pin_seeds], 16))
+    out.append('};')
+    out.append('static constexpr short chipPinSlots[CHIPTABLE_PIN_SLOTS] = {')
+    out.append(wrap(slot_list(pin_slots, pin_slot_rows).split(', '), 16))
+    out.append('};')
+    out.append('')
+    out.append('static constexpr unsigned short chipCommandNames[256] = {')
+    out.append(wrap([str(n) for n in command_names], 16))
+    out.append('};')
+    out.append('')
+    out.append('#endif // CHIPTABLES_H')
+
+    with open(argv[4], 'w') as f:
+        f.write('\n'.join(out) + '\n')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,153 @@
+#include "analogcapturedialog.h"
+#include "ui_analogcapturedialog.h"
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QCloseEvent>
+#include <QDateTime>
+
+AnalogCaptureDialog::AnalogCaptureDialog(stk500Serial *serial, const QList<int> &channels, QWidget *parent) :
+    QDialog(parent, Qt::WindowSystemMenuHint | Qt::WindowTitleHint | Qt::WindowCloseButtonHint),
+    ui(new Ui::AnalogCaptureDialog)
+{
+    ui->setupUi(this);
+
+    this->serial = serial;
+    this->task = NULL;
+    this->lastTotal = 0;
+    this->lastRefreshTime = 0;
+
+    // List all analog channels, selecting the ones asked for
+    for (int i = 0; i < ANALOG_PIN_COUNT; i++) {
+        QListWidgetItem *item = new QListWidgetItem(QString("A%1").arg(i), ui->channelList);
+        item->setFlags(item->flags() | Qt::ItemIsUserCheckable);
+        item->setCheckState(channels.contains(i) ? Qt::Checked : Qt::Unchecked);
+        item->setForeground(SamplePlot::channelColor(i));
+    }
+
+    ui->plot->setBuffer(&buffer);
+    connect(serial, SIGNAL(taskFinished(stk500Task*)),
+            this, SLOT(serialTaskFinished(stk500Task*)));
+    connect(&refreshTimer, SIGNAL(timeout()), this, SLOT(refresh()));
+    refreshTimer.start(ANALOG_CAPTURE_REFRESH_INTERVAL);
+    updateButtons();
+}
+
+AnalogCaptureDialog::~AnalogCaptureDialog()
+{
+    stopSampling();
+    delete ui;
+}
+
+QList<int> AnalogCaptureDialog::selectedChannels() {
+    QList<int> channels;
+    for (int i = 0; i < ui->channelList->count(); i++) {
+        if (ui->channelList->item(i)->checkState() == Qt::Checked) {
+            channels.append(i);
+        }
+    }
+    return channels;
+}
+
+void AnalogCaptureDialog::updateButtons() {
+    bool sampling = (task != NULL);
+    ui->startButton->setText(sampling ? "Stop" : "Start");
+    ui->channelList->setEnabled(!sampling);
+    ui->exportCsvButton->setEnabled(!sampling);
+    ui->exportBinaryButton->setEnabled(!sampling);
+}
+
+void AnalogCaptureDialog::on_startButton_clicked()
+{
+    if (task != NULL) {
+        task->cancel();
+        return;
+    }
+    QList<int> channels = selectedChannels();
+    if (channels.isEmpty()) {
+        QMessageBox::critical(this, "No channels selected", "Please select the analog channels to sample");
+        return;
+    }
+    if (!serial->isOpen()) {
+        QMessageBox::critical(this, "Not connected", "Please connect a device to sample its analog inputs");
+        return;
+    }
+
+    // Every run starts with an empty buffer
+    buffer.clear();
+    lastTotal = 0;
+    lastRefreshTime = QDateTime::currentMSecsSinceEpoch();
+    task = new stk500SampleAnalog(&buffer, channels);
+    serial->execute(*task, true);
+    updateButtons();
+}
+
+/* Cancels sampling and waits for the task to finish, it refers to the buffer */
+void AnalogCaptureDialog::stopSampling() {
+    if (task == NULL) {
+        return;
+    }
+    // Let go of the task first, so serialTaskFinished does not delete it while waiting
+    stk500SampleAnalog *stopped = task;
+    task = NULL;
+    serial->cancelAndWait(stopped);
+    delete stopped;
+}
+
+void AnalogCaptureDialog::serialTaskFinished(stk500Task *task) {
+    if (task != this->task) return;
+    if (task->hasError()) {
+        QMessageBox::critical(this, "Sampling failed", task->getErrorMessage());
+    }
+    delete this->task;
+    this->task = NULL;
+    updateButtons();
+    refresh();
+}
+
+void AnalogCaptureDialog::refresh() {
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 total = buffer.total();
+    if (task != NULL) {
+        ui->plot->refresh();
+        if ((now - lastRefreshTime) >= 1000) {
+            double rate = (double) (total - lastTotal) * 1000.0 / (now - lastRefreshTime);
+            ui->statusLabel->setText(QString("Sampling: %1 samples/s, %2 samples kept")
+                                     .arg(rate, 0, 'f', 0).arg(buffer.count()));
+            lastTotal = total;
+            lastRefreshTime = now;
+        }
+    } else if (lastTotal != total) {
+        ui->plot->refresh();
+        ui->statusLabel->setText(QString("Stopped: %1 samples kept").arg(buffer.count()));
+        lastTotal = total;
+    }
+}
+
+void AnalogCaptureDialog::on_clearButton_clicked()
+{
+    buffer.clear();
+    lastTotal = -1;
+    refresh();
+}
+
+void AnalogCaptureDialog::on_exportCsvButton_clicked()
+{
+    QString filePath = QFileDialog::getSaveFileName(this, "Export samples", "samples.csv", "CSV Files (*.csv)");
+    if (!filePath.isEmpty() && !buffer.exportCSV(filePath)) {
+        QMessageBox::critical(this, "Export failed", "Failed to write " + filePath);
+    }
+}
+
+void AnalogCaptureDialog::on_exportBinaryButton_clicked()
+{
+    QString filePath = QFileDialog::getSaveFileName(this, "Export samples", "samples.bin", "Binary Files (*.bin)");
+    if (!filePath.isEmpty() && !buffer.exportBinary(filePath)) {
+        QMessageBox::critical(this, "Export failed", "Failed to write " + filePath);
+    }
+}
+
+void AnalogCaptureDialog::closeEvent(QCloseEvent *event) {
+    stopSampling();
+    updateButtons();
+    event->accept();
+}
@@ -0,0 +1,46 @@
+#ifndef ANALOGCAPTUREDIALOG_H
+#define ANALOGCAPTUREDIALOG_H
+
+#include <QDialog>
+#include <QTimer>
+#include "../stk500/stk500serial.h"
+
+// Interval (in ms) at which the plot and sample rate are refreshed
+#define ANALOG_CAPTURE_REFRESH_INTERVAL 50
+
+namespace Ui {
+class AnalogCaptureDialog;
+}
+
+class AnalogCaptureDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit AnalogCaptureDialog(stk500Serial *serial, const QList<int> &channels, QWidget *parent = 0);
+    ~AnalogCaptureDialog();
+
+private slots:
+    void serialTaskFinished(stk500Task *task);
+    void refresh();
+    void on_startButton_clicked();
+    void on_clearButton_clicked();
+    void on_exportCsvButton_clicked();
+    void on_exportBinaryButton_clicked();
+
+private:
+    void stopSampling();
+    QList<int> selectedChannels();
+    void updateButtons();
+    void closeEvent(QCloseEvent *event);
+
+    Ui::AnalogCaptureDialog *ui;
+    stk500Serial *serial;
+    stk500SampleBuffer buffer;
+    stk500SampleAnalog *task;
+    QTimer refreshTimer;
+    qint64 lastTotal;
+    qint64 lastRefreshTime;
+};
+
+#endif // ANALOGCAPTUREDIALOG_H
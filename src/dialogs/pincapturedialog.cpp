@@ -0,0 +1,136 @@
+#include "pincapturedialog.h"
+#include "ui_pincapturedialog.h"
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QCloseEvent>
+
+PinCaptureDialog::PinCaptureDialog(stk500Serial *serial, const QList<PinMapInfo> &pinmap, const QList<int> &selectedRows, QWidget *parent) :
+    QDialog(parent, Qt::WindowSystemMenuHint | Qt::WindowTitleHint | Qt::WindowCloseButtonHint),
+    ui(new Ui::PinCaptureDialog)
+{
+    ui->setupUi(this);
+
+    this->serial = serial;
+    this->task = NULL;
+
+    // List every port pin once, selecting the ones asked for
+    QStringList ports;
+    for (int row = 0; row < pinmap.count(); row++) {
+        const PinMapInfo &info = pinmap[row];
+        if (info.addr_pin == -1) {
+            continue;
+        }
+        int index = ports.indexOf(info.port);
+        if (index == -1) {
+            index = ports.count();
+            ports.append(info.port);
+            pins.append(info);
+
+            QListWidgetItem *item = new QListWidgetItem(QString("%1 (%2) %3").arg(info.name, info.port, info.function), ui->pinList);
+            item->setFlags(item->flags() | Qt::ItemIsUserCheckable);
+            item->setCheckState(Qt::Unchecked);
+        }
+        if (selectedRows.contains(row)) {
+            ui->pinList->item(index)->setCheckState(Qt::Checked);
+        }
+    }
+
+    connect(serial, SIGNAL(taskFinished(stk500Task*)),
+            this, SLOT(serialTaskFinished(stk500Task*)));
+    connect(&refreshTimer, SIGNAL(timeout()), this, SLOT(refresh()));
+    refreshTimer.start(PIN_CAPTURE_REFRESH_INTERVAL);
+    updateButtons();
+}
+
+PinCaptureDialog::~PinCaptureDialog()
+{
+    stopCapturing();
+    delete ui;
+}
+
+QList<PinMapInfo> PinCaptureDialog::selectedPins() {
+    QList<PinMapInfo> selected;
+    for (int i = 0; i < ui->pinList->count(); i++) {
+        if (ui->pinList->item(i)->checkState() == Qt::Checked) {
+            selected.append(pins[i]);
+        }
+    }
+    return selected;
+}
+
+void PinCaptureDialog::updateButtons() {
+    bool capturing = (task != NULL);
+    ui->startButton->setText(capturing ? "Stop" : "Start");
+    ui->pinList->setEnabled(!capturing);
+    ui->exportButton->setEnabled(!capturing && (capture.changeCount() > 0));
+}
+
+void PinCaptureDialog::on_startButton_clicked()
+{
+    if (task != NULL) {
+        task->cancel();
+        return;
+    }
+    QList<PinMapInfo> selected = selectedPins();
+    if (selected.isEmpty()) {
+        QMessageBox::critical(this, "No pins selected", "Please select the pins to capture");
+        return;
+    }
+    if (selected.count() > PIN_CAPTURE_MAX_PINS) {
+        QMessageBox::critical(this, "Too many pins selected",
+                              QString("At most %1 pins can be captured at once").arg(PIN_CAPTURE_MAX_PINS));
+        return;
+    }
+    if (!serial->isOpen()) {
+        QMessageBox::critical(this, "Not connected", "Please connect a device to capture its pin states");
+        return;
+    }
+
+    capture.setPins(selected);
+    task = new stk500CapturePins(&capture);
+    serial->execute(*task, true);
+    updateButtons();
+    refresh();
+}
+
+/* Cancels capturing and waits for the task to finish, it refers to the capture */
+void PinCaptureDialog::stopCapturing() {
+    if (task == NULL) {
+        return;
+    }
+    // Let go of the task first, so serialTaskFinished does not delete it while waiting
+    stk500CapturePins *stopped = task;
+    task = NULL;
+    serial->cancelAndWait(stopped);
+    delete stopped;
+}
+
+void PinCaptureDialog::serialTaskFinished(stk500Task *task) {
+    if (task != this->task) return;
+    if (task->hasError()) {
+        QMessageBox::critical(this, "Capturing failed", task->getErrorMessage());
+    }
+    delete this->task;
+    this->task = NULL;
+    updateButtons();
+    refresh();
+}
+
+void PinCaptureDialog::refresh() {
+    QString text = QString("%1 changes in %2 samples").arg(capture.changeCount()).arg(capture.sampleCount());
+    ui->statusLabel->setText(((task != NULL) ? "Capturing: " : "Stopped: ") + text);
+}
+
+void PinCaptureDialog::on_exportButton_clicked()
+{
+    QString filePath = QFileDialog::getSaveFileName(this, "Export capture", "capture.vcd", "Value Change Dump (*.vcd)");
+    if (!filePath.isEmpty() && !capture.exportVCD(filePath)) {
+        QMessageBox::critical(this, "Export failed", "Failed to write " + filePath);
+    }
+}
+
+void PinCaptureDialog::closeEvent(QCloseEvent *event) {
+    stopCapturing();
+    updateButtons();
+    event->accept();
+}
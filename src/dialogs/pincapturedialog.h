@@ -0,0 +1,43 @@
+#ifndef PINCAPTUREDIALOG_H
+#define PINCAPTUREDIALOG_H
+
+#include <QDialog>
+#include <QTimer>
+#include "../stk500/stk500serial.h"
+
+// Interval (in ms) at which the capture status is refreshed
+#define PIN_CAPTURE_REFRESH_INTERVAL 250
+
+namespace Ui {
+class PinCaptureDialog;
+}
+
+class PinCaptureDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit PinCaptureDialog(stk500Serial *serial, const QList<PinMapInfo> &pinmap, const QList<int> &selectedRows, QWidget *parent = 0);
+    ~PinCaptureDialog();
+
+private slots:
+    void serialTaskFinished(stk500Task *task);
+    void refresh();
+    void on_startButton_clicked();
+    void on_exportButton_clicked();
+
+private:
+    void stopCapturing();
+    QList<PinMapInfo> selectedPins();
+    void updateButtons();
+    void closeEvent(QCloseEvent *event);
+
+    Ui::PinCaptureDialog *ui;
+    stk500Serial *serial;
+    stk500PinCapture capture;
+    stk500CapturePins *task;
+    QList<PinMapInfo> pins;
+    QTimer refreshTimer;
+};
+
+#endif // PINCAPTUREDIALOG_H
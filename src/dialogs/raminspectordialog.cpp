@@ -0,0 +1,192 @@
+#include "raminspectordialog.h"
+#include "ui_raminspectordialog.h"
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QCloseEvent>
+#include <QCompleter>
+#include <QHeaderView>
+
+#define WATCH_COL_EXPRESSION  0
+#define WATCH_COL_ADDRESS     1
+#define WATCH_COL_TYPE        2
+#define WATCH_COL_VALUE       3
+
+RamInspectorDialog::RamInspectorDialog(stk500Serial *serial, QWidget *parent) :
+    QDialog(parent, Qt::WindowSystemMenuHint | Qt::WindowTitleHint | Qt::WindowCloseButtonHint),
+    ui(new Ui::RamInspectorDialog)
+{
+    ui->setupUi(this);
+
+    this->serial = serial;
+    this->task = NULL;
+
+    model = new RamHexModel(this);
+    ui->hexView->setModel(model);
+    ui->hexView->horizontalHeader()->setSectionResizeMode(QHeaderView::ResizeToContents);
+    ui->hexView->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    ui->hexView->verticalHeader()->setDefaultSectionSize(ui->hexView->fontMetrics().height() + 4);
+    ui->watchTable->horizontalHeader()->setStretchLastSection(true);
+
+    connect(serial, SIGNAL(taskFinished(stk500Task*)),
+            this, SLOT(serialTaskFinished(stk500Task*)));
+    connect(&refreshTimer, SIGNAL(timeout()), this, SLOT(refresh()));
+    refreshTimer.start(RAM_INSPECTOR_REFRESH_INTERVAL);
+    updateButtons();
+}
+
+RamInspectorDialog::~RamInspectorDialog()
+{
+    stopMonitoring();
+    delete ui;
+}
+
+void RamInspectorDialog::updateButtons() {
+    ui->startButton->setText((task != NULL) ? "Stop" : "Start");
+}
+
+void RamInspectorDialog::on_startButton_clicked()
+{
+    if (task != NULL) {
+        task->cancel();
+        return;
+    }
+    if (!serial->isOpen()) {
+        QMessageBox::critical(this, "Not connected", "Please connect a device to inspect its RAM");
+        return;
+    }
+    updateVisible();
+    task = new stk500MonitorRam(&monitor);
+    serial->execute(*task, true);
+    updateButtons();
+}
+
+/* Cancels monitoring and waits for the task to finish, it refers to the monitor */
+void RamInspectorDialog::stopMonitoring() {
+    if (task == NULL) {
+        return;
+    }
+    // Let go of the task first, so serialTaskFinished does not delete it while waiting
+    stk500MonitorRam *stopped = task;
+    task = NULL;
+    serial->cancelAndWait(stopped);
+    delete stopped;
+}
+
+void RamInspectorDialog::serialTaskFinished(stk500Task *task) {
+    if (task != this->task) return;
+    if (task->hasError()) {
+        QMessageBox::critical(this, "Reading RAM failed", task->getErrorMessage());
+    }
+    delete this->task;
+    this->task = NULL;
+    updateButtons();
+}
+
+/* Only the rows in view are read, along with the watches */
+void RamInspectorDialog::updateVisible() {
+    QTableView *view = ui->hexView;
+    int firstRow = qMax(0, view->rowAt(0));
+    int lastRow = view->rowAt(view->viewport()->height() - 1);
+    if (lastRow == -1) {
+        lastRow = model->rowCount() - 1;
+    }
+    monitor.setVisible(model->address(firstRow), model->address(lastRow) + RAM_HEX_MODEL_BYTES - 1);
+}
+
+void RamInspectorDialog::refresh() {
+    updateVisible();
+    model->refresh(monitor);
+
+    // Update the watched values, highlighting the ones that changed
+    for (int i = 0; i < watches.count(); i++) {
+        QTableWidgetItem *item = ui->watchTable->item(i, WATCH_COL_VALUE);
+        QString text = stk500RamMonitor::formatWatch(watches[i], model->ramData());
+        if (item->text() != text) {
+            item->setText(text);
+            item->setBackground(Qt::yellow);
+        } else {
+            item->setBackground(Qt::white);
+        }
+    }
+
+    if (task != NULL) {
+        int interval = monitor.interval();
+        ui->statusLabel->setText(QString("Reading %1 bytes every %2 ms (%3 bytes/s)")
+                                 .arg(monitor.bytesPerPoll()).arg(interval)
+                                 .arg(monitor.bytesPerPoll() * 1000 / qMax(1, interval)));
+    }
+}
+
+void RamInspectorDialog::on_addWatchButton_clicked()
+{
+    RamWatch watch;
+    QString error;
+    if (!stk500RamMonitor::parseWatch(ui->watchEdit->text(), symbols, watch, error)) {
+        QMessageBox::critical(this, "Invalid watch", error);
+        return;
+    }
+    watches.append(watch);
+    monitor.setWatches(watches);
+
+    int row = ui->watchTable->rowCount();
+    ui->watchTable->insertRow(row);
+    ui->watchTable->setItem(row, WATCH_COL_EXPRESSION, new QTableWidgetItem(watch.expression));
+    ui->watchTable->setItem(row, WATCH_COL_ADDRESS, new QTableWidgetItem(
+                                "0x" + QString("%1").arg(watch.address, 4, 16, QChar('0')).toUpper()));
+    ui->watchTable->setItem(row, WATCH_COL_TYPE, new QTableWidgetItem(stk500RamMonitor::typeName(watch.type)));
+    ui->watchTable->setItem(row, WATCH_COL_VALUE, new QTableWidgetItem());
+    for (int col = 0; col < ui->watchTable->columnCount(); col++) {
+        QTableWidgetItem *item = ui->watchTable->item(row, col);
+        item->setFlags(item->flags() & ~Qt::ItemIsEditable);
+    }
+    ui->watchEdit->clear();
+}
+
+void RamInspectorDialog::on_removeWatchButton_clicked()
+{
+    int row = ui->watchTable->currentRow();
+    if (row == -1) {
+        return;
+    }
+    watches.removeAt(row);
+    ui->watchTable->removeRow(row);
+    monitor.setWatches(watches);
+}
+
+/* Shows the watched address in the hex view */
+void RamInspectorDialog::on_watchTable_cellDoubleClicked(int row, int)
+{
+    int hexRow = (watches[row].address - RAM_MONITOR_START) / RAM_HEX_MODEL_BYTES;
+    if (hexRow >= 0) {
+        ui->hexView->scrollTo(model->index(hexRow, 0), QAbstractItemView::PositionAtCenter);
+    }
+}
+
+void RamInspectorDialog::on_loadElfButton_clicked()
+{
+    QString filePath = QFileDialog::getOpenFileName(this, "Load symbols", "", "ELF Files (*.elf)");
+    if (filePath.isEmpty()) {
+        return;
+    }
+    if (!symbols.load(filePath)) {
+        QMessageBox::critical(this, "Loading symbols failed", symbols.errorMessage());
+        return;
+    }
+
+    // Complete the variable names while typing a watch
+    QStringList names;
+    QList<ElfSymbol> variables = symbols.dataSymbols();
+    for (int i = 0; i < variables.count(); i++) {
+        names.append(variables[i].name);
+    }
+    QCompleter *completer = new QCompleter(names, ui->watchEdit);
+    completer->setCaseSensitivity(Qt::CaseInsensitive);
+    ui->watchEdit->setCompleter(completer);
+    ui->statusLabel->setText(QString("%1 variables loaded").arg(variables.count()));
+}
+
+void RamInspectorDialog::closeEvent(QCloseEvent *event) {
+    stopMonitoring();
+    updateButtons();
+    event->accept();
+}
@@ -0,0 +1,49 @@
+#ifndef RAMINSPECTORDIALOG_H
+#define RAMINSPECTORDIALOG_H
+
+#include <QDialog>
+#include <QTimer>
+#include "../stk500/stk500serial.h"
+#include "../controls/ramhexmodel.h"
+
+// Interval (in ms) at which the hex view and watches are refreshed
+#define RAM_INSPECTOR_REFRESH_INTERVAL 100
+
+namespace Ui {
+class RamInspectorDialog;
+}
+
+class RamInspectorDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit RamInspectorDialog(stk500Serial *serial, QWidget *parent = 0);
+    ~RamInspectorDialog();
+
+private slots:
+    void serialTaskFinished(stk500Task *task);
+    void refresh();
+    void on_startButton_clicked();
+    void on_addWatchButton_clicked();
+    void on_removeWatchButton_clicked();
+    void on_loadElfButton_clicked();
+    void on_watchTable_cellDoubleClicked(int row, int column);
+
+private:
+    void stopMonitoring();
+    void updateVisible();
+    void updateButtons();
+    void closeEvent(QCloseEvent *event);
+
+    Ui::RamInspectorDialog *ui;
+    stk500Serial *serial;
+    stk500RamMonitor monitor;
+    stk500MonitorRam *task;
+    RamHexModel *model;
+    ElfSymbols symbols;
+    QList<RamWatch> watches;
+    QTimer refreshTimer;
+};
+
+#endif // RAMINSPECTORDIALOG_H
@@ -0,0 +1,115 @@
+#include "ramprofiledialog.h"
+#include "ui_ramprofiledialog.h"
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QCloseEvent>
+
+RamProfileDialog::RamProfileDialog(stk500Serial *serial, QWidget *parent) :
+    QDialog(parent, Qt::WindowSystemMenuHint | Qt::WindowTitleHint | Qt::WindowCloseButtonHint),
+    ui(new Ui::RamProfileDialog)
+{
+    ui->setupUi(this);
+
+    this->serial = serial;
+    this->task = NULL;
+    this->hasSymbols = false;
+
+    connect(serial, SIGNAL(taskFinished(stk500Task*)),
+            this, SLOT(serialTaskFinished(stk500Task*)));
+    connect(&refreshTimer, SIGNAL(timeout()), this, SLOT(refresh()));
+    refreshTimer.start(RAM_PROFILE_REFRESH_INTERVAL);
+    updateButtons();
+}
+
+RamProfileDialog::~RamProfileDialog()
+{
+    stopProfiling();
+    delete ui;
+}
+
+void RamProfileDialog::updateButtons() {
+    bool profiling = (task != NULL);
+    ui->startButton->setText(profiling ? "Stop" : "Start");
+    ui->startButton->setEnabled(profiling || hasSymbols);
+    ui->browseButton->setEnabled(!profiling);
+    ui->runTimeBox->setEnabled(!profiling);
+}
+
+void RamProfileDialog::on_browseButton_clicked()
+{
+    QString filePath = QFileDialog::getOpenFileName(this, "Select the sketch ELF file", "", "ELF Files (*.elf)");
+    if (filePath.isEmpty()) {
+        return;
+    }
+    ElfSymbols symbols;
+    QString error;
+    if (!symbols.load(filePath)) {
+        error = symbols.errorMessage();
+    } else if (profile.setSymbols(symbols, error)) {
+        error.clear();
+    }
+    hasSymbols = error.isEmpty();
+    if (hasSymbols) {
+        ui->elfEdit->setText(filePath);
+        ui->resultText->setPlainText(QString("Heap starts at 0x%1").arg(profile.heapStart(), 4, 16, QChar('0')));
+    } else {
+        ui->elfEdit->clear();
+        QMessageBox::critical(this, "Loading symbols failed", error);
+    }
+    updateButtons();
+}
+
+void RamProfileDialog::on_startButton_clicked()
+{
+    if (task != NULL) {
+        task->cancel();
+        return;
+    }
+    if (!serial->isOpen()) {
+        QMessageBox::critical(this, "Not connected", "Please connect a device to profile its RAM use");
+        return;
+    }
+    ui->resultText->clear();
+    task = new stk500ProfileRam(&profile, ui->runTimeBox->value());
+    serial->execute(*task, true);
+    updateButtons();
+}
+
+/* Cancels profiling and waits for the task to finish, it refers to the profile */
+void RamProfileDialog::stopProfiling() {
+    if (task == NULL) {
+        return;
+    }
+    // Let go of the task first, so serialTaskFinished does not delete it while waiting
+    stk500ProfileRam *stopped = task;
+    task = NULL;
+    serial->cancelAndWait(stopped);
+    delete stopped;
+}
+
+void RamProfileDialog::serialTaskFinished(stk500Task *task) {
+    if (task != this->task) return;
+    if (task->hasError()) {
+        QMessageBox::critical(this, "Profiling failed", task->getErrorMessage());
+    } else if (task->isSuccessful() && profile.isAnalyzed()) {
+        ui->resultText->setPlainText(profile.report());
+    }
+    delete this->task;
+    this->task = NULL;
+    ui->progressBar->setValue(0);
+    ui->statusLabel->setText("Finished");
+    updateButtons();
+}
+
+void RamProfileDialog::refresh() {
+    if (task != NULL) {
+        ui->progressBar->setValue((int) (qMax(0.0, task->progress()) * ui->progressBar->maximum()));
+        ui->statusLabel->setText(task->status());
+    }
+}
+
+void RamProfileDialog::closeEvent(QCloseEvent *event) {
+    stopProfiling();
+    updateButtons();
+    event->accept();
+}
@@ -0,0 +1,42 @@
+#ifndef RAMPROFILEDIALOG_H
+#define RAMPROFILEDIALOG_H
+
+#include <QDialog>
+#include <QTimer>
+#include "../stk500/stk500serial.h"
+
+// Interval (in ms) at which the profiling progress is refreshed
+#define RAM_PROFILE_REFRESH_INTERVAL 100
+
+namespace Ui {
+class RamProfileDialog;
+}
+
+class RamProfileDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit RamProfileDialog(stk500Serial *serial, QWidget *parent = 0);
+    ~RamProfileDialog();
+
+private slots:
+    void serialTaskFinished(stk500Task *task);
+    void refresh();
+    void on_browseButton_clicked();
+    void on_startButton_clicked();
+
+private:
+    void stopProfiling();
+    void updateButtons();
+    void closeEvent(QCloseEvent *event);
+
+    Ui::RamProfileDialog *ui;
+    stk500Serial *serial;
+    stk500RamProfile profile;
+    stk500ProfileRam *task;
+    bool hasSymbols;
+    QTimer refreshTimer;
+};
+
+#endif // RAMPROFILEDIALOG_H
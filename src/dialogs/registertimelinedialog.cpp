@@ -0,0 +1,144 @@
+#include "registertimelinedialog.h"
+#include "ui_registertimelinedialog.h"
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QDateTime>
+
+RegisterTimelineDialog::RegisterTimelineDialog(const stk500RegisterLog &log, QWidget *parent) :
+    QDialog(parent, Qt::WindowSystemMenuHint | Qt::WindowTitleHint | Qt::WindowCloseButtonHint),
+    ui(new Ui::RegisterTimelineDialog)
+{
+    ui->setupUi(this);
+    this->log = log;
+    setupSliders();
+}
+
+RegisterTimelineDialog::~RegisterTimelineDialog()
+{
+    delete ui;
+}
+
+void RegisterTimelineDialog::setupSliders() {
+    int last = qMax(0, log.count() - 1);
+    ui->fromSlider->blockSignals(true);
+    ui->toSlider->blockSignals(true);
+    ui->fromSlider->setRange(0, last);
+    ui->toSlider->setRange(0, last);
+    ui->fromSlider->setValue(qMax(0, last - 1));
+    ui->toSlider->setValue(last);
+    ui->fromSlider->blockSignals(false);
+    ui->toSlider->blockSignals(false);
+    ui->saveButton->setEnabled(log.count() > 0);
+    refresh();
+}
+
+QString RegisterTimelineDialog::timeText(int index) {
+    if (log.count() == 0) {
+        return "No states recorded";
+    }
+    qint64 time = log.time(index);
+    double offset = (double) (time - log.time(0)) / 1000.0;
+    return QString("State %1 of %2: %3 (+%4s)").arg(index + 1).arg(log.count())
+            .arg(QDateTime::fromMSecsSinceEpoch(time).toString("HH:mm:ss.zzz"))
+            .arg(offset, 0, 'f', 3);
+}
+
+QString RegisterTimelineDialog::pinStateText(const quint8 *regData, const PinMapInfo &info) {
+    int mask = info.addr_mask;
+    return QString("%1, %2, %3")
+            .arg((regData[info.addr_pin] & mask) ? "High" : "Low")
+            .arg((regData[info.addr_ddr] & mask) ? "Output" : "Input")
+            .arg((regData[info.addr_port] & mask) ? "High" : "Low");
+}
+
+void RegisterTimelineDialog::refresh() {
+    ui->fromLabel->setText(timeText(ui->fromSlider->value()));
+    ui->toLabel->setText(timeText(ui->toSlider->value()));
+
+    quint8 fromData[CHIPREG_BUFFSIZE];
+    quint8 toData[CHIPREG_BUFFSIZE];
+    log.stateAt(ui->fromSlider->value(), fromData);
+    log.stateAt(ui->toSlider->value(), toData);
+
+    // List all registers that differ
+    QTableWidget *tab = ui->registerDiffTable;
+    tab->setRowCount(0);
+    for (int addr = CHIPREG_ADDR_START; addr < CHIPREG_BUFFSIZE; addr++) {
+        if (fromData[addr] == toData[addr]) {
+            continue;
+        }
+        const ChipRegisterInfo &info = reg.info(addr);
+        QStringList changedBits;
+        for (int bit = 7; bit >= 0; bit--) {
+            if ((fromData[addr] ^ toData[addr]) & (1 << bit)) {
+                QString bitName = info.bitNames[bit];
+                changedBits.append(((bitName == "0") || (bitName == "1") || (bitName == "-")) ? QString::number(bit) : bitName);
+            }
+        }
+        int row = tab->rowCount();
+        tab->insertRow(row);
+        tab->setItem(row, 0, new QTableWidgetItem(info.address));
+        tab->setItem(row, 1, new QTableWidgetItem(info.name));
+        tab->setItem(row, 2, new QTableWidgetItem(stk500::getHexText(fromData[addr])));
+        tab->setItem(row, 3, new QTableWidgetItem(stk500::getHexText(toData[addr])));
+        tab->setItem(row, 4, new QTableWidgetItem(changedBits.join(" ")));
+    }
+
+    // List all pins of which the input, mode or output differs
+    tab = ui->pinDiffTable;
+    tab->setRowCount(0);
+    QStringList ports;
+    const QList<PinMapInfo> &pinmap = reg.pinmap();
+    for (int i = 0; i < pinmap.count(); i++) {
+        const PinMapInfo &info = pinmap[i];
+        if ((info.addr_pin == -1) || ports.contains(info.port)) {
+            continue;
+        }
+        ports.append(info.port);
+        QString fromText = pinStateText(fromData, info);
+        QString toText = pinStateText(toData, info);
+        if (fromText == toText) {
+            continue;
+        }
+        int row = tab->rowCount();
+        tab->insertRow(row);
+        tab->setItem(row, 0, new QTableWidgetItem(info.name));
+        tab->setItem(row, 1, new QTableWidgetItem(info.port));
+        tab->setItem(row, 2, new QTableWidgetItem(info.function));
+        tab->setItem(row, 3, new QTableWidgetItem(fromText));
+        tab->setItem(row, 4, new QTableWidgetItem(toText));
+    }
+}
+
+void RegisterTimelineDialog::on_fromSlider_valueChanged(int)
+{
+    refresh();
+}
+
+void RegisterTimelineDialog::on_toSlider_valueChanged(int)
+{
+    refresh();
+}
+
+void RegisterTimelineDialog::on_saveButton_clicked()
+{
+    QString filePath = QFileDialog::getSaveFileName(this, "Save register session", "registers.phnreg", "Register Sessions (*.phnreg)");
+    if (!filePath.isEmpty() && !log.save(filePath)) {
+        QMessageBox::critical(this, "Save failed", "Failed to write " + filePath);
+    }
+}
+
+void RegisterTimelineDialog::on_loadButton_clicked()
+{
+    QString filePath = QFileDialog::getOpenFileName(this, "Load register session", "", "Register Sessions (*.phnreg)");
+    if (filePath.isEmpty()) {
+        return;
+    }
+    stk500RegisterLog loaded;
+    if (!loaded.load(filePath)) {
+        QMessageBox::critical(this, "Load failed", "Failed to read a register session from " + filePath);
+        return;
+    }
+    log = loaded;
+    setupSliders();
+}
@@ -0,0 +1,40 @@
+#ifndef REGISTERTIMELINEDIALOG_H
+#define REGISTERTIMELINEDIALOG_H
+
+#include <QDialog>
+#include "../stk500/stk500registerlog.h"
+
+namespace Ui {
+class RegisterTimelineDialog;
+}
+
+/*
+ * Scrubs through a recorded register session, showing the registers and pins
+ * that differ between the two points in time selected
+ */
+class RegisterTimelineDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit RegisterTimelineDialog(const stk500RegisterLog &log, QWidget *parent = 0);
+    ~RegisterTimelineDialog();
+
+private slots:
+    void on_fromSlider_valueChanged(int value);
+    void on_toSlider_valueChanged(int value);
+    void on_saveButton_clicked();
+    void on_loadButton_clicked();
+
+private:
+    void setupSliders();
+    void refresh();
+    QString timeText(int index);
+    static QString pinStateText(const quint8 *regData, const PinMapInfo &info);
+
+    Ui::RegisterTimelineDialog *ui;
+    stk500RegisterLog log;
+    ChipRegisters reg;
+};
+
+#endif // REGISTERTIMELINEDIALOG_H
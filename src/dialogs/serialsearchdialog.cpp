@@ -0,0 +1,139 @@
+#include "serialsearchdialog.h"
+#include "ui_serialsearchdialog.h"
+#include "../stk500/stk500.h"
+#include <QElapsedTimer>
+#include <QDateTime>
+
+SerialSearchDialog::SerialSearchDialog(stk500SerialIndex *index, QWidget *parent) :
+    QDialog(parent, Qt::WindowSystemMenuHint | Qt::WindowTitleHint | Qt::WindowCloseButtonHint),
+    ui(new Ui::SerialSearchDialog)
+{
+    ui->setupUi(this);
+
+    this->index = index;
+    this->lastMatch = -1;
+    this->logStartTime = -1;
+
+    connect(index, SIGNAL(indexUpdated()), this, SLOT(indexUpdated()), Qt::QueuedConnection);
+    indexUpdated();
+}
+
+SerialSearchDialog::~SerialSearchDialog()
+{
+    delete ui;
+}
+
+void SerialSearchDialog::indexUpdated() {
+    stk500SerialLog *log = index->log();
+
+    // When the log is cleared or started, start searching from the beginning
+    qint64 startTime = log->startTime();
+    if (startTime != logStartTime) {
+        logStartTime = startTime;
+        lastMatch = -1;
+        QDateTime time = (startTime == 0) ? QDateTime::currentDateTime() : QDateTime::fromMSecsSinceEpoch(startTime);
+        ui->timeEdit->setDateTime(time);
+    }
+
+    ui->indexLabel->setText(QString("Indexed %1 of %2")
+                            .arg(stk500::getSizeText(index->indexedSize()))
+                            .arg(stk500::getSizeText(log->size())));
+}
+
+QRegularExpression SerialSearchDialog::searchExpression() {
+    QString pattern = ui->searchEdit->text();
+    if (!ui->regexCheck->isChecked()) {
+        pattern = QRegularExpression::escape(pattern);
+    }
+    QRegularExpression regex(pattern);
+    if (!ui->caseCheck->isChecked()) {
+        regex.setPatternOptions(QRegularExpression::CaseInsensitiveOption);
+    }
+    return regex;
+}
+
+void SerialSearchDialog::showMatch(qint64 offset) {
+    if (offset == -1) {
+        ui->statusLabel->setText("No more matches found");
+        return;
+    }
+    lastMatch = offset;
+    QDateTime time = QDateTime::fromMSecsSinceEpoch(index->log()->timeAt(offset));
+    ui->statusLabel->setText(QString("Match received at %1").arg(time.toString("hh:mm:ss.zzz")));
+    emit jumpToOffset(offset);
+}
+
+void SerialSearchDialog::on_findNextButton_clicked()
+{
+    if (ui->searchEdit->text().isEmpty()) {
+        return;
+    }
+    qint64 offset;
+    if (ui->regexCheck->isChecked()) {
+        QList<SerialLogMatch> matches = index->findLines(searchExpression(), lastMatch + 1, 1);
+        offset = matches.isEmpty() ? -1 : matches.first().offset;
+    } else {
+        offset = index->find(ui->searchEdit->text(), lastMatch + 1, true, ui->caseCheck->isChecked());
+    }
+    showMatch(offset);
+}
+
+void SerialSearchDialog::on_findPrevButton_clicked()
+{
+    if (ui->searchEdit->text().isEmpty()) {
+        return;
+    }
+    qint64 from = (lastMatch == -1) ? index->indexedSize() : lastMatch;
+    showMatch(index->find(ui->searchEdit->text(), from, false, ui->caseCheck->isChecked()));
+}
+
+void SerialSearchDialog::on_filterButton_clicked()
+{
+    QRegularExpression regex = searchExpression();
+    if (!regex.isValid()) {
+        ui->statusLabel->setText("Invalid expression: " + regex.errorString());
+        return;
+    }
+
+    // Find all matching lines and list them with the time they were received
+    QElapsedTimer timer;
+    timer.start();
+    QList<SerialLogMatch> matches = index->findLines(regex, 0, SERIAL_SEARCH_MAX_RESULTS);
+    qint64 elapsed = timer.elapsed();
+
+    ui->resultList->clear();
+    for (int i = 0; i < matches.count(); i++) {
+        const SerialLogMatch &match = matches[i];
+        QDateTime time = QDateTime::fromMSecsSinceEpoch(index->log()->timeAt(match.offset));
+        QListWidgetItem *item = new QListWidgetItem(time.toString("[hh:mm:ss.zzz] ") + match.text);
+        item->setData(Qt::UserRole, match.offset);
+        ui->resultList->addItem(item);
+    }
+
+    QString status = QString("%1 matching lines found in %2 ms").arg(matches.count()).arg(elapsed);
+    if (matches.count() >= SERIAL_SEARCH_MAX_RESULTS) {
+        status += " (limit reached)";
+    }
+    ui->statusLabel->setText(status);
+}
+
+void SerialSearchDialog::on_jumpButton_clicked()
+{
+    qint64 offset = index->log()->offsetAt(ui->timeEdit->dateTime().toMSecsSinceEpoch());
+    lastMatch = offset - 1;
+    ui->statusLabel->setText("");
+    emit jumpToOffset(offset);
+}
+
+void SerialSearchDialog::on_regexCheck_toggled(bool checked)
+{
+    // Searching backwards is only supported for plain text
+    ui->findPrevButton->setEnabled(!checked);
+}
+
+void SerialSearchDialog::on_resultList_itemActivated(QListWidgetItem *item)
+{
+    qint64 offset = item->data(Qt::UserRole).toLongLong();
+    lastMatch = offset;
+    emit jumpToOffset(offset);
+}
@@ -0,0 +1,45 @@
+#ifndef SERIALSEARCHDIALOG_H
+#define SERIALSEARCHDIALOG_H
+
+#include <QDialog>
+#include <QListWidgetItem>
+#include "../stk500/stk500serialindex.h"
+
+// Maximum amount of matching lines listed when filtering
+#define SERIAL_SEARCH_MAX_RESULTS 10000
+
+namespace Ui {
+class SerialSearchDialog;
+}
+
+class SerialSearchDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit SerialSearchDialog(stk500SerialIndex *index, QWidget *parent = 0);
+    ~SerialSearchDialog();
+
+signals:
+    void jumpToOffset(qint64 offset);
+
+private slots:
+    void indexUpdated();
+    void on_findNextButton_clicked();
+    void on_findPrevButton_clicked();
+    void on_filterButton_clicked();
+    void on_jumpButton_clicked();
+    void on_regexCheck_toggled(bool checked);
+    void on_resultList_itemActivated(QListWidgetItem *item);
+
+private:
+    QRegularExpression searchExpression();
+    void showMatch(qint64 offset);
+
+    Ui::SerialSearchDialog *ui;
+    stk500SerialIndex *index;
+    qint64 lastMatch;
+    qint64 logStartTime;
+};
+
+#endif // SERIALSEARCHDIALOG_H
@@ -460,6 +460,40 @@ void PHNImage::setPixel(int x, int y, QColor color) {
     this->onChanged();
 }
 
+/* Copies an area of a (true color) image into this image in one go */
+void PHNImage::drawImage(const QImage &image, const QRect &rect) {
+    // No image? Don't do anything at all.
+    if (isNull()) return;
+
+    QRect area = rect.intersected(QRect(0, 0, quant.width, quant.height)).intersected(image.rect());
+    if (area.isEmpty()) return;
+
+    // Colormapped images need every color looked up
+    if (!this->quant.trueColor || (this->destImageFormat == LCD16)) {
+        for (int y = area.top(); y <= area.bottom(); y++) {
+            for (int x = area.left(); x <= area.right(); x++) {
+                setPixel(x, y, QColor(image.pixel(x, y)));
+            }
+        }
+        return;
+    }
+
+    // True color 24-bit: directly apply the colors
+    for (int y = area.top(); y <= area.bottom(); y++) {
+        const QRgb* line = (const QRgb*) image.constScanLine(y);
+        for (int x = area.left(); x <= area.right(); x++) {
+            this->quant.pixels[x][y].rgb = line[x];
+        }
+    }
+
+    // Update the pixmap with the area
+    QPainter painter(&_pixmap);
+    painter.drawImage(area.topLeft(), image, area);
+    painter.end();
+
+    this->onChanged();
+}
+
 QColor PHNImage::pixel(int x, int y) {
     Quantize::Pixel &p = quant.pixels[x][y];
     if (!quant.trueColor) {
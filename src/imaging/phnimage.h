@@ -54,6 +54,7 @@ public:
     int getColorCount() { return quant.colors; }
     void setColor(int index, QColor color);
     void setPixel(int x, int y, QColor color);
+    void drawImage(const QImage &image, const QRect &rect);
     QColor pixel(int x, int y);
     void fill(QColor color);
 
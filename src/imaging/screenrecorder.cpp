@@ -0,0 +1,353 @@
+#include "screenrecorder.h"
+#include <QDataStream>
+#include <QFileInfo>
+#include <QHash>
+#include <string.h>
+
+// Palette index of a color in the 3-3-2 palette used for GIF recordings
+static inline uchar color565_to_gif(quint16 c) {
+    return (uchar) ((((c >> 13) & 0x7) << 5) | (((c >> 8) & 0x7) << 2) | ((c >> 3) & 0x3));
+}
+
+/*
+ * LZW-compresses palette indices the way GIF stores them
+ * Minimal code size is 8, the table is cleared as soon as it is full
+ */
+static QByteArray gifCompress(const QByteArray &indices) {
+    const int clearCode = 256;
+    const int endCode = 257;
+    QByteArray output;
+    QHash<int, int> table;
+    int codeSize = 9;
+    int maxCode = endCode;
+    quint32 bitBuffer = 0;
+    int bitCount = 0;
+
+#define GIF_WRITE_CODE(code) { \
+        bitBuffer |= ((quint32) (code) << bitCount); \
+        bitCount += codeSize; \
+        while (bitCount >= 8) { \
+            output.append((char) (bitBuffer & 0xFF)); \
+            bitBuffer >>= 8; \
+            bitCount -= 8; \
+        } \
+    }
+
+    GIF_WRITE_CODE(clearCode);
+    if (!indices.isEmpty()) {
+        int curCode = (uchar) indices[0];
+        for (int i = 1; i < indices.length(); i++) {
+            int next = (uchar) indices[i];
+            int key = (curCode << 8) | next;
+            QHash<int, int>::const_iterator found = table.constFind(key);
+            if (found != table.constEnd()) {
+                curCode = found.value();
+                continue;
+            }
+
+            GIF_WRITE_CODE(curCode);
+            table.insert(key, ++maxCode);
+            if (maxCode >= (1 << codeSize)) {
+                codeSize++;
+            }
+            if (maxCode == 4095) {
+                GIF_WRITE_CODE(clearCode);
+                table.clear();
+                codeSize = 9;
+                maxCode = endCode;
+            }
+            curCode = next;
+        }
+        GIF_WRITE_CODE(curCode);
+
+        // The decoder adds one more entry reading the last code, which can grow the code size
+        if ((maxCode > endCode) && ((maxCode + 1) >= (1 << codeSize)) && (codeSize < 12)) {
+            codeSize++;
+        }
+    }
+    GIF_WRITE_CODE(endCode);
+    if (bitCount > 0) {
+        output.append((char) (bitBuffer & 0xFF));
+    }
+
+#undef GIF_WRITE_CODE
+    return output;
+}
+
+ScreenRecorder::ScreenRecorder(QObject *parent) :
+    QThread(parent)
+{
+    this->stopRequested = true;
+    this->hasPendingFrame = false;
+    this->dropFrames = true;
+    this->format = RAW565;
+}
+
+ScreenRecorder::~ScreenRecorder() {
+    stopRecording();
+}
+
+bool ScreenRecorder::startRecording(const QString &filePath, Format format) {
+    if (isRunning()) {
+        return false;
+    }
+    this->format = format;
+    this->filePath = filePath;
+    this->hasPendingFrame = false;
+    this->droppedRect = QRect();
+    this->recordedCount.store(0);
+    this->skippedCount.store(0);
+    this->droppedCount.store(0);
+    memset(screen, 0, sizeof(screen));
+
+    if (format == PNG_SEQUENCE) {
+        // Images are stored next to each other, timestamps in a separate listing
+        QFileInfo info(filePath);
+        this->filePath = info.path() + "/" + info.completeBaseName();
+        indexFile.setFileName(this->filePath + "_frames.txt");
+        if (!indexFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            return false;
+        }
+    } else {
+        file.setFileName(filePath);
+        if (!file.open(QIODevice::WriteOnly)) {
+            return false;
+        }
+        if (format == ANIMATED_GIF) {
+            writeGifHeader();
+        } else {
+            file.write("PHNSCR01", 8);
+            QDataStream stream(&file);
+            stream.setByteOrder(QDataStream::LittleEndian);
+            stream << (quint16) SCREEN_WIDTH << (quint16) SCREEN_HEIGHT;
+        }
+    }
+
+    stopRequested = false;
+    start();
+    return true;
+}
+
+void ScreenRecorder::stopRecording() {
+    lock.lock();
+    stopRequested = true;
+    cond.wakeOne();
+    spaceCond.wakeAll();
+    lock.unlock();
+    wait();
+}
+
+/* Called by the screen decoder with the area changed since the last frame */
+void ScreenRecorder::screenFrame(qint64 time, const QRect &dirtyRect, const quint16* framebuffer) {
+    lock.lock();
+    while (!dropFrames && !stopRequested && (frames.count() >= SCREEN_RECORD_MAX_QUEUED)) {
+        spaceCond.wait(&lock);
+    }
+    if (stopRequested) {
+        // Not recording
+    } else if (frames.count() >= SCREEN_RECORD_MAX_QUEUED) {
+        // The area is recorded along with the next frame, so the recorded screen stays intact
+        droppedRect = droppedRect.united(dirtyRect);
+        droppedCount.ref();
+    } else {
+        ScreenRecordFrame frame;
+        frame.time = time;
+        frame.rect = dirtyRect.united(droppedRect);
+        droppedRect = QRect();
+        frame.pixels.resize(frame.rect.width() * frame.rect.height());
+        quint16* dest = frame.pixels.data();
+        for (int y = frame.rect.top(); y <= frame.rect.bottom(); y++) {
+            memcpy(dest, framebuffer + y * SCREEN_WIDTH + frame.rect.left(), frame.rect.width() * sizeof(quint16));
+            dest += frame.rect.width();
+        }
+        frames.enqueue(frame);
+        cond.wakeOne();
+    }
+    lock.unlock();
+}
+
+void ScreenRecorder::run() {
+    while (true) {
+        lock.lock();
+        while (frames.isEmpty() && !stopRequested) {
+            cond.wait(&lock);
+        }
+        if (frames.isEmpty()) {
+            lock.unlock();
+            break;
+        }
+        ScreenRecordFrame frame = frames.dequeue();
+        spaceCond.wakeAll();
+        lock.unlock();
+
+        if (applyFrame(frame)) {
+            writeFrame(frame);
+            recordedCount.ref();
+        } else {
+            skippedCount.ref();
+        }
+    }
+    finish();
+}
+
+/*
+ * Applies a frame to the recorded screen, and reduces it to the pixels that actually changed
+ * Returns false if no pixels changed at all
+ */
+bool ScreenRecorder::applyFrame(ScreenRecordFrame &frame) {
+    ScreenDirtyArea changed;
+    changed.clear();
+    const quint16* src = frame.pixels.constData();
+    for (int y = frame.rect.top(); y <= frame.rect.bottom(); y++) {
+        quint16* dest = screen + y * SCREEN_WIDTH;
+        for (int x = frame.rect.left(); x <= frame.rect.right(); x++) {
+            if (dest[x] != *src) {
+                dest[x] = *src;
+                changed.include(x, y);
+            }
+            src++;
+        }
+    }
+    if (changed.isEmpty()) {
+        return false;
+    }
+
+    frame.rect = changed.rect();
+    frame.pixels.resize(frame.rect.width() * frame.rect.height());
+    quint16* dest = frame.pixels.data();
+    for (int y = frame.rect.top(); y <= frame.rect.bottom(); y++) {
+        memcpy(dest, screen + y * SCREEN_WIDTH + frame.rect.left(), frame.rect.width() * sizeof(quint16));
+        dest += frame.rect.width();
+    }
+    return true;
+}
+
+void ScreenRecorder::writeFrame(const ScreenRecordFrame &frame) {
+    switch (format) {
+    case PNG_SEQUENCE:
+        writePNG(frame);
+        break;
+    case RAW565:
+        writeRaw(frame);
+        break;
+    case ANIMATED_GIF:
+        // The time a frame is shown is only known once the next frame is there
+        if (hasPendingFrame) {
+            writeGifFrame(pendingFrame, frame.time - pendingFrame.time);
+        }
+        pendingFrame = frame;
+        if (!hasPendingFrame) {
+            // First frame always covers the full screen
+            pendingFrame.rect = QRect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+            pendingFrame.pixels = QVector<quint16>(SCREEN_WIDTH * SCREEN_HEIGHT);
+            memcpy(pendingFrame.pixels.data(), screen, sizeof(screen));
+            hasPendingFrame = true;
+        }
+        break;
+    }
+}
+
+void ScreenRecorder::writePNG(const ScreenRecordFrame &frame) {
+    QImage image(SCREEN_WIDTH, SCREEN_HEIGHT, QImage::Format_ARGB32);
+    const quint32* table = stk500ScreenDecoder::colorTable();
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        quint32* dest = (quint32*) image.scanLine(y);
+        const quint16* src = screen + y * SCREEN_WIDTH;
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            dest[x] = table[src[x]];
+        }
+    }
+    QString imageName = QString("%1_%2.png").arg(filePath).arg(recordedCount.load(), 6, 10, QChar('0'));
+    image.save(imageName, "PNG");
+    indexFile.write(QString("%1 %2\n").arg(QFileInfo(imageName).fileName()).arg(frame.time).toLatin1());
+}
+
+/*
+ * Every frame is stored as: time (ms), keyframe flag, x, y, width, height and the pixels.
+ * Keyframes hold the full screen, other frames only the area that changed.
+ */
+void ScreenRecorder::writeRaw(const ScreenRecordFrame &frame) {
+    bool isKeyframe = ((recordedCount.load() % SCREEN_RECORD_KEYFRAME_INTERVAL) == 0);
+    QRect rect = isKeyframe ? QRect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT) : frame.rect;
+
+    QDataStream stream(&file);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream << (qint64) frame.time << (quint8) (isKeyframe ? 1 : 0);
+    stream << (quint16) rect.x() << (quint16) rect.y() << (quint16) rect.width() << (quint16) rect.height();
+    if (isKeyframe) {
+        file.write((const char*) screen, sizeof(screen));
+    } else {
+        file.write((const char*) frame.pixels.constData(), frame.pixels.count() * sizeof(quint16));
+    }
+}
+
+void ScreenRecorder::writeGifHeader() {
+    QByteArray header("GIF89a");
+    header.append((char) (SCREEN_WIDTH & 0xFF)).append((char) (SCREEN_WIDTH >> 8));
+    header.append((char) (SCREEN_HEIGHT & 0xFF)).append((char) (SCREEN_HEIGHT >> 8));
+    header.append((char) 0xF7);  // Global color table of 256 colors
+    header.append((char) 0x00);  // Background color
+    header.append((char) 0x00);  // Pixel aspect ratio
+
+    // Fixed palette with 3 bits red, 3 bits green and 2 bits blue
+    for (int i = 0; i < 256; i++) {
+        header.append((char) (((i >> 5) & 0x7) * 255 / 7));
+        header.append((char) (((i >> 2) & 0x7) * 255 / 7));
+        header.append((char) ((i & 0x3) * 255 / 3));
+    }
+
+    // Loop the animation forever
+    header.append("\x21\xFF\x0B" "NETSCAPE2.0" "\x03\x01\x00\x00\x00", 19);
+    file.write(header);
+}
+
+void ScreenRecorder::writeGifFrame(const ScreenRecordFrame &frame, qint64 duration) {
+    int delay = (int) qBound((qint64) 0, (duration + 5) / 10, (qint64) 0xFFFF);
+    QByteArray block;
+
+    // Graphic control: keep the previous frame as background, show this frame for a time
+    block.append("\x21\xF9\x04\x04", 4);
+    block.append((char) (delay & 0xFF)).append((char) (delay >> 8));
+    block.append("\x00\x00", 2);
+
+    // Image descriptor holding only the area changed
+    block.append((char) 0x2C);
+    int values[4] = {frame.rect.x(), frame.rect.y(), frame.rect.width(), frame.rect.height()};
+    for (int i = 0; i < 4; i++) {
+        block.append((char) (values[i] & 0xFF)).append((char) (values[i] >> 8));
+    }
+    block.append((char) 0x00);
+    file.write(block);
+
+    QByteArray indices;
+    indices.resize(frame.pixels.count());
+    for (int i = 0; i < frame.pixels.count(); i++) {
+        indices[i] = (char) color565_to_gif(frame.pixels[i]);
+    }
+    writeGifData(indices);
+}
+
+void ScreenRecorder::writeGifData(const QByteArray &indices) {
+    QByteArray data = gifCompress(indices);
+    QByteArray block;
+    block.append((char) 8);  // Minimal code size
+    for (int i = 0; i < data.length(); i += 255) {
+        int len = qMin(255, data.length() - i);
+        block.append((char) len);
+        block.append(data.constData() + i, len);
+    }
+    block.append((char) 0);
+    file.write(block);
+}
+
+void ScreenRecorder::finish() {
+    if (format == ANIMATED_GIF) {
+        if (hasPendingFrame) {
+            writeGifFrame(pendingFrame, SCREEN_RECORD_LAST_DELAY);
+            hasPendingFrame = false;
+        }
+        file.write("\x3B", 1);
+    }
+    file.close();
+    indexFile.close();
+}
@@ -0,0 +1,83 @@
+#ifndef SCREENRECORDER_H
+#define SCREENRECORDER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QFile>
+#include "../stk500/stk500screendecoder.h"
+
+#define SCREEN_RECORD_MAX_QUEUED         120   // Frames queued for encoding before new frames are dropped
+#define SCREEN_RECORD_KEYFRAME_INTERVAL   60   // Amount of frames between two full frames in raw recordings
+#define SCREEN_RECORD_LAST_DELAY         100   // Time (in ms) the last frame of an animation is shown
+
+// A single frame waiting to be encoded, holding only the changed area
+typedef struct ScreenRecordFrame {
+    qint64 time;
+    QRect rect;
+    QVector<quint16> pixels;
+} ScreenRecordFrame;
+
+/*
+ * Records the frames of screen share to disk
+ *
+ * Frames are received from the screen decoder and queued, encoding is done
+ * on a separate thread so decoding never waits for the disk. Frames without
+ * any pixels changed are skipped. Supported formats are a sequence of PNG
+ * images, an animated GIF and raw RGB565 frames with their timestamps. The
+ * GIF and raw formats only store the area changed between frames.
+ * When recording offline, frames can wait for room instead of being dropped.
+ */
+class ScreenRecorder : public QThread, public stk500ScreenSink
+{
+    Q_OBJECT
+
+public:
+    enum Format { PNG_SEQUENCE, ANIMATED_GIF, RAW565 };
+
+    ScreenRecorder(QObject *parent = 0);
+    ~ScreenRecorder();
+    bool startRecording(const QString &filePath, Format format);
+    void stopRecording();
+    void setDropFrames(bool drop) { dropFrames = drop; }
+    bool isRecording() { return isRunning(); }
+    int framesRecorded() { return recordedCount.load(); }
+    int framesSkipped() { return skippedCount.load(); }
+    int framesDropped() { return droppedCount.load(); }
+    virtual void screenFrame(qint64 time, const QRect &dirtyRect, const quint16* framebuffer);
+
+protected:
+    void run();
+
+private:
+    bool applyFrame(ScreenRecordFrame &frame);
+    void writeFrame(const ScreenRecordFrame &frame);
+    void writePNG(const ScreenRecordFrame &frame);
+    void writeRaw(const ScreenRecordFrame &frame);
+    void writeGifHeader();
+    void writeGifFrame(const ScreenRecordFrame &frame, qint64 duration);
+    void writeGifData(const QByteArray &indices);
+    void finish();
+
+    QMutex lock;
+    QWaitCondition cond;
+    QWaitCondition spaceCond;
+    QQueue<ScreenRecordFrame> frames;
+    QRect droppedRect;  // Area changed by frames that were dropped, added to the next frame queued
+    volatile bool stopRequested;
+    volatile bool dropFrames;
+    QAtomicInt recordedCount;
+    QAtomicInt skippedCount;
+    QAtomicInt droppedCount;
+
+    Format format;
+    QString filePath;
+    QFile file;
+    QFile indexFile;
+    quint16 screen[SCREEN_WIDTH * SCREEN_HEIGHT];
+    bool hasPendingFrame;
+    ScreenRecordFrame pendingFrame;
+};
+
+#endif // SCREENRECORDER_H
@@ -1,7 +1,10 @@
 #include "mainwindow.h"
+#include "imaging/screenrecorder.h"
 #include <QApplication>
 #include <QCommandLineParser>
 #include <QFontDatabase>
+#include <QFileInfo>
+#include <QThread>
 
 int main(int argc, char *argv[])
 {
@@ -27,6 +30,18 @@ int main(int argc, char *argv[])
     QCommandLineOption skiFormat("ski", "Convert image into SKI (headerless 1-bit LCD) format");
     parser.addOption(skiFormat);
 
+    // Option to decode a captured screen share stream (--screen)
+    QCommandLineOption screenDecodeOption("screen", "Decode captured screen share data into a PNG image of the last frame, or a GIF/RAW recording");
+    parser.addOption(screenDecodeOption);
+
+    // Option to run a test sequence on a connected device, writing JUnit XML results (--test)
+    QCommandLineOption testSequenceOption("test", "Run a test sequence on the device connected to the port, and write the results as JUnit XML");
+    parser.addOption(testSequenceOption);
+
+    // Port the device to test is connected to (--port)
+    QCommandLineOption portOption("port", "Serial port of the device", "port");
+    parser.addOption(portOption);
+
     // Process the actual command line arguments given by the user
     parser.process(app);
 
@@ -55,11 +70,117 @@ int main(int argc, char *argv[])
     if (parser.isSet(firmwareVersionOption)) {
         QString source = args.at(0);
         ProgramData program;
-        program.loadFile(source);
+        if (!program.loadFile(source)) {
+            printf("%s\n", program.errorMessage().toStdString().c_str());
+            return 1;
+        }
         printf(program.firmwareVersion().toStdString().c_str());
         return 0;
     }
 
+    // Decode screen share data as if received at 115200 baud, and store the result
+    if (parser.isSet(screenDecodeOption)) {
+        QString source = args.at(0);
+        QString dest = args.at(1);
+        QFile sourceFile(source);
+        if (!sourceFile.open(QIODevice::ReadOnly)) {
+            printf("Failed to open %s\n", source.toStdString().c_str());
+            return 1;
+        }
+
+        stk500ScreenDecoder decoder;
+        ScreenRecorder recorder;
+        QString suffix = QFileInfo(dest).suffix().toLower();
+        bool recording = (suffix == "gif") || (suffix == "raw");
+        if (recording) {
+            recorder.setDropFrames(false);
+            if (!recorder.startRecording(dest, (suffix == "gif") ? ScreenRecorder::ANIMATED_GIF : ScreenRecorder::RAW565)) {
+                printf("Failed to create %s\n", dest.toStdString().c_str());
+                return 1;
+            }
+            decoder.setSink(&recorder);
+        }
+
+        // Every frame interval, the amount of bytes transferred at 115200 baud is decoded
+        const int chunkSize = 115200 / 10 * SCREEN_FRAME_INTERVAL / 1000;
+        qint64 time = 0;
+        while (!sourceFile.atEnd()) {
+            QByteArray data = sourceFile.read(chunkSize);
+            decoder.decode(data.data(), data.length());
+            time += SCREEN_FRAME_INTERVAL;
+            decoder.publishToSink(time);
+        }
+        if (decoder.isExtended()) {
+            printf("Extended stream negotiated\n");
+        }
+
+        if (recording) {
+            recorder.stopRecording();
+            printf("%d frames recorded, %d unchanged frames skipped\n",
+                   recorder.framesRecorded(), recorder.framesSkipped());
+        } else {
+            QImage image;
+            QRect dirtyRect;
+            decoder.takeFrame(image, dirtyRect);
+            if (!image.save(dest)) {
+                printf("Failed to save %s\n", dest.toStdString().c_str());
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    // Run the test sequence on the device, print the results and exit with 0 when all passed
+    if (parser.isSet(testSequenceOption)) {
+        QString source = args.at(0);
+        QString dest = (args.count() > 1) ? args.at(1) : QString();
+        QString portName = parser.value(portOption);
+        stk500TestSequence sequence;
+        if (!sequence.load(source)) {
+            printf("%s\n", sequence.errorMessage().toStdString().c_str());
+            return 1;
+        }
+        if (portName.isEmpty()) {
+            printf("No port specified, use --port\n");
+            return 1;
+        }
+
+        stk500Serial serial(NULL);
+        stk500RunTestSequence task(&sequence);
+        serial.open(portName);
+        serial.execute(task, true);
+        while (!task.isFinished() && serial.isOpen()) {
+            QThread::msleep(1);
+        }
+        serial.close();
+        if (!task.isFinished()) {
+            printf("Failed to open port %s\n", portName.toStdString().c_str());
+            return 1;
+        }
+        if (task.hasError()) {
+            printf("%s\n", task.getErrorMessage().toStdString().c_str());
+        }
+
+        QList<TestCase> &tests = sequence.testCases();
+        for (int i = 0; i < tests.count(); i++) {
+            const TestCase &test = tests[i];
+            QString result = !test.error.isEmpty() ? "ERROR" : !test.failures.isEmpty() ? "FAIL" :
+                             test.skipped ? "SKIP" : "PASS";
+            printf("%-5s %s (%.3f s)\n", result.toStdString().c_str(), test.name.toStdString().c_str(), test.time / 1000000.0);
+            for (int j = 0; j < test.failures.count(); j++) {
+                printf("      %s\n", test.failures[j].toStdString().c_str());
+            }
+            if (!test.error.isEmpty()) {
+                printf("      %s\n", test.error.toStdString().c_str());
+            }
+        }
+        if (!dest.isEmpty() && !sequence.exportJUnit(dest)) {
+            printf("Failed to save %s\n", dest.toStdString().c_str());
+            return 1;
+        }
+        return (sequence.passed() && !task.hasError()) ? 0 : 1;
+    }
+
     // Load fonts before GUI launches
     loadFont(":/fonts/OpenSans-Regular.ttf");
     loadFont(":/fonts/Inconsolata-Regular.ttf");
@@ -661,7 +661,7 @@ void MainWindow::on_control_firmwareBtn_clicked()
     /* Select the file to open */
     QFileDialog dialog(this);
     dialog.setWindowTitle("Select the hex file to upload");
-    dialog.setNameFilter ("Intel Hex Files (*.hex)");
+    dialog.setNameFilter ("Program Files (*.hex *.elf *.bin);;Intel Hex Files (*.hex)");
     dialog.setViewMode (QFileDialog :: Detail);
     if (!dialog.exec()) {
         return;
@@ -670,7 +670,10 @@ void MainWindow::on_control_firmwareBtn_clicked()
 
     /* Load the firmware */
     ProgramData data;
-    data.loadFile(filePath);
+    if (!data.loadFile(filePath)) {
+        QMessageBox::critical(this, "Uploading", "The file could not be loaded\n\n" + data.errorMessage());
+        return;
+    }
     if (data.hasFirmwareData()) {
         QString message = QString("The hex file you selected contains device firmware\n"
                                   "Firmware version: %1\n\n"
@@ -692,6 +695,23 @@ void MainWindow::on_control_firmwareBtn_clicked()
     serial->execute(task, false, false);
 }
 
+void MainWindow::on_control_downloadBtn_clicked()
+{
+    /* Select the file to save to */
+    QString filePath = QFileDialog::getSaveFileName(this, "Save the flash contents to",
+                                                    "", "Intel Hex Files (*.hex);;Binary Files (*.bin)");
+    if (filePath.isEmpty()) {
+        return;
+    }
+
+    /* Read the flash and save it */
+    stk500ReadFlash task;
+    serial->execute(task);
+    if (task.isSuccessful() && !task.data.saveFile(filePath)) {
+        QMessageBox::critical(this, "Saving flash contents", "Failed to write " + filePath);
+    }
+}
+
 void MainWindow::on_serial_deviceMode_clicked()
 {
     QIcon icon_sketch(":/icons/serial_sketch.png");
@@ -88,6 +88,8 @@ private slots:
 
     void on_control_firmwareBtn_clicked();
 
+    void on_control_downloadBtn_clicked();
+
     void on_serial_deviceMode_clicked();
 
     void on_serial_upload_clicked();
@@ -0,0 +1,241 @@
+#include "ScreenStream.h"
+
+#define CMD_RLE      0xF0
+#define CMD_SKIP     0xF1
+#define CMD_PALETTE  0xF2
+#define CMD_SPAN     0xF3
+#define CMD_HELLO    0xFD
+
+ScreenStream::ScreenStream(Stream &port) : port(port) {
+  extended = false;
+  pixelsSelected = false;
+  runCount = 0;
+  memset(palette, 0, sizeof(palette));
+  winX0 = winY0 = curX = curY = 0;
+  winX1 = 319;
+  winY1 = 239;
+}
+
+boolean ScreenStream::begin(unsigned long timeout) {
+  while (port.available()) {
+    port.read();
+  }
+
+  // Request the extended stream, the toolkit answers with the version it agrees on
+  port.write(CMD_HELLO);
+  port.write(SCREENSTREAM_VERSION);
+  extended = false;
+  unsigned long start = millis();
+  int received = 0;
+  while ((millis() - start) < timeout) {
+    if (!port.available()) {
+      continue;
+    }
+    int value = port.read();
+    if (received == 0) {
+      received = (value == CMD_HELLO) ? 1 : 0;
+    } else {
+      extended = (value >= 1);
+      break;
+    }
+  }
+
+  setWindow(0, 0, 319, 239);
+  return extended;
+}
+
+void ScreenStream::reset() {
+  flush();
+  port.write((uint8_t) 0x00);
+  setWindow(0, 0, 319, 239);
+}
+
+void ScreenStream::setWindow(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1) {
+  flush();
+
+  // The display is mounted rotated, registers count from the opposite corner
+  writeRegister(0x03, 0x1008);
+  writeRegister(0x53, 319 - x0);
+  writeRegister(0x52, 319 - x1);
+  writeRegister(0x51, 239 - y0);
+  writeRegister(0x50, 239 - y1);
+  writeRegister(0x20, 239 - y0);
+  writeRegister(0x21, 319 - x0);
+  winX0 = curX = x0;
+  winY0 = curY = y0;
+  winX1 = x1;
+  winY1 = y1;
+}
+
+void ScreenStream::writeRun(uint16_t color, uint16_t count) {
+  if (count == 0) {
+    return;
+  }
+  advance(count);
+  if (!extended) {
+    // Repeated CGRAM write
+    selectPixels();
+    port.write(0xFE);
+    writeWord(color);
+    writeWord(count);
+    writeWord(0);
+    return;
+  }
+
+  // Runs are buffered and sent together, up to 256 pixels each
+  while (count > 0) {
+    uint16_t length = min(count, 256);
+    if (runCount == SCREENSTREAM_MAX_RUNS) {
+      flush();
+    }
+    runLength[runCount] = (uint8_t) length;
+    runColor[runCount] = color;
+    runCount++;
+    count -= length;
+  }
+}
+
+void ScreenStream::writeSkip(uint16_t count) {
+  if (count == 0) {
+    return;
+  }
+  flush();
+  advance(count);
+  if (extended) {
+    port.write(CMD_SKIP);
+    writeWord(count);
+  } else {
+    // Move the cursor past the pixels instead
+    writeRegister(0x20, 239 - curY);
+    writeRegister(0x21, 319 - curX);
+  }
+}
+
+void ScreenStream::writePixels(const uint16_t *pixels, uint16_t count) {
+  uint16_t i = 0;
+  while (i < count) {
+    uint16_t length = 1;
+    while (((i + length) < count) && (pixels[i + length] == pixels[i])) {
+      length++;
+    }
+    writeRun(pixels[i], length);
+    i += length;
+  }
+}
+
+void ScreenStream::setPalette(uint8_t index, const uint16_t *colors, uint16_t count) {
+  for (uint16_t i = 0; i < count; i++) {
+    uint8_t entry = (uint8_t) (index + i);
+    if (entry < SCREENSTREAM_PALETTE_SIZE) {
+      palette[entry] = colors[i];
+    }
+  }
+  if (!extended) {
+    return;
+  }
+  flush();
+  while (count > 0) {
+    uint16_t length = min(count, 256);
+    port.write(CMD_PALETTE);
+    port.write(index);
+    port.write((uint8_t) length);
+    for (uint16_t i = 0; i < length; i++) {
+      writeWord(colors[i]);
+    }
+    index += length;
+    colors += length;
+    count -= length;
+  }
+}
+
+void ScreenStream::writeIndexed(uint8_t bpp, const uint8_t *indices, uint16_t count) {
+  uint16_t perByte = 8 / bpp;
+  uint8_t mask = (1 << bpp) - 1;
+  if (extended) {
+    flush();
+    advance(count);
+    port.write(CMD_SPAN);
+    port.write(bpp);
+    writeWord(count);
+    port.write(indices, (count + perByte - 1) / perByte);
+    return;
+  }
+
+  // Look up the colors, combining equal pixels into runs
+  uint16_t spanColor = 0;
+  uint16_t spanLength = 0;
+  for (uint16_t i = 0; i < count; i++) {
+    uint8_t shift = 8 - bpp * (1 + (i % perByte));
+    uint8_t entry = (indices[i / perByte] >> shift) & mask;
+    uint16_t color = (entry < SCREENSTREAM_PALETTE_SIZE) ? palette[entry] : 0;
+    if (spanLength && (color != spanColor)) {
+      writeRun(spanColor, spanLength);
+      spanLength = 0;
+    }
+    spanColor = color;
+    spanLength++;
+  }
+  writeRun(spanColor, spanLength);
+}
+
+void ScreenStream::writeRow(const uint16_t *row, const uint16_t *prevRow, uint16_t count) {
+  uint16_t i = 0;
+  while (i < count) {
+    uint16_t length = 0;
+    if (prevRow) {
+      while (((i + length) < count) && (row[i + length] == prevRow[i + length])) {
+        length++;
+      }
+    }
+    if (length) {
+      writeSkip(length);
+    } else {
+      while (((i + length) < count) && (!prevRow || (row[i + length] != prevRow[i + length]))) {
+        length++;
+      }
+      writePixels(row + i, length);
+    }
+    i += length;
+  }
+}
+
+void ScreenStream::writeWord(uint16_t value) {
+  port.write((uint8_t) (value & 0xFF));
+  port.write((uint8_t) (value >> 8));
+}
+
+void ScreenStream::writeRegister(uint8_t reg, uint16_t value) {
+  port.write(reg);
+  port.write(0xFF);
+  writeWord(value);
+  pixelsSelected = false;
+}
+
+void ScreenStream::selectPixels() {
+  if (!pixelsSelected) {
+    port.write(0x22);
+    pixelsSelected = true;
+  }
+}
+
+void ScreenStream::flush() {
+  if (runCount == 0) {
+    return;
+  }
+  port.write(CMD_RLE);
+  port.write(runCount);
+  for (uint8_t i = 0; i < runCount; i++) {
+    port.write(runLength[i]);
+    writeWord(runColor[i]);
+  }
+  runCount = 0;
+}
+
+/* Keeps track of the cursor, pixels are written left to right, top to bottom */
+void ScreenStream::advance(uint16_t count) {
+  uint16_t width = winX1 - winX0 + 1;
+  uint16_t height = winY1 - winY0 + 1;
+  uint32_t pos = (uint32_t) (curX - winX0) + count;
+  curX = winX0 + (pos % width);
+  curY = winY0 + ((curY - winY0) + (pos / width)) % height;
+}
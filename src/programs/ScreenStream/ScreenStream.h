@@ -0,0 +1,70 @@
+/***********************************************************************************************
+ ********************************** Screen Stream Encoder **************************************
+ ***********************************************************************************************
+ *
+ * Encodes screen share data for the Phoenard Toolkit. Pixels are written through a window
+ * from left to right, top to bottom. After begin() negotiated the extended stream, runs of
+ * a single color, pixels unchanged since the previous frame and palette-indexed pixels are
+ * sent compressed. When the toolkit does not answer, the original register writes are used
+ * instead, so the same sketch works with older versions of the toolkit.
+ *
+ * == Extended stream commands ==
+ * 0xFD [version]                       Hello, answered by the toolkit with the version agreed
+ * 0xF0 [runs] ([length] [color:2])*    Runs of a single color, a length of 0 means 256
+ * 0xF1 [count:2]                       Skip pixels, keeping the previous frame
+ * 0xF2 [index] [count] ([color:2])*    Set palette entries, a count of 0 means 256
+ * 0xF3 [bpp] [count:2] [indices]       Palette-indexed pixels, 1/2/4/8 bits, MSB first
+ * All values are little-endian.
+ */
+#ifndef SCREENSTREAM_H
+#define SCREENSTREAM_H
+
+#include <Arduino.h>
+
+#define SCREENSTREAM_VERSION        1   // Version of the extended stream requested
+#define SCREENSTREAM_PALETTE_SIZE  16   // Palette entries kept to send indexed pixels the old way
+#define SCREENSTREAM_MAX_RUNS      32   // Runs buffered before an RLE command is sent
+
+class ScreenStream {
+ public:
+  ScreenStream(Stream &port);
+
+  /* Negotiates the extended stream, returns whether it is used */
+  boolean begin(unsigned long timeout = 500);
+  boolean isExtended() { return extended; }
+
+  /* Clears the screen and resets the window to the full screen */
+  void reset();
+  void setWindow(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1);
+
+  /* Pixel data, continuing where the previous write stopped */
+  void writeRun(uint16_t color, uint16_t count);
+  void writeSkip(uint16_t count);
+  void writePixels(const uint16_t *pixels, uint16_t count);
+  void setPalette(uint8_t index, const uint16_t *colors, uint16_t count);
+  void writeIndexed(uint8_t bpp, const uint8_t *indices, uint16_t count);
+
+  /* Encodes a row, skipping pixels equal to the previous row (or NULL to send all) */
+  void writeRow(const uint16_t *row, const uint16_t *prevRow, uint16_t count);
+
+  /* Sends the runs still buffered, call at the end of every frame */
+  void flush();
+
+ private:
+  void writeWord(uint16_t value);
+  void writeRegister(uint8_t reg, uint16_t value);
+  void selectPixels();
+  void advance(uint16_t count);
+
+  Stream &port;
+  boolean extended;
+  boolean pixelsSelected;
+  uint16_t winX0, winY0, winX1, winY1;
+  uint16_t curX, curY;
+  uint16_t palette[SCREENSTREAM_PALETTE_SIZE];
+  uint8_t runCount;
+  uint8_t runLength[SCREENSTREAM_MAX_RUNS];
+  uint16_t runColor[SCREENSTREAM_MAX_RUNS];
+};
+
+#endif
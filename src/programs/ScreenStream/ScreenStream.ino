@@ -0,0 +1,71 @@
+/***********************************************************************************************
+ ********************************** Screen Stream Example **************************************
+ ***********************************************************************************************
+ *
+ * Streams an animation to the screen share of the Phoenard Toolkit using the ScreenStream
+ * encoder. The background is sent once as palette-indexed pixels, after which every frame
+ * only sends the pixels that differ from the frame before. Only two rows are kept in
+ * memory: the animation is computed row by row for both the previous and the current frame.
+ *
+ * Open the Serial tab in the toolkit with screen share enabled at 115200 baud, then reset
+ * the device to have the stream negotiated.
+ */
+#include "ScreenStream.h"
+
+#define BOX_SIZE  40
+
+ScreenStream screen(Serial);
+uint16_t rowPrev[320];
+uint16_t rowCurr[320];
+const uint16_t background[4] = {0x0000, 0x001F, 0x07E0, 0xF800};
+unsigned int frame = 0;
+
+/* Position of the bouncing box in a given frame */
+void boxPosition(unsigned int f, int &x, int &y) {
+  x = f % (2 * (320 - BOX_SIZE));
+  y = (f * 3 / 4) % (2 * (240 - BOX_SIZE));
+  if (x >= (320 - BOX_SIZE)) x = 2 * (320 - BOX_SIZE) - x;
+  if (y >= (240 - BOX_SIZE)) y = 2 * (240 - BOX_SIZE) - y;
+}
+
+/* Background: horizontal bands of the palette colors */
+uint8_t backgroundIndex(int y) {
+  return (y / 60) & 0x3;
+}
+
+void renderRow(unsigned int f, int y, uint16_t *row) {
+  int bx, by;
+  boxPosition(f, bx, by);
+  uint16_t color = background[backgroundIndex(y)];
+  for (int x = 0; x < 320; x++) {
+    boolean inBox = (x >= bx) && (x < (bx + BOX_SIZE)) && (y >= by) && (y < (by + BOX_SIZE));
+    row[x] = inBox ? 0xFFFF : color;
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  screen.begin();
+  screen.reset();
+
+  // Send the background as 2-bit palette indices
+  uint8_t indices[80];
+  screen.setPalette(0, background, 4);
+  for (int y = 0; y < 240; y++) {
+    uint8_t index = backgroundIndex(y);
+    memset(indices, (index << 6) | (index << 4) | (index << 2) | index, sizeof(indices));
+    screen.writeIndexed(2, indices, 320);
+  }
+  screen.flush();
+}
+
+void loop() {
+  // Send only the pixels changed since the previous frame
+  for (int y = 0; y < 240; y++) {
+    renderRow(frame, y, rowPrev);
+    renderRow(frame + 1, y, rowCurr);
+    screen.writeRow(rowCurr, (frame == 0) ? NULL : rowPrev, 320);
+  }
+  screen.flush();
+  frame++;
+}
@@ -0,0 +1,122 @@
+#include "elfsymbols.h"
+#include <QFile>
+#include <algorithm>
+
+#define ELF_SECTION_SYMTAB   2    // Section type of the symbol table
+#define ELF_SYMBOL_OBJECT    1    // Symbol type of variables
+#define ELF_SYMBOL_FUNC      2    // Symbol type of functions
+#define ELF_SYMBOL_SIZE     16    // Size of a single symbol table entry
+
+/* Reads a little-endian number out of the file data */
+static quint32 readNumber(const QByteArray &data, quint32 offset, int length) {
+    quint32 value = 0;
+    for (int i = length - 1; i >= 0; i--) {
+        value = (value << 8) | (quint8) data[offset + i];
+    }
+    return value;
+}
+
+static bool compareAddress(const ElfSymbol &a, const ElfSymbol &b) {
+    return a.address < b.address;
+}
+
+bool ElfSymbols::load(const QString &filePath) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        parseError = "Failed to open " + filePath;
+        return false;
+    }
+    return parse(file.readAll());
+}
+
+bool ElfSymbols::parse(const QByteArray &data) {
+    symbolList.clear();
+    symbolIndex.clear();
+    parseError.clear();
+
+    // Only 32-bit little-endian files are produced for AVR
+    if ((data.size() < 52) || !data.startsWith("\x7F" "ELF") || (data[4] != 1) || (data[5] != 1)) {
+        parseError = "Not a 32-bit little-endian ELF file";
+        return false;
+    }
+    quint32 sectionOffset = readNumber(data, 0x20, 4);
+    quint32 sectionSize = readNumber(data, 0x2E, 2);
+    quint32 sectionCount = readNumber(data, 0x30, 2);
+    if ((sectionSize < 40) || ((quint64) sectionOffset + (quint64) sectionSize * sectionCount > (quint64) data.size())) {
+        parseError = "The section table is corrupted";
+        return false;
+    }
+
+    for (quint32 i = 0; i < sectionCount; i++) {
+        quint32 section = sectionOffset + i * sectionSize;
+        if (readNumber(data, section + 0x04, 4) != ELF_SECTION_SYMTAB) {
+            continue;
+        }
+
+        // The symbol names are stored in the string table linked to
+        quint32 tableOffset = readNumber(data, section + 0x10, 4);
+        quint32 tableSize = readNumber(data, section + 0x14, 4);
+        quint32 stringSection = readNumber(data, section + 0x18, 4);
+        if (stringSection >= sectionCount) {
+            parseError = "The symbol table has no string table";
+            return false;
+        }
+        quint32 stringOffset = readNumber(data, sectionOffset + stringSection * sectionSize + 0x10, 4);
+        quint32 stringSize = readNumber(data, sectionOffset + stringSection * sectionSize + 0x14, 4);
+        if (((quint64) tableOffset + tableSize > (quint64) data.size()) ||
+                ((quint64) stringOffset + stringSize > (quint64) data.size())) {
+            parseError = "The symbol table is corrupted";
+            return false;
+        }
+
+        for (quint32 entry = tableOffset; (entry + ELF_SYMBOL_SIZE) <= (tableOffset + tableSize); entry += ELF_SYMBOL_SIZE) {
+            quint32 nameOffset = readNumber(data, entry, 4);
+            quint8 type = (quint8) data[entry + 12] & 0xF;
+            if ((nameOffset == 0) || (nameOffset >= stringSize)) {
+                continue;
+            }
+            ElfSymbol symbol;
+            symbol.name = QString::fromLatin1(data.constData() + stringOffset + nameOffset,
+                                              qstrnlen(data.constData() + stringOffset + nameOffset,
+                                                       stringSize - nameOffset));
+            symbol.address = readNumber(data, entry + 4, 4);
+            symbol.size = readNumber(data, entry + 8, 4);
+            symbol.isData = (symbol.address >= ELF_DATA_OFFSET) && (symbol.address < ELF_DATA_END);
+            symbol.isFunction = (type == ELF_SYMBOL_FUNC);
+            if (symbol.isData) {
+                symbol.address -= ELF_DATA_OFFSET;
+            }
+
+            // Section and file names are not of interest
+            if (!symbol.isData && !symbol.isFunction && (type != ELF_SYMBOL_OBJECT)) {
+                continue;
+            }
+            if (!symbolIndex.contains(symbol.name)) {
+                symbolIndex.insert(symbol.name, symbolList.count());
+            }
+            symbolList.append(symbol);
+        }
+    }
+    if (symbolList.isEmpty()) {
+        parseError = "The file contains no symbols";
+        return false;
+    }
+    return true;
+}
+
+/* All symbols located in RAM, sorted by address */
+QList<ElfSymbol> ElfSymbols::dataSymbols() const {
+    QList<ElfSymbol> result;
+    for (int i = 0; i < symbolList.count(); i++) {
+        if (symbolList[i].isData) {
+            result.append(symbolList[i]);
+        }
+    }
+    std::sort(result.begin(), result.end(), compareAddress);
+    return result;
+}
+
+const ElfSymbol *ElfSymbols::find(const QString &name) const {
+    QHash<QString, int>::const_iterator it = symbolIndex.find(name);
+    return (it == symbolIndex.end()) ? NULL : &symbolList[it.value()];
+}
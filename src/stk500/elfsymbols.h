@@ -0,0 +1,45 @@
+#ifndef ELFSYMBOLS_H
+#define ELFSYMBOLS_H
+
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QByteArray>
+
+#define ELF_DATA_OFFSET   0x800000   // Offset of the data space in AVR ELF addresses
+#define ELF_DATA_END      0x810000   // End of the data space in AVR ELF addresses
+
+typedef struct ElfSymbol {
+    QString name;
+    quint32 address;   // Data space address of variables, flash address otherwise
+    quint32 size;
+    bool isData;       // Whether the symbol is located in RAM
+    bool isFunction;
+} ElfSymbol;
+
+/*
+ * Reads the symbol table of an AVR ELF file, as produced when compiling a sketch
+ *
+ * Symbols of variables are located in the data space, which AVR ELF files store
+ * with an offset of 0x800000. That offset is removed, so the address of a RAM
+ * symbol can be read from the device as-is.
+ */
+class ElfSymbols
+{
+public:
+    ElfSymbols() {}
+    bool load(const QString &filePath);
+    bool parse(const QByteArray &data);
+    const QString &errorMessage() const { return parseError; }
+    bool isEmpty() const { return symbolList.isEmpty(); }
+    const QList<ElfSymbol> &symbols() const { return symbolList; }
+    QList<ElfSymbol> dataSymbols() const;
+    const ElfSymbol *find(const QString &name) const;
+
+private:
+    QString parseError;
+    QList<ElfSymbol> symbolList;
+    QHash<QString, int> symbolIndex;
+};
+
+#endif // ELFSYMBOLS_H
@@ -1,158 +1,472 @@
 #include "programdata.h"
 
+#define ELF_PROGRAM_LOAD   1    // Program header type of segments loaded into memory
+
+/* Value of every character as a hexadecimal digit, -1 for all other characters */
+static struct HexDigits {
+    signed char value[256];
+    HexDigits() {
+        memset(value, -1, sizeof(value));
+        for (int i = 0; i < 10; i++) {
+            value['0' + i] = i;
+        }
+        for (int i = 0; i < 6; i++) {
+            value['A' + i] = 10 + i;
+            value['a' + i] = 10 + i;
+        }
+    }
+} hexDigits;
+
+/* Checks whether data starts with an Intel HEX record, leading whitespace aside */
+static bool isHexData(const char* data, qint64 length) {
+    qint64 i = 0;
+    while ((i < length) && ((quint8) data[i] <= ' ')) i++;
+    if ((i == length) || (data[i] != ':')) {
+        return false;
+    }
+    for (qint64 k = i + 1; (k < length) && (k <= (i + 8)); k++) {
+        if (hexDigits.value[(quint8) data[k]] < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Reads a little-endian number out of the file data */
+static quint32 readNumber(const QByteArray &data, quint32 offset, int length) {
+    quint32 value = 0;
+    for (int i = length - 1; i >= 0; i--) {
+        value = (value << 8) | (quint8) data[offset + i];
+    }
+    return value;
+}
+
 ProgramData::ProgramData()
 {
+    clear();
+}
+
+void ProgramData::clear() {
+    _pages = QVector<QByteArray>(PROGRAMDATA_PAGE_COUNT);
+    _sketchLength = 0;
+    _firmwareLength = 0;
 }
 
-void ProgramData::loadFile(const QString &fileName) {
+bool ProgramData::loadFile(const QString &fileName) {
 
     /* Load the contents of the file */
     QFile file(fileName);
-    if (file.open(QFile::ReadOnly)) {
-        load(file.readAll());
-        file.close();
+    if (!file.open(QFile::ReadOnly)) {
+        clear();
+        parseError = "Failed to open " + fileName;
+        return false;
+    }
+    return load(file);
+}
+
+/*
+ * Loads Intel HEX, ELF or binary data from a device
+ * Files are memory-mapped when possible, other devices are read as they stream in
+ */
+bool ProgramData::load(QIODevice &device) {
+    clear();
+    parseError.clear();
+    bool success;
+    QFile *file = qobject_cast<QFile*>(&device);
+    uchar *mapped = (file && (file->size() > 0)) ? file->map(0, file->size()) : NULL;
+    if (mapped) {
+        success = parse((const char*) mapped, file->size());
+        file->unmap(mapped);
+    } else {
+        success = parseStream(device);
+    }
+    if (!success) {
+        clear();
+    }
+    updateLengths();
+    return success;
+}
+
+bool ProgramData::load(const QByteArray &data) {
+    clear();
+    parseError.clear();
+    bool success = parse(data.constData(), data.size());
+    if (!success) {
+        clear();
+    }
+    updateLengths();
+    return success;
+}
+
+/* Loads a full image of the flash memory, starting at address 0 */
+void ProgramData::loadBinary(const QByteArray &data) {
+    clear();
+    parseError.clear();
+    write(0, data.constData(), data.size());
+    updateLengths();
+}
+
+bool ProgramData::parse(const char* data, qint64 length) {
+    if ((length >= 4) && !memcmp(data, "\x7F" "ELF", 4)) {
+        return parseElf(QByteArray::fromRawData(data, (int) length));
+    }
+    if (!isHexData(data, length)) {
+        write(0, data, length);
+        return true;
     }
+    HexState state = { 0, 0, false };
+    qint64 parsed;
+    if (!parseHexLines(state, data, length, parsed)) {
+        return false;
+    }
+    if ((parsed < length) && !parseHexLine(state, data + parsed, (int) (length - parsed))) {
+        return false;
+    }
+    return finishHex(state);
 }
 
-void ProgramData::load(const QByteArray &data) {
+/* Parses data read from a device in chunks; only Intel HEX is parsed while it is read */
+bool ProgramData::parseStream(QIODevice &device) {
+    QByteArray buffer = device.peek(16);
+    if (!isHexData(buffer.constData(), buffer.size())) {
+        buffer = device.readAll();
+        return parse(buffer.constData(), buffer.size());
+    }
+    buffer.clear();
+
+    HexState state = { 0, 0, false };
+    for (;;) {
+        QByteArray chunk = device.read(PROGRAMDATA_READ_CHUNK);
+        if (chunk.isEmpty()) {
+            break;
+        }
+        buffer += chunk;
+        qint64 parsed;
+        if (!parseHexLines(state, buffer.constData(), buffer.size(), parsed)) {
+            return false;
+        }
+        buffer.remove(0, (int) parsed);
 
-    /* Evaluate whether this is Intel HEX Data or not */
-    bool isBinary = data.length() < 12;
-    for (unsigned char i = 0; i < 12 && !isBinary; i++) {
-        if (data[i] < 0x30 || data[i] > 0x46) {
-            isBinary = true;
+        /* A line that long can not be a record, it is reported as such */
+        if (buffer.size() > PROGRAMDATA_READ_CHUNK) {
+            return parseHexLine(state, buffer.constData(), buffer.size()) && finishHex(state);
         }
     }
+    if (!buffer.isEmpty() && !parseHexLine(state, buffer.constData(), buffer.size())) {
+        return false;
+    }
+    return finishHex(state);
+}
 
-    /* Load in the data into a big 256KB array */
-    char fullData[256*1024];
-    memset(fullData, 0xFF, sizeof(fullData));
-    if (isBinary) {
-        /* For binary data, simply copy it into the array directly */
-        int len = std::min((int) sizeof(fullData), data.length());
-        memcpy(fullData, data.data(), len);
-    } else {
-        /* For Intel Hex data, process all the entries */
-        char data_buff[512];
-        int dataIndex = 0;
-        unsigned char length, recordtype;
-        quint32 address = 0;
-        quint8* address_bytes = (quint8*) &address;
-        quint16* address_words = (quint16*) &address;
-        for (;;) {
-
-            /* Read in a new hex entry */
-            unsigned char data_ctr = 0;
-            char* buff = data_buff - 1;
-            while (dataIndex < data.length()) {
-                /* Read the next byte, handle block incrementing */
-                char c = data[dataIndex++];
-                if (data_ctr) {
-                    data_ctr++;
-
-                    /* Read the data until a char before the 0-F range is read */
-                    if (c < '0') break;
-
-                    /* Start of a new byte, increment and set to an initial 0x00 */
-                    if (!(data_ctr & 0x1)) {
-                        *(++buff) = 0x00;
-                    }
-
-                    /* Convert the character into HEX, put it into the buffer */
-                    *buff <<= 4;
-                    if (c & 0x40) {
-                        c -= ('A' - '0') - 10;
-                    }
-                    *buff |= (c - '0') & 0xF;
-                } else {
-                    /* Set to 1 when : is received, starting the reading */
-                    data_ctr = (c == ':');
-                }
-            }
+/* Parses all complete lines in the data, and stores the amount of bytes they span in parsed */
+bool ProgramData::parseHexLines(HexState &state, const char* data, qint64 length, qint64 &parsed) {
+    const char* start = data;
+    const char* end = data + length;
+    const char* newline;
+    while ((newline = (const char*) memchr(start, '\n', end - start)) != NULL) {
+        if (!parseHexLine(state, start, (int) (newline - start))) {
+            return false;
+        }
+        start = newline + 1;
+    }
+    parsed = (start - data);
+    return true;
+}
 
-            /* Process the HEX entry */
-            length = data_buff[0];
-            recordtype = data_buff[3];
+/* Parses a single line of Intel HEX data, validating the record it holds */
+bool ProgramData::parseHexLine(HexState &state, const char* line, int length) {
+    state.line++;
 
-            /* Validate that the data is valid using the provided CRC */
-            unsigned char crc_expected = data_buff[length + 4];
-            unsigned char crc_read = 0;
-            for (int i = 0; i < (length+4); i++) crc_read += data_buff[i];
-            crc_read = (~crc_read + 1) & 0xFF;
-            if (crc_expected != crc_read) {
-                continue;
-            }
+    /* Blank lines, and anything after the end-of-file record, are ignored */
+    while ((length > 0) && ((quint8) line[length - 1] <= ' ')) length--;
+    while ((length > 0) && ((quint8) line[0] <= ' ')) {
+        line++;
+        length--;
+    }
+    if ((length == 0) || state.ended) {
+        return true;
+    }
+    if (line[0] != ':') {
+        return hexError(state, "expected a record starting with ':'");
+    }
+    if (length < 11) {
+        return hexError(state, "the record is too short");
+    }
+    if (length > 521) {
+        return hexError(state, "the record is too long");
+    }
+    if (!(length & 1)) {
+        return hexError(state, "the record has an odd amount of digits");
+    }
 
-            /* Read the address part of data hex lines */
-            if (!recordtype) {
-                address_bytes[0] = data_buff[2];
-                address_bytes[1] = data_buff[1];
-            }
+    /* Decode the record and sum up all bytes; including the checksum, the sum is 0 */
+    quint8 record[260];
+    int count = (length - 1) / 2;
+    quint8 sum = 0;
+    for (int i = 0; i < count; i++) {
+        int high = hexDigits.value[(quint8) line[1 + 2 * i]];
+        int low = hexDigits.value[(quint8) line[2 + 2 * i]];
+        if ((high | low) < 0) {
+            return hexError(state, QString("invalid character at column %1").arg((high < 0) ? (2 + 2 * i) : (3 + 2 * i)));
+        }
+        record[i] = (quint8) ((high << 4) | low);
+        sum += record[i];
+    }
+    int dataLength = record[0];
+    quint16 address = (record[1] << 8) | record[2];
+    quint8 recordtype = record[3];
+    const quint8* data = record + 4;
+    if (dataLength != (count - 5)) {
+        return hexError(state, QString("the record length is %1, but it holds %2 bytes of data").arg(dataLength).arg(count - 5));
+    }
+    if (sum != 0) {
+        quint8 expected = record[count - 1] - sum;
+        return hexError(state, QString("checksum %1 is incorrect, expected %2")
+                        .arg(QString("%1").arg((int) record[count - 1], 2, 16, QChar('0')).toUpper())
+                        .arg(QString("%1").arg((int) expected, 2, 16, QChar('0')).toUpper()));
+    }
 
-            /* Extended data segment, we ignore data_buff[5] (out of range) */
-            if (recordtype == 0x2) {
-                address_words[1] = ((quint16) data_buff[4] >> 4);
-                continue;
-            }
+    switch (recordtype) {
+    case 0x0:
+        /* Data */
+        if (((quint64) state.base + address + dataLength) > PROGRAMDATA_FLASH_SIZE) {
+            return hexError(state, QString("data at address 0x%1 is outside of the flash memory")
+                            .arg(QString("%1").arg(state.base + address, 5, 16, QChar('0')).toUpper()));
+        }
+        write(state.base + address, (const char*) data, dataLength);
+        return true;
 
-            /* Start Segment Address, detected but unused */
-            if (recordtype == 0x3) {
-                continue;
-            }
+    case 0x1:
+        /* End of file */
+        state.ended = true;
+        return true;
 
-            /* Extended Linear Address, found to exist sometimes */
-            if (recordtype == 0x4) {
-                address_bytes[2] = data_buff[5];
-                /*address_bytes[3] = data_buff[4]; (out of range) */
-                continue;
-            }
+    case 0x2:
+    case 0x4:
+        /* Extended segment address (in units of 16 bytes) and extended linear address (in units of 64KB) */
+        if (dataLength != 2) {
+            return hexError(state, "an extended address record must hold 2 bytes of data");
+        }
+        state.base = ((data[0] << 8) | data[1]);
+        state.base <<= (recordtype == 0x2) ? 4 : 16;
+        return true;
 
-            /* Fill the buffer with entry data */
-            qint32 remaining = sizeof(fullData) - address;
-            if (remaining > 0) {
-                if (remaining < length) {
-                    length = remaining;
-                }
-                memcpy(fullData + address, data_buff + 4, length);
-            }
+    case 0x3:
+    case 0x5:
+        /* Start segment address and start linear address, unused */
+        if (dataLength != 4) {
+            return hexError(state, "a start address record must hold 4 bytes of data");
+        }
+        return true;
+
+    default:
+        return hexError(state, QString("unknown record type %1").arg((int) recordtype));
+    }
+}
+
+bool ProgramData::finishHex(const HexState &state) {
+    if (!state.ended) {
+        parseError = "The data ends without an end-of-file record";
+        return false;
+    }
+    return true;
+}
+
+bool ProgramData::hexError(const HexState &state, const QString &message) {
+    parseError = QString("Line %1: %2").arg(state.line).arg(message);
+    return false;
+}
+
+/* Loads the segments of an AVR ELF file that are stored in flash */
+bool ProgramData::parseElf(const QByteArray &data) {
+    if ((data.size() < 52) || (data[4] != 1) || (data[5] != 1)) {
+        parseError = "Not a 32-bit little-endian ELF file";
+        return false;
+    }
+    quint32 headerOffset = readNumber(data, 0x1C, 4);
+    quint32 headerSize = readNumber(data, 0x2A, 2);
+    quint32 headerCount = readNumber(data, 0x2C, 2);
+    if ((headerSize < 32) || ((quint64) headerOffset + (quint64) headerSize * headerCount > (quint64) data.size())) {
+        parseError = "The program header table is corrupted";
+        return false;
+    }
+
+    /* Data segments are stored in flash after the code; the physical address is where */
+    for (quint32 i = 0; i < headerCount; i++) {
+        quint32 header = headerOffset + i * headerSize;
+        quint32 offset = readNumber(data, header + 0x04, 4);
+        quint32 address = readNumber(data, header + 0x0C, 4);
+        quint32 fileSize = readNumber(data, header + 0x10, 4);
+        if ((readNumber(data, header, 4) != ELF_PROGRAM_LOAD) || (fileSize == 0) || (address >= PROGRAMDATA_FLASH_SIZE)) {
+            continue;
+        }
+        if ((quint64) offset + fileSize > (quint64) data.size()) {
+            parseError = "A program segment is corrupted";
+            return false;
+        }
+        if ((quint64) address + fileSize > PROGRAMDATA_FLASH_SIZE) {
+            parseError = QString("The segment at address 0x%1 does not fit in the flash memory")
+                    .arg(QString("%1").arg(address, 5, 16, QChar('0')).toUpper());
+            return false;
+        }
+        write(address, data.constData() + offset, fileSize);
+    }
+    return true;
+}
+
+/* Writes data into the pages, allocating the pages touched; data beyond the flash memory is dropped */
+void ProgramData::write(quint32 address, const char* data, qint64 length) {
+    while ((length > 0) && (address < PROGRAMDATA_FLASH_SIZE)) {
+        QByteArray &page = _pages[address / PROGRAMDATA_PAGE_SIZE];
+        if (page.isEmpty()) {
+            page = QByteArray(PROGRAMDATA_PAGE_SIZE, (char) 0xFF);
+        }
+        int offset = (address % PROGRAMDATA_PAGE_SIZE);
+        int count = (int) std::min((qint64) (PROGRAMDATA_PAGE_SIZE - offset), length);
+        memcpy(page.data() + offset, data, count);
+        address += count;
+        data += count;
+        length -= count;
+    }
+}
 
-            /* End of data record */
-            if (recordtype == 0x1) {
+/* Finds where the sketch and firmware data end, leaving out trailing 0xFFFF words */
+void ProgramData::updateLengths() {
+    quint32 ends[2] = { 0, PROGRAMDATA_FIRMWARE_START };
+    for (int i = 0; i < _pages.count(); i++) {
+        const QByteArray &page = _pages[i];
+        if (page.isEmpty()) {
+            continue;
+        }
+        for (int k = PROGRAMDATA_PAGE_SIZE - 2; k >= 0; k -= 2) {
+            if ((page[k] != (char) 0xFF) || (page[k+1] != (char) 0xFF)) {
+                quint32 address = i * PROGRAMDATA_PAGE_SIZE + k;
+                ends[address >= PROGRAMDATA_FIRMWARE_START] = address + 2;
                 break;
             }
         }
     }
+    _sketchLength = ends[0];
+    _firmwareLength = ends[1] - PROGRAMDATA_FIRMWARE_START;
+}
 
-    /* Now that the data has been loaded, detect firmware / sketch data ranges */
-    const quint32 boot_start = 0x3E000;
-    quint32 sketch_end = 0;
-    quint32 firmware_end = boot_start;
-    for (quint32 i = 0; i < firmware_end; i += 2) {
-        if ((fullData[i] != (char) 0xFF) || (fullData[i+1] != (char) 0xFF)) {
-            sketch_end = i+2;
-        }
+/* Copies a range of the flash memory, pages not loaded read as 0xFF */
+QByteArray ProgramData::readRange(quint32 address, quint32 length) const {
+    QByteArray result(length, (char) 0xFF);
+    for (quint32 i = 0; i < length; ) {
+        int offset = ((address + i) % PROGRAMDATA_PAGE_SIZE);
+        int count = std::min(PROGRAMDATA_PAGE_SIZE - offset, (int) (length - i));
+        memcpy(result.data() + i, pageAt(address + i), count);
+        i += count;
+    }
+    return result;
+}
+
+/* Saves the program data as raw binary when the file ends with .bin, as Intel HEX otherwise */
+bool ProgramData::saveFile(const QString &fileName) const {
+    QFile file(fileName);
+    if (!file.open(QFile::WriteOnly)) {
+        return false;
+    }
+    QByteArray data = fileName.endsWith(".bin", Qt::CaseInsensitive) ? toBinary() : toHex();
+    bool success = (file.write(data) == data.size());
+    file.close();
+    return success;
+}
+
+/* Writes a single byte as two hexadecimal characters */
+static inline char* writeHexByte(char* out, quint8 value) {
+    static const char digits[] = "0123456789ABCDEF";
+    out[0] = digits[value >> 4];
+    out[1] = digits[value & 0xF];
+    return out + 2;
+}
+
+/* Writes a single Intel HEX record, including the checksum and line ending */
+static char* writeHexRecord(char* out, quint8 recordtype, quint16 address, const char* data, int length) {
+    quint8 crc = length + (address >> 8) + (address & 0xFF) + recordtype;
+    *out++ = ':';
+    out = writeHexByte(out, length);
+    out = writeHexByte(out, address >> 8);
+    out = writeHexByte(out, address & 0xFF);
+    out = writeHexByte(out, recordtype);
+    for (int i = 0; i < length; i++) {
+        crc += (quint8) data[i];
+        out = writeHexByte(out, data[i]);
+    }
+    out = writeHexByte(out, (~crc + 1) & 0xFF);
+    *out++ = '\n';
+    return out;
+}
+
+/* Produces compact Intel HEX data, in which blank (0xFF) records are left out */
+QByteArray ProgramData::toHex() const {
+    /* A record takes twice its data in characters plus 12 more; add room for the other records */
+    int pageCount = 0;
+    for (int i = 0; i < _pages.count(); i++) {
+        pageCount += _pages[i].isEmpty() ? 0 : 1;
     }
-    for (quint32 i = boot_start; i < sizeof(fullData); i += 2) {
-        if ((fullData[i] != (char) 0xFF) || (fullData[i+1] != (char) 0xFF)) {
-            firmware_end = i+2;
+    int records = pageCount * (PROGRAMDATA_PAGE_SIZE / PROGRAMDATA_HEX_RECORD) + 8;
+    QByteArray result(records * (PROGRAMDATA_HEX_RECORD * 2 + 12), 0);
+    char* out = result.data();
+    quint32 segment = 0;
+    for (int i = 0; i < _pages.count(); i++) {
+        const QByteArray &page = _pages[i];
+        for (int k = 0; (k < page.size()) && !page.isEmpty(); k += PROGRAMDATA_HEX_RECORD) {
+            const char* record = page.constData() + k;
+            int n = 0;
+            while ((n < PROGRAMDATA_HEX_RECORD) && (record[n] == (char) 0xFF)) n++;
+            if (n == PROGRAMDATA_HEX_RECORD) {
+                continue;
+            }
+
+            /* Records are aligned, so they never cross a 64KB segment */
+            quint32 address = i * PROGRAMDATA_PAGE_SIZE + k;
+            if ((address >> 16) != segment) {
+                segment = address >> 16;
+                char extended[2] = { (char) (segment >> 8), (char) (segment & 0xFF) };
+                out = writeHexRecord(out, 0x4, 0, extended, sizeof(extended));
+            }
+            out = writeHexRecord(out, 0x0, address & 0xFFFF, record, PROGRAMDATA_HEX_RECORD);
         }
     }
+    out = writeHexRecord(out, 0x1, 0, NULL, 0);
+    result.truncate(out - result.data());
+    return result;
+}
 
-    /* Fill the sketch/firmware data buffers */
-    _sketchData = QByteArray(fullData, sketch_end);
-    _firmwareData = QByteArray(fullData+boot_start, firmware_end-boot_start);
+/* Produces a raw image of the flash from address 0, up to the end of the last data */
+QByteArray ProgramData::toBinary() const {
+    return readRange(0, hasFirmwareData() ? (PROGRAMDATA_FIRMWARE_START + firmwareSize()) : sketchSize());
+}
 
-    /* Make sure to pad the data to 256 page size */
-    pageAlign(_sketchData);
-    pageAlign(_firmwareData);
+/* Gets the data at an address of the flash memory; pages not loaded are blank */
+const char* ProgramData::pageAt(quint32 address) const {
+    static const QByteArray blankPage(PROGRAMDATA_PAGE_SIZE, (char) 0xFF);
+    const QByteArray &page = (address < PROGRAMDATA_FLASH_SIZE) ? _pages[address / PROGRAMDATA_PAGE_SIZE] : blankPage;
+    return (page.isEmpty() ? blankPage.constData() : page.constData()) + (address % PROGRAMDATA_PAGE_SIZE);
 }
 
 const char* ProgramData::sketchPage(quint32 address) const {
-    return _sketchData.data() + address;
+    return pageAt(address);
 }
 
 const char* ProgramData::firmwarePage(quint32 address) const {
-    return _firmwareData.data() + address;
+    return pageAt(PROGRAMDATA_FIRMWARE_START + address);
+}
+
+void ProgramData::clearSketchData() {
+    for (int i = 0; i < (PROGRAMDATA_FIRMWARE_START / PROGRAMDATA_PAGE_SIZE); i++) {
+        _pages[i].clear();
+    }
+    _sketchLength = 0;
+}
+
+void ProgramData::clearFirmwareData() {
+    for (int i = (PROGRAMDATA_FIRMWARE_START / PROGRAMDATA_PAGE_SIZE); i < _pages.count(); i++) {
+        _pages[i].clear();
+    }
+    _firmwareLength = 0;
 }
 
 bool ProgramData::hasServiceSupport() const {
@@ -160,8 +474,9 @@ bool ProgramData::hasServiceSupport() const {
         0x9380, 0x005b, 0x9320, 0x0057, 0x95e8,
         0x91df, 0x91cf, 0x911f, 0x910f, 0x90ff, 0x9508
     };
-    for (int i = 0; i < _firmwareData.length(); i += 2) {
-        if (!memcmp(_firmwareData.data() + i, spm_func_data, sizeof(spm_func_data))) {
+    QByteArray firmware = readRange(PROGRAMDATA_FIRMWARE_START, firmwareSize() + sizeof(spm_func_data));
+    for (quint32 i = 0; i < _firmwareLength; i += 2) {
+        if (!memcmp(firmware.constData() + i, spm_func_data, sizeof(spm_func_data))) {
             return true;
         }
     }
@@ -170,9 +485,10 @@ bool ProgramData::hasServiceSupport() const {
 
 QString ProgramData::firmwareVersion() const {
     // Generate CRC
+    QByteArray firmware = firmwareData();
     quint32 crc = ~0;
-    for (int i = 0; i < _firmwareData.length(); i++) {
-        crc ^= (quint8) _firmwareData[i];
+    for (int i = 0; i < firmware.length(); i++) {
+        crc ^= (quint8) firmware[i];
         for (unsigned char k = 8; k; k--) {
           unsigned char m = (crc & 0x1);
           crc >>= 1;
@@ -186,10 +502,3 @@ QString ProgramData::firmwareVersion() const {
     version += hasServiceSupport() ? "-S" : "-N";
     return version;
 }
-
-void ProgramData::pageAlign(QByteArray &data) {
-    int size = data.size();
-    int pageSize = (size + 256 - 1) & ~(256-1);
-    data.reserve(pageSize);
-    memset(data.data()+size, 0xFF, pageSize-size);
-}
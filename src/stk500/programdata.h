@@ -3,34 +3,78 @@
 
 #include <QByteArray>
 #include <QFile>
+#include <QIODevice>
+#include <QVector>
 #include <QDebug>
 
+#define PROGRAMDATA_FLASH_SIZE      0x40000   // Total size of the flash memory
+#define PROGRAMDATA_FIRMWARE_START  0x3E000   // Flash address at which the firmware starts
+#define PROGRAMDATA_PAGE_SIZE           256   // Size of a single page of flash
+#define PROGRAMDATA_PAGE_COUNT  (PROGRAMDATA_FLASH_SIZE / PROGRAMDATA_PAGE_SIZE)
+#define PROGRAMDATA_HEX_RECORD           32   // Amount of data bytes in a single exported hex record
+#define PROGRAMDATA_READ_CHUNK        65536   // Amount of bytes read at once from devices that can not be mapped
+
+/*
+ * Program data to upload to, or read from, the flash memory of the device
+ *
+ * The data is kept as a sparse map of 256-byte pages; only the pages touched by
+ * the input are allocated. Intel HEX, ELF and raw binary input all end up in
+ * this same page model. Intel HEX is parsed line by line as it streams in, with
+ * every record validated, so a bad file fails with the line at fault.
+ */
 class ProgramData
 {
 public:
     ProgramData();
-    void loadFile(const QString &fileName);
-    void load(const QByteArray &data);
+    bool loadFile(const QString &fileName);
+    bool load(QIODevice &device);
+    bool load(const QByteArray &data);
+    void loadBinary(const QByteArray &data);
+    bool saveFile(const QString &fileName) const;
+    QByteArray toHex() const;
+    QByteArray toBinary() const;
+    const QString &errorMessage() const { return parseError; }
     QString firmwareVersion() const;
-    bool hasSketchData() const { return !_sketchData.isEmpty(); }
-    bool hasFirmwareData() const { return !_firmwareData.isEmpty(); }
-    const QByteArray &sketchData() { return _sketchData; }
-    const QByteArray &firmwareData() { return _firmwareData; }
-    quint32 sketchSize() const { return (quint32) _sketchData.size(); }
-    quint32 firmwareSize() const { return (quint32) _firmwareData.size(); }
+    bool hasSketchData() const { return _sketchLength > 0; }
+    bool hasFirmwareData() const { return _firmwareLength > 0; }
+    QByteArray sketchData() const { return readRange(0, _sketchLength); }
+    QByteArray firmwareData() const { return readRange(PROGRAMDATA_FIRMWARE_START, _firmwareLength); }
+    quint32 sketchSize() const { return pageAlign(_sketchLength); }
+    quint32 firmwareSize() const { return pageAlign(_firmwareLength); }
     const char* sketchPage(quint32 address) const;
     const char* firmwarePage(quint32 address) const;
-    void clearSketchData() { _sketchData.clear(); }
-    void clearFirmwareData() { _firmwareData.clear(); }
+    void clearSketchData();
+    void clearFirmwareData();
     bool hasServiceSupport() const;
 
     /* Verifies if a 256-byte page of data is the service page */
     static bool isServicePage(const char* pageData);
 
 private:
-    void pageAlign(QByteArray &data);
-    QByteArray _firmwareData;
-    QByteArray _sketchData;
+    typedef struct HexState {
+        quint32 base;    // Address added to the address of data records
+        int line;        // Number of the last line parsed
+        bool ended;      // Whether the end-of-file record was read
+    } HexState;
+
+    void clear();
+    bool parse(const char* data, qint64 length);
+    bool parseHexLine(HexState &state, const char* line, int length);
+    bool parseHexLines(HexState &state, const char* data, qint64 length, qint64 &parsed);
+    bool parseStream(QIODevice &device);
+    bool finishHex(const HexState &state);
+    bool hexError(const HexState &state, const QString &message);
+    bool parseElf(const QByteArray &data);
+    void write(quint32 address, const char* data, qint64 length);
+    const char* pageAt(quint32 address) const;
+    void updateLengths();
+    QByteArray readRange(quint32 address, quint32 length) const;
+    static quint32 pageAlign(quint32 length) { return (length + PROGRAMDATA_PAGE_SIZE - 1) & ~(PROGRAMDATA_PAGE_SIZE - 1); }
+
+    QVector<QByteArray> _pages;
+    quint32 _sketchLength;    // Length of the sketch data, up to the last byte that is not 0xFF
+    quint32 _firmwareLength;  // Length of the firmware data, up to the last byte that is not 0xFF
+    QString parseError;
 };
 
 #endif // PROGRAMDATA_H
@@ -1,16 +1,20 @@
 #include "stk500.h"
 #include <QDebug>
+#include <QVector>
+#include <QMutex>
 
 // Default interface when none is specified - does nothing
 stk500StatusInterface stk500_empty_status_interface;
 
-stk500::stk500(stk500StatusInterface *status_interface)
+stk500::stk500(stk500StatusInterface *status_interface, stk500CancelToken *cancel_token)
 {
+    this->port.setCancelToken(cancel_token);
     this->lastCmdTime = 0;
     this->sd_handler = new stk500sd(this);
     this->reg_handler = new stk500registers(this);
     this->service_handler = new stk500service(this);
     this->signedOn = false;
+    this->pipelineDepth = STK500_PIPELINE_DEPTH;
     this->lastResetTime = QDateTime::currentMSecsSinceEpoch() - STK500_MIN_RESET_TIME;
     this->currentState = STK500::UNOPENED;
 
@@ -19,24 +23,6 @@ stk500::stk500(stk500StatusInterface *status_interface)
     if (this->status_interface == NULL) {
         this->status_interface = &stk500_empty_status_interface;
     }
-
-    // Initialize the command names table
-    QFile cmdFile(":/data/commands.csv");
-    if (cmdFile.open(QIODevice::ReadOnly)) {
-        QTextStream textStream(&cmdFile);
-        while (!textStream.atEnd()) {
-            // Read the next entry
-            QStringList fields = textStream.readLine().split(",");
-            if (fields.length() == 2) {
-                bool succ = false;
-                int command = fields[1].toInt(&succ, 16);
-                if (succ && (command >= 0) && (command < 256)) {
-                    commandNames[command] = fields[0];
-                }
-            }
-        }
-        cmdFile.close();
-    }
 }
 
 stk500::~stk500() {
@@ -96,6 +82,7 @@ void stk500::reset(bool signOut) {
     }
 
     QByteArray data = port.readAll(STK500_RESET_DELAY);
+    checkCancelled();
     if (!data.isEmpty()) {
         QString dataText = data;
         QString errorMessage = QString("Failed to reset firmware: "
@@ -124,7 +111,7 @@ void stk500::reset(bool signOut) {
     const int MAX_TRIALS = 2;
     STK500::State oldState = currentState;
     currentState = STK500::NONE;
-    for (int trial = 0; trial < MAX_TRIALS && (currentState == STK500::NONE); trial++) {
+    for (int trial = 0; trial < MAX_TRIALS && (currentState == STK500::NONE) && !port.isCancelled(); trial++) {
 
         /*
          * Write out a command which excludes the service w/r/a/m characters
@@ -158,12 +145,19 @@ void stk500::reset(bool signOut) {
                 currentState = STK500::SERVICE;
                 break;
             }
-        } while ((QDateTime::currentMSecsSinceEpoch() - lastCmdTime) < port.readTimeout());
+        } while (!port.isCancelled() && ((QDateTime::currentMSecsSinceEpoch() - lastCmdTime) < port.readTimeout()));
 
         /* Reset timeout to prevent successive resetting */
         lastResetTime = lastCmdTime = QDateTime::currentMSecsSinceEpoch();
     }
 
+    /* When cancelled halfway, the state is unknown and the reset is repeated next time */
+    if (currentState == STK500::NONE && port.isCancelled()) {
+        currentState = oldState;
+        resetFirmware();
+        checkCancelled();
+    }
+
     /* If this is the first reset, then we assume no firmware communication is possible */
     if (currentState == STK500::NONE && oldState == STK500::UNOPENED) {
         currentState = STK500::SKETCH_ONLY;
@@ -263,7 +257,9 @@ bool stk500::setState(STK500::State newState, qint32 baudRate) {
         // Restore settings to make sure they are preserved
         PHN_Settings oldSettings;
         ProgramData serviceSketch;
-        serviceSketch.loadFile(":/programs/SetServiceMode.hex");
+        if (!serviceSketch.loadFile(":/programs/SetServiceMode.hex")) {
+            throw ProtocolException("Failed to load the service mode sketch: " + serviceSketch.errorMessage());
+        }
         oldSettings = readSettings();
         FLASH_upload(serviceSketch);
         writeSettings(oldSettings);
@@ -422,20 +418,50 @@ bool stk500::isFirmwareTimeout() {
     return firmwareIdleTime() > STK500_DEVICE_TIMEOUT;
 }
 
+void stk500::checkCancelled() {
+    if (port.isCancelled()) {
+        throw ProtocolException("Operation cancelled");
+    }
+}
+
 int stk500::command(STK500::CMD command, const char* arguments, int argumentsLength, char* response, int responseMaxLength) {
 
+    // Don't start new commands once cancelled
+    checkCancelled();
+
     // Write out the command (also arranges firmware initialization)
     commandWrite(command, arguments, argumentsLength);
 
     // Read the response
+    QByteArray receivedData;
+    return commandRead(command, response, responseMaxLength, receivedData);
+}
+
+/*
+ * Reads the response to the command sent with the current sequence number
+ * Data received is kept in receivedData, which can hold the responses to later commands too
+ */
+int stk500::commandRead(STK500::CMD command, char* response, int responseMaxLength, QByteArray &receivedData) {
     qint64 totalRead = 0;
     qint64 cmdStartTime = QDateTime::currentMSecsSinceEpoch();
     quint16 respLength = 0;
     bool processed = false;
     bool hasResponse = false;
+    int messageStart = -1;
+    int messageEnd = 0;
     QString errorInfo = "No Response";
-    QByteArray receivedData;
-    do {
+
+    /* The response may have been received already while reading an earlier one */
+    if (!receivedData.isEmpty()) {
+        errorInfo = readCommandResponse(command, receivedData, response, responseMaxLength,
+                                        &hasResponse, &messageStart, &messageEnd);
+        if (errorInfo.startsWith("RESP=")) {
+            respLength = errorInfo.remove(0, 5).toInt();
+            processed = true;
+        }
+    }
+
+    while (!processed) {
 
         /* Read in received response data */
         QByteArray newData = port.read(port.readTimeout());
@@ -453,22 +479,41 @@ int stk500::command(STK500::CMD command, const char* arguments, int argumentsLen
         }
 
         /* Process full response */
-        errorInfo = readCommandResponse(command, receivedData, response, responseMaxLength, &hasResponse);
+        errorInfo = readCommandResponse(command, receivedData, response, responseMaxLength,
+                                        &hasResponse, &messageStart, &messageEnd);
         if (errorInfo.startsWith("RESP=")) {
             respLength = errorInfo.remove(0, 5).toInt();
             processed = true;
         }
 
-        /* Abort if too much data is received (ERR_OVERFLOW) */
-        if (receivedData.length() > 800) {
+        /* Abort if too much data is received for this response (ERR_OVERFLOW) */
+        if (!processed && ((receivedData.length() - qMax(0, messageStart)) > 800)) {
+            break;
+        }
+
+        /* Stop waiting for the remainder of the response when cancelled */
+        if (!processed && port.isCancelled()) {
             break;
         }
-    } while (!processed);
+    }
 
     totalRead = receivedData.length();
 
+    /* Drop the response handled, and anything before it; what remains belongs to later commands */
+    if (processed) {
+        receivedData.remove(0, messageEnd);
+    }
+
+    // Cancelled while waiting for the response; the device may still respond later on
+    // Skip the sequence number so such late response is ignored, and force the address to be loaded again
+    if (!processed && port.isCancelled()) {
+        sequenceNumber = (sequenceNumber + 1) & 0xFF;
+        currentAddress = 0xFFFFFFFF;
+        checkCancelled();
+    }
+
     // Handle (the lack of) the response
-    QString cmdName = commandNames[command] + " (" + getHexText((uint) command) + ")";
+    QString cmdName = ChipRegisters::commandName(command) + " (" + getHexText((uint) command) + ")";
     if (!processed) {
         // Log the error
         QString errorMessage;
@@ -511,7 +556,43 @@ int stk500::command(STK500::CMD command, const char* arguments, int argumentsLen
     }
 }
 
-void stk500::commandWrite(STK500::CMD command, const char* arguments, int argumentsLength) {
+/*
+ * Sends several commands, keeping up to the pipeline depth of them in flight
+ * The next commands are sent before the response to the first one is read,
+ * hiding the round trip time. Responses are matched by sequence number.
+ */
+void stk500::commandPipeline(stk500PipelinedCommand *commands, int count) {
+    checkCancelled();
+
+    QByteArray receivedData;
+    uint firstSequenceNumber = sequenceNumber;
+    int written = 0;
+    int finished = 0;
+    try {
+        while (finished < count) {
+            while ((written < count) && ((written - finished) < qMax(1, pipelineDepth))) {
+                const stk500PipelinedCommand &cmd = commands[written];
+                commandWrite(cmd.command, cmd.arguments.data(), cmd.arguments.length(), written - finished);
+                written++;
+            }
+            const stk500PipelinedCommand &cmd = commands[finished];
+            commandRead(cmd.command, cmd.response, cmd.responseMaxLength, receivedData);
+            finished++;
+
+            /* Forget any data left over once nothing else is pending */
+            if (finished == written) {
+                receivedData.clear();
+            }
+        }
+    } catch (ProtocolException &) {
+        /* Skip the sequence numbers of commands still in flight, so late responses are ignored */
+        sequenceNumber = (firstSequenceNumber + written) & 0xFF;
+        currentAddress = 0xFFFFFFFF;
+        throw;
+    }
+}
+
+void stk500::commandWrite(STK500::CMD command, const char* arguments, int argumentsLength, int sequenceOffset) {
     // If bootloader timed out, reset the device first
     if (isFirmwareTimeout()) {
         reset();
@@ -530,7 +611,7 @@ void stk500::commandWrite(STK500::CMD command, const char* arguments, int argume
     // Build up a message to send out
     char* data = new char[total_length];
     data[0] = STK500::MESSAGE_START;
-    data[1] = (char) (sequenceNumber & 0xFF);
+    data[1] = (char) ((sequenceNumber + sequenceOffset) & 0xFF);
     data[2] = (char) ((message_length >> 8) & 0xFF);
     data[3] = (char) (message_length & 0xFF);
     data[4] = STK500::TOKEN;
@@ -555,10 +636,17 @@ void stk500::commandWrite(STK500::CMD command, const char* arguments, int argume
     port.waitBaudCycles(total_length);
 }
 
+/*
+ * Looks for the response to the command in the input data
+ * The offset of the first message with the current sequence number is stored in messageStart (-1 if none),
+ * and when the response is found, the offset just past its end is stored in messageEnd
+ */
 QString stk500::readCommandResponse(STK500::CMD command, const QByteArray &input,
-                                    char* response, int responseMaxLength, bool* hasResponse) {
+                                    char* response, int responseMaxLength, bool* hasResponse,
+                                    int* messageStart, int* messageEnd) {
 
     *hasResponse = false;
+    *messageStart = -1;
 
     const int MIN_MSG_LEN = 8;
     if (input.length() == 0) {
@@ -596,6 +684,9 @@ QString stk500::readCommandResponse(STK500::CMD command, const QByteArray &input
             }
             continue;
         }
+        if (*messageStart == -1) {
+            *messageStart = offset;
+        }
 
         // Token check
         if (data[4] != STK500::TOKEN) {
@@ -678,6 +769,7 @@ QString stk500::readCommandResponse(STK500::CMD command, const QByteArray &input
 
         // All alright; read in the data and reply with RESP: [len]
         memcpy(response, data + 7, std::min(responseMaxLength, (int) respLength));
+        *messageEnd = offset + msg_end_idx + 1;
         errorMessage = QString("RESP=%1").arg(respLength-2);
         break;
 
@@ -813,14 +905,121 @@ void stk500::FLASH_verifyCorrect(quint32 address, const char* src, int srcLen) {
 }
 
 void stk500::FLASH_upload(const ProgramData &programData) {
-    // Write data
-    for (quint32 address = 0; address < programData.sketchSize(); address += 256) {
-        FLASH_writePage(address, programData.sketchPage(address), 256);
+    // Only the pages that differ from the device are written; all of them if reading back fails
+    QVector<quint32> pages;
+    try {
+        pages = FLASH_changedPages(programData, 0, programData.sketchSize());
+    } catch (ProtocolException &) {
+        checkCancelled();
+        pages.clear();
+        for (quint32 address = 0; address < programData.sketchSize(); address += 256) {
+            pages.append(address);
+        }
+    }
+    QByteArray pageData(pages.count() * 256, (char) 0xFF);
+    for (int i = 0; i < pages.count(); i++) {
+        int len = std::min(256, (int) (programData.sketchSize() - pages[i]));
+        memcpy(pageData.data() + i * 256, programData.sketchPage(pages[i]), len);
+    }
+    // Write and verify in one pass, then correct the pages that failed
+    QVector<quint32> failed = FLASH_writeVerifyBatch(pages.constData(), pageData.constData(), pages.count());
+    for (int i = 0; i < failed.count(); i++) {
+        FLASH_verifyCorrect(failed[i], pageData.constData() + pages.indexOf(failed[i]) * 256, 256);
+    }
+}
+
+/* Adds a command to load the word address to the pipeline, if the address is not already current */
+static void appendLoadAddress(QVector<stk500PipelinedCommand> &commands, quint32 &address, quint32 wordAddress) {
+    if (address == wordAddress) {
+        return;
+    }
+    char arguments[4] = { (char) ((wordAddress >> 24) & 0xFF), (char) ((wordAddress >> 16) & 0xFF),
+                          (char) ((wordAddress >> 8) & 0xFF), (char) (wordAddress & 0xFF) };
+    stk500PipelinedCommand cmd;
+    cmd.command = STK500::LOAD_ADDRESS;
+    cmd.arguments = QByteArray(arguments, sizeof(arguments));
+    cmd.response = NULL;
+    cmd.responseMaxLength = 0;
+    commands.append(cmd);
+    address = wordAddress;
+}
+
+/*
+ * Reads several pages of flash into dest, one after the other, each of the length specified
+ * All address loads and reads are sent as a single pipeline; should that fail, the pages are
+ * read again one at a time. Returns whether the pipeline succeeded.
+ */
+bool stk500::FLASH_readBatch(const quint32 *addresses, char* dest, int count, int length) {
+    QVector<stk500PipelinedCommand> commands;
+    quint32 address = currentAddress;
+    for (int i = 0; i < count; i++) {
+        appendLoadAddress(commands, address, addresses[i] >> 1);
+        char arguments[2] = { (char) ((length >> 8) & 0xFF), (char) (length & 0xFF) };
+        stk500PipelinedCommand cmd;
+        cmd.command = STK500::READ_FLASH_ISP;
+        cmd.arguments = QByteArray(arguments, sizeof(arguments));
+        cmd.response = dest + i * length;
+        cmd.responseMaxLength = length;
+        commands.append(cmd);
+        address += length / 2;
+    }
+    try {
+        commandPipeline(commands.data(), commands.count());
+        currentAddress = address;
+        return true;
+    } catch (ProtocolException &) {
+        checkCancelled();
+        for (int i = 0; i < count; i++) {
+            FLASH_readPage(addresses[i], dest + i * length, length);
+        }
+        return false;
+    }
+}
+
+/*
+ * Writes several 256-byte pages of flash from src, then reads them all back in a single pipeline
+ * While a page is being written the device can not receive, so pages are written one at a time.
+ * Returns the addresses of the pages that did not read back as written.
+ */
+QVector<quint32> stk500::FLASH_writeVerifyBatch(const quint32 *addresses, const char* src, int count) {
+    for (int i = 0; i < count; i++) {
+        FLASH_writePage(addresses[i], src + i * 256, 256);
+    }
+    QByteArray readBack(count * 256, 0);
+    FLASH_readBatch(addresses, readBack.data(), count);
+
+    QVector<quint32> failed;
+    for (int i = 0; i < count; i++) {
+        if (memcmp(readBack.constData() + i * 256, src + i * 256, 256) != 0) {
+            failed.append(addresses[i]);
+        }
     }
-    // Verify and correct data
-    for (quint32 address = 0; address < programData.sketchSize(); address += 256) {
-        FLASH_verifyCorrect(address, programData.sketchPage(address), 256);
+    return failed;
+}
+
+/*
+ * Reads the sketch pages in the address range from the device, and finds the ones that differ
+ * The pages are read in a single pipeline, and compared to the program data padded with 0xFF
+ */
+QVector<quint32> stk500::FLASH_changedPages(const ProgramData &programData, quint32 address, quint32 endAddress) {
+    QVector<quint32> addresses;
+    for (quint32 pageAddress = address; pageAddress < endAddress; pageAddress += 256) {
+        addresses.append(pageAddress);
+    }
+    QByteArray devicePages(addresses.count() * 256, 0);
+    FLASH_readBatch(addresses.data(), devicePages.data(), addresses.count());
+
+    QVector<quint32> changed;
+    char pageData[256];
+    for (int i = 0; i < addresses.count(); i++) {
+        int len = std::max(0, std::min(256, (int) (programData.sketchSize() - addresses[i])));
+        memcpy(pageData, programData.sketchPage(addresses[i]), len);
+        memset(pageData + len, 0xFF, 256 - len);
+        if (memcmp(pageData, devicePages.data() + i * 256, 256) != 0) {
+            changed.append(addresses[i]);
+        }
     }
+    return changed;
 }
 
 void stk500::EEPROM_read(quint32 address, char* dest, int destLen) {
@@ -849,6 +1048,36 @@ void stk500::RAM_write(quint16 address, const char* src, int srcLen) {
     currentAddress += srcLen;
 }
 
+/*
+ * Reads several ranges of RAM into dest, one after the other
+ * All address loads and reads are sent as a single pipeline
+ */
+void stk500::RAM_readBatch(const quint16 *addresses, const int *lengths, char* dest, int count) {
+    QVector<stk500PipelinedCommand> commands;
+    quint32 address = currentAddress;
+    for (int i = 0; i < count; i++) {
+        stk500PipelinedCommand cmd;
+        if (address != addresses[i]) {
+            char arguments[4] = { 0, 0, (char) (addresses[i] >> 8), (char) (addresses[i] & 0xFF) };
+            cmd.command = STK500::LOAD_ADDRESS;
+            cmd.arguments = QByteArray(arguments, sizeof(arguments));
+            cmd.response = NULL;
+            cmd.responseMaxLength = 0;
+            commands.append(cmd);
+        }
+        char arguments[2] = { (char) ((lengths[i] >> 8) & 0xFF), (char) (lengths[i] & 0xFF) };
+        cmd.command = STK500::READ_RAM_ISP;
+        cmd.arguments = QByteArray(arguments, sizeof(arguments));
+        cmd.response = dest;
+        cmd.responseMaxLength = lengths[i];
+        commands.append(cmd);
+        dest += lengths[i];
+        address = addresses[i] + lengths[i];
+    }
+    commandPipeline(commands.data(), commands.count());
+    currentAddress = address;
+}
+
 quint8 stk500::RAM_readByte(quint16 address) {
     char output = 0x00;
     char arguments[2];
@@ -871,20 +1100,43 @@ quint8 stk500::RAM_writeByte(quint16 address, quint8 value, quint8 mask) {
 
 quint16 stk500::ANALOG_read(quint8 pin) {
     char output[2];
+    char arguments[3];
+    analogArguments(pin, arguments);
+
+    /* Use the analog read command */
+    command(STK500::READ_ANALOG_ISP, arguments, sizeof(arguments), output, sizeof(output));
+    return ((quint8) output[0] << 8) | (output[1] & 0xFF);
+}
+
+/* Reads several analog inputs, sending the next reads before the results of earlier ones are in */
+void stk500::ANALOG_readBatch(const quint8 *pins, quint16 *values, int count) {
+    QVector<stk500PipelinedCommand> commands(count);
+    QByteArray output(count * 2, 0);
+    char arguments[3];
+    for (int i = 0; i < count; i++) {
+        analogArguments(pins[i], arguments);
+        commands[i].command = STK500::READ_ANALOG_ISP;
+        commands[i].arguments = QByteArray(arguments, sizeof(arguments));
+        commands[i].response = output.data() + i * 2;
+        commands[i].responseMaxLength = 2;
+    }
+    commandPipeline(commands.data(), count);
+    for (int i = 0; i < count; i++) {
+        values[i] = ((quint8) output[i * 2] << 8) | (output[i * 2 + 1] & 0xFF);
+    }
+}
+
+/* Builds the arguments of the analog read command, setting up the ADC registers */
+void stk500::analogArguments(quint8 pin, char* arguments) {
     int analog_reference = 1;
 
     /* allow for channel or pin numbers */
     if (pin >= 54) pin -= 54;
 
     /* Setup the ADC registers to start a measurement */
-    unsigned char adcsra = 0x87 | (1 << 6);
-    unsigned char adcsrb = (pin & 0x8);
-    unsigned char admux = (analog_reference << 6) | (pin & 0x07);
-
-    /* Use the analog read command */
-    unsigned char arguments[3] = { adcsra, adcsrb, admux };
-    command(STK500::READ_ANALOG_ISP, (char*) arguments, sizeof(arguments), output, sizeof(output));
-    return (output[0] << 8) | (output[1] & 0xFF);
+    arguments[0] = (char) (0x87 | (1 << 6));
+    arguments[1] = (char) (pin & 0x8);
+    arguments[2] = (char) ((analog_reference << 6) | (pin & 0x07));
 }
 
 void stk500::SPI_transfer(const char *src, char* dest, int length) {
@@ -952,16 +1204,22 @@ QString stk500::phnTempFolder = "";
 
 QString stk500::getTempFile(const QString &filePath) {
     // Generate the temporary folder if needed
+    // Also called from the process threads, so only one thread may do so
+    static QMutex tempFolderLock;
+    tempFolderLock.lock();
     if (phnTempFolder.isEmpty()) {
-        phnTempFolder = QDir::tempPath() + "/phntk_cache.tmp";
+        QString folder = QDir::tempPath() + "/phntk_cache.tmp";
 
         // Make the directory
         QDir dir = QDir::root();
-        dir.mkpath(phnTempFolder);
+        dir.mkpath(folder);
+        phnTempFolder = folder;
     }
+    QString folder = phnTempFolder;
+    tempFolderLock.unlock();
 
     // Get the path
-    return phnTempFolder + "/" + getFileName(filePath);
+    return folder + "/" + getFileName(filePath);
 }
 
 QString stk500::getFileName(const QString &filePath) {
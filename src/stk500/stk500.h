@@ -7,6 +7,7 @@
 #include <QThread>
 #include <QMutex>
 #include <QWaitCondition>
+#include <QVector>
 #include <QDir>
 #include "stk500command.h"
 #include "stk500_fat.h"
@@ -20,6 +21,8 @@
 #define STK500_CMD_MIN_INTERVAL  100   // Minimal interval of commands to stay in bootloader mode
 #define STK500_SERVICE_DELAY     100   // Delay between signOut and service mode sketch ready
 #define STK500_BAUD           115200   // Default baud rate for the STK500 protocol
+#define STK500_YIELD_INTERVAL    250   // Minimal interval between tasks run while another task yields
+#define STK500_PIPELINE_DEPTH      2   // Maximum amount of commands sent ahead of their response
 
 // Pre-define components up front
 class stk500sd;
@@ -27,11 +30,19 @@ class stk500registers;
 class stk500service;
 class stk500StatusInterface;
 
+// A single command sent as part of a pipeline, see stk500::commandPipeline
+typedef struct stk500PipelinedCommand {
+    STK500::CMD command;
+    QByteArray arguments;
+    char* response;
+    int responseMaxLength;
+} stk500PipelinedCommand;
+
 // Main STK500 protocol handling class
 class stk500
 {
 public:
-    stk500(stk500StatusInterface *status_interface = NULL);
+    stk500(stk500StatusInterface *status_interface = NULL, stk500CancelToken *cancel_token = NULL);
     ~stk500();
     stk500Port* getPort() { return &port; }
     stk500sd& sd() { return *sd_handler; }
@@ -66,6 +77,9 @@ public:
     void FLASH_writePage(quint32 address, const char* src, int srcLen);
     void FLASH_verifyCorrect(quint32 address, const char* src, int srcLen);
     void FLASH_upload(const ProgramData &programData);
+    bool FLASH_readBatch(const quint32 *addresses, char* dest, int count, int length = 256);
+    QVector<quint32> FLASH_writeVerifyBatch(const quint32 *addresses, const char* src, int count);
+    QVector<quint32> FLASH_changedPages(const ProgramData &programData, quint32 address, quint32 endAddress);
     void EEPROM_read(quint32 address, char* dest, int destLen);
     void EEPROM_write(quint32 address, const char* src, int srcLen);
     void RAM_read(quint16 address, char* dest, int destLen);
@@ -73,6 +87,10 @@ public:
     quint8 RAM_readByte(quint16 address);
     quint8 RAM_writeByte(quint16 address, quint8 value, quint8 mask = 0xFF);
     quint16 ANALOG_read(quint8 adc);
+    void ANALOG_readBatch(const quint8 *pins, quint16 *values, int count);
+    void RAM_readBatch(const quint16 *addresses, const int *lengths, char* dest, int count);
+    void setPipelineDepth(int depth) { pipelineDepth = depth; }
+    int getPipelineDepth() const { return pipelineDepth; }
     void SPI_transfer(const char *src, char* dest, int length);
     void SERIAL_begin(int serialIdxA, int serialIdxB);
 
@@ -87,9 +105,14 @@ public:
 
 private:
     /* Private commands used internally */
+    void checkCancelled();
     int command(STK500::CMD command, const char* arguments, int argumentsLength, char* response, int responseMaxLength);
-    void commandWrite(STK500::CMD command, const char* arguments, int argumentsLength);
-    QString readCommandResponse(STK500::CMD command, const QByteArray &input, char* response, int responseMaxLength, bool* hasResponse);
+    int commandRead(STK500::CMD command, char* response, int responseMaxLength, QByteArray &receivedData);
+    void commandWrite(STK500::CMD command, const char* arguments, int argumentsLength, int sequenceOffset = 0);
+    void commandPipeline(stk500PipelinedCommand *commands, int count);
+    static void analogArguments(quint8 pin, char* arguments);
+    QString readCommandResponse(STK500::CMD command, const QByteArray &input, char* response, int responseMaxLength,
+                                bool* hasResponse, int* messageStart, int* messageEnd);
     void loadAddress(quint32 address);
     void readData(STK500::CMD data_command, quint32 address, char* dest, int destLen);
     void writeData(STK500::CMD data_command, quint32 address, const char* src, int srcLen);
@@ -106,6 +129,7 @@ private:
     qint64 lastCmdTime;
     qint64 lastResetTime;
     uint sequenceNumber;
+    int pipelineDepth;
     quint32 currentAddress;
     stk500sd *sd_handler;
     stk500registers *reg_handler;
@@ -113,7 +137,6 @@ private:
     stk500StatusInterface *status_interface;
     bool signedOn;
     STK500::State currentState;
-    QString commandNames[256];
 };
 
 // Exception thrown by the stk500 protocol if it gets into an error state
@@ -0,0 +1,161 @@
+#include "stk500pincapture.h"
+#include <QFile>
+#include <QTextStream>
+#include <QDateTime>
+#include <QRegExp>
+
+stk500PinCapture::stk500PinCapture() {
+    samples = 0;
+    lastTime = 0;
+}
+
+/*
+ * Sets the pins to capture, and groups their PIN registers into ranges to read
+ * Registers close to each other are read as a single range, the gap in between read along
+ */
+void stk500PinCapture::setPins(const QList<PinMapInfo> &pins) {
+    lock.lock();
+    capturedPins = pins.mid(0, PIN_CAPTURE_MAX_PINS);
+    addresses.clear();
+    lengths.clear();
+    pinOffsets.clear();
+    changes.clear();
+    samples = 0;
+
+    bool used[CHIPREG_BUFFSIZE] = { false };
+    for (int i = 0; i < capturedPins.count(); i++) {
+        used[capturedPins[i].addr_pin] = true;
+    }
+    int offsets[CHIPREG_BUFFSIZE];
+    int rangeOffset = 0;
+    for (int addr = 0; addr < CHIPREG_BUFFSIZE; addr++) {
+        if (!used[addr]) {
+            continue;
+        }
+        if (!addresses.isEmpty() && ((addr - (addresses.last() + lengths.last())) <= CHIPREG_READ_MAX_GAP)) {
+            lengths.last() = (addr - addresses.last() + 1);
+        } else {
+            rangeOffset += lengths.isEmpty() ? 0 : lengths.last();
+            addresses.append(addr);
+            lengths.append(1);
+        }
+        offsets[addr] = rangeOffset + (addr - addresses.last());
+    }
+    for (int i = 0; i < capturedPins.count(); i++) {
+        pinOffsets.append(offsets[capturedPins[i].addr_pin]);
+    }
+    lock.unlock();
+}
+
+/* Total amount of bytes read for all ranges */
+int stk500PinCapture::rangeTotalLength() const {
+    int total = 0;
+    for (int i = 0; i < lengths.count(); i++) {
+        total += lengths[i];
+    }
+    return total;
+}
+
+void stk500PinCapture::clear() {
+    lock.lock();
+    changes.clear();
+    samples = 0;
+    lock.unlock();
+}
+
+/*
+ * Records the data read for all ranges at a given time, storing it when pin states changed
+ * Returns false when no more changes can be recorded
+ */
+bool stk500PinCapture::record(qint64 time, const char* data) {
+    quint32 states = 0;
+    for (int i = 0; i < capturedPins.count(); i++) {
+        if (data[pinOffsets[i]] & capturedPins[i].addr_mask) {
+            states |= (1u << i);
+        }
+    }
+
+    lock.lock();
+    bool success = true;
+    samples++;
+    lastTime = time;
+    if (changes.isEmpty() || (changes.last().states != states)) {
+        if (changes.count() >= PIN_CAPTURE_MAX_CHANGES) {
+            success = false;
+        } else {
+            PinStateChange change;
+            change.time = time;
+            change.states = states;
+            changes.append(change);
+        }
+    }
+    lock.unlock();
+    return success;
+}
+
+int stk500PinCapture::changeCount() {
+    lock.lock();
+    int rval = changes.count();
+    lock.unlock();
+    return rval;
+}
+
+qint64 stk500PinCapture::sampleCount() {
+    lock.lock();
+    qint64 rval = samples;
+    lock.unlock();
+    return rval;
+}
+
+/*
+ * Writes all changes as a Value Change Dump, readable by GTKWave
+ * Every pin is a single-bit wire named after the pin, with times in microseconds
+ */
+bool stk500PinCapture::exportVCD(const QString &filePath) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return false;
+    }
+    lock.lock();
+    QVector<PinStateChange> data = changes;
+    qint64 endTime = lastTime;
+    lock.unlock();
+
+    QTextStream stream(&file);
+    stream << "$date " << QDateTime::currentDateTime().toString(Qt::ISODate) << " $end\n";
+    stream << "$version Phoenard Toolkit $end\n";
+    stream << "$timescale 1us $end\n";
+    stream << "$scope module phoenard $end\n";
+    for (int i = 0; i < capturedPins.count(); i++) {
+        const PinMapInfo &info = capturedPins[i];
+        QString name = info.name + "_" + info.port;
+        name.replace(QRegExp("[^A-Za-z0-9_]"), "_");
+        stream << "$var wire 1 " << (char) ('!' + i) << " " << name << " $end\n";
+    }
+    stream << "$upscope $end\n";
+    stream << "$enddefinitions $end\n";
+
+    // The first change holds the initial states, the others only the pins that toggled
+    for (int c = 0; c < data.count(); c++) {
+        quint32 toggled = (c == 0) ? 0xFFFFFFFF : (data[c].states ^ data[c - 1].states);
+        stream << "#" << (data[c].time - data[0].time) << "\n";
+        if (c == 0) {
+            stream << "$dumpvars\n";
+        }
+        for (int i = 0; i < capturedPins.count(); i++) {
+            if (toggled & (1u << i)) {
+                stream << ((data[c].states & (1u << i)) ? '1' : '0') << (char) ('!' + i) << "\n";
+            }
+        }
+        if (c == 0) {
+            stream << "$end\n";
+        }
+    }
+
+    // Mark the end of the capture, so the last states are shown up till then
+    if (!data.isEmpty() && (endTime > data.last().time)) {
+        stream << "#" << (endTime - data[0].time) << "\n";
+    }
+    stream.flush();
+    return (file.error() == QFile::NoError);
+}
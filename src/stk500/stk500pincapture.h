@@ -0,0 +1,54 @@
+#ifndef STK500PINCAPTURE_H
+#define STK500PINCAPTURE_H
+
+#include "stk500registers.h"
+#include <QVector>
+#include <QMutex>
+
+#define PIN_CAPTURE_MAX_PINS          32   // Maximum amount of pins captured at once
+#define PIN_CAPTURE_MAX_CHANGES  1000000   // Maximum amount of changes recorded before capturing stops
+
+// The states of all captured pins from a given time on
+typedef struct PinStateChange {
+    qint64 time;      // Time (in us) since the start of capturing
+    quint32 states;   // Pin states, one bit per captured pin
+} PinStateChange;
+
+/*
+ * Records the changes of digital pin states, and exports them as a VCD file
+ *
+ * The PIN registers of the pins captured are read in as few ranges as possible.
+ * The capture task on the process thread reads those ranges and records the
+ * data, while the GUI reads out the amount of changes at the same time.
+ */
+class stk500PinCapture
+{
+public:
+    stk500PinCapture();
+    void setPins(const QList<PinMapInfo> &pins);
+    const QList<PinMapInfo> &pins() const { return capturedPins; }
+    const QVector<quint16> &rangeAddresses() const { return addresses; }
+    const QVector<int> &rangeLengths() const { return lengths; }
+    int rangeTotalLength() const;
+    void clear();
+    bool record(qint64 time, const char* data);
+    int changeCount();
+    qint64 sampleCount();
+    bool exportVCD(const QString &filePath);
+
+private:
+    // copy ops are private to prevent copying
+    stk500PinCapture(const stk500PinCapture&); // no implementation
+    stk500PinCapture& operator=(const stk500PinCapture&); // no implementation
+
+    QMutex lock;
+    QList<PinMapInfo> capturedPins;
+    QVector<quint16> addresses;
+    QVector<int> lengths;
+    QVector<int> pinOffsets;
+    QVector<PinStateChange> changes;
+    qint64 samples;
+    qint64 lastTime;
+};
+
+#endif // STK500PINCAPTURE_H
@@ -4,6 +4,7 @@ stk500Port::stk500Port() {
     isNetMode = false;
     device = NULL;
     errorStr = "";
+    cancelToken = NULL;
 }
 
 stk500Port::~stk500Port() {
@@ -159,7 +160,7 @@ QByteArray stk500Port::read(int timeout) {
     QByteArray result;
     do {
         result = readStep();
-        if (!result.isEmpty()) {
+        if (!result.isEmpty() || isCancelled()) {
             break;
         }
     } while ((QDateTime::currentMSecsSinceEpoch() - start_time) < timeout);
@@ -171,12 +172,16 @@ QByteArray stk500Port::readAll(int timeout) {
     QByteArray data;
     do {
         data.append(readStep());
-    } while ((QDateTime::currentMSecsSinceEpoch() - start_time) < timeout);
+    } while (!isCancelled() && ((QDateTime::currentMSecsSinceEpoch() - start_time) < timeout));
     return data;
 }
 
-QByteArray stk500Port::readStep() {
-    device->waitForReadyRead(PORT_READ_STEP_TIME);
+QByteArray stk500Port::readStep(int waitTime) {
+    /* Don't wait for more data when cancelled, but do return what is available */
+    /* Waiting ends as soon as new data arrives */
+    if (!isCancelled()) {
+        device->waitForReadyRead(waitTime);
+    }
     return device->readAll();
 }
 
@@ -13,6 +13,12 @@
 // Amount of time (in ms) spent doing a single reading cycle
 #define PORT_READ_STEP_TIME 5
 
+// Token polled while waiting for data, allowing pending reads to be aborted from another thread
+class stk500CancelToken {
+public:
+    virtual bool isCancelled() { return false; }
+};
+
 class stk500Port
 {
 public:
@@ -28,13 +34,15 @@ public:
     QString portName();
     QByteArray readAll(int timeout);
     QByteArray read(int timeout);
-    QByteArray readStep();
+    QByteArray readStep(int waitTime = PORT_READ_STEP_TIME);
     int write(const char* buffer, int nrOfBytes);
     QString errorString();
     bool isOpen();
     bool isNet() const { return isNetMode; }
     bool isSerialPort() const;
     int readTimeout() const;
+    void setCancelToken(stk500CancelToken *token) { cancelToken = token; }
+    bool isCancelled() { return (cancelToken != NULL) && cancelToken->isCancelled(); }
 
     static QList<QString> getPortNames();
 
@@ -42,6 +50,7 @@ private:
     QIODevice *device;
     bool isNetMode;
     QString errorStr;
+    stk500CancelToken *cancelToken;
 };
 
 #endif // STK500PORT_H
@@ -0,0 +1,214 @@
+#include "stk500rammonitor.h"
+#include <QRegExp>
+
+#define RAM_WATCH_MAX_LENGTH   64   // Maximum amount of bytes shown by a single watch
+
+stk500RamMonitor::stk500RamMonitor() {
+    visibleStart = 0;
+    visibleEnd = -1;
+    clear();
+}
+
+void stk500RamMonitor::clear() {
+    lock.lock();
+    memset(ramData, 0, sizeof(ramData));
+    memset(ramKnown, 0, sizeof(ramKnown));
+    pollInterval = RAM_MONITOR_MIN_INTERVAL;
+    pollBytes = 0;
+    polls = 0;
+    lock.unlock();
+}
+
+/* Sets the range of addresses in view, which are read along with the watches */
+void stk500RamMonitor::setVisible(int start, int end) {
+    lock.lock();
+    visibleStart = qMax(start, RAM_MONITOR_START);
+    visibleEnd = qMin(end, RAM_MONITOR_END);
+    lock.unlock();
+}
+
+void stk500RamMonitor::setWatches(const QList<RamWatch> &watches) {
+    lock.lock();
+    watchList = watches;
+    lock.unlock();
+}
+
+/*
+ * Gets the ranges of addresses to read next
+ * Addresses close to each other are read as a single range, the gap in between read along
+ */
+void stk500RamMonitor::ranges(QVector<quint16> &addresses, QVector<int> &lengths) {
+    bool used[RAM_MONITOR_SIZE] = { false };
+    lock.lock();
+    for (int addr = visibleStart; addr <= visibleEnd; addr++) {
+        used[addr] = true;
+    }
+    for (int i = 0; i < watchList.count(); i++) {
+        const RamWatch &watch = watchList[i];
+        for (int addr = watch.address; (addr < (watch.address + watch.length)) && (addr < RAM_MONITOR_SIZE); addr++) {
+            used[addr] = true;
+        }
+    }
+    lock.unlock();
+
+    addresses.clear();
+    lengths.clear();
+    for (int addr = RAM_MONITOR_START; addr < RAM_MONITOR_SIZE; addr++) {
+        if (!used[addr]) {
+            continue;
+        }
+        if (!addresses.isEmpty() && ((addr - (addresses.last() + lengths.last())) <= CHIPREG_READ_MAX_GAP) &&
+                ((addr - addresses.last()) < RAM_MONITOR_MAX_READ)) {
+            lengths.last() = (addr - addresses.last() + 1);
+        } else {
+            addresses.append(addr);
+            lengths.append(1);
+        }
+    }
+}
+
+/* Stores the ranges read, and derives the time to wait before the next poll from the time (in us) it took */
+void stk500RamMonitor::store(const QVector<quint16> &addresses, const QVector<int> &lengths, const char* data, qint64 pollTime) {
+    lock.lock();
+    int total = 0;
+    for (int i = 0; i < addresses.count(); i++) {
+        memcpy(ramData + addresses[i], data + total, lengths[i]);
+        memset(ramKnown + addresses[i], 1, lengths[i]);
+        total += lengths[i];
+    }
+    int interval = (int) (pollTime * (100 - RAM_MONITOR_LINK_SHARE) / RAM_MONITOR_LINK_SHARE / 1000);
+    pollInterval = qBound(RAM_MONITOR_MIN_INTERVAL, interval, RAM_MONITOR_MAX_INTERVAL);
+    pollBytes = total;
+    polls++;
+    lock.unlock();
+}
+
+/* Copies the RAM data, and which addresses were read at least once */
+void stk500RamMonitor::snapshot(quint8 *data, bool *known) {
+    lock.lock();
+    memcpy(data, ramData, sizeof(ramData));
+    memcpy(known, ramKnown, sizeof(ramKnown));
+    lock.unlock();
+}
+
+int stk500RamMonitor::interval() {
+    lock.lock();
+    int rval = pollInterval;
+    lock.unlock();
+    return rval;
+}
+
+int stk500RamMonitor::bytesPerPoll() {
+    lock.lock();
+    int rval = pollBytes;
+    lock.unlock();
+    return rval;
+}
+
+qint64 stk500RamMonitor::pollCount() {
+    lock.lock();
+    qint64 rval = polls;
+    lock.unlock();
+    return rval;
+}
+
+/*
+ * Parses a watch expression: an address or symbol name, optionally followed by an
+ * offset and the type to show it as. For example: 0x300, counter:u16, buffer+4:char[8]
+ * Without a type, the type follows from the size of the symbol
+ */
+bool stk500RamMonitor::parseWatch(const QString &text, const ElfSymbols &symbols, RamWatch &watch, QString &error) {
+    QRegExp pattern("^\\s*([A-Za-z_][\\w.$]*|0x[0-9A-Fa-f]+|\\d+)\\s*(\\+\\s*(0x[0-9A-Fa-f]+|\\d+))?"
+                    "\\s*(:\\s*(u8|i8|u16|i16|u32|i32|float|char|bytes)\\s*(\\[\\s*(\\d+)\\s*\\])?)?\\s*$");
+    if (!pattern.exactMatch(text)) {
+        error = "Expected an address or symbol, optionally followed by +offset and :type";
+        return false;
+    }
+    QString location = pattern.cap(1);
+    QString type = pattern.cap(5);
+    int symbolSize = 0;
+    bool isNumber;
+    watch.expression = text.trimmed();
+    watch.address = location.toInt(&isNumber, 0);
+    if (!isNumber) {
+        const ElfSymbol *symbol = symbols.find(location);
+        if ((symbol == NULL) || !symbol->isData) {
+            error = "Unknown variable " + location;
+            return false;
+        }
+        watch.address = symbol->address;
+        symbolSize = symbol->size;
+    }
+    if (!pattern.cap(3).isEmpty()) {
+        watch.address += pattern.cap(3).toInt(&isNumber, 0);
+        symbolSize = 0;
+    }
+
+    if (type.isEmpty()) {
+        type = (symbolSize == 2) ? "u16" : (symbolSize == 4) ? "u32" : (symbolSize > 4) ? "bytes" : "u8";
+    }
+    const char* typeNames[] = { "u8", "i8", "u16", "i16", "u32", "i32", "float", "char", "bytes" };
+    const int typeLengths[] = { 1, 1, 2, 2, 4, 4, 4, 0, 0 };
+    watch.type = RAM_WATCH_U8;
+    watch.length = 0;
+    for (int i = 0; i <= RAM_WATCH_BYTES; i++) {
+        if (type == typeNames[i]) {
+            watch.type = (RamWatchType) i;
+            watch.length = typeLengths[i];
+        }
+    }
+    if (watch.length == 0) {
+        // Text and bytes are as long as given, or as long as the symbol
+        watch.length = pattern.cap(7).isEmpty() ? (symbolSize ? symbolSize : 16) : pattern.cap(7).toInt();
+        watch.length = qBound(1, watch.length, RAM_WATCH_MAX_LENGTH);
+    }
+    // The I/O registers below the SRAM are not watched: reading UDRn, SPDR and the like has side effects
+    if ((watch.address < RAM_MONITOR_START) || ((watch.address + watch.length - 1) > RAM_MONITOR_END)) {
+        error = QString("Address 0x%1 is outside of the RAM").arg(watch.address, 4, 16, QChar('0'));
+        return false;
+    }
+    return true;
+}
+
+/* Formats the value of a watch from the RAM data, all values are stored little-endian */
+QString stk500RamMonitor::formatWatch(const RamWatch &watch, const quint8 *data) {
+    const quint8 *value = data + watch.address;
+    quint32 number = 0;
+    for (int i = qMin(watch.length, 4) - 1; i >= 0; i--) {
+        number = (number << 8) | value[i];
+    }
+    switch (watch.type) {
+    case RAM_WATCH_U8:
+    case RAM_WATCH_U16:
+    case RAM_WATCH_U32:
+        return QString::number(number);
+    case RAM_WATCH_I8:
+        return QString::number((qint8) number);
+    case RAM_WATCH_I16:
+        return QString::number((qint16) number);
+    case RAM_WATCH_I32:
+        return QString::number((qint32) number);
+    case RAM_WATCH_FLOAT:
+    {
+        float f;
+        memcpy(&f, &number, sizeof(f));
+        return QString::number(f);
+    }
+    case RAM_WATCH_CHAR:
+        return "\"" + QString::fromLatin1((const char*) value, qstrnlen((const char*) value, watch.length)) + "\"";
+    case RAM_WATCH_BYTES:
+    {
+        QString text;
+        for (int i = 0; i < watch.length; i++) {
+            text += QString("%1 ").arg(value[i], 2, 16, QChar('0')).toUpper();
+        }
+        return text.trimmed();
+    }
+    }
+    return QString();
+}
+
+QString stk500RamMonitor::typeName(RamWatchType type) {
+    const char* names[] = { "uint8", "int8", "uint16", "int16", "uint32", "int32", "float", "char[]", "bytes" };
+    return names[type];
+}
@@ -0,0 +1,79 @@
+#ifndef STK500RAMMONITOR_H
+#define STK500RAMMONITOR_H
+
+#include "stk500registers.h"
+#include "elfsymbols.h"
+#include <QMutex>
+#include <QVector>
+
+#define RAM_MONITOR_START         0x200   // First address of the SRAM
+#define RAM_MONITOR_END          0x21FF   // Last address of the SRAM
+#define RAM_MONITOR_SIZE  (RAM_MONITOR_END + 1)
+#define RAM_MONITOR_MAX_READ        512   // Maximum amount of bytes read by a single command
+#define RAM_MONITOR_BATCH_SIZE     1024   // Maximum amount of bytes read in a single pipeline
+#define RAM_MONITOR_LINK_SHARE       50   // Share of the link time (in percent) spent on polling
+#define RAM_MONITOR_MIN_INTERVAL     20   // Minimal time (in ms) between two polls
+#define RAM_MONITOR_MAX_INTERVAL    200   // Maximum time (in ms) between two polls, keeps the bootloader active
+
+// The ways the value of a watched address is shown
+enum RamWatchType {
+    RAM_WATCH_U8,
+    RAM_WATCH_I8,
+    RAM_WATCH_U16,
+    RAM_WATCH_I16,
+    RAM_WATCH_U32,
+    RAM_WATCH_I32,
+    RAM_WATCH_FLOAT,
+    RAM_WATCH_CHAR,    // Text, up to the first null character
+    RAM_WATCH_BYTES    // Bytes in hexadecimal
+};
+
+typedef struct RamWatch {
+    QString expression;
+    int address;
+    int length;
+    RamWatchType type;
+} RamWatch;
+
+/*
+ * Live copy of the device RAM, refreshed by the monitor task
+ *
+ * Only the addresses in view and the addresses watched are read, grouped into as few
+ * ranges as possible. The time between two polls follows the time a poll takes,
+ * so polling uses a fixed share of the link no matter how much is read.
+ */
+class stk500RamMonitor
+{
+public:
+    stk500RamMonitor();
+    void clear();
+    void setVisible(int start, int end);
+    void setWatches(const QList<RamWatch> &watches);
+    void ranges(QVector<quint16> &addresses, QVector<int> &lengths);
+    void store(const QVector<quint16> &addresses, const QVector<int> &lengths, const char* data, qint64 pollTime);
+    void snapshot(quint8 *data, bool *known);
+    int interval();
+    int bytesPerPoll();
+    qint64 pollCount();
+
+    static bool parseWatch(const QString &text, const ElfSymbols &symbols, RamWatch &watch, QString &error);
+    static QString formatWatch(const RamWatch &watch, const quint8 *data);
+    static QString typeName(RamWatchType type);
+
+private:
+    // copy ops are private to prevent copying
+    stk500RamMonitor(const stk500RamMonitor&); // no implementation
+    stk500RamMonitor& operator=(const stk500RamMonitor&); // no implementation
+
+    QMutex lock;
+    quint8 ramData[RAM_MONITOR_SIZE];
+    bool ramKnown[RAM_MONITOR_SIZE];
+    int visibleStart;
+    int visibleEnd;
+    QList<RamWatch> watchList;
+    int pollInterval;
+    int pollBytes;
+    qint64 polls;
+};
+
+#endif // STK500RAMMONITOR_H
@@ -0,0 +1,118 @@
+#include "stk500ramprofile.h"
+
+stk500RamProfile::stk500RamProfile() {
+    heapStartAddr = -1;
+    brkvalAddr = -1;
+    regionStartAddr = 0;
+    regionEndAddr = -1;
+    analyzed = false;
+    heapEnd = 0;
+    stackStart = 0;
+    brkvalRead = 0;
+    stackPointerRead = 0;
+    footprintCount = 0;
+}
+
+/* Finds the start of the heap, and the heap end pointer malloc keeps, in the symbols of the sketch */
+bool stk500RamProfile::setSymbols(const ElfSymbols &symbols, QString &error) {
+    const ElfSymbol *heapStartSymbol = symbols.find("__heap_start");
+    const ElfSymbol *brkvalSymbol = symbols.find("__brkval");
+    if ((heapStartSymbol == NULL) || !heapStartSymbol->isData) {
+        error = "The sketch has no __heap_start symbol";
+        return false;
+    }
+    if ((heapStartSymbol->address < RAM_MONITOR_START) || (heapStartSymbol->address > RAM_MONITOR_END)) {
+        error = "The heap of the sketch starts outside of the RAM";
+        return false;
+    }
+    heapStartAddr = heapStartSymbol->address;
+    brkvalAddr = ((brkvalSymbol != NULL) && brkvalSymbol->isData) ? (int) brkvalSymbol->address : -1;
+    analyzed = false;
+    return true;
+}
+
+void stk500RamProfile::setRegion(int start, int end) {
+    regionStartAddr = start;
+    regionEndAddr = end;
+    footprint.clear();
+    footprintCount = 0;
+    analyzed = false;
+}
+
+/* Marks the bytes of the region that no longer hold the canary after only resetting the device */
+void stk500RamProfile::setFootprint(const QByteArray &data) {
+    footprint = QByteArray(regionLength(), 0);
+    footprintCount = 0;
+    for (int i = 0; i < qMin(data.length(), footprint.length()); i++) {
+        if ((quint8) data[i] != RAM_PROFILE_CANARY) {
+            footprint[i] = 1;
+            footprintCount++;
+        }
+    }
+}
+
+void stk500RamProfile::analyze(const QByteArray &data, int brkval, int stackPointer) {
+    int length = qMin(data.length(), regionLength());
+    const char* mask = (footprint.length() >= length) ? footprint.constData() : NULL;
+
+    // Going up from the heap start, the heap ends before the first run of intact canary
+    heapEnd = regionStartAddr;
+    int run = 0;
+    for (int i = 0; (i < length) && (run < RAM_PROFILE_CANARY_RUN); i++) {
+        if (mask && mask[i]) {
+            continue;
+        }
+        if ((quint8) data[i] == RAM_PROFILE_CANARY) {
+            run++;
+        } else {
+            heapEnd = regionStartAddr + i + 1;
+            run = 0;
+        }
+    }
+
+    // Going down from the top, the stack ends after the first run of intact canary
+    stackStart = regionStartAddr + length;
+    run = 0;
+    for (int i = length - 1; (i >= 0) && (run < RAM_PROFILE_CANARY_RUN); i--) {
+        if (mask && mask[i]) {
+            continue;
+        }
+        if ((quint8) data[i] == RAM_PROFILE_CANARY) {
+            run++;
+        } else {
+            stackStart = regionStartAddr + i;
+            run = 0;
+        }
+    }
+    brkvalRead = brkval;
+    stackPointerRead = stackPointer;
+    analyzed = true;
+}
+
+QString stk500RamProfile::report() const {
+    if (!analyzed) {
+        return QString();
+    }
+    QString text;
+    text += QString("Heap: %1 bytes, 0x%2 - 0x%3\n").arg(heapBytes())
+            .arg(heapStartAddr, 4, 16, QChar('0')).arg(qMax(heapStartAddr, heapEnd - 1), 4, 16, QChar('0'));
+    if (stackStart > regionEndAddr) {
+        // The stack never reached the RAM that was seeded
+        text += QString("Stack: at most %1 bytes, it stayed above the RAM seeded\n").arg(stackBytes());
+    } else {
+        text += QString("Stack: %1 bytes, 0x%2 - 0x%3\n").arg(stackBytes())
+                .arg(stackStart, 4, 16, QChar('0')).arg(RAM_MONITOR_END, 4, 16, QChar('0'));
+    }
+    if (heapEnd > stackStart) {
+        text += "Free: none, the heap and stack collided\n";
+    } else {
+        text += QString("Free: %1 bytes at the lowest\n").arg(freeBytes());
+    }
+    if ((brkvalAddr != -1) && (brkvalRead >= heapStartAddr) && (brkvalRead <= RAM_MONITOR_END)) {
+        text += QString("Heap end kept by malloc (__brkval): 0x%1\n").arg(brkvalRead, 4, 16, QChar('0'));
+    }
+    text += QString("Seeded 0x%1 - 0x%2, %3 bytes used by the bootloader were left out\n")
+            .arg(regionStartAddr, 4, 16, QChar('0')).arg(regionEndAddr, 4, 16, QChar('0')).arg(footprintCount);
+    text += QString("Stack pointer after re-entering the bootloader: 0x%1").arg(stackPointerRead, 4, 16, QChar('0'));
+    return text;
+}
@@ -0,0 +1,55 @@
+#ifndef STK500RAMPROFILE_H
+#define STK500RAMPROFILE_H
+
+#include "elfsymbols.h"
+#include "stk500rammonitor.h"
+#include <QByteArray>
+
+#define RAM_PROFILE_CANARY        0xC5   // Value the free RAM is filled with
+#define RAM_PROFILE_CANARY_RUN       8   // Intact canary bytes in a row that end the heap or stack in use
+#define RAM_PROFILE_SP_MARGIN       64   // Bytes below the stack pointer of the bootloader left alone
+#define RAM_PROFILE_WRITE_SIZE     512   // Maximum amount of bytes seeded by a single RAM write
+
+/*
+ * Measures how far the heap and stack of a sketch grew, using a canary pattern
+ *
+ * The free RAM between the start of the heap and the stack is filled with the
+ * canary before the sketch runs. Afterwards, the heap ends where the canary is
+ * found intact going up from the heap start, and the stack ends where it is found
+ * intact going down from the top. Bytes the bootloader itself changes when the
+ * device is reset are measured up front, and are left out of the scan.
+ */
+class stk500RamProfile
+{
+public:
+    stk500RamProfile();
+    bool setSymbols(const ElfSymbols &symbols, QString &error);
+    int heapStart() const { return heapStartAddr; }
+    int brkvalAddress() const { return brkvalAddr; }
+    void setRegion(int start, int end);
+    int regionStart() const { return regionStartAddr; }
+    int regionEnd() const { return regionEndAddr; }
+    int regionLength() const { return regionEndAddr - regionStartAddr + 1; }
+    void setFootprint(const QByteArray &data);
+    void analyze(const QByteArray &data, int brkval, int stackPointer);
+    bool isAnalyzed() const { return analyzed; }
+    int heapBytes() const { return heapEnd - heapStartAddr; }
+    int stackBytes() const { return RAM_MONITOR_END + 1 - stackStart; }
+    int freeBytes() const { return qMax(0, stackStart - heapEnd); }
+    QString report() const;
+
+private:
+    int heapStartAddr;
+    int brkvalAddr;
+    int regionStartAddr;
+    int regionEndAddr;
+    QByteArray footprint;
+    bool analyzed;
+    int heapEnd;       // First address after the heap in use
+    int stackStart;    // Lowest address of the stack in use
+    int brkvalRead;
+    int stackPointerRead;
+    int footprintCount;
+};
+
+#endif // STK500RAMPROFILE_H
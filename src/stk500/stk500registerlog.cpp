@@ -0,0 +1,209 @@
+#include "stk500registerlog.h"
+#include <QFile>
+
+#define REGISTER_LOG_MAX_GAP  2   // Unchanged registers stored along to join two runs
+
+stk500RegisterLog::stk500RegisterLog() {
+    clear();
+}
+
+void stk500RegisterLog::clear() {
+    stream.clear();
+    records.clear();
+    memset(lastState, 0, sizeof(lastState));
+}
+
+void stk500RegisterLog::writeNumber(quint64 value) {
+    while (value >= 0x80) {
+        stream.append((char) ((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    stream.append((char) value);
+}
+
+bool stk500RegisterLog::readNumber(const char* &data, const char* end, quint64 &value) {
+    value = 0;
+    for (int shift = 0; (data < end) && (shift < 64); shift += 7) {
+        quint8 b = (quint8) *(data++);
+        value |= ((quint64) (b & 0x7F) << shift);
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Appends the registers read at a given time, storing the changes since the last record */
+void stk500RegisterLog::record(qint64 time, const quint8 *regData) {
+    RegisterLogRecord rec;
+    rec.time = time;
+    rec.offset = (quint32) stream.size();
+    rec.keyframe = ((records.count() % REGISTER_LOG_KEYFRAME_INTERVAL) == 0);
+
+    // Keyframes store all registers that are not zero
+    quint8 base[CHIPREG_BUFFSIZE];
+    if (rec.keyframe) {
+        memset(base, 0, sizeof(base));
+    } else {
+        memcpy(base, lastState, sizeof(base));
+    }
+
+    // Find the runs of changed registers, joining runs with small gaps in between
+    QVector<int> runStart;
+    QVector<int> runLength;
+    for (int addr = 0; addr < CHIPREG_BUFFSIZE; addr++) {
+        if (regData[addr] == base[addr]) {
+            continue;
+        }
+        if (!runStart.isEmpty() && ((addr - (runStart.last() + runLength.last())) <= REGISTER_LOG_MAX_GAP)) {
+            runLength.last() = (addr - runStart.last() + 1);
+        } else {
+            runStart.append(addr);
+            runLength.append(1);
+        }
+    }
+
+    qint64 lastTime = records.isEmpty() ? 0 : records.last().time;
+    stream.append((char) (rec.keyframe ? 1 : 0));
+    writeNumber((quint64) qMax((qint64) 0, time - lastTime));
+    writeNumber(runStart.count());
+    int addr = 0;
+    for (int i = 0; i < runStart.count(); i++) {
+        writeNumber(runStart[i] - addr);
+        writeNumber(runLength[i]);
+        stream.append((const char*) regData + runStart[i], runLength[i]);
+        addr = runStart[i] + runLength[i];
+    }
+
+    records.append(rec);
+    memcpy(lastState, regData, sizeof(lastState));
+}
+
+/*
+ * Decodes a single record, applying the registers stored to regData
+ * For keyframes, regData is cleared first. Returns false when the record is incomplete.
+ */
+bool stk500RegisterLog::decodeRecord(const char* &data, const char* end, quint8 *regData, qint64 *timeDelta, bool *keyframe) {
+    quint64 delta, runs, skip, length;
+    if (data >= end) {
+        return false;
+    }
+    *keyframe = (*(data++) & 1);
+    if (!readNumber(data, end, delta) || !readNumber(data, end, runs)) {
+        return false;
+    }
+    *timeDelta = (qint64) delta;
+    if (*keyframe) {
+        memset(regData, 0, CHIPREG_BUFFSIZE);
+    }
+    quint64 addr = 0;
+    for (quint64 i = 0; i < runs; i++) {
+        if (!readNumber(data, end, skip) || !readNumber(data, end, length)) {
+            return false;
+        }
+        addr += skip;
+        if (((addr + length) > CHIPREG_BUFFSIZE) || ((quint64) (end - data) < length)) {
+            return false;
+        }
+        memcpy(regData + addr, data, length);
+        data += length;
+        addr += length;
+    }
+    return true;
+}
+
+/* Index of the last record read at or before a given time */
+int stk500RegisterLog::indexAt(qint64 time) const {
+    int low = 0;
+    int high = records.count() - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (records[mid].time <= time) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+/* Gets the state of all registers at a record, decoding from the keyframe before it */
+void stk500RegisterLog::stateAt(int index, quint8 *regData) const {
+    memset(regData, 0, CHIPREG_BUFFSIZE);
+    if ((index < 0) || (index >= records.count())) {
+        return;
+    }
+    int keyIndex = index - (index % REGISTER_LOG_KEYFRAME_INTERVAL);
+    const char* data = stream.constData() + records[keyIndex].offset;
+    const char* end = stream.constData() + stream.size();
+    qint64 timeDelta;
+    bool keyframe;
+    for (int i = keyIndex; i <= index; i++) {
+        if (!decodeRecord(data, end, regData, &timeDelta, &keyframe)) {
+            break;
+        }
+    }
+}
+
+/*
+ * Session file format: the "PHNREG01" header, the amount of registers per
+ * state (4 bytes, little-endian), followed by the records as stored in memory
+ */
+bool stk500RegisterLog::save(const QString &filePath) const {
+    QFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    quint32 regCount = CHIPREG_BUFFSIZE;
+    char header[12] = { 'P', 'H', 'N', 'R', 'E', 'G', '0', '1' };
+    for (int i = 0; i < 4; i++) {
+        header[8 + i] = (char) ((regCount >> (i * 8)) & 0xFF);
+    }
+    file.write(header, sizeof(header));
+    file.write(stream);
+    return (file.error() == QFile::NoError);
+}
+
+bool stk500RegisterLog::load(const QString &filePath) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QByteArray data = file.readAll();
+    if (!data.startsWith("PHNREG01") || (data.size() < 12)) {
+        return false;
+    }
+    quint32 regCount = 0;
+    for (int i = 0; i < 4; i++) {
+        regCount |= ((quint32) (quint8) data[8 + i] << (i * 8));
+    }
+    if (regCount != CHIPREG_BUFFSIZE) {
+        return false;
+    }
+
+    // Read all records to rebuild the record index and the last state
+    clear();
+    stream = data.mid(12);
+    const char* start = stream.constData();
+    const char* pos = start;
+    const char* end = start + stream.size();
+    const char* valid = start;
+    quint8 state[CHIPREG_BUFFSIZE];
+    qint64 time = 0;
+    while (pos < end) {
+        RegisterLogRecord rec;
+        qint64 timeDelta;
+        rec.offset = (quint32) (pos - start);
+        memcpy(state, lastState, sizeof(state));
+        if (!decodeRecord(pos, end, state, &timeDelta, &rec.keyframe)) {
+            break;
+        }
+        memcpy(lastState, state, sizeof(lastState));
+        time += timeDelta;
+        rec.time = time;
+        records.append(rec);
+        valid = pos;
+    }
+    stream.truncate(valid - start);
+    return !records.isEmpty();
+}
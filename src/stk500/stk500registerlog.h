@@ -0,0 +1,52 @@
+#ifndef STK500REGISTERLOG_H
+#define STK500REGISTERLOG_H
+
+#include <QString>
+#include <QVector>
+#include <QByteArray>
+#include "stk500registers.h"
+
+#define REGISTER_LOG_KEYFRAME_INTERVAL  256   // Amount of records between two full register states
+
+// Position of a single record in the delta stream
+typedef struct RegisterLogRecord {
+    qint64 time;     // Time (ms since epoch) the registers were read
+    quint32 offset;  // Offset of the record into the delta stream
+    bool keyframe;   // Whether the record holds all registers, instead of the changes
+} RegisterLogRecord;
+
+/*
+ * Session log of the register states read over time
+ *
+ * Every record only stores the runs of registers that changed since the record
+ * before it, with every so many records holding all registers instead. Going to
+ * a record decodes forward from the keyframe before it. A record is stored as:
+ * a flags byte (1 = keyframe), the time since the previous record (ms), the
+ * amount of runs, then for every run the amount of registers skipped, the run
+ * length and the register values. All numbers are stored as 7-bit varints.
+ */
+class stk500RegisterLog
+{
+public:
+    stk500RegisterLog();
+    void clear();
+    void record(qint64 time, const quint8 *regData);
+    int count() const { return records.count(); }
+    qint64 size() const { return stream.size(); }
+    qint64 time(int index) const { return records[index].time; }
+    int indexAt(qint64 time) const;
+    void stateAt(int index, quint8 *regData) const;
+    bool save(const QString &filePath) const;
+    bool load(const QString &filePath);
+
+private:
+    void writeNumber(quint64 value);
+    static bool readNumber(const char* &data, const char* end, quint64 &value);
+    static bool decodeRecord(const char* &data, const char* end, quint8 *regData, qint64 *timeDelta, bool *keyframe);
+
+    QByteArray stream;
+    QVector<RegisterLogRecord> records;
+    quint8 lastState[CHIPREG_BUFFSIZE];
+};
+
+#endif // STK500REGISTERLOG_H
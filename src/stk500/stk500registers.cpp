@@ -1,4 +1,5 @@
 #include "stk500registers.h"
+#include "chiptables.h"
 
 bool ChipRegisters::registerInfoInit = false;
 ChipRegisterInfo ChipRegisters::registerInfo[CHIPREG_BUFFSIZE];
@@ -7,40 +8,67 @@ ChipRegisterInfo ChipRegisters::registerInfoHeader;
 QList<PinMapInfo> ChipRegisters::pinmapInfo;
 PinMapInfo ChipRegisters::pinmapInfoHeader;
 
+// Registers where writing has side effects: pins toggle, flags clear when writing a one,
+// data is sent or a timed sequence starts. Writing them as part of a larger block would
+// write back the bits read earlier, so only the changed bits are written.
+static const char* const sensitiveRegisterNames[] = {
+    "PINA", "PINB", "PINC", "PIND", "PINE", "PINF", "PING", "PINH", "PINJ", "PINK", "PINL",
+    "TIFR0", "TIFR1", "TIFR2", "TIFR3", "TIFR4", "TIFR5", "PCIFR", "EIFR",
+    "UCSR0A", "UCSR1A", "UCSR2A", "UCSR3A", "UDR0", "UDR1", "UDR2", "UDR3",
+    "SPSR", "SPDR", "TWCR", "TWDR", "EECR", "ADCSRA", "ACSR", "GTCCR",
+    "SPMCSR", "MCUSR", "WDTCSR", "CLKPR", "SPL", "SPH", "SREG",
+    NULL
+};
+
+// Registers changed by the chip itself, polled at the live interval at least and
+// never written along with changes to other registers
+static const char* const liveRegisterPrefixes[] = {
+    "PIN", "TIFR", "TCNT", "ICR", "ADC", "UCSR", "TWSR", "TWCR", "EIFR", "PCIFR", "SPSR", "EECR",
+    NULL
+};
+
+// 16-bit registers sharing the TEMP register: the high byte must be written first
+static const char* const wordRegisterPrefixes[] = {
+    "TCNT", "ICR", "OCR",
+    NULL
+};
+
+/* Gets a string from the generated string pool, without copying it */
+static QString chipString(unsigned short offset) {
+    const char16_t *text = chipStringPool + offset;
+    int length = 0;
+    while (text[length]) length++;
+    return QString::fromRawData(reinterpret_cast<const QChar*>(text), length);
+}
+
+/* FNV-1a hash of a name, must match name_hash() in data/chiptables.py */
+static quint32 chipNameHash(const QString &name, quint32 hash) {
+    for (int i = 0; i < name.length(); i++) {
+        hash ^= name[i].unicode();
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static quint32 chipPinHash(const QString &module, const QString &function, quint32 seed) {
+    quint32 hash = chipNameHash(module, 2166136261u ^ seed);
+    hash ^= 0x1F;
+    hash *= 16777619u;
+    return chipNameHash(function, hash);
+}
+
 void ChipRegisters::initRegisters() {
     if (registerInfoInit) return;
     registerInfoInit = true;
 
     // Default entry if none exists
-    ChipRegisterInfo defaultEntry;
-
-    // Read all entries
-    QList<ChipRegisterInfo> entries;
-    QFile registersFile(":/data/registers.csv");
-    if (registersFile.open(QIODevice::ReadOnly)) {
-        QTextStream textStream(&registersFile);
-        while (!textStream.atEnd()) {
-            // Read the next entry
-            ChipRegisterInfo entry(textStream.readLine().split(","));
-
-            // Handle different entry types
-            if (entry.address == "OTHER") {
-                // OTHER default constant
-                defaultEntry = entry;
-            } else if (entry.addressValue == -1) {
-                // Header - no valid address
-                registerInfoHeader = entry;
-            } else {
-                // Entry with valid address
-                entries.append(entry);
-            }
-        }
-        registersFile.close();
-    }
+    ChipRegisterInfo defaultEntry(chipRegisterDefault);
+    registerInfoHeader.load(chipRegisterHeader);
 
     // Initialize all register info entries to the default values
     for (int addr = 0; addr < CHIPREG_BUFFSIZE; addr++) {
         registerInfo[addr] = defaultEntry;
+        registerInfo[addr].reserved = true;
         registerInfo[addr].addressValue = addr;
         registerInfo[addr].address = stk500::getHexText(addr);
         registerInfo[addr].values[0] = registerInfo[addr].address;
@@ -49,17 +77,44 @@ void ChipRegisters::initRegisters() {
     // Store all entries at the addresses
     int index = 0;
 
-    for (int i = 0; i < entries.count(); i++) {
-        ChipRegisterInfo &entry = entries[i];
-        int addr = entry.addressValue;
+    for (int i = 0; i < CHIPTABLE_REGISTER_COUNT; i++) {
+        int addr = chipRegisters[i].address;
         if ((addr >= 0) && (addr < CHIPREG_COUNT)) {
-            registerInfo[addr] = entry;
+            registerInfo[addr].load(chipRegisters[i]);
             registerInfo[addr].index = index;
             registerInfoByIndex[index] = &registerInfo[addr];
             index++;
         }
     }
 
+    // Mark the registers that can not be written as part of a block
+    for (int addr = 0; addr < CHIPREG_BUFFSIZE; addr++) {
+        for (int p = 0; liveRegisterPrefixes[p]; p++) {
+            if (registerInfo[addr].name.startsWith(liveRegisterPrefixes[p])) {
+                registerInfo[addr].live = true;
+            }
+        }
+    }
+    for (int i = 0; sensitiveRegisterNames[i]; i++) {
+        int addr = findRegisterAddress(sensitiveRegisterNames[i]);
+        if (addr != -1) {
+            registerInfo[addr].sensitive = true;
+        }
+    }
+    for (int i = 0; i < CHIPTABLE_REGISTER_COUNT; i++) {
+        QString name = chipString(chipRegisters[i].values[3]);
+        for (int p = 0; wordRegisterPrefixes[p]; p++) {
+            if (!name.startsWith(wordRegisterPrefixes[p]) || !name.endsWith("L")) {
+                continue;
+            }
+            int addr = findRegisterAddress(name);
+            if ((addr != -1) && (findRegisterAddress(name.left(name.length() - 1) + "H") == (addr + 1))) {
+                registerInfo[addr].sensitive = registerInfo[addr + 1].sensitive = true;
+                registerInfo[addr].wordLow = true;
+            }
+        }
+    }
+
     // Fill the remaining entries with the 'OTHER' registers
     for (int i = CHIPREG_ADDR_START; i < CHIPREG_BUFFSIZE; i++) {
         if (registerInfo[i].index == -1) {
@@ -69,45 +124,34 @@ void ChipRegisters::initRegisters() {
         }
     }
 
-    // Load all registers into a list
+    // Load all pins into a list
+    pinmapInfoHeader.load(chipPinHeader);
     pinmapInfo = QList<PinMapInfo>();
-    QFile pinmapFile(":/data/pinmapping.csv");
-    if (pinmapFile.open(QIODevice::ReadOnly)) {
-        QTextStream textStream(&pinmapFile);
-        while (!textStream.atEnd()) {
-            // Read the next entry
-            PinMapInfo entry(textStream.readLine().split(","));
-            if (entry.pin == -1) {
-                // Header
-                pinmapInfoHeader = entry;
-            } else {
-                // Add valid entry
-                pinmapInfo.append(entry);
-            }
-        }
-        pinmapFile.close();
+    for (int i = 0; i < CHIPTABLE_PIN_COUNT; i++) {
+        pinmapInfo.append(PinMapInfo(chipPins[i]));
     }
 }
 
 /* Pin Mapping information element initialization and logic */
 
 PinMapInfo::PinMapInfo() {
-    load(QStringList());
+    index = -1;
+    pin = -1;
+    addr_pin = addr_ddr = addr_port = -1;
+    addr_mask = 0;
 }
 
-PinMapInfo::PinMapInfo(const QStringList &values) {
-    load(values);
+PinMapInfo::PinMapInfo(const ChipPinEntry &entry) {
+    load(entry);
 }
 
-void PinMapInfo::load(const QStringList &values) {
+void PinMapInfo::load(const ChipPinEntry &entry) {
     for (int i = 0; i < PINMAP_DATA_COLUMNS; i++) {
-        this->values[i] = (i < values.count()) ? values[i] : "-";
+        this->values[i] = chipString(entry.values[i]);
     }
 
-    // Parse the pin number
-    bool pinSucc = false;
-    this->pin = this->values[4].toInt(&pinSucc, 10);
-    if (!pinSucc) this->pin = -1;
+    this->index = -1;
+    this->pin = entry.pin;
 
     // Textual values
     this->name = this->values[3];
@@ -115,33 +159,38 @@ void PinMapInfo::load(const QStringList &values) {
     this->function = this->values[2];
     this->port = this->values[0];
 
-    // Parse port name into the addresses and mask to use
-    this->addr_pin = this->addr_ddr = this->addr_port = -1;
-    this->addr_mask = 0;
-    if (this->port.length() == 2) {
-        this->addr_mask = (1 << this->port.right(1).toInt());
-        this->addr_pin = ChipRegisters::findRegisterAddress("PIN" + this->port[0]);
-        this->addr_ddr = ChipRegisters::findRegisterAddress("DDR" + this->port[0]);
-        this->addr_port = ChipRegisters::findRegisterAddress("PORT" + this->port[0]);
-    }
+    // Addresses and mask of the port, resolved when generating the tables
+    this->addr_pin = entry.addr_pin;
+    this->addr_ddr = entry.addr_ddr;
+    this->addr_port = entry.addr_port;
+    this->addr_mask = entry.addr_mask;
 }
 
 /* Chip register information element initialization and logic */
 
 ChipRegisterInfo::ChipRegisterInfo() {
-    load(QStringList());
+    index = -1;
+    addressValue = -1;
+    sensitive = false;
+    wordLow = false;
+    live = false;
+    reserved = false;
 }
 
-ChipRegisterInfo::ChipRegisterInfo(const QStringList &values) {
-    load(values);
+ChipRegisterInfo::ChipRegisterInfo(const ChipRegisterEntry &entry) {
+    load(entry);
 }
 
-void ChipRegisterInfo::load(const QStringList &values) {
+void ChipRegisterInfo::load(const ChipRegisterEntry &entry) {
     for (int i = 0; i < CHIPREG_DATA_COLUMNS; i++) {
-        this->values[i] = (i < values.count()) ? values[i] : "-";
+        this->values[i] = chipString(entry.values[i]);
     }
 
     this->index = -1;
+    this->sensitive = false;
+    this->wordLow = false;
+    this->live = false;
+    this->reserved = false;
     this->address = this->values[0];
     this->module = this->values[1];
     this->function = this->values[2];
@@ -149,9 +198,7 @@ void ChipRegisterInfo::load(const QStringList &values) {
     for (int i = 0; i < 8; i++) {
         this->bitNames[7-i] = this->values[i + 4];
     }
-    bool succ = false;
-    this->addressValue = this->address.toInt(&succ, 16);
-    if (!succ) this->addressValue = -1;
+    this->addressValue = entry.address;
 }
 
 /* Chip register container initialization and properties */
@@ -161,9 +208,17 @@ ChipRegisters::ChipRegisters() {
     memset(regDataLast, 0, sizeof(regDataLast));
     memset(regDataRead, 0, sizeof(regDataRead));
     memset(regDataError, 0, sizeof(regDataError));
+    memset(regDataFresh, 0, sizeof(regDataFresh));
     memset(analogData, 0, sizeof(analogData));
     analogDataIndex = 0;
     regDataWasRead = false;
+    setPolledAll(true);
+}
+
+void ChipRegisters::setPolledAll(bool polled) {
+    for (int i = 0; i < CHIPREG_BUFFSIZE; i++) {
+        regDataPolled[i] = polled;
+    }
 }
 
 bool ChipRegisters::changed(int address) {
@@ -175,6 +230,10 @@ quint8 ChipRegisters::error(int address) {
     return regDataError[address];
 }
 
+bool ChipRegisters::hasChanges() const {
+    return memcmp(regDataLast, regData, sizeof(regData)) != 0;
+}
+
 bool ChipRegisters::hasUserChanges() {
     return memcmp(regDataRead, regData, sizeof(regData)) != 0;
 }
@@ -187,6 +246,14 @@ void ChipRegisters::resetChanges() {
     memcpy(regDataLast, regDataRead, sizeof(regDataRead));
 }
 
+/*
+ * Takes over the changes as the values known to be on the device
+ * Used after writing the changes out without reading them back
+ */
+void ChipRegisters::acceptUserChanges() {
+    memcpy(regDataRead, regData, sizeof(regData));
+}
+
 void ChipRegisters::applyUserChanges(const ChipRegisters& other) {
     for (int i = 0; i < CHIPREG_BUFFSIZE; i++) {
         quint8 changeMask = other.regData[i] ^ other.regDataRead[i];
@@ -230,12 +297,15 @@ const PinMapInfo &ChipRegisters::pinmapHeader() {
     return pinmapInfoHeader;
 }
 
+/*
+ * Finds the address of a register by name using the generated perfect hash table
+ * The name is hashed to find the seed of its bucket, then hashed with that seed to find its slot
+ */
 int ChipRegisters::findRegisterAddress(const QString &name) {
-    initRegisters();
-    for (int i = 0; i < CHIPREG_COUNT; i++) {
-        if (registerInfoByIndex[i]->name == name) {
-            return registerInfoByIndex[i]->addressValue;
-        }
+    quint32 seed = chipRegisterSeeds[chipNameHash(name, 2166136261u) & (CHIPTABLE_REGISTER_BUCKETS - 1)];
+    int row = chipRegisterSlots[chipNameHash(name, 2166136261u ^ seed) & (CHIPTABLE_REGISTER_SLOTS - 1)];
+    if ((row != -1) && (chipRegisters[row].address < CHIPREG_COUNT) && (chipString(chipRegisters[row].values[3]) == name)) {
+        return chipRegisters[row].address;
     }
     qDebug() << "Register not found:" << name;
     return -1;
@@ -243,8 +313,10 @@ int ChipRegisters::findRegisterAddress(const QString &name) {
 
 PinMapInfo &ChipRegisters::findPinInfo(const QString module, const QString &function) {
     initRegisters();
-    for (int i = 0; i < pinmapInfo.count(); i++) {
-        PinMapInfo &info = pinmapInfo[i];
+    quint32 seed = chipPinSeeds[chipPinHash(module, function, 0) & (CHIPTABLE_PIN_BUCKETS - 1)];
+    int row = chipPinSlots[chipPinHash(module, function, seed) & (CHIPTABLE_PIN_SLOTS - 1)];
+    if (row != -1) {
+        PinMapInfo &info = pinmapInfo[row];
         if ((info.module == module) && (info.function == function)) {
             return info;
         }
@@ -253,6 +325,10 @@ PinMapInfo &ChipRegisters::findPinInfo(const QString module, const QString &func
     return pinmapInfoHeader;
 }
 
+QString ChipRegisters::commandName(quint8 command) {
+    return chipString(chipCommandNames[command]);
+}
+
 PinMapInfo &ChipRegisters::findPinInfo(int pin) {
     initRegisters();
     for (int i = 0; i < pinmapInfo.count(); i++) {
@@ -349,6 +425,27 @@ bool ChipRegisters::getChangedRange(int* address, int* count) {
     return found;
 }
 
+/*
+ * Whether the register can be written as a whole, as part of a block of registers
+ * When registers were never read, only the changed bits are known
+ */
+bool ChipRegisters::canWriteWhole(int address) {
+    if (info(address).sensitive) {
+        return false;
+    }
+    return regDataWasRead || (changeMask(address) == 0xFF);
+}
+
+/*
+ * Whether an unchanged register can be written along to join two runs of changes
+ * Only registers with a known purpose that the chip does not change by itself, and
+ * of which the value was refreshed by the last read, are written back unchanged
+ */
+bool ChipRegisters::canWriteAlong(int address) {
+    const ChipRegisterInfo &regInfo = info(address);
+    return !regInfo.sensitive && !regInfo.live && !regInfo.reserved && regDataFresh[address];
+}
+
 void ChipRegisters::setupUART(int idx, qint32 baudRate) {
     // Calculate baud rate register value
     qreal F_CPU = 16000000;
@@ -370,43 +467,170 @@ void ChipRegisters::setupUART(int idx, qint32 baudRate) {
     set(QString("UBRR%1H").arg(n), baudData >> 8);
 }
 
-/* stk500 Register handler functions */
+/* Register polling rate control */
 
-void stk500registers::write(ChipRegisters &registers) {
-    // For any bytes that differ, write the byte to the chip
-    // Only write out the bits that changed for added safety
-    // When done, reset the value to the read one
+ChipRegisterPoller::ChipRegisterPoller() {
+    ChipRegisters reg;
+    for (int addr = 0; addr < CHIPREG_BUFFSIZE; addr++) {
+        maxInterval[addr] = CHIPREG_POLL_MAX_INTERVAL;
+        if (reg.info(addr).live) {
+            maxInterval[addr] = CHIPREG_POLL_LIVE_INTERVAL;
+        }
+    }
+    reset();
+}
+
+void ChipRegisterPoller::reset() {
+    for (int addr = 0; addr < CHIPREG_BUFFSIZE; addr++) {
+        visible[addr] = visibleLast[addr] = false;
+        interval[addr] = CHIPREG_POLL_MIN_INTERVAL;
+        nextTime[addr] = 0;
+    }
+    lastSweepTime = -CHIPREG_POLL_SWEEP_INTERVAL;
+}
+
+void ChipRegisterPoller::clearVisible() {
+    memcpy(visibleLast, visible, sizeof(visible));
+    memset(visible, 0, sizeof(visible));
+}
+
+void ChipRegisterPoller::setVisible(int address) {
+    if ((address >= CHIPREG_ADDR_START) && (address < CHIPREG_BUFFSIZE)) {
+        visible[address] = true;
+    }
+}
+
+void ChipRegisterPoller::select(ChipRegisters &registers, qint64 now) {
+    if ((now - lastSweepTime) >= CHIPREG_POLL_SWEEP_INTERVAL) {
+        lastSweepTime = now;
+        registers.setPolledAll(true);
+        return;
+    }
+
+    // Registers that just came into view are polled right away
     for (int addr = CHIPREG_ADDR_START; addr < CHIPREG_BUFFSIZE; addr++) {
-        quint8 changeMask = registers.regData[addr] ^ registers.regDataRead[addr];
-        if (changeMask) {
-            _handler->RAM_writeByte(addr, registers[addr], changeMask);
+        bool due = visible[addr] && (!visibleLast[addr] || (now >= nextTime[addr]));
+        registers.setPolled(addr, due || registers.changeMask(addr));
+    }
+}
+
+void ChipRegisterPoller::update(ChipRegisters &registers, qint64 now) {
+    for (int addr = CHIPREG_ADDR_START; addr < CHIPREG_BUFFSIZE; addr++) {
+        if (!registers.polled(addr)) {
+            continue;
         }
+        if (registers.changed(addr) || registers.error(addr)) {
+            interval[addr] = CHIPREG_POLL_MIN_INTERVAL;
+        } else {
+            interval[addr] = qMin(interval[addr] * 2, maxInterval[addr]);
+        }
+        nextTime[addr] = now + interval[addr];
     }
 }
 
-void stk500registers::read(ChipRegisters &registers) {
-    // Read the latest registers
-    char reg[CHIPREG_COUNT];
-    _handler->RAM_read(CHIPREG_ADDR_START, reg, CHIPREG_COUNT);
+/* stk500 Register handler functions */
 
-    // Store the previously read values into the last registers
-    memcpy(registers.regDataLast, registers.regDataRead, sizeof(registers.regDataLast));
+void stk500registers::write(ChipRegisters &registers) {
+    // Changes are grouped into runs of registers that can be written as a whole,
+    // and written using a single RAM write. Small gaps of unchanged registers are
+    // written along with them, when their current value is known. All other changes
+    // are written one byte at a time, only writing out the bits that changed for
+    // added safety.
+    int addr = CHIPREG_ADDR_START;
+    while (addr < CHIPREG_BUFFSIZE) {
+        if (!registers.changeMask(addr)) {
+            addr++;
+            continue;
+        }
+        if (!registers.canWriteWhole(addr)) {
+            if (registers.info(addr - 1).wordLow) {
+                // High byte of a 16-bit register changed, the low byte is unchanged
+                writeMasked(registers, addr - 1);
+                addr++;
+            } else {
+                writeMasked(registers, addr);
+                addr += registers.info(addr).wordLow ? 2 : 1;
+            }
+            continue;
+        }
 
-    // Refresh the registers
-    memcpy(registers.regDataRead + CHIPREG_ADDR_START, reg, CHIPREG_COUNT);
+        // Find the end of the run
+        int runEnd = addr + 1;
+        for (int next = runEnd; (next < CHIPREG_BUFFSIZE) && ((next - runEnd) < CHIPREG_WRITE_MAX_GAP); next++) {
+            if (!registers.canWriteWhole(next)) {
+                break;
+            }
+            if (registers.changeMask(next)) {
+                runEnd = next + 1;
+            } else if (!registers.canWriteAlong(next)) {
+                // Unchanged registers can only be written along when their value is known
+                break;
+            }
+        }
 
-    // Compare the last written values to the newly read values
-    // If there is a difference, we failed to write those particular bits
-    for (int i = CHIPREG_ADDR_START; i < CHIPREG_BUFFSIZE; i++) {
-        if (registers.regDataLast[i] != registers.regData[i]) {
-            registers.regDataError[i] = (registers.regDataRead[i] ^ registers.regData[i]);
+        int runLength = runEnd - addr;
+        if (runLength == 1) {
+            _handler->RAM_writeByte(addr, registers[addr], 0xFF);
         } else {
-            registers.regDataError[i] = 0;
+            _handler->RAM_write(addr, (char*) registers.regData + addr, runLength);
+        }
+        addr = runEnd;
+    }
+}
+
+void stk500registers::writeMasked(ChipRegisters &registers, int address) {
+    // 16-bit registers: the high byte is held until the low byte is written, so both
+    // are written, high byte first. Reading them back would change the held byte,
+    // so they are written as a whole when known.
+    if (registers.info(address).wordLow) {
+        quint8 fullMask = registers.regDataWasRead ? 0xFF : 0x00;
+        _handler->RAM_writeByte(address + 1, registers[address + 1], fullMask | registers.changeMask(address + 1));
+        _handler->RAM_writeByte(address, registers[address], fullMask | registers.changeMask(address));
+    } else {
+        _handler->RAM_writeByte(address, registers[address], registers.changeMask(address));
+    }
+}
+
+void stk500registers::read(ChipRegisters &registers) {
+    // Read the polled registers, joining ranges separated by small gaps
+    char reg[CHIPREG_BUFFSIZE];
+    bool regRead[CHIPREG_BUFFSIZE];
+    memset(regRead, 0, sizeof(regRead));
+    int addr = CHIPREG_ADDR_START;
+    while (addr < CHIPREG_BUFFSIZE) {
+        if (!registers.polled(addr)) {
+            addr++;
+            continue;
+        }
+        int rangeEnd = addr + 1;
+        for (int next = rangeEnd; (next < CHIPREG_BUFFSIZE) && ((next - rangeEnd) < CHIPREG_READ_MAX_GAP); next++) {
+            if (registers.polled(next)) {
+                rangeEnd = next + 1;
+            }
         }
+        _handler->RAM_read(addr, reg + addr, rangeEnd - addr);
+        memset(regRead + addr, 1, rangeEnd - addr);
+        addr = rangeEnd;
     }
 
-    // Synchronize the current register values with the last ones read
-    memcpy(registers.regData, registers.regDataRead, sizeof(registers.regData));
+    for (int i = CHIPREG_ADDR_START; i < CHIPREG_BUFFSIZE; i++) {
+        // Store the previously read value as the last one
+        registers.regDataLast[i] = registers.regDataRead[i];
+        registers.regDataFresh[i] = regRead[i];
+        if (regRead[i]) {
+            // Refresh the register, and compare the last written value to the newly read value
+            // If there is a difference, we failed to write those particular bits
+            registers.regDataRead[i] = (quint8) reg[i];
+            if (registers.regDataLast[i] != registers.regData[i]) {
+                registers.regDataError[i] = (registers.regDataRead[i] ^ registers.regData[i]);
+            } else {
+                registers.regDataError[i] = 0;
+            }
+        }
+
+        // Synchronize the current register value with the last one read
+        registers.regData[i] = registers.regDataRead[i];
+    }
 
     // Mark as read
     registers.regDataWasRead = true;
@@ -12,11 +12,22 @@
 #define PINMAP_DATA_COLUMNS   5
 #define ANALOG_PIN_COUNT      16
 #define ANALOG_PIN_INCREMENT  4
+#define CHIPREG_WRITE_MAX_GAP 4   // Unchanged registers written along to join two runs of changes
+#define CHIPREG_READ_MAX_GAP  8   // Registers not polled read along to join two ranges
+
+#define CHIPREG_POLL_MIN_INTERVAL     20   // Refresh interval (ms) of registers that just changed
+#define CHIPREG_POLL_MAX_INTERVAL   1000   // Refresh interval (ms) of registers that stay the same
+#define CHIPREG_POLL_LIVE_INTERVAL   100   // Maximum refresh interval (ms) of inputs, counters and flags
+#define CHIPREG_POLL_SWEEP_INTERVAL 5000   // Interval (ms) at which all registers are read
+
+// Entries of the tables generated from the CSV files in data/, see chiptables.h
+struct ChipRegisterEntry;
+struct ChipPinEntry;
 
 typedef struct ChipRegisterInfo {
     ChipRegisterInfo();
-    ChipRegisterInfo(const QStringList &values);
-    void load(const QStringList &values);
+    ChipRegisterInfo(const ChipRegisterEntry &entry);
+    void load(const ChipRegisterEntry &entry);
 
     QString values[CHIPREG_DATA_COLUMNS];
     int index;
@@ -26,12 +37,16 @@ typedef struct ChipRegisterInfo {
     QString module;
     QString function;
     QString bitNames[8];
+    bool sensitive;   // Writing has side effects, only write changed bits one byte at a time
+    bool wordLow;     // Low byte of a 16-bit register, the high byte is written before it
+    bool live;        // Changed by the chip itself, never written along with other registers
+    bool reserved;    // Not described in the register table, its purpose is unknown
 } ChipRegisterInfo;
 
 typedef struct PinMapInfo {
     PinMapInfo();
-    PinMapInfo(const QStringList &values);
-    void load(const QStringList &values);
+    PinMapInfo(const ChipPinEntry &entry);
+    void load(const ChipPinEntry &entry);
 
     QString values[PINMAP_DATA_COLUMNS];
     int index;
@@ -53,9 +68,17 @@ public:
     void resetUserChanges();
     void resetChanges();
     void applyUserChanges(const ChipRegisters& other);
+    void acceptUserChanges();
     bool changed(int address);
     bool hasUserChanges();
+    bool hasChanges() const;
     bool getChangedRange(int* address, int* count);
+    quint8 changeMask(int address) const { return regData[address] ^ regDataRead[address]; }
+    bool canWriteWhole(int address);
+    bool canWriteAlong(int address);
+    bool polled(int address) const { return regDataPolled[address]; }
+    void setPolled(int address, bool polled) { regDataPolled[address] = polled; }
+    void setPolledAll(bool polled);
     quint8* data(int addrStart = CHIPREG_ADDR_START) { return regData + addrStart; }
     quint8 error(int address);
     quint16 analog(int pinNr) const { return analogData[pinNr]; }
@@ -88,6 +111,7 @@ public:
     static int findRegisterAddress(const QString &name);
     static PinMapInfo &findPinInfo(const QString module, const QString &function);
     static PinMapInfo &findPinInfo(int pin);
+    static QString commandName(quint8 command);
 
     friend class stk500registers;
 
@@ -99,6 +123,8 @@ protected:
     quint16 analogData[ANALOG_PIN_COUNT];  // Live updates analog input values
     quint8 analogDataIndex;                // Index of the analog pin to be refreshed next
     bool regDataWasRead;                   // Whether the register data was previously read
+    bool regDataPolled[CHIPREG_BUFFSIZE];  // Registers refreshed by the next read
+    bool regDataFresh[CHIPREG_BUFFSIZE];   // Registers refreshed by the last read
 private:
     static void initRegisters();
     static ChipRegisterInfo registerInfo[CHIPREG_BUFFSIZE];
@@ -109,6 +135,33 @@ private:
     static bool registerInfoInit;
 };
 
+/*
+ * Decides which registers are refreshed by the next read
+ *
+ * Only the registers shown are polled, each at its own rate. A register that
+ * stays the same is polled less and less often, while registers that change
+ * are polled at the fastest rate. Inputs, counters and flags are never polled
+ * slower than the live interval. All registers are read in a periodic sweep,
+ * and registers changed by the user are always read back.
+ */
+class ChipRegisterPoller {
+public:
+    ChipRegisterPoller();
+    void reset();
+    void clearVisible();
+    void setVisible(int address);
+    void select(ChipRegisters &registers, qint64 now);
+    void update(ChipRegisters &registers, qint64 now);
+
+private:
+    bool visible[CHIPREG_BUFFSIZE];
+    bool visibleLast[CHIPREG_BUFFSIZE];
+    int maxInterval[CHIPREG_BUFFSIZE];
+    int interval[CHIPREG_BUFFSIZE];
+    qint64 nextTime[CHIPREG_BUFFSIZE];
+    qint64 lastSweepTime;
+};
+
 class stk500registers
 {
 public:
@@ -118,6 +171,8 @@ public:
     void readADC(ChipRegisters &registers);
 
 private:
+    void writeMasked(ChipRegisters &registers, int address);
+
     stk500 *_handler;
 };
 
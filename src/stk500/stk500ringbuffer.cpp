@@ -0,0 +1,100 @@
+#include "stk500ringbuffer.h"
+#include <string.h>
+
+stk500RingBuffer::stk500RingBuffer(int capacity) {
+    /* Round the capacity up to a power of two so positions can be masked */
+    _capacity = 1;
+    while (_capacity < capacity) {
+        _capacity <<= 1;
+    }
+    _mask = _capacity - 1;
+    _buffer = new char[_capacity];
+}
+
+stk500RingBuffer::~stk500RingBuffer() {
+    delete[] _buffer;
+}
+
+int stk500RingBuffer::available() {
+    /* Positions wrap around at 2^32, the unsigned difference stays correct */
+    return (int) ((uint) _head.loadAcquire() - (uint) _tail.loadAcquire());
+}
+
+int stk500RingBuffer::space() {
+    return _capacity - available();
+}
+
+int stk500RingBuffer::write(const char* data, int length) {
+    uint head = (uint) _head.load();
+    uint tail = (uint) _tail.loadAcquire();
+    int free = _capacity - (int) (head - tail);
+    if (length > free) {
+        length = free;
+    }
+    if (length <= 0) {
+        return 0;
+    }
+
+    /* Copy in up to two parts when wrapping around the end */
+    int offset = (int) (head & _mask);
+    int firstLen = qMin(length, _capacity - offset);
+    memcpy(_buffer + offset, data, firstLen);
+    memcpy(_buffer, data + firstLen, length - firstLen);
+
+    /* Publish the data to the consumer */
+    _head.storeRelease((int) (head + length));
+    return length;
+}
+
+void stk500RingBuffer::discard() {
+    _discardHead.storeRelease(_head.load());
+    _discardPending.storeRelease(1);
+}
+
+void stk500RingBuffer::handleDiscard() {
+    if (_discardPending.loadAcquire() && _discardPending.testAndSetOrdered(1, 0)) {
+        /* Data read meanwhile was not discarded, never move back */
+        uint discardHead = (uint) _discardHead.loadAcquire();
+        uint tail = (uint) _tail.load();
+        if ((int) (discardHead - tail) > 0) {
+            _tail.storeRelease((int) discardHead);
+        }
+    }
+}
+
+int stk500RingBuffer::peek(char* data, int length) {
+    handleDiscard();
+    uint tail = (uint) _tail.load();
+    uint head = (uint) _head.loadAcquire();
+    int count = (int) (head - tail);
+    if (length > count) {
+        length = count;
+    }
+    if (length <= 0) {
+        return 0;
+    }
+
+    /* Copy out in up to two parts when wrapping around the end */
+    int offset = (int) (tail & _mask);
+    int firstLen = qMin(length, _capacity - offset);
+    memcpy(data, _buffer + offset, firstLen);
+    memcpy(data + firstLen, _buffer, length - firstLen);
+    return length;
+}
+
+void stk500RingBuffer::skip(int length) {
+    if (length > 0) {
+        _tail.storeRelease(_tail.load() + length);
+    }
+}
+
+int stk500RingBuffer::read(char* data, int length) {
+    int count = peek(data, length);
+    skip(count);
+    return count;
+}
+
+void stk500RingBuffer::clear() {
+    _discardPending.storeRelease(0);
+    _tail.storeRelease(_head.loadAcquire());
+}
@@ -0,0 +1,51 @@
+#ifndef STK500RINGBUFFER_H
+#define STK500RINGBUFFER_H
+
+#include <QAtomicInt>
+
+/*
+ * Fixed-capacity ring buffer used to pass data between exactly one producer thread
+ * and exactly one consumer thread without locking. The capacity must be a power of two.
+ *
+ * Only the producer may call write() and discard(), only the consumer may call read(),
+ * peek(), skip() and clear(). available() and space() can be called from both sides,
+ * though the result is only a lower bound for the side that did not call it.
+ */
+class stk500RingBuffer
+{
+public:
+    stk500RingBuffer(int capacity);
+    ~stk500RingBuffer();
+
+    /* Producer side */
+    int write(const char* data, int length);
+    void discard();
+
+    /* Consumer side */
+    int read(char* data, int length);
+    int peek(char* data, int length);
+    void skip(int length);
+    void clear();
+
+    int available();
+    int space();
+    int capacity() const { return _capacity; }
+    bool isEmpty() { return available() == 0; }
+
+private:
+    void handleDiscard();
+
+    // copy ops are private to prevent copying
+    stk500RingBuffer(const stk500RingBuffer&); // no implementation
+    stk500RingBuffer& operator=(const stk500RingBuffer&); // no implementation
+
+    char *_buffer;
+    int _capacity;
+    int _mask;
+    QAtomicInt _head;          // Total bytes written, only changed by the producer
+    QAtomicInt _tail;          // Total bytes read, only changed by the consumer
+    QAtomicInt _discardHead;   // Head position up until which data is to be discarded
+    QAtomicInt _discardPending;
+};
+
+#endif // STK500RINGBUFFER_H
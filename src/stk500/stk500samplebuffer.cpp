@@ -0,0 +1,107 @@
+#include "stk500samplebuffer.h"
+#include <QFile>
+#include <QTextStream>
+#include <QDataStream>
+
+stk500SampleBuffer::stk500SampleBuffer(int capacity) {
+    this->capacity = capacity;
+    this->ring.resize(capacity);
+    clear();
+}
+
+void stk500SampleBuffer::clear() {
+    lock.lock();
+    head = 0;
+    length = 0;
+    totalCount = 0;
+    lock.unlock();
+}
+
+void stk500SampleBuffer::append(const AnalogSample *samples, int count) {
+    lock.lock();
+    for (int i = 0; i < count; i++) {
+        ring[head] = samples[i];
+        head = (head + 1) % capacity;
+    }
+    length = qMin(capacity, length + count);
+    totalCount += count;
+    lock.unlock();
+}
+
+int stk500SampleBuffer::count() {
+    lock.lock();
+    int rval = length;
+    lock.unlock();
+    return rval;
+}
+
+/* Total amount of samples appended since cleared, including the ones discarded */
+qint64 stk500SampleBuffer::total() {
+    lock.lock();
+    qint64 rval = totalCount;
+    lock.unlock();
+    return rval;
+}
+
+/* All samples kept, oldest first */
+QVector<AnalogSample> stk500SampleBuffer::samples() {
+    lock.lock();
+    QVector<AnalogSample> rval(length);
+    int start = (head - length + capacity) % capacity;
+    for (int i = 0; i < length; i++) {
+        rval[i] = ring[(start + i) % capacity];
+    }
+    lock.unlock();
+    return rval;
+}
+
+/* Samples taken within a time span before the most recent one, oldest first */
+QVector<AnalogSample> stk500SampleBuffer::latest(qint64 timeSpan) {
+    lock.lock();
+    int found = 0;
+    qint64 fromTime = (length == 0) ? 0 : (ring[(head - 1 + capacity) % capacity].time - timeSpan);
+    while ((found < length) && (ring[(head - found - 1 + capacity) % capacity].time >= fromTime)) {
+        found++;
+    }
+    QVector<AnalogSample> rval(found);
+    for (int i = 0; i < found; i++) {
+        rval[i] = ring[(head - found + i + capacity) % capacity];
+    }
+    lock.unlock();
+    return rval;
+}
+
+bool stk500SampleBuffer::exportCSV(const QString &filePath) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return false;
+    }
+    QVector<AnalogSample> data = samples();
+    QTextStream stream(&file);
+    stream << "time_us,channel,value\n";
+    for (int i = 0; i < data.count(); i++) {
+        stream << data[i].time << "," << data[i].channel << "," << data[i].value << "\n";
+    }
+    stream.flush();
+    return (file.error() == QFile::NoError);
+}
+
+/*
+ * Binary format: the "PHNADC01" header and sample count, followed by all samples
+ * Every sample is stored little-endian as time (us, 8 bytes), channel (1 byte) and value (2 bytes)
+ */
+bool stk500SampleBuffer::exportBinary(const QString &filePath) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    QVector<AnalogSample> data = samples();
+    file.write("PHNADC01", 8);
+    QDataStream stream(&file);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream << (quint32) data.count();
+    for (int i = 0; i < data.count(); i++) {
+        stream << (qint64) data[i].time << (quint8) data[i].channel << (quint16) data[i].value;
+    }
+    return (stream.status() == QDataStream::Ok);
+}
@@ -0,0 +1,50 @@
+#ifndef STK500SAMPLEBUFFER_H
+#define STK500SAMPLEBUFFER_H
+
+#include <QString>
+#include <QVector>
+#include <QMutex>
+
+#define SAMPLE_BUFFER_CAPACITY   262144   // Maximum amount of samples kept, oldest are discarded first
+
+// A single analog measurement
+typedef struct AnalogSample {
+    qint64 time;      // Time (in us) since the start of sampling
+    quint8 channel;   // Analog channel measured
+    quint16 value;    // Measured value, 0 - 1023
+} AnalogSample;
+
+/*
+ * Ring buffer of analog samples with host timestamps
+ *
+ * Samples are appended by the sampling task on the process thread, and
+ * read out by the GUI for plotting or exporting at the same time. When
+ * the buffer is full, the oldest samples are overwritten.
+ */
+class stk500SampleBuffer
+{
+public:
+    stk500SampleBuffer(int capacity = SAMPLE_BUFFER_CAPACITY);
+    void clear();
+    void append(const AnalogSample *samples, int count);
+    int count();
+    qint64 total();
+    QVector<AnalogSample> samples();
+    QVector<AnalogSample> latest(qint64 timeSpan);
+    bool exportCSV(const QString &filePath);
+    bool exportBinary(const QString &filePath);
+
+private:
+    // copy ops are private to prevent copying
+    stk500SampleBuffer(const stk500SampleBuffer&); // no implementation
+    stk500SampleBuffer& operator=(const stk500SampleBuffer&); // no implementation
+
+    QMutex lock;
+    QVector<AnalogSample> ring;
+    int capacity;
+    int head;
+    int length;
+    qint64 totalCount;
+};
+
+#endif // STK500SAMPLEBUFFER_H
@@ -0,0 +1,379 @@
+#include "stk500screendecoder.h"
+#include <QDebug>
+#include <string.h>
+
+stk500ScreenDecoder::stk500ScreenDecoder() {
+    colorTable();
+    sink = NULL;
+    reset();
+}
+
+const quint32* stk500ScreenDecoder::colorTable() {
+    /* Built once on first use, converting the same way as color565_to_rgb */
+    static quint32 table[65536];
+    static bool tableInit = false;
+    if (!tableInit) {
+        for (int c = 0; c < 65536; c++) {
+            quint32 r = (c & 0xF800) >> 8;
+            quint32 g = (c & 0x07E0) >> 3;
+            quint32 b = (c & 0x001F) << 3;
+            table[c] = 0xFF000000 | (r << 16) | (g << 8) | b;
+        }
+        tableInit = true;
+    }
+    return table;
+}
+
+void stk500ScreenDecoder::reset() {
+    lock.lock();
+    memset(&screen, 0, sizeof(screen));
+    screen.view_hb = SCREEN_WIDTH - 1;
+    screen.view_vb = SCREEN_HEIGHT - 1;
+    memset(palette, 0, sizeof(palette));
+    extended = false;
+    extCmd = 0;
+    reply.clear();
+    resetScreen();
+    lock.unlock();
+}
+
+void stk500ScreenDecoder::resetScreen() {
+    memset(framebuffer, 0, sizeof(framebuffer));
+    dirty.setAll();
+    sinkDirty.setAll();
+}
+
+/* Sets the sink to receive frames, which starts with the full screen */
+void stk500ScreenDecoder::setSink(stk500ScreenSink *sink) {
+    lock.lock();
+    this->sink = sink;
+    sinkDirty.setAll();
+    lock.unlock();
+}
+
+void stk500ScreenDecoder::publishToSink(qint64 time) {
+    lock.lock();
+    if ((sink != NULL) && !sinkDirty.isEmpty()) {
+        sink->screenFrame(time, sinkDirty.rect(), framebuffer);
+        sinkDirty.clear();
+    }
+    lock.unlock();
+}
+
+bool stk500ScreenDecoder::isExtended() {
+    lock.lock();
+    bool rval = extended;
+    lock.unlock();
+    return rval;
+}
+
+/* Takes the data to send back to the device */
+QByteArray stk500ScreenDecoder::takeReply() {
+    lock.lock();
+    QByteArray rval = reply;
+    reply.clear();
+    lock.unlock();
+    return rval;
+}
+
+bool stk500ScreenDecoder::isDirty() {
+    lock.lock();
+    bool rval = !dirty.isEmpty();
+    lock.unlock();
+    return rval;
+}
+
+void stk500ScreenDecoder::decode(const char* data, int length) {
+    lock.lock();
+    for (int i = 0; i < length; i++) {
+        receive((quint8) data[i]);
+    }
+    lock.unlock();
+}
+
+/*
+ * Converts the area changed since the last frame into the image
+ * The image is (re)created when it does not have the right size yet
+ */
+bool stk500ScreenDecoder::takeFrame(QImage &image, QRect &dirtyRect) {
+    if ((image.width() != SCREEN_WIDTH) || (image.height() != SCREEN_HEIGHT) ||
+            (image.format() != QImage::Format_ARGB32)) {
+        image = QImage(SCREEN_WIDTH, SCREEN_HEIGHT, QImage::Format_ARGB32);
+        image.fill(Qt::black);
+    }
+
+    lock.lock();
+    bool hasFrame = !dirty.isEmpty();
+    if (hasFrame) {
+        const quint32* table = colorTable();
+        dirtyRect = dirty.rect();
+        for (int y = dirty.minY; y <= dirty.maxY; y++) {
+            quint32* dest = (quint32*) image.scanLine(y);
+            const quint16* src = framebuffer + y * SCREEN_WIDTH;
+            for (int x = dirty.minX; x <= dirty.maxX; x++) {
+                dest[x] = table[src[x]];
+            }
+        }
+        dirty.clear();
+    }
+    lock.unlock();
+    return hasFrame;
+}
+
+/* Receives a single byte as part of the screen serial protocol */
+void stk500ScreenDecoder::receive(quint8 byte)
+{
+    if (this->extCmd) {
+        receiveExtended(byte);
+    } else if (this->screen.cmd_len) {
+        // Refresh buffer
+        this->screen.cmd_buff[this->screen.cmd_buff_index++] = byte;
+        if (this->screen.cmd_buff_index == this->screen.cmd_len) {
+            quint16 data = *((quint16*) this->screen.cmd_buff);
+            quint32 data_cnt = 1;
+            if (this->screen.cmd_len == 6) {
+                data_cnt = *((quint32*) (this->screen.cmd_buff + 2));
+
+                // Make sure to limit it to the amount of pixels we have
+                // In case it glitches, we won't be stuck in a loop
+                if (data_cnt > (SCREEN_WIDTH*SCREEN_HEIGHT)) data_cnt = (SCREEN_WIDTH*SCREEN_HEIGHT);
+            }
+            this->screen.cmd_len = 0;
+            // Process the command with the data known
+            switch (this->screen.cmd) {
+            case 0x22:
+                // CGRAM read/write
+                for (quint32 i = 0; i < data_cnt; i++) {
+                    receivePixel(data);
+                }
+                break;
+            case 0x03:
+                // Read entrymode
+                this->screen.entrymode = data;
+                break;
+            case 0x50:
+                // Horizontal start viewport
+                this->screen.view_vb = 239 - data;
+                break;
+            case 0x51:
+                // Horizontal end viewport
+                this->screen.view_va = 239 - data;
+                break;
+            case 0x52:
+                // Vertical start viewport
+                this->screen.view_hb = 319 - data;
+                break;
+            case 0x53:
+                // Vertical end viewport
+                this->screen.view_ha = 319 - data;
+                break;
+            case 0x20:
+                // Horizontal cursor (y)
+                this->screen.cur_y = 239 - data;
+                break;
+            case 0x21:
+                // Vertical cursor (z)
+                this->screen.cur_x = 319 - data;
+                break;
+
+            default:
+                // Do nothing
+                qDebug() << "SCREEN ERROR " << screen.cmd;
+                break;
+            }
+        }
+    } else {
+        this->screen.cmd_buff_index = 0;
+        this->screen.cmd_len = 0;
+        if ((byte == SCREEN_CMD_HELLO) || (this->extended && (byte >= SCREEN_CMD_RLE) && (byte <= SCREEN_CMD_SPAN))) {
+            // Extended stream command
+            this->extCmd = byte;
+            this->extStage = 0;
+            this->extIndex = 0;
+        } else if (byte == 0x00) {
+            // Screen reset
+            this->screen.view_ha = 0;
+            this->screen.view_hb = 319;
+            this->screen.view_va = 0;
+            this->screen.view_vb = 239;
+            this->resetScreen();
+        } else if (byte == 0xFF) {
+            this->screen.cmd_len = 2;
+        } else if (byte == 0xFE) {
+            this->screen.cmd_len = 6;
+        } else {
+            this->screen.cmd = byte;
+        }
+    }
+}
+
+/*
+ * Receives a single byte of an extended stream command
+ * Fixed-size arguments are collected first (stage 0), then the data follows (stage 1)
+ */
+void stk500ScreenDecoder::receiveExtended(quint8 byte)
+{
+    if (extStage == 0) {
+        extBuff[extIndex++] = byte;
+        int argSize = 1;
+        if ((extCmd == SCREEN_CMD_SKIP) || (extCmd == SCREEN_CMD_PALETTE)) {
+            argSize = 2;
+        } else if (extCmd == SCREEN_CMD_SPAN) {
+            argSize = 3;
+        }
+        if (extIndex < argSize) {
+            return;
+        }
+        extIndex = 0;
+        extStage = 1;
+
+        switch (extCmd) {
+        case SCREEN_CMD_HELLO:
+            // Agree on the highest version both sides support
+            extBuff[0] = qMin(extBuff[0], (quint8) SCREEN_STREAM_VERSION);
+            extended = (extBuff[0] >= 1);
+            reply.append((char) SCREEN_CMD_HELLO).append((char) extBuff[0]);
+            extCmd = 0;
+            break;
+        case SCREEN_CMD_RLE:
+            extRemaining = extBuff[0];
+            break;
+        case SCREEN_CMD_SKIP:
+            extRemaining = qMin(extBuff[0] | (extBuff[1] << 8), SCREEN_WIDTH * SCREEN_HEIGHT);
+            for (int i = 0; i < extRemaining; i++) {
+                advanceCursor();
+            }
+            extRemaining = 0;
+            break;
+        case SCREEN_CMD_PALETTE:
+            extRemaining = (extBuff[1] == 0) ? 256 : extBuff[1];
+            break;
+        case SCREEN_CMD_SPAN:
+            // Anything but 1, 2, 4 or 8 bits per pixel means the stream is corrupt
+            if ((extBuff[0] != 1) && (extBuff[0] != 2) && (extBuff[0] != 4) && (extBuff[0] != 8)) {
+                qDebug() << "SCREEN ERROR span bpp" << extBuff[0];
+                extRemaining = 0;
+            } else {
+                extRemaining = extBuff[1] | (extBuff[2] << 8);
+            }
+            break;
+        }
+        if (extRemaining == 0) {
+            extCmd = 0;
+        }
+        return;
+    }
+
+    switch (extCmd) {
+    case SCREEN_CMD_RLE:
+        // Run of a single color
+        extBuff[1 + extIndex++] = byte;
+        if (extIndex == 3) {
+            extIndex = 0;
+            int length = (extBuff[1] == 0) ? 256 : extBuff[1];
+            quint16 color = extBuff[2] | (extBuff[3] << 8);
+            for (int i = 0; i < length; i++) {
+                receivePixel(color);
+            }
+            extRemaining--;
+        }
+        break;
+    case SCREEN_CMD_PALETTE:
+        // Palette entry, stored starting at the index
+        extBuff[2 + extIndex++] = byte;
+        if (extIndex == 2) {
+            extIndex = 0;
+            palette[extBuff[0]++] = extBuff[2] | (extBuff[3] << 8);
+            extRemaining--;
+        }
+        break;
+    case SCREEN_CMD_SPAN: {
+        // Palette indices packed into a byte, first pixel in the highest bits
+        int bpp = extBuff[0];
+        int mask = (1 << bpp) - 1;
+        for (int shift = 8 - bpp; (shift >= 0) && (extRemaining > 0); shift -= bpp) {
+            receivePixel(palette[(byte >> shift) & mask]);
+            extRemaining--;
+        }
+        break;
+    }
+    default:
+        extRemaining = 0;
+        break;
+    }
+    if (extRemaining <= 0) {
+        extCmd = 0;
+    }
+}
+
+/* Receives a single pixel */
+void stk500ScreenDecoder::receivePixel(quint16 color)
+{
+    // Write pixel to the framebuffer and include it in the changed area
+    int x = screen.cur_x;
+    int y = screen.cur_y;
+    if ((x < SCREEN_WIDTH) && (y < SCREEN_HEIGHT)) {
+        framebuffer[y * SCREEN_WIDTH + x] = color;
+        dirty.include(x, y);
+        sinkDirty.include(x, y);
+    }
+    advanceCursor();
+}
+
+/* Moves to the next pixel without changing the current one */
+void stk500ScreenDecoder::advanceCursor()
+{
+    // Next pixel - use entrymode and view port
+    switch (screen.entrymode) {
+    case 0x1008:
+        if (moveCursor_x(1)) moveCursor_y(1);
+        break;
+    case 0x1020:
+        if (moveCursor_y(1)) moveCursor_x(-1);
+        break;
+    case 0x1038:
+        if (moveCursor_x(-1)) moveCursor_y(1);
+        break;
+    case 0x1010:
+        if (moveCursor_y(-1)) moveCursor_x(1);
+        break;
+    case 0x1018:
+        if (moveCursor_x(1)) moveCursor_y(-1);
+        break;
+    case 0x1000:
+        if (moveCursor_y(1)) moveCursor_x(1);
+        break;
+    case 0x1028:
+        if (moveCursor_x(-1)) moveCursor_y(-1);
+        break;
+    case 0x1030:
+        if (moveCursor_y(-1)) moveCursor_x(-1);
+        break;
+    }
+}
+
+bool stk500ScreenDecoder::moveCursor_x(qint8 dx) {
+    screen.cur_x += dx;
+    if (screen.cur_x > screen.view_hb) {
+        screen.cur_x = screen.view_ha;
+        return true;
+    } else if (screen.cur_x < screen.view_ha) {
+        screen.cur_x = screen.view_hb;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+bool stk500ScreenDecoder::moveCursor_y(qint8 dy) {
+    screen.cur_y += dy;
+    if (screen.cur_y > screen.view_vb) {
+        screen.cur_y = screen.view_va;
+        return true;
+    } else if (screen.cur_y < screen.view_va) {
+        screen.cur_y = screen.view_vb;
+        return true;
+    } else {
+        return false;
+    }
+}
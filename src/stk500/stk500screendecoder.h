@@ -0,0 +1,121 @@
+#ifndef STK500SCREENDECODER_H
+#define STK500SCREENDECODER_H
+
+#include <QImage>
+#include <QRect>
+#include <QMutex>
+#include <climits>
+
+#define SCREEN_WIDTH          320   // Width of the Phoenard display
+#define SCREEN_HEIGHT         240   // Height of the Phoenard display
+#define SCREEN_FRAME_INTERVAL  16   // Minimal time (in ms) between two published frames
+#define SCREEN_STREAM_VERSION   1   // Highest version of the extended stream supported
+
+/*
+ * Commands of the extended screen share stream
+ * The device sends HELLO with the version it wants to use, and uses the other
+ * commands only after the same HELLO is sent back with the version agreed on.
+ * All values are little-endian, pixels follow the entry mode like CGRAM writes.
+ */
+#define SCREEN_CMD_RLE      0xF0   // [runs] then per run: [length (0=256)] [color:2]
+#define SCREEN_CMD_SKIP     0xF1   // [count:2] pixels left as they are in the previous frame
+#define SCREEN_CMD_PALETTE  0xF2   // [index] [count (0=256)] then [color:2] per entry
+#define SCREEN_CMD_SPAN     0xF3   // [bpp 1/2/4/8] [count:2] then palette indices, packed MSB-first
+#define SCREEN_CMD_HELLO    0xFD   // [version] requests (or confirms) the extended stream
+
+typedef struct {
+    quint16 cur_x;
+    quint16 cur_y;
+    quint16 entrymode;
+    quint16 view_ha;
+    quint16 view_hb;
+    quint16 view_va;
+    quint16 view_vb;
+    quint8 cmd;
+    quint8 cmd_len;
+    quint8 cmd_buff[50];
+    quint8 cmd_buff_index;
+} ScreenRegisters;
+
+// Area of the screen changed since it was last taken
+typedef struct ScreenDirtyArea {
+    int minX, minY;
+    int maxX, maxY;
+
+    void clear() { minX = minY = INT_MAX; maxX = maxY = -1; }
+    void setAll() { minX = minY = 0; maxX = SCREEN_WIDTH - 1; maxY = SCREEN_HEIGHT - 1; }
+    bool isEmpty() const { return maxX < minX; }
+    QRect rect() const { return QRect(QPoint(minX, minY), QPoint(maxX, maxY)); }
+    void include(int x, int y) {
+        if (x < minX) minX = x;
+        if (x > maxX) maxX = x;
+        if (y < minY) minY = y;
+        if (y > maxY) maxY = y;
+    }
+} ScreenDirtyArea;
+
+// Receives the frames decoded, used to record the screen
+class stk500ScreenSink {
+public:
+    virtual void screenFrame(qint64 time, const QRect &dirtyRect, const quint16* framebuffer) = 0;
+};
+
+/*
+ * Decodes the screen share protocol into a framebuffer
+ *
+ * Decoding is done by the process thread as data is received. Pixels are
+ * stored as-is in RGB565 format, and the area changed since the last frame
+ * is tracked. Another thread takes the changed area as a frame, which is
+ * converted to ARGB using a lookup table holding all 65536 colors. A sink
+ * can be set to receive the changed area of the framebuffer as well.
+ *
+ * Next to the register writes of the original protocol, an extended stream
+ * with run-length encoding, skipping of unchanged pixels and palette-indexed
+ * pixels is decoded once negotiated. Replies to the device are collected, the
+ * process thread takes and sends them.
+ */
+class stk500ScreenDecoder
+{
+public:
+    stk500ScreenDecoder();
+    void reset();
+    void decode(const char* data, int length);
+    bool isDirty();
+    bool takeFrame(QImage &image, QRect &dirtyRect);
+    void setSink(stk500ScreenSink *sink);
+    void publishToSink(qint64 time);
+    bool isExtended();
+    QByteArray takeReply();
+    static quint32 toARGB(quint16 color565) { return colorTable()[color565]; }
+    static const quint32* colorTable();
+
+private:
+    void resetScreen();
+    void receive(quint8 byte);
+    void receiveExtended(quint8 byte);
+    void receivePixel(quint16 color);
+    void advanceCursor();
+    bool moveCursor_x(qint8 dx);
+    bool moveCursor_y(qint8 dy);
+
+    // copy ops are private to prevent copying
+    stk500ScreenDecoder(const stk500ScreenDecoder&); // no implementation
+    stk500ScreenDecoder& operator=(const stk500ScreenDecoder&); // no implementation
+
+    QMutex lock;
+    ScreenRegisters screen;
+    quint16 framebuffer[SCREEN_WIDTH * SCREEN_HEIGHT];
+    quint16 palette[256];
+    bool extended;
+    quint8 extCmd;
+    int extStage;
+    int extIndex;
+    int extRemaining;
+    quint8 extBuff[4];
+    QByteArray reply;
+    ScreenDirtyArea dirty;
+    ScreenDirtyArea sinkDirty;
+    stk500ScreenSink *sink;
+};
+
+#endif // STK500SCREENDECODER_H
@@ -86,6 +86,11 @@ char* stk500sd::cacheBlock(quint32 block, bool readBlock, bool markDirty, bool i
             init();
             _handler->SD_readBlock(selected->block, selected->buffer, 512);
         } catch (ProtocolException&) {
+            /* When cancelled, the block is not read and should not be retried */
+            if (_handler->getPort()->isCancelled()) {
+                selected->reset();
+                throw;
+            }
             BlockCache cache_old = *selected;
             _handler->reset();
             init();
@@ -101,6 +106,10 @@ void stk500sd::writeOutCache(BlockCache *cache) {
          init();
         _handler->SD_writeBlock(cache->block, cache->buffer, 512, cache->isFAT);
     } catch (ProtocolException&) {
+        /* When cancelled, keep the block dirty so it can still be written out later */
+        if (_handler->getPort()->isCancelled()) {
+            throw;
+        }
         BlockCache cache_old = *cache;
         _handler->reset();
          init();
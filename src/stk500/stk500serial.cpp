@@ -7,6 +7,11 @@
 stk500Serial::stk500Serial(QWidget *owner)
     : QObject(owner) {
     process = NULL;
+    batchSize = 0;
+    pacing.chunkSize = 0;
+    pacing.chunkDelay = 0;
+    pacing.matchBaud = false;
+    pacing.flowControl = false;
 }
 
 bool stk500Serial::isOpen() {
@@ -26,7 +31,10 @@ void stk500Serial::open(QString & portName) {
     close();
 
     // Start a new process for the new port
+    // Serial options set before are kept when switching ports
     process = new stk500_ProcessThread(this, portName);
+    process->batchSize = batchSize;
+    process->pacing = pacing;
     process->start();
 }
 
@@ -36,11 +44,11 @@ void stk500Serial::close() {
         if (process->isRunning) {
             process->closeRequested = true;
             process->cancelTasks();
+            process->wake();
 
             // Wait with 6s timeout for the process to exit by itself
-            for (int i = 0; process->isRunning && i < ((6000)/20); i++) {
-                QThread::msleep(20);
-            }
+            // Cancelling aborts pending reads of the current task, so this is usually quick
+            process->wait(6000);
 
             // Force-terminate the thread if still running (locked)
             // Also notify ourselves of the forcible closing of the port
@@ -73,6 +81,18 @@ void stk500Serial::notifyTaskFinished(stk500_ProcessThread *, stk500Task *task)
     emit taskFinished(task);
 }
 
+void stk500Serial::notifyDataReceived(stk500_ProcessThread *) {
+    emit dataReceived();
+}
+
+void stk500Serial::notifyDataWritable(stk500_ProcessThread *) {
+    emit dataWritable();
+}
+
+void stk500Serial::notifyScreenUpdated(stk500_ProcessThread *) {
+    emit screenUpdated();
+}
+
 void stk500Serial::execute(stk500Task &task, bool asynchronous, bool dialogDelay) {
     QList<stk500Task*> tasks;
     tasks.append(&task);
@@ -207,10 +227,94 @@ void stk500Serial::cancelTasks() {
     process->cancelTasks();
 }
 
+/*
+ * Cancels an asynchronous task and waits for it to finish, handling events meanwhile
+ * A task that does not finish in time closes the port, so it is no longer used afterwards
+ * Events are handled during the wait, so owners deleting the task when it finishes let go of it first
+ */
+void stk500Serial::cancelAndWait(stk500Task *task) {
+    task->cancel();
+    qint64 startTime = QDateTime::currentMSecsSinceEpoch();
+    while (!task->isFinished() && isOpen()) {
+        if ((QDateTime::currentMSecsSinceEpoch() - startTime) >= SERIAL_CANCEL_TIMEOUT) {
+            close();
+            break;
+        }
+        QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+        QThread::msleep(1);
+    }
+}
+
 void stk500Serial::closeSerial() {
     openSerial(0);
 }
 
+/*
+ * Sets the amount of bytes to collect before forwarding them, in either direction
+ * Reduces the overhead when throughput matters more than latency; 0 forwards right away
+ * Data is never held back longer than SERIAL_BATCH_MAX_DELAY
+ */
+void stk500Serial::setSerialBatchSize(int batchSize) {
+    this->batchSize = batchSize;
+    if (isOpen()) {
+        this->process->batchSize = batchSize;
+    }
+}
+
+int stk500Serial::serialBatchSize() {
+    return this->batchSize;
+}
+
+/*
+ * Sets how data sent over Serial is paced, to prevent overflowing the small
+ * receive buffer of the device. Only used while Serial is opened, and kept
+ * when another port is opened.
+ */
+void stk500Serial::setSerialPacing(const SerialPacing &pacing) {
+    this->pacing = pacing;
+    if (isOpen()) {
+        this->process->pacingLock.lock();
+        this->process->pacing = pacing;
+        this->process->pacingChanged = true;
+        this->process->pacingLock.unlock();
+    }
+}
+
+SerialPacing stk500Serial::serialPacing() {
+    return this->pacing;
+}
+
+/*
+ * Sets whether received Serial data is decoded as screen share data
+ * Decoded data is no longer available to read, and is taken as frames instead
+ */
+void stk500Serial::setScreenDecoding(bool enabled) {
+    if (isOpen()) {
+        this->process->screenDecoding.storeRelease(enabled ? 1 : 0);
+    }
+}
+
+bool stk500Serial::takeScreenFrame(QImage &image, QRect &dirtyRect) {
+    // Re-arm the notification before taking, so changes after this are notified again
+    if (isOpen()) {
+        this->process->screenNotifyPending.storeRelease(0);
+    }
+    return this->screenDecoder.takeFrame(image, dirtyRect);
+}
+
+qint64 stk500Serial::serialBytesReceived() {
+    return isOpen() ? this->process->bytesReceived.load() : 0;
+}
+
+qint64 stk500Serial::serialBytesSent() {
+    return isOpen() ? this->process->bytesSent.load() : 0;
+}
+
+/* Amount of bytes written that are still waiting to be sent out */
+int stk500Serial::serialBytesPending() {
+    return isOpen() ? this->process->writeBuff.available() : 0;
+}
+
 void stk500Serial::openSerial(int baudrate, STK500::State mode) {
     // Don't do anything if not open
     if (!isOpen()) {
@@ -229,59 +333,52 @@ void stk500Serial::openSerial(int baudrate, STK500::State mode) {
     this->process->isBaudChanged = true;
 }
 
-int stk500Serial::read(char* buff, int len) {
-    if (!isSerialOpen()) {
-        return 0;
-    }
-
-    // Lock the reading buffer and read from it
-    this->process->readBuffLock.lock();
-    int count = this->process->readBuff.length();
-    int remaining = 0;
-    if (count > len) {
-        remaining = (count - len);
-        count = len;
-    }
-    if (count) {
-        char* input_buff = this->process->readBuff.data();
-
-        // Read the contents
-        memcpy(buff, input_buff, count);
-
-        // Shift data around
-        memcpy(input_buff, input_buff + count, remaining);
-        this->process->readBuff.truncate(remaining);
+/* Re-arms the dataReceived notification; call before reading the Serial log, so data logged after is notified again */
+void stk500Serial::dataHandled() {
+    if (isOpen()) {
+        this->process->readNotifyPending.storeRelease(0);
     }
-    this->process->readBuffLock.unlock();
-
-    // All done!
-    return count;
 }
 
-void stk500Serial::write(const char* buff, int len) {
+int stk500Serial::write(const char* buff, int len) {
     if (!isSerialOpen()) {
-        return;
+        return 0;
     }
 
-    // Lock the writing buffer and write to it
-    this->process->writeBuffLock.lock();
-    this->process->writeBuff.append(buff, len);
-    this->process->writeBuffLock.unlock();
+    // Write as much as fits in the buffer; the process thread only takes from it
+    int written = this->process->writeBuff.write(buff, len);
+    if (written < len) {
+        // Buffer is full: request a notification once data is sent out
+        // Try once more in case all was sent out before the request was made
+        this->process->writeNotifyPending.storeRelease(1);
+        written += this->process->writeBuff.write(buff + written, len - written);
+    }
+    return written;
 }
 
-void stk500Serial::write(const QString &message) {
+int stk500Serial::write(const QString &message) {
     QByteArray messageData = message.toLatin1();
-    write(messageData.data(), messageData.length());
+    return write(messageData.data(), messageData.length());
 }
 
 /* Task processing thread */
 
-stk500_ProcessThread::stk500_ProcessThread(stk500Serial *owner, QString portName) {
+stk500_ProcessThread::stk500_ProcessThread(stk500Serial *owner, QString portName)
+    : writeBuff(SERIAL_WRITE_BUFFER_SIZE) {
     this->owner = owner;
     this->closeRequested = false;
     this->isRunning = true;
     this->isProcessing = false;
     this->isBaudChanged = false;
+    this->lastYieldTime = 0;
+    this->currentTask = NULL;
+    this->batchSize = 0;
+    this->pacing.chunkSize = 0;
+    this->pacing.chunkDelay = 0;
+    this->pacing.matchBaud = false;
+    this->pacing.flowControl = false;
+    this->pacingChanged = false;
+    this->screenDecoding.storeRelease(0);
     this->serialBaud = 0;
     this->portName = portName;
     this->status = "";
@@ -295,7 +392,7 @@ stk500_ProcessThread::~stk500_ProcessThread() {
 
 void stk500_ProcessThread::run() {
     /* Initialize the protocol and internal port */
-    this->protocol = new stk500(this);
+    this->protocol = new stk500(this, this);
 
     /* Attempt to open the port */
     updateStatus("Opening port...");
@@ -314,6 +411,19 @@ void stk500_ProcessThread::run() {
         long currSerialBaud = 0;
         STK500::State currSerialMode = STK500::SKETCH;
         bool wasIdling = true;
+        int readPendingLen = 0;
+        qint64 readPendingTime = 0;
+        qint64 writePendingTime = 0;
+        QByteArray replyPending;
+        char writeData[1024];
+        SerialPacing currPacing;
+        bool currScreenDecoding = false;
+        qint64 lastScreenTime = 0;
+        bool flowPaused = false;
+        int chunkSent = 0;
+        qint64 chunkDoneTime = 0;
+        double paceCredit = 0.0;
+        qint64 paceTime = 0;
         while (!this->closeRequested) {
             /*
              * Poll the next task to execute
@@ -321,6 +431,19 @@ void stk500_ProcessThread::run() {
              */
             stk500Task *task;
             bool taskIsSync = false;
+            pacingLock.lock();
+            currPacing = this->pacing;
+            bool isPacingChanged = this->pacingChanged;
+            this->pacingChanged = false;
+            pacingLock.unlock();
+
+            /* Pacing starts over with new settings */
+            if (isPacingChanged) {
+                chunkSent = 0;
+                paceCredit = 0.0;
+                paceTime = QDateTime::currentMSecsSinceEpoch();
+            }
+            currScreenDecoding = (this->screenDecoding.loadAcquire() != 0);
             tasksLock.lock();
             if (syncTasks.empty()) {
                 if (asyncTasks.empty()) {
@@ -339,13 +462,18 @@ void stk500_ProcessThread::run() {
                 currSerialBaud = this->serialBaud;
                 currSerialMode = this->serialMode;
 
-                /* Clear input/output buffers */
-                this->readBuffLock.lock();
-                this->readBuff.clear();
-                this->readBuffLock.unlock();
-                this->writeBuffLock.lock();
+                /* Clear input/output buffers and counters */
+                readPendingLen = 0;
+                replyPending.clear();
                 this->writeBuff.clear();
-                this->writeBuffLock.unlock();
+                this->bytesReceived.store(0);
+                this->bytesSent.store(0);
+                this->owner->serialLog.clear();
+                this->owner->screenDecoder.reset();
+                flowPaused = false;
+                chunkSent = 0;
+                paceCredit = 0.0;
+                paceTime = QDateTime::currentMSecsSinceEpoch();
 
                 if (currSerialBaud) {
                     // Changing to a different baud rate
@@ -379,42 +507,141 @@ void stk500_ProcessThread::run() {
             }
 
             if ((task == NULL) && currSerialBaud) {
-                /* Serial mode: process serial I/O */
-
-                /* Write out data */
-                if (!this->writeBuff.isEmpty()) {
-                    this->writeBuffLock.lock();
-
-                    char* buff = this->writeBuff.data();
-                    int buff_len = this->writeBuff.length();
-                    int written = protocol->getPort()->write(buff, buff_len);
-                    int remaining = (buff_len - written);
-                    if (!remaining) {
-                        this->writeBuff.clear();
-                    } else if (written == -1) {
+                /*
+                 * Serial mode: process serial I/O
+                 * Data is forwarded as soon as it is available in either direction.
+                 * Waiting for received data is done in short steps which end as soon
+                 * as data arrives, so data to send is never held back for long either.
+                 */
+                qint64 now = QDateTime::currentMSecsSinceEpoch();
+                int currBatchSize = this->batchSize;
+
+                /* Write out data, when batching only once enough is collected or held back too long */
+                int writeAvailable = this->writeBuff.available();
+                if (!writeAvailable) {
+                    writePendingTime = now;
+                }
+                bool writeNow = (writeAvailable > 0) &&
+                        ((writeAvailable >= currBatchSize) || ((now - writePendingTime) >= SERIAL_BATCH_MAX_DELAY));
+
+                /* Limit the amount of data written out when pacing */
+                int writeLimit = (int) sizeof(writeData);
+                if (currPacing.flowControl && flowPaused) {
+                    writeLimit = 0;
+                }
+                if (currPacing.chunkSize > 0) {
+                    if ((chunkSent >= currPacing.chunkSize) && ((now - chunkDoneTime) >= currPacing.chunkDelay)) {
+                        chunkSent = 0;
+                    }
+                    writeLimit = qMin(writeLimit, qMax(0, currPacing.chunkSize - chunkSent));
+                }
+                if (currPacing.matchBaud) {
+                    /* Every byte takes 10 bits to transfer: start, 8 data and stop bit */
+                    paceCredit += (double) (now - paceTime) * currSerialBaud / 10000.0;
+                    paceCredit = qMin(paceCredit, (double) SERIAL_PACE_MAX_BURST);
+                    writeLimit = qMin(writeLimit, (int) paceCredit);
+                }
+                paceTime = now;
+
+                /* Replies to the device go out first and are never batched, then the data written to the buffer */
+                int writeLen;
+                bool hasSent = false;
+                while ((writeLimit > 0) && (writeNow || !replyPending.isEmpty())) {
+                    bool isReply = !replyPending.isEmpty();
+                    if (isReply) {
+                        writeLen = qMin(writeLimit, replyPending.length());
+                        memcpy(writeData, replyPending.constData(), writeLen);
+                    } else if ((writeLen = this->writeBuff.peek(writeData, writeLimit)) <= 0) {
+                        break;
+                    }
+                    int written = protocol->getPort()->write(writeData, writeLen);
+                    if (written == -1) {
                         /* Do something here? Error conditions are unclear */
                         qDebug() << "An error occurred while writing";
-                    } else {
-                        /* Not sure if overflow is allowed to happen, but it's handled */
-                        memcpy(buff, buff + written, remaining);
-                        this->writeBuff.truncate(remaining);
+                        break;
                     }
 
-                    this->writeBuffLock.unlock();
+                    /* Not sure if overflow is allowed to happen, but it's handled */
+                    if (isReply) {
+                        replyPending.remove(0, written);
+                    } else {
+                        this->writeBuff.skip(written);
+                        hasSent = hasSent || (written > 0);
+                        this->bytesSent.fetchAndAddRelaxed(written);
+                        writePendingTime = now;
+                    }
+                    writeLimit -= written;
+                    if (currPacing.matchBaud) {
+                        paceCredit -= written;
+                    }
+                    if (currPacing.chunkSize > 0) {
+                        chunkSent += written;
+                        if (chunkSent >= currPacing.chunkSize) {
+                            chunkDoneTime = now;
+                        }
+                    }
+                    if (written < writeLen) {
+                        break;
+                    }
                 }
 
-                /* Read in data */
-                QByteArray serialData = protocol->getPort()->readAll(20);
+                /* Notify the writer that buffer space is available again, once data was taken from it */
+                if (hasSent && this->writeNotifyPending.testAndSetOrdered(1, 0)) {
+                    this->owner->notifyDataWritable(this);
+                }
 
-                /* Copy to the read buffer */
+                /* Read in data, returns as soon as data arrives */
+                QByteArray serialData = protocol->getPort()->readStep(SERIAL_PUMP_STEP_TIME);
                 if (!serialData.isEmpty()) {
                     if (!hasData) {
                         hasData = true;
                         qDebug() << "Program started after " << (QDateTime::currentMSecsSinceEpoch() - start_time) << "ms";
                     }
-                    this->readBuffLock.lock();
-                    this->readBuff.append(serialData);
-                    this->readBuffLock.unlock();
+                    this->bytesReceived.fetchAndAddRelaxed(serialData.length());
+
+                    /* Pause or resume sending when the device requests it */
+                    if (currPacing.flowControl) {
+                        int xoff = serialData.lastIndexOf((char) SERIAL_XOFF);
+                        int xon = serialData.lastIndexOf((char) SERIAL_XON);
+                        if (xoff != xon) {
+                            flowPaused = (xoff > xon);
+                        }
+                    }
+
+                    /* Log all data received, so it can be saved or looked up later; screen share data is no text and is left out */
+                    if (!currScreenDecoding) {
+                        this->owner->serialLog.append(serialData.data(), serialData.length(),
+                                                      QDateTime::currentMSecsSinceEpoch());
+                        if (!readPendingLen) {
+                            readPendingTime = now;
+                        }
+                        readPendingLen += serialData.length();
+                    }
+                }
+
+                /* Screen share data is decoded right away, frames are published at display rate */
+                if (currScreenDecoding) {
+                    this->owner->screenDecoder.decode(serialData.data(), serialData.length());
+                    serialData.clear();
+
+                    /* Answer the device negotiating the extended stream, sent out paced like all other data */
+                    replyPending.append(this->owner->screenDecoder.takeReply());
+                    if ((now - lastScreenTime) >= SCREEN_FRAME_INTERVAL) {
+                        lastScreenTime = now;
+                        this->owner->screenDecoder.publishToSink(now);
+                        if (this->owner->screenDecoder.isDirty() && this->screenNotifyPending.testAndSetOrdered(0, 1)) {
+                            this->owner->notifyScreenUpdated(this);
+                        }
+                    }
+                }
+
+                /* Notify the reader of newly logged data, unless a notification is already pending */
+                /* When batching, only once enough is collected or held back too long */
+                if ((readPendingLen > 0) && ((readPendingLen >= currBatchSize) ||
+                                             ((now - readPendingTime) >= SERIAL_BATCH_MAX_DELAY)) &&
+                        this->readNotifyPending.testAndSetOrdered(0, 1)) {
+                    readPendingLen = 0;
+                    this->owner->notifyDataReceived(this);
                 }
             } else {
                 /* Command mode: process bootloader I/O */
@@ -469,22 +696,36 @@ void stk500_ProcessThread::run() {
 
                         // Before processing, force the Micro-SD to re-read information
                         // Only needed if we were idling before (and user may have switched card)
+                        // Changes that failed to be written out before are tried once more first
                         if (wasIdling) {
+                            try {
+                                protocol->sd().flushCache();
+                            } catch (ProtocolException&) {
+                            }
                             protocol->sd().reset();
                         }
 
                         // Process the task after setting the protocol
                         if (!task->isCancelled()) {
                             task->setProtocol(protocol);
+                            task->setYieldInterface(this);
+                            currentTask = task;
                             task->run();
+                            currentTask = NULL;
                         }
 
                         // Flush the data on the Micro-SD now all is well
                         protocol->sd().flushCache();
                     } catch (ProtocolException &ex) {
-                        task->setError(ex);
+                        currentTask = NULL;
+                        if (!task->isCancelled()) {
+                            task->setError(ex);
+                        }
 
-                        /* Flush here as well, but eat up any errors... */
+                        /*
+                         * Flush here as well, but eat up any errors...
+                         * Also when aborted halfway, so the FAT on the Micro-SD stays consistent
+                         */
                         try {
                             protocol->sd().flushCache();
                         } catch (ProtocolException&) {
@@ -583,6 +824,78 @@ void stk500_ProcessThread::commandFinished() {
     updateStatus(this->stateStatus);
 }
 
+void stk500_ProcessThread::yieldTask(stk500Task *task) {
+    /* Only run tasks in between every so often so the yielding task keeps most of the bandwidth */
+    if ((QDateTime::currentMSecsSinceEpoch() - lastYieldTime) < STK500_YIELD_INTERVAL) {
+        return;
+    }
+
+    /* Tasks run in between rely on the bootloader being active */
+    if (closeRequested || !protocol->isSignedOn()) {
+        return;
+    }
+
+    /*
+     * Find the first asynchronous task that may be run in between
+     * It is kept in the queue until it finishes, so it can still be cancelled
+     */
+    stk500Task *interleaved = NULL;
+    tasksLock.lock();
+    for (int i = 0; i < asyncTasks.count(); i++) {
+        stk500Task *other = asyncTasks[i];
+        if ((other != task) && other->isInterleavable() && other->usesFirmware()) {
+            interleaved = other;
+            break;
+        }
+    }
+    tasksLock.unlock();
+    if (interleaved == NULL) {
+        return;
+    }
+
+    /*
+     * Write out pending Micro-SD changes of the yielding task first
+     * Changes of the task in between are written out when it finishes, also when it fails
+     * The address is loaded again by the yielding task when it changed meanwhile
+     */
+    protocol->sd().flushCache();
+
+    try {
+        interleaved->init();
+        if (!interleaved->isCancelled()) {
+            interleaved->setProtocol(protocol);
+            currentTask = interleaved;
+            interleaved->run();
+            currentTask = task;
+        }
+        protocol->sd().flushCache();
+    } catch (ProtocolException &ex) {
+        currentTask = task;
+        if (!interleaved->isCancelled()) {
+            interleaved->setError(ex);
+        }
+
+        /* Flush here as well, but eat up any errors... */
+        try {
+            protocol->sd().flushCache();
+        } catch (ProtocolException&) {
+        }
+    }
+
+    tasksLock.lock();
+    asyncTasks.removeOne(interleaved);
+    tasksLock.unlock();
+    owner->notifyTaskFinished(this, interleaved);
+
+    lastYieldTime = QDateTime::currentMSecsSinceEpoch();
+}
+
+bool stk500_ProcessThread::isCancelled() {
+    /* Pending reads are only aborted while a task that can be cancelled is running */
+    stk500Task *task = currentTask;
+    return (task != NULL) && (task->isCancelled() || (closeRequested && !task->isCancelSuppressed()));
+}
+
 bool stk500_ProcessThread::trySignOn() {
     for (int i = 0; i < 2; i++) {
         try {
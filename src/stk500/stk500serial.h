@@ -3,8 +3,27 @@
 
 #include "stk500.h"
 #include "stk500task.h"
+#include "stk500ringbuffer.h"
+#include "stk500seriallog.h"
+#include "stk500screendecoder.h"
 #include <QQueue>
 
+#define SERIAL_WRITE_BUFFER_SIZE   16384   // Capacity of the buffer holding Serial data to send
+#define SERIAL_CANCEL_TIMEOUT       3000   // Maximum time (in ms) waited for a cancelled task to finish
+#define SERIAL_PUMP_STEP_TIME          1   // Maximum time (in ms) waiting for received data before sending
+#define SERIAL_BATCH_MAX_DELAY        20   // Maximum time (in ms) data is held back when batching
+#define SERIAL_PACE_MAX_BURST         64   // Maximum amount of bytes sent at once when matching the baud rate
+#define SERIAL_XON                  0x11   // Received to resume sending when using flow control
+#define SERIAL_XOFF                 0x13   // Received to pause sending when using flow control
+
+// Limits the rate at which Serial data is sent to the device
+typedef struct SerialPacing {
+    int chunkSize;      // Amount of bytes sent before waiting, 0 to send without waiting
+    int chunkDelay;     // Time (in ms) waited after every chunk
+    bool matchBaud;     // Send no faster than the baud rate can transfer
+    bool flowControl;   // Pause sending while the device sends XOFF, until XON
+} SerialPacing;
+
 class stk500_ProcessThread;
 
 class stk500Serial : public QObject
@@ -22,23 +41,41 @@ public:
     void execute(stk500Task &task, bool asynchronous = false, bool dialogDelay = true);
     void executeAll(QList<stk500Task*> tasks, bool asynchronous = false, bool dialogDelay = true);
     void cancelTasks();
+    void cancelAndWait(stk500Task *task);
     void openSerial(int baudrate, STK500::State mode = STK500::SKETCH);
     void closeSerial();
     bool isSerialOpen();
+    void setSerialBatchSize(int batchSize);
+    int serialBatchSize();
+    void setSerialPacing(const SerialPacing &pacing);
+    SerialPacing serialPacing();
+    qint64 serialBytesReceived();
+    qint64 serialBytesSent();
+    int serialBytesPending();
     bool isExecuting();
-    int read(char* buff, int buffLen);
-    void write(const char* buff, int buffLen);
-    void write(const QString &message);
+    void dataHandled();
+    int write(const char* buff, int buffLen);
+    int write(const QString &message);
+    stk500SerialLog &log() { return serialLog; }
+    void setScreenDecoding(bool enabled);
+    bool takeScreenFrame(QImage &image, QRect &dirtyRect);
+    void setScreenSink(stk500ScreenSink *sink) { screenDecoder.setSink(sink); }
 
 protected:
     void notifyStatus(stk500_ProcessThread *sender, QString status);
     void notifyClosed(stk500_ProcessThread *sender);
     void notifySerialOpened(stk500_ProcessThread *sender);
     void notifyTaskFinished(stk500_ProcessThread *sender, stk500Task *task);
+    void notifyDataReceived(stk500_ProcessThread *sender);
+    void notifyDataWritable(stk500_ProcessThread *sender);
+    void notifyScreenUpdated(stk500_ProcessThread *sender);
 
 signals:
     void statusChanged(QString status);
     void serialOpened();
+    void dataReceived();
+    void dataWritable();
+    void screenUpdated();
     void closed();
     void taskFinished(stk500Task *task);
 
@@ -47,10 +84,14 @@ protected:
 
 private:
     stk500_ProcessThread *process;
+    SerialPacing pacing;
+    int batchSize;
+    stk500SerialLog serialLog;
+    stk500ScreenDecoder screenDecoder;
 };
 
 // Thread that processes stk500 tasks
-class stk500_ProcessThread : public QThread, public stk500StatusInterface {
+class stk500_ProcessThread : public QThread, public stk500StatusInterface, public stk500YieldInterface, public stk500CancelToken {
 
 public:
     stk500_ProcessThread(stk500Serial *owner, QString portName);
@@ -63,6 +104,8 @@ public:
 protected:
     virtual void run();
     virtual void commandFinished();
+    virtual void yieldTask(stk500Task *task);
+    virtual bool isCancelled();
     bool trySignOn();
     void runTests();
 
@@ -73,15 +116,24 @@ public:
     QWaitCondition cond;
     QQueue<stk500Task*> asyncTasks;
     QQueue<stk500Task*> syncTasks;
+    stk500Task *currentTask;
     QMutex tasksLock;
-    QMutex readBuffLock;
-    QMutex writeBuffLock;
-    QByteArray readBuff;
-    QByteArray writeBuff;
+    QMutex pacingLock;
+    stk500RingBuffer writeBuff;
+    QAtomicInt readNotifyPending;
+    QAtomicInt writeNotifyPending;
+    QAtomicInt screenNotifyPending;
+    QAtomicInteger<qint64> bytesReceived;
+    QAtomicInteger<qint64> bytesSent;
+    int batchSize;
+    SerialPacing pacing;
+    bool pacingChanged;
+    QAtomicInt screenDecoding;
     bool closeRequested;
     bool isRunning;
     bool isProcessing;
     bool isBaudChanged;
+    qint64 lastYieldTime;
     int serialBaud;
     STK500::State serialMode;
     QString protocolName;
@@ -0,0 +1,400 @@
+#include "stk500serialindex.h"
+#include <QElapsedTimer>
+
+// Amount of bytes per signature
+#define SERIAL_INDEX_SIG_SIZE (SERIAL_INDEX_SIG_BITS / 8)
+
+// Minimal time (in ms) between two update notifications while catching up
+#define SERIAL_INDEX_NOTIFY_INTERVAL 200
+
+static inline uchar toLowerChar(uchar c) {
+    return ((c >= 'A') && (c <= 'Z')) ? (c + ('a' - 'A')) : c;
+}
+
+static QByteArray toLowerData(const QByteArray &data) {
+    QByteArray rval = data;
+    for (int i = 0; i < rval.length(); i++) {
+        rval[i] = (char) toLowerChar((uchar) rval[i]);
+    }
+    return rval;
+}
+
+stk500SerialIndex::stk500SerialIndex(stk500SerialLog *log, QObject *parent) :
+    QThread(parent)
+{
+    this->_log = log;
+    this->stopRequested = false;
+    resetIndex();
+}
+
+stk500SerialIndex::~stk500SerialIndex() {
+    stop();
+}
+
+void stk500SerialIndex::stop() {
+    stopRequested = true;
+    wait();
+}
+
+void stk500SerialIndex::resetIndex() {
+    logGeneration = _log->generation();
+    _indexedSize = 0;
+    signatures.clear();
+    prevChars[0] = prevChars[1] = 0;
+}
+
+qint64 stk500SerialIndex::indexedSize() {
+    lock.lock();
+    qint64 rval = _indexedSize;
+    lock.unlock();
+    return rval;
+}
+
+uint stk500SerialIndex::trigramBit(uchar a, uchar b, uchar c) {
+    uint key = ((uint) a << 16) | ((uint) b << 8) | (uint) c;
+    return ((key * 2654435761U) >> 16) & (SERIAL_INDEX_SIG_BITS - 1);
+}
+
+QVector<uint> stk500SerialIndex::trigramBits(const QByteArray &text) {
+    QVector<uint> bits;
+    QByteArray lower = toLowerData(text);
+    for (int i = 2; i < lower.length(); i++) {
+        bits.append(trigramBit((uchar) lower[i - 2], (uchar) lower[i - 1], (uchar) lower[i]));
+    }
+    return bits;
+}
+
+/* Checks whether text with the trigram bits specified can start in a block */
+bool stk500SerialIndex::isCandidate(qint64 block, const QVector<uint> &bits) {
+    if (bits.isEmpty()) {
+        return true;
+    }
+
+    /*
+     * Trigrams are stored in the block holding their last character.
+     * Text starting in this block can end in the block that follows.
+     */
+    bool rval = true;
+    lock.lock();
+    qint64 blockCount = signatures.length() / SERIAL_INDEX_SIG_SIZE;
+    const uchar* sig = (const uchar*) signatures.constData() + block * SERIAL_INDEX_SIG_SIZE;
+    bool hasNext = ((block + 1) < blockCount);
+    for (int i = 0; (i < bits.count()) && (block < blockCount); i++) {
+        uint idx = bits[i] >> 3;
+        uchar mask = (1 << (bits[i] & 7));
+        uchar value = sig[idx];
+        if (hasNext) {
+            value |= sig[SERIAL_INDEX_SIG_SIZE + idx];
+        }
+        if (!(value & mask)) {
+            rval = false;
+            break;
+        }
+    }
+    lock.unlock();
+    return rval;
+}
+
+void stk500SerialIndex::run() {
+    char buff[65536];
+    QElapsedTimer notifyTimer;
+    notifyTimer.start();
+    bool notifyPending = false;
+    while (!stopRequested) {
+        /* Start over when the log was cleared */
+        if (_log->generation() != logGeneration) {
+            lock.lock();
+            resetIndex();
+            lock.unlock();
+            notifyPending = true;
+        }
+
+        /* Wait for more data when everything is indexed */
+        qint64 size = _log->size();
+        if (_indexedSize >= size) {
+            if (notifyPending) {
+                notifyPending = false;
+                emit indexUpdated();
+            }
+            msleep(SERIAL_INDEX_IDLE_TIME);
+            continue;
+        }
+
+        int len = _log->read(_indexedSize, buff, (int) qMin((qint64) sizeof(buff), size - _indexedSize));
+        if (len <= 0) {
+            msleep(SERIAL_INDEX_IDLE_TIME);
+            continue;
+        }
+
+        /* Set the bits of all trigrams ending in the data read */
+        lock.lock();
+        qint64 pos = _indexedSize;
+        for (int i = 0; i < len; i++, pos++) {
+            qint64 block = pos / SERIAL_INDEX_BLOCK_SIZE;
+            if ((pos % SERIAL_INDEX_BLOCK_SIZE) == 0) {
+                signatures.append(QByteArray(SERIAL_INDEX_SIG_SIZE, 0));
+            }
+
+            /* Trigrams are taken from the text as it is matched: without carriage returns, NUL as a space */
+            uchar c = (uchar) buff[i];
+            if (c == '\r') {
+                continue;
+            }
+            c = toLowerChar((c == '\0') ? ' ' : c);
+            if (pos >= 2) {
+                uint bit = trigramBit(prevChars[0], prevChars[1], c);
+                signatures.data()[block * SERIAL_INDEX_SIG_SIZE + (bit >> 3)] |= (1 << (bit & 7));
+            }
+            prevChars[0] = prevChars[1];
+            prevChars[1] = c;
+        }
+        _indexedSize = pos;
+        lock.unlock();
+
+        notifyPending = true;
+        if (notifyTimer.elapsed() >= SERIAL_INDEX_NOTIFY_INTERVAL) {
+            notifyTimer.restart();
+            notifyPending = false;
+            emit indexUpdated();
+        }
+    }
+}
+
+/* Finds the offset of the next (or previous) occurrence of text in the indexed data, -1 if not found */
+qint64 stk500SerialIndex::find(const QString &text, qint64 fromOffset, bool forward, bool caseSensitive) {
+    QByteArray pattern = text.toLatin1();
+    if (pattern.isEmpty()) {
+        return -1;
+    }
+    if (!caseSensitive) {
+        pattern = toLowerData(pattern);
+    }
+
+    /* Text longer than a block can not be checked against the signatures */
+    QVector<uint> bits;
+    if (pattern.length() <= SERIAL_INDEX_BLOCK_SIZE) {
+        bits = trigramBits(pattern);
+    }
+
+    qint64 size = indexedSize();
+    qint64 blockCount = (size + SERIAL_INDEX_BLOCK_SIZE - 1) / SERIAL_INDEX_BLOCK_SIZE;
+    qint64 block;
+    if (forward) {
+        block = qMax((qint64) 0, fromOffset) / SERIAL_INDEX_BLOCK_SIZE;
+    } else {
+        block = (qMin(fromOffset, size) - 1) / SERIAL_INDEX_BLOCK_SIZE;
+    }
+    for (; (block >= 0) && (block < blockCount); block += (forward ? 1 : -1)) {
+        if (!isCandidate(block, bits)) {
+            continue;
+        }
+
+        /* Read the block, plus enough of the next block to find text starting at the end */
+        qint64 blockStart = block * SERIAL_INDEX_BLOCK_SIZE;
+        qint64 readEnd = qMin(size, blockStart + SERIAL_INDEX_BLOCK_SIZE + pattern.length() - 1);
+        QByteArray data = _log->read(blockStart, (int) (readEnd - blockStart));
+        if (!caseSensitive) {
+            data = toLowerData(data);
+        }
+
+        int idx;
+        if (forward) {
+            idx = data.indexOf(pattern, (int) qMax((qint64) 0, fromOffset - blockStart));
+        } else {
+            int from = (int) qMin((qint64) SERIAL_INDEX_BLOCK_SIZE, fromOffset - blockStart) - 1;
+            idx = (from < 0) ? -1 : data.lastIndexOf(pattern, from);
+        }
+        if ((idx != -1) && (idx < SERIAL_INDEX_BLOCK_SIZE)) {
+            return blockStart + idx;
+        }
+    }
+    return -1;
+}
+
+/* Finds the start of the line holding the data at an offset */
+qint64 stk500SerialIndex::findLineStart(qint64 offset) {
+    qint64 start = qMax((qint64) 0, offset - SERIAL_INDEX_MAX_LINE_LENGTH);
+    QByteArray data = _log->read(start, (int) (offset - start));
+    int idx = data.lastIndexOf('\n');
+    return (idx == -1) ? start : (start + idx + 1);
+}
+
+/*
+ * Finds the longest text that must occur for a regular expression to match.
+ * When that can not be told for certain, nothing is returned.
+ */
+QByteArray stk500SerialIndex::requiredLiteral(const QString &pattern, QRegularExpression::PatternOptions options) {
+    QByteArray longest;
+    QByteArray current;
+    QList<QByteArray> groupLongest;   // Longest text found before each group that is still open
+    QList<bool> groupOptional;        // Whether the text inside each open group is not required
+    bool caseInsensitive = (options & QRegularExpression::CaseInsensitiveOption);
+    if (pattern.contains('|') || (options & QRegularExpression::ExtendedPatternSyntaxOption)) {
+        return QByteArray();
+    }
+    for (int i = 0; i < pattern.length(); i++) {
+        QChar c = pattern[i];
+        QChar next = ((i + 1) < pattern.length()) ? pattern[i + 1] : QChar();
+        bool isLiteral = false;
+        if (c == '\\') {
+            /*
+             * Escaped symbols are literal, escaped letters and digits are character classes.
+             * Escapes that take an argument (\x41, \0101, \k<name>, ...) are not understood.
+             */
+            i++;
+            if (next.isNull() || QString("0xuocgkNpPQE").contains(next)) {
+                return QByteArray();
+            }
+            if (!next.isLetterOrNumber()) {
+                c = next;
+                isLiteral = true;
+            }
+        } else if (c == '[') {
+            /* Skip character sets entirely; a ']' right at the start is part of the set */
+            i++;
+            if ((i < pattern.length()) && (pattern[i] == '^')) {
+                i++;
+            }
+            if ((i < pattern.length()) && (pattern[i] == ']')) {
+                i++;
+            }
+            while ((i < pattern.length()) && (pattern[i] != ']')) {
+                QChar next = ((i + 1) < pattern.length()) ? pattern[i + 1] : QChar();
+                if (pattern[i] == '\\') {
+                    i++;
+                } else if ((pattern[i] == '[') && ((next == ':') || (next == '.') || (next == '='))) {
+                    /* POSIX classes like [:alpha:] end with their own ']' */
+                    i = pattern.indexOf(QString(next) + ']', i + 2);
+                    if (i == -1) {
+                        return QByteArray();
+                    }
+                    i++;
+                }
+                i++;
+            }
+            if (i >= pattern.length()) {
+                return QByteArray();
+            }
+        } else if (c == '(') {
+            /* Text inside a negative lookaround must not occur, inline options and other special groups are not understood */
+            bool optional = false;
+            if (next == '?') {
+                QString kind = pattern.mid(i + 2, 2);
+                if (kind.startsWith(':') || kind.startsWith('=') || kind.startsWith('>')) {
+                    i += 2;
+                } else if (kind.startsWith('!')) {
+                    optional = true;
+                    i += 2;
+                } else if (kind == "<=") {
+                    i += 3;
+                } else if (kind == "<!") {
+                    optional = true;
+                    i += 3;
+                } else if (kind.startsWith('<') || kind.startsWith('\'') || (kind == "P<")) {
+                    i = pattern.indexOf(kind.startsWith('\'') ? '\'' : '>', i + 3);
+                    if (i == -1) {
+                        return QByteArray();
+                    }
+                } else {
+                    return QByteArray();
+                }
+            }
+            if (current.length() > longest.length()) {
+                longest = current;
+            }
+            current.clear();
+            groupLongest.append(longest);
+            groupOptional.append(optional);
+        } else if (c == ')') {
+            /* Text inside a group that is optional or repeated zero times is not required */
+            if (groupLongest.isEmpty()) {
+                return QByteArray();
+            }
+            QChar after = ((i + 2) < pattern.length()) ? pattern[i + 2] : QChar();
+            bool optional = groupOptional.takeLast() || (next == '?') || (next == '*') ||
+                            ((next == '{') && ((after == '0') || (after == ',')));
+            QByteArray before = groupLongest.takeLast();
+            if (optional) {
+                longest = before;
+                current.clear();
+            }
+        } else if ((c == '*') || (c == '?') || (c == '{')) {
+            /* The character before is optional or repeated an unknown amount */
+            current.chop(1);
+            while ((c == '{') && (i < pattern.length()) && (pattern[i] != '}')) {
+                i++;
+            }
+        } else if (QString(".^$+").indexOf(c) == -1) {
+            isLiteral = true;
+        }
+
+        /* Case-insensitive matching folds more than the ASCII letters the index folds */
+        if (isLiteral && caseInsensitive && (c.unicode() >= 128)) {
+            return QByteArray();
+        }
+        if (isLiteral && (c.unicode() < 256)) {
+            current.append((char) c.unicode());
+        } else {
+            if (current.length() > longest.length()) {
+                longest = current;
+            }
+            current.clear();
+        }
+    }
+    if (current.length() > longest.length()) {
+        longest = current;
+    }
+    return longest;
+}
+
+/* Finds the lines matching a regular expression, starting with the first line starting at or after an offset */
+QList<SerialLogMatch> stk500SerialIndex::findLines(const QRegularExpression &regex, qint64 fromOffset, int maxResults) {
+    QList<SerialLogMatch> results;
+    if (!regex.isValid() || (maxResults <= 0)) {
+        return results;
+    }
+    QVector<uint> bits = trigramBits(requiredLiteral(regex.pattern(), regex.patternOptions()));
+
+    qint64 size = indexedSize();
+    qint64 blockCount = (size + SERIAL_INDEX_BLOCK_SIZE - 1) / SERIAL_INDEX_BLOCK_SIZE;
+    qint64 processedEnd = qMax((qint64) 0, fromOffset);
+    bool skipPartial = (findLineStart(processedEnd) != processedEnd);
+    for (qint64 block = processedEnd / SERIAL_INDEX_BLOCK_SIZE; block < blockCount; block++) {
+        qint64 blockStart = block * SERIAL_INDEX_BLOCK_SIZE;
+        qint64 blockEnd = qMin(size, blockStart + SERIAL_INDEX_BLOCK_SIZE);
+        if ((processedEnd >= blockEnd) || !isCandidate(block, bits)) {
+            continue;
+        }
+
+        /* Check all lines overlapping with this block, the last line can continue past the end */
+        qint64 start = qMax(processedEnd, findLineStart(blockStart));
+        qint64 readEnd = qMin(size, blockEnd + SERIAL_INDEX_MAX_LINE_LENGTH);
+        QByteArray data = _log->read(start, (int) (readEnd - start));
+        int pos = 0;
+        while ((pos < data.length()) && ((start + pos) < blockEnd)) {
+            int lineEnd = data.indexOf('\n', pos);
+            int nextPos = lineEnd + 1;
+            if ((lineEnd == -1) || ((lineEnd - pos) >= SERIAL_INDEX_MAX_LINE_LENGTH)) {
+                lineEnd = qMin(data.length(), pos + SERIAL_INDEX_MAX_LINE_LENGTH);
+                nextPos = lineEnd;
+            }
+
+            QString text = QString::fromLatin1(data.constData() + pos, lineEnd - pos);
+            text.replace(QChar('\0'), QChar(' '));
+            text.remove('\r');
+            bool isPartial = skipPartial && ((start + pos) == fromOffset);
+            if (!isPartial && regex.match(text).hasMatch()) {
+                SerialLogMatch match;
+                match.offset = start + pos;
+                match.text = text;
+                results.append(match);
+                if (results.count() >= maxResults) {
+                    return results;
+                }
+            }
+            pos = nextPos;
+        }
+        processedEnd = start + pos;
+    }
+    return results;
+}
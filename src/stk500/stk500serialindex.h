@@ -0,0 +1,66 @@
+#ifndef STK500SERIALINDEX_H
+#define STK500SERIALINDEX_H
+
+#include <QThread>
+#include <QMutex>
+#include <QByteArray>
+#include <QRegularExpression>
+#include "stk500seriallog.h"
+
+#define SERIAL_INDEX_BLOCK_SIZE     16384   // Amount of logged data covered by a single trigram signature
+#define SERIAL_INDEX_SIG_BITS        8192   // Amount of bits in a trigram signature, must be a power of two
+#define SERIAL_INDEX_IDLE_TIME         50   // Time (in ms) to wait for new data once everything is indexed
+#define SERIAL_INDEX_MAX_LINE_LENGTH 4096   // Lines longer than this are broken up
+
+// A line of the log matching a search
+typedef struct SerialLogMatch {
+    qint64 offset;  // Offset into the log of the start of the line
+    QString text;   // Text contents of the line
+} SerialLogMatch;
+
+/*
+ * Indexes the data in a Serial log in the background for fast searching
+ *
+ * For every block of data a signature is stored with a bit set for every
+ * (case-insensitive) trigram that occurs in it. A search only reads back the
+ * blocks whose signature contains all trigrams of the searched text, which
+ * skips most of the log for all but the most common text. The index updates
+ * as new data is logged, and starts over when the log is cleared.
+ */
+class stk500SerialIndex : public QThread
+{
+    Q_OBJECT
+
+public:
+    stk500SerialIndex(stk500SerialLog *log, QObject *parent = 0);
+    ~stk500SerialIndex();
+    void stop();
+    stk500SerialLog *log() { return _log; }
+    qint64 indexedSize();
+    qint64 find(const QString &text, qint64 fromOffset, bool forward, bool caseSensitive);
+    QList<SerialLogMatch> findLines(const QRegularExpression &regex, qint64 fromOffset, int maxResults);
+
+signals:
+    void indexUpdated();
+
+protected:
+    void run();
+
+private:
+    static uint trigramBit(uchar a, uchar b, uchar c);
+    static QByteArray requiredLiteral(const QString &pattern, QRegularExpression::PatternOptions options);
+    QVector<uint> trigramBits(const QByteArray &text);
+    bool isCandidate(qint64 block, const QVector<uint> &bits);
+    void resetIndex();
+    qint64 findLineStart(qint64 offset);
+
+    stk500SerialLog *_log;
+    QMutex lock;
+    volatile bool stopRequested;
+    int logGeneration;
+    qint64 _indexedSize;
+    QByteArray signatures;
+    uchar prevChars[2];
+};
+
+#endif // STK500SERIALINDEX_H
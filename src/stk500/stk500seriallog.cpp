@@ -0,0 +1,286 @@
+#include "stk500seriallog.h"
+#include "stk500.h"
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+
+stk500SerialLog::stk500SerialLog() {
+    clearCount = 0;
+    failed = false;
+    totalSize = 0;
+    indexCount = 0;
+    firstTime = 0;
+    lastIndexTime = 0;
+    memory = new char[SERIAL_LOG_MEMORY_SIZE];
+}
+
+stk500SerialLog::~stk500SerialLog() {
+    clear();
+    delete[] memory;
+}
+
+QString stk500SerialLog::chunkPath(int chunkIndex) {
+    return QString("%1/chunk%2.bin").arg(folder).arg(chunkIndex, 5, 10, QChar('0'));
+}
+
+bool stk500SerialLog::openFiles() {
+    /* Unique folder for every log, multiple instances of the application can run */
+    QString name = QString("serial_%1_%2").arg(QCoreApplication::applicationPid())
+                                          .arg(QDateTime::currentMSecsSinceEpoch());
+    folder = stk500::getTempFile(name);
+    QDir::root().mkpath(folder);
+
+    chunkFile.setFileName(chunkPath(0));
+    indexFile.setFileName(folder + "/index.bin");
+    /* Unbuffered, so a full disk shows up as a failed write right away */
+    return chunkFile.open(QIODevice::WriteOnly | QIODevice::Unbuffered) &&
+           indexFile.open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+}
+
+void stk500SerialLog::closeFiles() {
+    chunkFile.close();
+    indexFile.close();
+    if (!folder.isEmpty()) {
+        QDir(folder).removeRecursively();
+        folder = "";
+    }
+}
+
+void stk500SerialLog::append(const char* data, int length, qint64 time) {
+    if (length <= 0) {
+        return;
+    }
+
+    lock.lock();
+
+    /* Opening the files is attempted only once, the log stays empty when that fails */
+    if (!failed && !indexFile.isOpen() && !openFiles()) {
+        failed = true;
+        closeFiles();
+    }
+    if (failed) {
+        lock.unlock();
+        return;
+    }
+
+    /* Add an index entry for the first data received, and every so often after */
+    if ((totalSize == 0) || ((time - lastIndexTime) >= SERIAL_LOG_INDEX_INTERVAL)) {
+        if (totalSize == 0) {
+            firstTime = time;
+        }
+        SerialLogIndex entry;
+        entry.time = time;
+        entry.offset = totalSize;
+        if (!indexFile.seek(indexCount * sizeof(SerialLogIndex)) ||
+                (indexFile.write((char*) &entry, sizeof(entry)) != sizeof(entry))) {
+            failed = true;
+            lock.unlock();
+            return;
+        }
+        indexCount++;
+        lastIndexTime = time;
+    }
+
+    while (length > 0) {
+        /* Continue with the next chunk file once the current one is full */
+        qint64 chunkOffset = (totalSize % SERIAL_LOG_CHUNK_SIZE);
+        if ((chunkOffset == 0) && (totalSize != 0)) {
+            chunkFile.close();
+            chunkFile.setFileName(chunkPath(totalSize / SERIAL_LOG_CHUNK_SIZE));
+            failed = !chunkFile.open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+        }
+
+        /* Stop logging when the disk is full; data logged up till now stays readable */
+        int len = (int) qMin((qint64) length, SERIAL_LOG_CHUNK_SIZE - chunkOffset);
+        if (failed || (chunkFile.write(data, len) != len)) {
+            failed = true;
+            break;
+        }
+
+        /* Keep a copy of the most recent data in memory */
+        int memOffset = (int) (totalSize % SERIAL_LOG_MEMORY_SIZE);
+        int memLen = qMin(len, SERIAL_LOG_MEMORY_SIZE - memOffset);
+        memcpy(memory + memOffset, data, memLen);
+        memcpy(memory, data + memLen, len - memLen);
+
+        totalSize += len;
+        data += len;
+        length -= len;
+    }
+    lock.unlock();
+}
+
+void stk500SerialLog::clear() {
+    lock.lock();
+    closeFiles();
+    clearCount++;
+    failed = false;
+    totalSize = 0;
+    indexCount = 0;
+    firstTime = 0;
+    lastIndexTime = 0;
+    lock.unlock();
+}
+
+/* Changes every time the log is cleared, so readers know to start over */
+int stk500SerialLog::generation() {
+    lock.lock();
+    int rval = clearCount;
+    lock.unlock();
+    return rval;
+}
+
+qint64 stk500SerialLog::size() {
+    lock.lock();
+    qint64 rval = totalSize;
+    lock.unlock();
+    return rval;
+}
+
+qint64 stk500SerialLog::startTime() {
+    lock.lock();
+    qint64 rval = firstTime;
+    lock.unlock();
+    return rval;
+}
+
+int stk500SerialLog::read(qint64 offset, char* dest, int length) {
+    lock.lock();
+    int done = readData(offset, dest, length);
+    lock.unlock();
+    return done;
+}
+
+/* Reads logged data, the lock must be held */
+int stk500SerialLog::readData(qint64 offset, char* dest, int length) {
+    if ((offset < 0) || (offset >= totalSize)) {
+        length = 0;
+    } else if (length > (totalSize - offset)) {
+        length = (int) (totalSize - offset);
+    }
+
+    /* Recent data is read from memory, older data from the chunk files */
+    qint64 memStart = qMax((qint64) 0, totalSize - SERIAL_LOG_MEMORY_SIZE);
+    int done = 0;
+    if (offset < memStart) {
+        chunkFile.flush();
+        while ((done < length) && ((offset + done) < memStart)) {
+            qint64 pos = offset + done;
+            QFile file(chunkPath(pos / SERIAL_LOG_CHUNK_SIZE));
+            if (!file.open(QIODevice::ReadOnly) || !file.seek(pos % SERIAL_LOG_CHUNK_SIZE)) {
+                break;
+            }
+            qint64 chunkRemaining = SERIAL_LOG_CHUNK_SIZE - (pos % SERIAL_LOG_CHUNK_SIZE);
+            int len = (int) qMin((qint64) (length - done), chunkRemaining);
+            qint64 fileRead = file.read(dest + done, len);
+            if (fileRead <= 0) {
+                break;
+            }
+            done += (int) fileRead;
+        }
+    }
+    while ((done < length) && ((offset + done) >= memStart)) {
+        int memOffset = (int) ((offset + done) % SERIAL_LOG_MEMORY_SIZE);
+        int len = qMin(length - done, SERIAL_LOG_MEMORY_SIZE - memOffset);
+        memcpy(dest + done, memory + memOffset, len);
+        done += len;
+    }
+    return done;
+}
+
+QByteArray stk500SerialLog::read(qint64 offset, int length) {
+    QByteArray data;
+    data.resize(qMax(0, length));
+    data.resize(read(offset, data.data(), data.length()));
+    return data;
+}
+
+bool stk500SerialLog::readIndex(qint64 entryIndex, SerialLogIndex &entry) {
+    indexFile.flush();
+    if (!indexFile.seek(entryIndex * sizeof(SerialLogIndex))) {
+        return false;
+    }
+    return indexFile.read((char*) &entry, sizeof(entry)) == sizeof(entry);
+}
+
+/* Binary search for the first index entry with a time or offset larger than the value */
+qint64 stk500SerialLog::findIndex(bool byTime, qint64 value) {
+    qint64 low = 0;
+    qint64 high = indexCount;
+    SerialLogIndex entry;
+    while (low < high) {
+        qint64 mid = low + (high - low) / 2;
+        if (!readIndex(mid, entry)) {
+            break;
+        }
+        if ((byTime ? entry.time : entry.offset) <= value) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+qint64 stk500SerialLog::timeAt(qint64 offset) {
+    lock.lock();
+    qint64 time = firstTime;
+    SerialLogIndex entry;
+    qint64 entryIndex = findIndex(false, offset) - 1;
+    if ((entryIndex >= 0) && readIndex(entryIndex, entry)) {
+        time = entry.time;
+    }
+    lock.unlock();
+    return time;
+}
+
+qint64 stk500SerialLog::offsetAt(qint64 time) {
+    lock.lock();
+    qint64 offset = totalSize;
+    SerialLogIndex entry;
+    qint64 entryIndex = findIndex(true, time - 1);
+    if ((entryIndex < indexCount) && readIndex(entryIndex, entry)) {
+        offset = entry.offset;
+    }
+    lock.unlock();
+    return offset;
+}
+
+bool stk500SerialLog::save(const QString &filePath) {
+    return save(filePath, 0, size());
+}
+
+bool stk500SerialLog::save(const QString &filePath, qint64 startOffset, qint64 endOffset) {
+    /* Only take over the current state; data already written is never changed, unless the log is cleared */
+    lock.lock();
+    chunkFile.flush();
+    int saveGeneration = clearCount;
+    endOffset = qMin(endOffset, totalSize);
+    startOffset = qMax((qint64) 0, startOffset);
+    lock.unlock();
+
+    QFile destFile(filePath);
+    if (!destFile.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    /*
+     * Copy the chunk files (or parts of them) without blocking new data from being logged
+     * When the log is cleared meanwhile, saving fails rather than mixing in data of the new log
+     */
+    char buff[65536];
+    qint64 pos = startOffset;
+    while (pos < endOffset) {
+        int len = (int) qMin((qint64) sizeof(buff), endOffset - pos);
+        lock.lock();
+        len = (clearCount == saveGeneration) ? readData(pos, buff, len) : 0;
+        lock.unlock();
+        if ((len <= 0) || (destFile.write(buff, len) != len)) {
+            destFile.close();
+            return false;
+        }
+        pos += len;
+    }
+    destFile.close();
+    return true;
+}
@@ -0,0 +1,75 @@
+#ifndef STK500SERIALLOG_H
+#define STK500SERIALLOG_H
+
+#include <QString>
+#include <QFile>
+#include <QMutex>
+#include <QByteArray>
+
+#define SERIAL_LOG_CHUNK_SIZE    16777216   // Maximum size of a single chunk file on disk
+#define SERIAL_LOG_MEMORY_SIZE    1048576   // Amount of most recently received data kept in memory
+#define SERIAL_LOG_INDEX_INTERVAL      10   // Minimal time (in ms) between two timestamp index entries
+
+// Single entry of the timestamp index, stored as-is in the index file
+typedef struct SerialLogIndex {
+    qint64 time;    // Time (ms since epoch) the data at the offset was received
+    qint64 offset;  // Offset into the log of the first byte received at that time
+} SerialLogIndex;
+
+/*
+ * Append-only log of all data received over Serial
+ *
+ * Data is appended by the process thread as it is received and streamed into
+ * chunk files in a temporary folder. A timestamp index is stored alongside it.
+ * Only the most recently received data is kept in memory, so memory usage stays
+ * the same no matter how long the log grows. All other functions may be called
+ * from any other thread while data is being appended. When the files can not be
+ * created or written, logging stops until the log is cleared.
+ */
+class stk500SerialLog
+{
+public:
+    stk500SerialLog();
+    ~stk500SerialLog();
+
+    /* Used by the process thread receiving the data */
+    void append(const char* data, int length, qint64 time);
+    void clear();
+
+    /* Reading of the logged data */
+    int generation();
+    qint64 size();
+    qint64 startTime();
+    int read(qint64 offset, char* dest, int length);
+    QByteArray read(qint64 offset, int length);
+    qint64 timeAt(qint64 offset);
+    qint64 offsetAt(qint64 time);
+    bool save(const QString &filePath);
+    bool save(const QString &filePath, qint64 startOffset, qint64 endOffset);
+
+private:
+    QString chunkPath(int chunkIndex);
+    bool openFiles();
+    void closeFiles();
+    int readData(qint64 offset, char* dest, int length);
+    bool readIndex(qint64 entryIndex, SerialLogIndex &entry);
+    qint64 findIndex(bool byTime, qint64 value);
+
+    // copy ops are private to prevent copying
+    stk500SerialLog(const stk500SerialLog&); // no implementation
+    stk500SerialLog& operator=(const stk500SerialLog&); // no implementation
+
+    QMutex lock;
+    int clearCount;
+    bool failed;
+    QString folder;
+    QFile chunkFile;
+    QFile indexFile;
+    qint64 totalSize;
+    qint64 indexCount;
+    qint64 firstTime;
+    qint64 lastIndexTime;
+    char *memory;
+};
+
+#endif // STK500SERIALLOG_H
@@ -132,6 +132,9 @@ int stk500service::readSerial(char* output, int limit) {
         memcpy(output + readLength, data.data(), len);
         readLength += len;
     }
+    if ((readLength < limit) && port->isCancelled()) {
+        throw ProtocolException("Operation cancelled");
+    }
     return readLength;
 }
 
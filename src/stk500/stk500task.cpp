@@ -35,6 +35,12 @@ void stk500Task::setError(ProtocolException exception) {
     _exception = exception;
 }
 
+void stk500Task::yield() {
+    if ((_yieldInterface != NULL) && !isCancelled()) {
+        _yieldInterface->yieldTask(this);
+    }
+}
+
 /***************************************************************
  ************* Standard Micro-SD Task Functions ****************
  ***************************************************************
@@ -7,21 +7,36 @@
 #include <QStringList>
 #include <QList>
 #include "longfilenamegen.h"
+#include "stk500samplebuffer.h"
+#include "stk500pincapture.h"
+#include "stk500testsequence.h"
+#include "stk500rammonitor.h"
+#include "stk500ramprofile.h"
 #include <QDebug>
 #include <QDir>
 #include <QFile>
+#include <QElapsedTimer>
 #include <QMessageBox>
 #include <qmath.h>
 
 #define SHOW_DOTNAMES 0
 
+class stk500Task;
+
+// Interface used by long-running tasks to let other tasks run at safe points
+class stk500YieldInterface {
+public:
+    virtual void yieldTask(stk500Task *) {}
+};
+
 class stk500Task
 {
 public:
     stk500Task(QString title = "")
         : _hasError(false), _isCancelled(false), _progress(-1.0),
           _status(title + "..."), _title(title), _cancelSuppress(false),
-          _isFinished(false), _usesFirmware(true) {}
+          _isFinished(false), _usesFirmware(true), _isInterleavable(false),
+          _yieldInterface(NULL) {}
 
     virtual ~stk500Task() {}
     virtual void run() = 0;
@@ -33,6 +48,9 @@ public:
     bool isSuccessful() { return !isCancelled() && !hasError(); }
     bool usesFirmware() { return _usesFirmware; }
     void setUsesFirmware(bool usesFirmware) { _usesFirmware = usesFirmware; }
+    bool isInterleavable() { return _isInterleavable; }
+    void setInterleavable(bool interleavable) { _isInterleavable = interleavable; }
+    void setYieldInterface(stk500YieldInterface *yieldInterface) { _yieldInterface = yieldInterface; }
     void suppressCancel(bool suppress) { _cancelSuppress = suppress; }
     bool isCancelSuppressed() { return _cancelSuppress; }
     const ProtocolException getError() { return _exception; }
@@ -58,6 +76,12 @@ public:
     void sd_allocEntries(DirectoryEntryPtr startPos, int oldLength, int newLength);
     bool sd_remove(QString fileName, bool fileIsDir);
 protected:
+    /*
+     * Called by long-running tasks at points where the protocol state is consistent
+     * Short interleavable tasks queued meanwhile may then be executed in between
+     */
+    void yield();
+
     stk500 *protocol;
 
 private:
@@ -70,9 +94,20 @@ private:
     bool _cancelSuppress;
     bool _isFinished;
     bool _usesFirmware;
+    bool _isInterleavable;
+    stk500YieldInterface *_yieldInterface;
     QMutex _sync;
 };
 
+// Suppresses cancelling a task while in scope, also when an exception is thrown
+class stk500CancelSuppressor {
+public:
+    stk500CancelSuppressor(stk500Task *task, bool suppress = true) : _task(task) { task->suppressCancel(suppress); }
+    ~stk500CancelSuppressor() { _task->suppressCancel(false); }
+private:
+    stk500Task *_task;
+};
+
 class stk500ListSubDirs : public stk500Task {
 public:
     stk500ListSubDirs(QString directoryPath) : stk500Task("Listing files"), directoryPath(directoryPath) {}
@@ -161,7 +196,7 @@ public:
 
 class stk500LoadIcon : public stk500Task {
 public:
-    stk500LoadIcon(SketchInfo &sketch) : stk500Task("Loading icon"), sketch(sketch) {}
+    stk500LoadIcon(SketchInfo &sketch) : stk500Task("Loading icon"), sketch(sketch) { setInterleavable(true); }
     virtual void run();
 
     SketchInfo sketch;
@@ -169,7 +204,7 @@ public:
 
 class stk500UpdateRegisters : public stk500Task {
 public:
-    stk500UpdateRegisters(ChipRegisters &reg) : stk500Task("Updating registers"), reg(reg), read(true), readADC(true) {}
+    stk500UpdateRegisters(ChipRegisters &reg) : stk500Task("Updating registers"), reg(reg), read(true), readADC(true) { setInterleavable(true); }
     virtual void run();
 
     ChipRegisters reg;
@@ -177,14 +212,91 @@ public:
     bool readADC;
 };
 
+class stk500SampleAnalog : public stk500Task {
+public:
+    stk500SampleAnalog(stk500SampleBuffer *buffer, const QList<int> &channels)
+        : stk500Task("Sampling analog inputs"), buffer(buffer), channels(channels) {}
+    virtual void run();
+
+    stk500SampleBuffer *buffer;
+    QList<int> channels;
+};
+
+class stk500CapturePins : public stk500Task {
+public:
+    stk500CapturePins(stk500PinCapture *capture)
+        : stk500Task("Capturing pin states"), capture(capture) {}
+    virtual void run();
+
+    stk500PinCapture *capture;
+};
+
+class stk500MonitorRam : public stk500Task {
+public:
+    stk500MonitorRam(stk500RamMonitor *monitor)
+        : stk500Task("Reading RAM"), monitor(monitor) {}
+    virtual void run();
+
+    stk500RamMonitor *monitor;
+};
+
+class stk500ProfileRam : public stk500Task {
+public:
+    stk500ProfileRam(stk500RamProfile *profile, int runTime)
+        : stk500Task("Profiling RAM use"), profile(profile), runTime(runTime) {}
+    virtual void run();
+
+    stk500RamProfile *profile;
+    int runTime;
+
+private:
+    void seed();
+    QByteArray readRegion();
+    quint16 readWord(int address);
+    void enterFirmware();
+};
+
+class stk500RunTestSequence : public stk500Task {
+public:
+    stk500RunTestSequence(stk500TestSequence *sequence)
+        : stk500Task("Running tests"), sequence(sequence) {}
+    virtual void run();
+
+    stk500TestSequence *sequence;
+
+private:
+    void runTest(TestCase &test);
+    void writeSteps(const QList<TestStep> &steps, int first, int end);
+    void expectSteps(TestCase &test, int first, int end);
+    void sleepUntil(qint64 deadline);
+
+    ChipRegisters reg;
+    QElapsedTimer timer;
+};
+
+class stk500ReadFlash : public stk500Task {
+public:
+    stk500ReadFlash() : stk500Task("Reading flash"), pipelined(true) {}
+    virtual void run();
+
+    ProgramData data;
+
+private:
+    void readRange(char* flash, quint32 address, quint32 endAddress, quint32 doneBytes, quint32 totalBytes);
+    void readPages(const quint32 *addresses, char* dest, int count, int length);
+
+    bool pipelined;
+};
+
 class stk500Upload : public stk500Task {
 public:
-    stk500Upload(const ProgramData &data)
-        : stk500Task("Uploading"), data(data) {}
+    stk500Upload(const ProgramData &data, bool differential = true)
+        : stk500Task("Uploading"), data(data), differential(differential) {}
     virtual void run();
     virtual void init();
 
     ProgramData data;
+    bool differential;
 };
 
 class stk500BeginSerial : public stk500Task {
@@ -0,0 +1,307 @@
+#include "stk500testsequence.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QXmlStreamWriter>
+#include <QDateTime>
+#include <QHostInfo>
+
+/* Splits a line into whitespace-separated tokens, text within double quotes is one token */
+static QStringList splitTokens(const QString &line) {
+    QStringList tokens;
+    QString token;
+    bool quoted = false;
+    bool hasToken = false;
+    for (int i = 0; i < line.length(); i++) {
+        QChar c = line[i];
+        if (c == '"') {
+            quoted = !quoted;
+            hasToken = true;
+        } else if (quoted) {
+            token += c;
+        } else if (c == '#') {
+            break;
+        } else if (c.isSpace()) {
+            if (hasToken) {
+                tokens.append(token);
+                token.clear();
+                hasToken = false;
+            }
+        } else {
+            token += c;
+            hasToken = true;
+        }
+    }
+    if (hasToken) {
+        tokens.append(token);
+    }
+    return tokens;
+}
+
+bool stk500TestSequence::load(const QString &filePath) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        parseError = "Failed to open " + filePath;
+        return false;
+    }
+    sequenceName = QFileInfo(filePath).completeBaseName();
+    return parse(QTextStream(&file).readAll());
+}
+
+bool stk500TestSequence::parse(const QString &text) {
+    cases.clear();
+    parseError.clear();
+    QStringList lines = text.split('\n');
+    for (int i = 0; i < lines.count(); i++) {
+        QStringList tokens = splitTokens(lines[i]);
+        if (tokens.isEmpty()) {
+            continue;
+        }
+
+        // A new test starts, steps before the first test belong to a test named after the sequence
+        if (tokens[0] == "test") {
+            if (tokens.count() != 2) {
+                parseError = QString("Line %1: a test needs a name").arg(i + 1);
+                return false;
+            }
+            TestCase test;
+            test.name = tokens[1];
+            cases.append(test);
+            continue;
+        }
+        if (cases.isEmpty()) {
+            TestCase test;
+            test.name = sequenceName.isEmpty() ? QString("sequence") : sequenceName;
+            cases.append(test);
+        }
+
+        TestStep step;
+        step.line = i + 1;
+        step.pin = -1;
+        step.address = -1;
+        step.channel = -1;
+        step.mask = 0xFF;
+        step.mode = false;
+        step.value = 0;
+        step.maximum = 0;
+        step.time = 0;
+        if (!parseLine(tokens, step)) {
+            parseError = QString("Line %1: %2").arg(i + 1).arg(parseError);
+            return false;
+        }
+        cases.last().steps.append(step);
+    }
+    clearResults();
+    return true;
+}
+
+bool stk500TestSequence::parseLine(const QStringList &tokens, TestStep &step) {
+    const QString &command = tokens[0];
+    if (command == "output" || command == "input") {
+        // output <pin> <state>, input <pin> [pull-up]
+        step.type = TEST_STEP_SET_PIN;
+        step.mode = (command == "output");
+        if ((tokens.count() != 3) && (step.mode || (tokens.count() != 2))) {
+            parseError = "expected " + command + " <pin> " + (step.mode ? "<state>" : "[pull-up]");
+            return false;
+        }
+        return parsePin(tokens[1], step) &&
+               ((tokens.count() == 2) || parseNumber(tokens[2], 0, 1, step.value));
+    }
+    if (command == "set") {
+        // set <register> <value>
+        step.type = TEST_STEP_SET_REGISTER;
+        if (tokens.count() != 3) {
+            parseError = "expected set <register> <value>";
+            return false;
+        }
+        return parseRegister(tokens[1], step) && parseNumber(tokens[2], 0, 0xFF, step.value);
+    }
+    if (command == "sleep") {
+        // sleep <ms>
+        step.type = TEST_STEP_SLEEP;
+        if (tokens.count() != 2) {
+            parseError = "expected sleep <ms>";
+            return false;
+        }
+        return parseNumber(tokens[1], 0, 60000, step.time);
+    }
+    if (command != "expect" || tokens.count() < 2) {
+        parseError = "unknown step " + command;
+        return false;
+    }
+
+    // expect <what> <arguments> [mask <mask>] [within <ms>]
+    QStringList args = tokens.mid(2);
+    if ((args.count() >= 2) && (args[args.count() - 2] == "within")) {
+        if (!parseNumber(args.last(), 0, 60000, step.time)) {
+            return false;
+        }
+        args = args.mid(0, args.count() - 2);
+    }
+    if ((tokens[1] == "reg") && (args.count() >= 2) && (args[args.count() - 2] == "mask")) {
+        int mask;
+        if (!parseNumber(args.last(), 0, 0xFF, mask)) {
+            return false;
+        }
+        step.mask = (quint8) mask;
+        args = args.mid(0, args.count() - 2);
+    }
+    if ((tokens[1] == "pin") && (args.count() == 2)) {
+        step.type = TEST_STEP_EXPECT_PIN;
+        return parsePin(args[0], step) && parseNumber(args[1], 0, 1, step.value);
+    }
+    if ((tokens[1] == "reg") && (args.count() == 2)) {
+        step.type = TEST_STEP_EXPECT_REGISTER;
+        return parseRegister(args[0], step) && parseNumber(args[1], 0, 0xFF, step.value);
+    }
+    if ((tokens[1] == "adc") && (args.count() == 3)) {
+        step.type = TEST_STEP_EXPECT_ADC;
+        return parseNumber(args[0], 0, ANALOG_PIN_COUNT - 1, step.channel) &&
+               parseNumber(args[1], 0, 1023, step.value) &&
+               parseNumber(args[2], step.value, 1023, step.maximum);
+    }
+    parseError = "expected expect pin <pin> <state>, expect reg <register> <value> [mask <mask>]"
+                 " or expect adc <channel> <min> <max>, optionally followed by within <ms>";
+    return false;
+}
+
+/* Pins are given by number, or by module and function separated by a colon */
+bool stk500TestSequence::parsePin(const QString &text, TestStep &step) {
+    int pin;
+    bool isNumber;
+    pin = text.toInt(&isNumber);
+    int split = text.indexOf(':');
+    if (isNumber) {
+        step.pin = ChipRegisters::findPinInfo(pin).pin;
+    } else if (split != -1) {
+        step.pin = ChipRegisters::findPinInfo(text.left(split), text.mid(split + 1)).pin;
+    } else {
+        step.pin = -1;
+    }
+    if (step.pin == -1) {
+        parseError = "unknown pin " + text;
+        return false;
+    }
+    step.address = ChipRegisters::findPinInfo(step.pin).addr_pin;
+    return true;
+}
+
+/* Registers are given by name, or by address */
+bool stk500TestSequence::parseRegister(const QString &text, TestStep &step) {
+    bool isNumber;
+    int address = text.toInt(&isNumber, 0);
+    if (!isNumber) {
+        address = ChipRegisters::findRegisterAddress(text);
+    }
+    if ((address < CHIPREG_ADDR_START) || (address > CHIPREG_ADDR_END)) {
+        parseError = "unknown register " + text;
+        return false;
+    }
+    step.address = address;
+    return true;
+}
+
+bool stk500TestSequence::parseNumber(const QString &text, int minimum, int maximum, int &value) {
+    bool isNumber;
+    value = text.toInt(&isNumber, 0);
+    if (!isNumber || (value < minimum) || (value > maximum)) {
+        parseError = QString("%1 is not a number from %2 to %3").arg(text).arg(minimum).arg(maximum);
+        return false;
+    }
+    return true;
+}
+
+bool stk500TestSequence::isSetStep(const TestStep &step) {
+    return (step.type == TEST_STEP_SET_PIN) || (step.type == TEST_STEP_SET_REGISTER);
+}
+
+bool stk500TestSequence::isExpectStep(const TestStep &step) {
+    return (step.type == TEST_STEP_EXPECT_PIN) || (step.type == TEST_STEP_EXPECT_REGISTER) ||
+           (step.type == TEST_STEP_EXPECT_ADC);
+}
+
+void stk500TestSequence::clearResults() {
+    for (int i = 0; i < cases.count(); i++) {
+        cases[i].failures.clear();
+        cases[i].error.clear();
+        cases[i].skipped = false;
+        cases[i].time = 0;
+    }
+}
+
+int stk500TestSequence::failureCount() const {
+    int count = 0;
+    for (int i = 0; i < cases.count(); i++) {
+        if (!cases[i].failures.isEmpty() && cases[i].error.isEmpty()) count++;
+    }
+    return count;
+}
+
+int stk500TestSequence::errorCount() const {
+    int count = 0;
+    for (int i = 0; i < cases.count(); i++) {
+        if (!cases[i].error.isEmpty()) count++;
+    }
+    return count;
+}
+
+int stk500TestSequence::skippedCount() const {
+    int count = 0;
+    for (int i = 0; i < cases.count(); i++) {
+        if (cases[i].skipped) count++;
+    }
+    return count;
+}
+
+bool stk500TestSequence::passed() const {
+    return !cases.isEmpty() && !failureCount() && !errorCount() && !skippedCount();
+}
+
+bool stk500TestSequence::exportJUnit(const QString &filePath) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    qint64 totalTime = 0;
+    for (int i = 0; i < cases.count(); i++) {
+        totalTime += cases[i].time;
+    }
+
+    QXmlStreamWriter xml(&file);
+    xml.setAutoFormatting(true);
+    xml.writeStartDocument();
+    xml.writeStartElement("testsuite");
+    xml.writeAttribute("name", sequenceName);
+    xml.writeAttribute("tests", QString::number(cases.count()));
+    xml.writeAttribute("failures", QString::number(failureCount()));
+    xml.writeAttribute("errors", QString::number(errorCount()));
+    xml.writeAttribute("skipped", QString::number(skippedCount()));
+    xml.writeAttribute("time", QString::number(totalTime / 1000000.0, 'f', 3));
+    xml.writeAttribute("timestamp", QDateTime::currentDateTime().toString(Qt::ISODate));
+    xml.writeAttribute("hostname", QHostInfo::localHostName());
+    for (int i = 0; i < cases.count(); i++) {
+        const TestCase &test = cases[i];
+        xml.writeStartElement("testcase");
+        xml.writeAttribute("classname", sequenceName);
+        xml.writeAttribute("name", test.name);
+        xml.writeAttribute("time", QString::number(test.time / 1000000.0, 'f', 3));
+        if (!test.error.isEmpty()) {
+            xml.writeStartElement("error");
+            xml.writeAttribute("message", test.error);
+            xml.writeCharacters(test.failures.join('\n'));
+            xml.writeEndElement();
+        } else if (!test.failures.isEmpty()) {
+            xml.writeStartElement("failure");
+            xml.writeAttribute("message", test.failures.first());
+            xml.writeCharacters(test.failures.join('\n'));
+            xml.writeEndElement();
+        } else if (test.skipped) {
+            xml.writeEmptyElement("skipped");
+        }
+        xml.writeEndElement();
+    }
+    xml.writeEndElement();
+    xml.writeEndDocument();
+    return !xml.hasError();
+}
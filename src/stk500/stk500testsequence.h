@@ -0,0 +1,94 @@
+#ifndef STK500TESTSEQUENCE_H
+#define STK500TESTSEQUENCE_H
+
+#include "stk500registers.h"
+#include <QStringList>
+#include <QList>
+
+#define TEST_SEQUENCE_SPIN_TIME   2   // Time (in ms) before a deadline spent spinning instead of sleeping
+
+// The kinds of steps a test sequence is made of
+enum TestStepType {
+    TEST_STEP_SET_PIN,        // Sets a pin as input or output, and its state
+    TEST_STEP_SET_REGISTER,   // Sets a register value
+    TEST_STEP_SLEEP,          // Waits a given time
+    TEST_STEP_EXPECT_PIN,     // Reads the state of a pin, and compares it
+    TEST_STEP_EXPECT_REGISTER,// Reads a register, and compares the masked value
+    TEST_STEP_EXPECT_ADC      // Reads an analog input, and checks it is within range
+};
+
+typedef struct TestStep {
+    TestStepType type;
+    int line;         // Line in the sequence file, for reporting
+    int pin;          // Pin number of pin steps
+    int address;      // Register address read or written
+    int channel;      // Analog input channel
+    quint8 mask;      // Bits of the register compared
+    bool mode;        // Pin is set as output
+    int value;        // Value set or expected, minimum of analog values
+    int maximum;      // Maximum of analog values
+    int time;         // Time to sleep, or time (in ms) an expectation may take to become true
+} TestStep;
+
+typedef struct TestCase {
+    QString name;
+    QList<TestStep> steps;
+
+    // Results of the last run
+    QStringList failures;
+    QString error;
+    bool skipped;
+    qint64 time;      // Time (in us) the test took
+} TestCase;
+
+/*
+ * A sequence of pin, register and analog input steps, split into named tests
+ *
+ * Sequences are loaded from a text file with one step per line:
+ *
+ *   # Comments start with a hash
+ *   test "Button and LED"
+ *   output 13 1                       # Pin 13 as output, driven high
+ *   input "System:SELECT Button" 1    # Pin by module and function, with pull-up
+ *   set PORTB 0x80                    # Register by name or address
+ *   sleep 20                          # Wait 20 ms
+ *   expect pin 38 1 within 100        # Allow the pin 100 ms to become high
+ *   expect reg PINB 0x80 mask 0x80
+ *   expect adc 3 400 600
+ *
+ * The runner task writes consecutive set steps in one go, and reads consecutive
+ * expect steps in one go, so a sequence should group independent steps together.
+ * The results are exported as JUnit XML, which build servers understand.
+ */
+class stk500TestSequence
+{
+public:
+    stk500TestSequence() {}
+    bool load(const QString &filePath);
+    bool parse(const QString &text);
+    const QString &errorMessage() const { return parseError; }
+    const QString &name() const { return sequenceName; }
+    void setName(const QString &name) { sequenceName = name; }
+    QList<TestCase> &testCases() { return cases; }
+    void clearResults();
+    int failureCount() const;
+    int errorCount() const;
+    int skippedCount() const;
+    bool passed() const;
+    bool exportJUnit(const QString &filePath);
+
+    static bool isSetStep(const TestStep &step);
+    static bool isExpectStep(const TestStep &step);
+
+private:
+    bool parseLine(const QStringList &tokens, TestStep &step);
+    bool parsePin(const QString &text, TestStep &step);
+    bool parseRegister(const QString &text, TestStep &step);
+    bool parseNumber(const QString &text, int minimum, int maximum, int &value);
+
+    QString sequenceName;
+    QString parseError;
+    QList<TestCase> cases;
+};
+
+#endif // STK500TESTSEQUENCE_H
@@ -0,0 +1,70 @@
+#include "../stk500task.h"
+#include <QElapsedTimer>
+
+void stk500CapturePins::run() {
+    if (capture->pins().isEmpty()) {
+        return;
+    }
+
+    /*
+     * The PIN register ranges are read several times over in one pipeline
+     * If the device can not keep up with pipelined commands, this capture falls back to one at a time
+     */
+    const QVector<quint16> &addresses = capture->rangeAddresses();
+    const QVector<int> &lengths = capture->rangeLengths();
+    int rangeCount = addresses.count();
+    int sampleLength = capture->rangeTotalLength();
+    int depth = qMax(1, protocol->getPipelineDepth());
+    bool pipelined = true;
+    QVector<quint16> batchAddresses;
+    QVector<int> batchLengths;
+    for (int i = 0; i < depth; i++) {
+        batchAddresses += addresses;
+        batchLengths += lengths;
+    }
+    QByteArray data(depth * sampleLength, 0);
+    QElapsedTimer timer;
+    timer.start();
+    qint64 lastStatusTime = 0;
+    while (!isCancelled()) {
+        qint64 startTime = timer.nsecsElapsed() / 1000;
+        if (pipelined) {
+            try {
+                protocol->RAM_readBatch(batchAddresses.data(), batchLengths.data(), data.data(), depth * rangeCount);
+            } catch (ProtocolException &) {
+                if (isCancelled()) {
+                    throw;
+                }
+                pipelined = false;
+                depth = 1;
+                continue;
+            }
+        } else {
+            char* dest = data.data();
+            for (int i = 0; i < rangeCount; i++) {
+                protocol->RAM_read(addresses[i], dest, lengths[i]);
+                dest += lengths[i];
+            }
+        }
+        qint64 endTime = timer.nsecsElapsed() / 1000;
+
+        // Spread the timestamps over the time the batch took
+        for (int i = 0; i < depth; i++) {
+            qint64 time = startTime + (endTime - startTime) * (i + 1) / depth;
+            if (!capture->record(time, data.constData() + i * sampleLength)) {
+                setStatus("Capture full, stopped capturing");
+                return;
+            }
+        }
+
+        // Show the sample rate every now and then
+        if ((endTime - lastStatusTime) >= 1000000) {
+            double rate = (double) capture->sampleCount() * 1000000.0 / qMax((qint64) 1, endTime);
+            setStatus(QString("Capturing pin states: %1 samples/s").arg(rate, 0, 'f', 0));
+            lastStatusTime = endTime;
+        }
+
+        // Let register updates run in between
+        yield();
+    }
+}
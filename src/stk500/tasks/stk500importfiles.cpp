@@ -86,112 +86,126 @@ void stk500ImportFiles::importFile(DirectoryEntryPtr dirStartPtr, QString source
 
     bool hasReadError = false;
     if (fileEntry.fileSize) {
-        /* Proceed to write out the data, this stuff could fail any moment... */
-        char buff[512];
-        quint32 remaining = fileEntry.fileSize;
-        quint32 done = 0;
-        qint64 startTime = QDateTime::currentMSecsSinceEpoch();
-        qint64 time = startTime;
-        qint64 timeElapsed = 0;
-
-        /* Prepare a buffer for storing the clusters */
-        const int cluster_buffer_len = 256;
-        quint32 cluster_buffer[cluster_buffer_len];
-        quint32 cluster_remaining = 0;
-        bool isFirstCluster = true;
-        quint32 cluster = 0;
-        while (remaining > 0) {
-
-            if (!cluster_remaining) {
-                if (isFirstCluster) {
-                    isFirstCluster = false;
-                    cluster = fileEntry.firstCluster();
-                    cluster_buffer[cluster_remaining++] = cluster;
-                }
+        /* When cancelled, writing may abort halfway; the file is then deleted below */
+        try {
+            /* Proceed to write out the data, this stuff could fail any moment... */
+            char buff[512];
+            quint32 remaining = fileEntry.fileSize;
+            quint32 done = 0;
+            qint64 startTime = QDateTime::currentMSecsSinceEpoch();
+            qint64 time = startTime;
+            qint64 timeElapsed = 0;
+
+            /* Prepare a buffer for storing the clusters */
+            const int cluster_buffer_len = 256;
+            quint32 cluster_buffer[cluster_buffer_len];
+            quint32 cluster_remaining = 0;
+            bool isFirstCluster = true;
+            quint32 cluster = 0;
+            while (remaining > 0) {
+
+                if (!cluster_remaining) {
+                    if (isFirstCluster) {
+                        isFirstCluster = false;
+                        cluster = fileEntry.firstCluster();
+                        cluster_buffer[cluster_remaining++] = cluster;
+                    }
 
-                quint32 cluster_next = cluster;
-                while (cluster_remaining < cluster_buffer_len) {
-                    cluster_next = protocol->sd().fatGet(cluster_next);
-                    if (protocol->sd().isEOC(cluster_next)) {
-                        break;
-                    } else {
-                        cluster_buffer[cluster_remaining++] = cluster_next;
+                    quint32 cluster_next = cluster;
+                    while (cluster_remaining < cluster_buffer_len) {
+                        cluster_next = protocol->sd().fatGet(cluster_next);
+                        if (protocol->sd().isEOC(cluster_next)) {
+                            break;
+                        } else {
+                            cluster_buffer[cluster_remaining++] = cluster_next;
+                        }
                     }
                 }
-            }
-            if (!cluster_remaining) {
-                // No more clusters available (odd?)
-                throw ProtocolException("Ran out of clusters to write to (Allocation error)");
-            }
-
-            // Poll the first cluster from the top of the buffer
-            cluster = cluster_buffer[0];
-            cluster_remaining--;
-            memcpy(cluster_buffer, cluster_buffer + 1, cluster_remaining * sizeof(quint32));
-
-            quint32 block = protocol->sd().getClusterBlock(cluster);
-            for (int i = 0; i < protocol->sd().volume().blocksPerCluster; i++) {
-                int read = sourceFile.read(buff, 512);
-                if (read == -1) {
-                    hasReadError = true;
-                    remaining = 0;
-                } else if (read < 512) {
-                    remaining = read;
+                if (!cluster_remaining) {
+                    // No more clusters available (odd?)
+                    throw ProtocolException("Ran out of clusters to write to (Allocation error)");
                 }
 
-                /* If cancelled, stop reading/writing by setting remaining to 0 */
-                if (isCancelled()) {
-                    remaining = 0;
-                }
+                // Poll the first cluster from the top of the buffer
+                cluster = cluster_buffer[0];
+                cluster_remaining--;
+                memcpy(cluster_buffer, cluster_buffer + 1, cluster_remaining * sizeof(quint32));
+
+                quint32 block = protocol->sd().getClusterBlock(cluster);
+                for (int i = 0; i < protocol->sd().volume().blocksPerCluster; i++) {
+                    int read = sourceFile.read(buff, 512);
+                    if (read == -1) {
+                        hasReadError = true;
+                        remaining = 0;
+                    } else if (read < 512) {
+                        remaining = read;
+                    }
 
-                time = QDateTime::currentMSecsSinceEpoch();
-                timeElapsed = (time - startTime) / 1000;
-                done = (fileEntry.fileSize - remaining);
-                int speed_ps;
-                if (timeElapsed == 0 || done == 0) {
-                    speed_ps = 6000;
-                } else {
-                    speed_ps = done / timeElapsed;
-                }
+                    /* If cancelled, stop reading/writing by setting remaining to 0 */
+                    if (isCancelled()) {
+                        remaining = 0;
+                    }
 
-                /* Update progress */
-                setProgress(progStart + progTotal * ((double) done / (double) fileEntry.fileSize));
-
-                /* Update the status info */
-                QString newStatus;
-                newStatus.append("Writing ").append(destFilePath).append(": ");
-                newStatus.append(stk500::getSizeText(remaining)).append(" remaining (");
-                newStatus.append(stk500::getSizeText(speed_ps)).append("/s)\n");
-                newStatus.append("Elapsed: ").append(stk500::getTimeText(timeElapsed));
-                newStatus.append(", estimated ").append(stk500::getTimeText(remaining / speed_ps));
-                newStatus.append(" remaining");
-                setStatus(newStatus);
-
-                /* Write the full block of data to the Micro-SD */
-                protocol->sd().write(block + i, 0, buff, 512);
-                if (remaining < 512) {
-                    remaining = 0;
-                    break;
-                } else {
-                    remaining -= 512;
+                    time = QDateTime::currentMSecsSinceEpoch();
+                    timeElapsed = (time - startTime) / 1000;
+                    done = (fileEntry.fileSize - remaining);
+                    int speed_ps;
+                    if (timeElapsed == 0 || done == 0) {
+                        speed_ps = 6000;
+                    } else {
+                        speed_ps = done / timeElapsed;
+                    }
+
+                    /* Update progress */
+                    setProgress(progStart + progTotal * ((double) done / (double) fileEntry.fileSize));
+
+                    /* Update the status info */
+                    QString newStatus;
+                    newStatus.append("Writing ").append(destFilePath).append(": ");
+                    newStatus.append(stk500::getSizeText(remaining)).append(" remaining (");
+                    newStatus.append(stk500::getSizeText(speed_ps)).append("/s)\n");
+                    newStatus.append("Elapsed: ").append(stk500::getTimeText(timeElapsed));
+                    newStatus.append(", estimated ").append(stk500::getTimeText(remaining / speed_ps));
+                    newStatus.append(" remaining");
+                    setStatus(newStatus);
+
+                    /* Write the full block of data to the Micro-SD */
+                    protocol->sd().write(block + i, 0, buff, 512);
+                    if (remaining < 512) {
+                        remaining = 0;
+                        break;
+                    } else {
+                        remaining -= 512;
+                    }
                 }
+
+                /* Let other short tasks run in between clusters */
+                yield();
+            }
+        } catch (ProtocolException&) {
+            if (!isCancelled()) {
+                throw;
             }
         }
     }
 
-    /* Flush data to the Micro-SD */
-    protocol->sd().flushCache();
+    /* If cancelled or reading failed, the file is deleted again; this cleanup must not be cancelled */
+    bool isAborted = isCancelled();
+    {
+        stk500CancelSuppressor suppress(this, isAborted || hasReadError);
 
-    /* Close eventually - is also done by the deconstructor when errors occur */
-    if (sourceFile.isOpen()) {
-        sourceFile.close();
-    }
+        /* Flush data to the Micro-SD */
+        protocol->sd().flushCache();
 
-    /* If cancelled or an error occurred while reading; delete the file */
-    if (isCancelled() || hasReadError) {
-        suppressCancel(true);
-        sd_remove(this->destFile, false);
-        suppressCancel(false);
+        /* Close eventually - is also done by the deconstructor when errors occur */
+        if (sourceFile.isOpen()) {
+            sourceFile.close();
+        }
+
+        /* If cancelled or an error occurred while reading; delete the file */
+        if (isAborted || hasReadError) {
+            sd_remove(this->destFile, false);
+        }
     }
 
     /* Deal with this once all is well and done... */
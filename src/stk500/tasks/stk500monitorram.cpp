@@ -0,0 +1,64 @@
+#include "../stk500task.h"
+#include <QElapsedTimer>
+#include <QThread>
+
+void stk500MonitorRam::run() {
+    QVector<quint16> addresses;
+    QVector<int> lengths;
+    QByteArray data;
+    QElapsedTimer timer;
+    timer.start();
+    bool pipelined = true;
+    while (!isCancelled()) {
+        // Read the ranges in view and watched, a limited amount of bytes per pipeline
+        qint64 pollStart = timer.nsecsElapsed() / 1000;
+        monitor->ranges(addresses, lengths);
+        if (!addresses.isEmpty()) {
+            int total = 0;
+            for (int i = 0; i < lengths.count(); i++) {
+                total += lengths[i];
+            }
+            data.resize(total);
+            int first = 0;
+            char* dest = data.data();
+            while (first < addresses.count()) {
+                int count = 0;
+                int bytes = 0;
+                while (((first + count) < addresses.count()) &&
+                       ((count == 0) || ((bytes + lengths[first + count]) <= RAM_MONITOR_BATCH_SIZE))) {
+                    bytes += lengths[first + count];
+                    count++;
+                }
+
+                // If the device can not keep up with pipelined commands, fall back to one at a time
+                if (pipelined) {
+                    try {
+                        protocol->RAM_readBatch(addresses.constData() + first, lengths.constData() + first, dest, count);
+                    } catch (ProtocolException &) {
+                        if (isCancelled()) {
+                            throw;
+                        }
+                        pipelined = false;
+                    }
+                }
+                if (!pipelined) {
+                    char* rangeDest = dest;
+                    for (int i = first; i < (first + count); i++) {
+                        protocol->RAM_read(addresses[i], rangeDest, lengths[i]);
+                        rangeDest += lengths[i];
+                    }
+                }
+                first += count;
+                dest += bytes;
+            }
+            monitor->store(addresses, lengths, data.constData(), timer.nsecsElapsed() / 1000 - pollStart);
+        }
+
+        // Wait until the next poll, letting register updates run in between
+        qint64 nextPoll = timer.nsecsElapsed() / 1000 + monitor->interval() * 1000;
+        while (!isCancelled() && ((timer.nsecsElapsed() / 1000) < nextPoll)) {
+            yield();
+            QThread::msleep(1);
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#include "../stk500task.h"
+#include <QElapsedTimer>
+#include <QThread>
+
+void stk500ProfileRam::run() {
+    // The bootloader is using the stack at the top, only the RAM below it is seeded
+    int stackPointer = readWord(ChipRegisters::findRegisterAddress("SPL"));
+    profile->setRegion(profile->heapStart(), stackPointer - RAM_PROFILE_SP_MARGIN);
+    if (profile->regionLength() < RAM_PROFILE_CANARY_RUN) {
+        throw ProtocolException("There is no free RAM between the heap and the stack to profile");
+    }
+
+    // Reset into the bootloader once without running the sketch
+    // Whatever the bootloader changes by itself is left out when scanning
+    setStatus("Measuring bootloader RAM use");
+    setProgress(0.0);
+    seed();
+    enterFirmware();
+    profile->setFootprint(readRegion());
+    if (isCancelled()) return;
+
+    // Seed again and let the sketch run for the time given
+    setStatus("Seeding free RAM");
+    seed();
+    setStatus("Running sketch");
+    protocol->signOut();
+    QElapsedTimer timer;
+    timer.start();
+    qint64 runTimeMs = (qint64) runTime * 1000;
+    while (!isCancelled() && (timer.elapsed() < runTimeMs)) {
+        setProgress((double) timer.elapsed() / runTimeMs);
+        setStatus(QString("Running sketch, %1 s left").arg((runTimeMs - timer.elapsed() + 999) / 1000));
+        QThread::msleep(50);
+    }
+    if (isCancelled()) return;
+
+    // Stop the sketch and scan what is left of the canary
+    setStatus("Scanning RAM");
+    enterFirmware();
+    QByteArray data = readRegion();
+    int brkval = (profile->brkvalAddress() == -1) ? 0 : readWord(profile->brkvalAddress());
+    stackPointer = readWord(ChipRegisters::findRegisterAddress("SPL"));
+    profile->analyze(data, brkval, stackPointer);
+    setProgress(1.0);
+}
+
+/* Fills the region with the canary */
+void stk500ProfileRam::seed() {
+    QByteArray canary(RAM_PROFILE_WRITE_SIZE, (char) RAM_PROFILE_CANARY);
+    int address = profile->regionStart();
+    while (address <= profile->regionEnd()) {
+        int length = qMin(RAM_PROFILE_WRITE_SIZE, profile->regionEnd() - address + 1);
+        protocol->RAM_write(address, canary.constData(), length);
+        address += length;
+    }
+}
+
+QByteArray stk500ProfileRam::readRegion() {
+    QByteArray data(profile->regionLength(), 0);
+    protocol->RAM_read(profile->regionStart(), data.data(), data.length());
+    return data;
+}
+
+quint16 stk500ProfileRam::readWord(int address) {
+    char data[2];
+    protocol->RAM_read(address, data, sizeof(data));
+    return ((quint8) data[1] << 8) | (quint8) data[0];
+}
+
+/* Resets the device and signs on, so the bootloader runs again; the RAM is kept */
+void stk500ProfileRam::enterFirmware() {
+    protocol->resetFirmware();
+    protocol->signOn();
+}
@@ -0,0 +1,99 @@
+#include "../stk500task.h"
+
+#define READFLASH_PROBE_STEP     1024   // Distance between the addresses probed to find the end of the sketch
+#define READFLASH_PROBE_LENGTH     16   // Amount of bytes read at every address probed
+#define READFLASH_BATCH_PAGES      16   // Amount of pages read in a single pipeline
+
+/* Checks whether a block of flash data is entirely erased (0xFF) */
+static bool isBlank(const char* data, int length) {
+    for (int i = 0; i < length; i++) {
+        if (data[i] != (char) 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void stk500ReadFlash::run() {
+    QByteArray flash(BOOT_TOTAL_MEM, (char) 0xFF);
+
+    /* Probe the sketch area sparsely to find roughly where the sketch ends */
+    setStatus("Probing flash");
+    setProgress(0.0);
+    QVector<quint32> probeAddresses;
+    for (quint32 address = 0; address < BOOT_START_ADDR; address += READFLASH_PROBE_STEP) {
+        probeAddresses.append(address);
+    }
+    QByteArray probeData(probeAddresses.count() * READFLASH_PROBE_LENGTH, 0);
+    readPages(probeAddresses.constData(), probeData.data(), probeAddresses.count(), READFLASH_PROBE_LENGTH);
+    quint32 firstBlank = BOOT_START_ADDR;
+    bool hasDataAfterBlank = false;
+    for (int i = 0; i < probeAddresses.count(); i++) {
+        if (!isBlank(probeData.constData() + i * READFLASH_PROBE_LENGTH, READFLASH_PROBE_LENGTH)) {
+            hasDataAfterBlank = hasDataAfterBlank || (firstBlank != BOOT_START_ADDR);
+        } else if (firstBlank == BOOT_START_ADDR) {
+            firstBlank = probeAddresses[i];
+        }
+    }
+
+    /*
+     * Data after a blank probe means the sketch is not one block, then the entire sketch area is read.
+     * Otherwise the sketch is read up to the first blank probe, and continues for as long as
+     * the pages following it hold any data.
+     */
+    quint32 sketchEnd = hasDataAfterBlank ? BOOT_START_ADDR : firstBlank;
+    readRange(flash.data(), 0, sketchEnd, 0, sketchEnd + BOOT_SIZE);
+    while (!isCancelled() && (sketchEnd < BOOT_START_ADDR)) {
+        quint32 checkEnd = std::min((quint32) BOOT_START_ADDR, sketchEnd + READFLASH_PROBE_STEP);
+        readRange(flash.data(), sketchEnd, checkEnd, sketchEnd, checkEnd + BOOT_SIZE);
+        if (isBlank(flash.constData() + sketchEnd, checkEnd - sketchEnd)) {
+            break;
+        }
+        sketchEnd = checkEnd;
+    }
+
+    /* Read the firmware */
+    if (!isCancelled()) {
+        readRange(flash.data(), BOOT_START_ADDR, BOOT_TOTAL_MEM, sketchEnd, sketchEnd + BOOT_SIZE);
+    }
+    if (isCancelled()) {
+        return;
+    }
+    data.loadBinary(flash);
+    setProgress(1.0);
+}
+
+/* Reads a range of flash in pipelined batches of pages, updating the status as it goes */
+void stk500ReadFlash::readRange(char* flash, quint32 address, quint32 endAddress, quint32 doneBytes, quint32 totalBytes) {
+    while ((address < endAddress) && !isCancelled()) {
+        QString status("Reading flash: ");
+        status += QString::number(doneBytes);
+        status += " / ";
+        status += QString::number(totalBytes);
+        status += " bytes";
+        setStatus(status);
+        setProgress((double) doneBytes / (double) totalBytes);
+
+        QVector<quint32> pages;
+        while ((address < endAddress) && (pages.count() < READFLASH_BATCH_PAGES)) {
+            pages.append(address);
+            address += 256;
+        }
+        readPages(pages.constData(), flash + pages.first(), pages.count(), 256);
+        doneBytes += pages.count() * 256;
+
+        /* Let other short tasks run in between batches */
+        yield();
+    }
+}
+
+/* Reads pages in a single pipeline; once the device failed to keep up, they are read one at a time */
+void stk500ReadFlash::readPages(const quint32 *addresses, char* dest, int count, int length) {
+    if (pipelined) {
+        pipelined = protocol->FLASH_readBatch(addresses, dest, count, length);
+    } else {
+        for (int i = 0; i < count; i++) {
+            protocol->FLASH_readPage(addresses[i], dest + i * length, length);
+        }
+    }
+}
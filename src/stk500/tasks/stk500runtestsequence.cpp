@@ -0,0 +1,194 @@
+#include "../stk500task.h"
+#include <QThread>
+
+void stk500RunTestSequence::run() {
+    QList<TestCase> &tests = sequence->testCases();
+    sequence->clearResults();
+    timer.start();
+
+    // All registers are read once, so that the steps can write whole registers
+    // From then on, only the values expected are read back
+    reg.setPolledAll(true);
+    try {
+        protocol->reg().read(reg);
+    } catch (ProtocolException &ex) {
+        for (int i = 0; i < tests.count(); i++) {
+            tests[i].error = ex.what();
+        }
+        throw;
+    }
+
+    for (int i = 0; i < tests.count(); i++) {
+        TestCase &test = tests[i];
+        if (isCancelled()) {
+            test.skipped = true;
+            continue;
+        }
+        setStatus("Running test " + test.name);
+        setProgress((double) i / tests.count());
+        qint64 startTime = timer.nsecsElapsed();
+        try {
+            runTest(test);
+        } catch (ProtocolException &ex) {
+            test.error = ex.what();
+        }
+        test.time = (timer.nsecsElapsed() - startTime) / 1000;
+
+        // Communication failed, the remaining tests can not run
+        if (!test.error.isEmpty()) {
+            for (int j = i + 1; j < tests.count(); j++) {
+                tests[j].skipped = true;
+            }
+            break;
+        }
+    }
+    setProgress(1.0);
+}
+
+void stk500RunTestSequence::runTest(TestCase &test) {
+    const QList<TestStep> &steps = test.steps;
+    int i = 0;
+    while ((i < steps.count()) && !isCancelled()) {
+        const TestStep &step = steps[i];
+        if (step.type == TEST_STEP_SLEEP) {
+            // Sleeps are timed from the moment the previous step completed
+            sleepUntil(timer.nsecsElapsed() + (qint64) step.time * 1000000);
+            i++;
+            continue;
+        }
+
+        // Consecutive steps of the same kind are done together
+        int end = i + 1;
+        bool isSet = stk500TestSequence::isSetStep(step);
+        while ((end < steps.count()) && (isSet ? stk500TestSequence::isSetStep(steps[end])
+                                               : stk500TestSequence::isExpectStep(steps[end]))) {
+            end++;
+        }
+        if (isSet) {
+            writeSteps(steps, i, end);
+        } else {
+            expectSteps(test, i, end);
+        }
+        i = end;
+    }
+    if (isCancelled()) {
+        test.skipped = true;
+    }
+}
+
+/* Applies all changes, then writes them using as few RAM writes as possible */
+void stk500RunTestSequence::writeSteps(const QList<TestStep> &steps, int first, int end) {
+    for (int i = first; i < end; i++) {
+        const TestStep &step = steps[i];
+        if (step.type == TEST_STEP_SET_PIN) {
+            reg.setPin(step.pin, step.mode, step.value != 0);
+        } else {
+            reg.set(step.address, (quint8) step.value);
+        }
+    }
+    protocol->reg().write(reg);
+    reg.acceptUserChanges();
+}
+
+/*
+ * Reads all registers and analog inputs the steps expect in one go, and compares them
+ * When steps allow time for the expected values to show up, they are read until all match
+ */
+void stk500RunTestSequence::expectSteps(TestCase &test, int first, int end) {
+    const QList<TestStep> &steps = test.steps;
+    QVector<quint8> channels;
+    int timeout = 0;
+    reg.setPolledAll(false);
+    for (int i = first; i < end; i++) {
+        const TestStep &step = steps[i];
+        if (step.type == TEST_STEP_EXPECT_ADC) {
+            channels.append((quint8) step.channel);
+        } else {
+            reg.setPolled(step.address, true);
+        }
+        timeout = qMax(timeout, step.time);
+    }
+    QVector<quint16> analog(channels.count());
+    bool hasRegisters = (channels.count() < (end - first));
+    qint64 startTime = timer.nsecsElapsed();
+    qint64 deadline = startTime + (qint64) timeout * 1000000;
+    QVector<bool> matched(end - first, false);
+    bool firstRead = true;
+    forever {
+        if (hasRegisters) {
+            protocol->reg().read(reg);
+        }
+        if (!channels.isEmpty()) {
+            protocol->ANALOG_readBatch(channels.data(), analog.data(), channels.count());
+        }
+
+        // A step that matched in time passes, even if its value changes after
+        qint64 elapsed = timer.nsecsElapsed() - startTime;
+        bool allMatched = true;
+        int channelIdx = 0;
+        for (int i = first; i < end; i++) {
+            const TestStep &step = steps[i];
+            bool match;
+            if (step.type == TEST_STEP_EXPECT_PIN) {
+                match = (reg.getPin(step.pin) == (step.value != 0));
+            } else if (step.type == TEST_STEP_EXPECT_REGISTER) {
+                match = ((reg[step.address] & step.mask) == (step.value & step.mask));
+            } else {
+                quint16 value = analog[channelIdx++];
+                match = (value >= step.value) && (value <= step.maximum);
+            }
+            if (match && (firstRead || (elapsed <= (qint64) step.time * 1000000))) {
+                matched[i - first] = true;
+            }
+            allMatched &= matched[i - first];
+        }
+        if (allMatched || (timer.nsecsElapsed() >= deadline) || isCancelled()) {
+            break;
+        }
+        firstRead = false;
+        yield();
+    }
+    if (isCancelled()) {
+        return;
+    }
+
+    // Report the steps that did not match, with the last values read
+    int channelIdx = 0;
+    for (int i = first; i < end; i++) {
+        const TestStep &step = steps[i];
+        QString message;
+        if (step.type == TEST_STEP_EXPECT_PIN) {
+            message = QString("pin %1 is %2, expected %3")
+                    .arg(step.pin).arg(reg.getPin(step.pin) ? 1 : 0).arg(step.value);
+        } else if (step.type == TEST_STEP_EXPECT_REGISTER) {
+            message = QString("register %1 is 0x%2, expected 0x%3 (mask 0x%4)")
+                    .arg(reg.info(step.address).name)
+                    .arg(reg[step.address], 2, 16, QChar('0'))
+                    .arg(step.value, 2, 16, QChar('0'))
+                    .arg(step.mask, 2, 16, QChar('0'));
+        } else {
+            message = QString("analog input %1 is %2, expected %3 to %4")
+                    .arg(step.channel).arg(analog[channelIdx]).arg(step.value).arg(step.maximum);
+            channelIdx++;
+        }
+        if (!matched[i - first]) {
+            if (step.time) {
+                message += QString(" within %1 ms").arg(step.time);
+            }
+            test.failures.append(QString("Line %1: %2").arg(step.line).arg(message));
+        }
+    }
+}
+
+/* Sleeps until shortly before the deadline, and spins for the remainder to be precise */
+void stk500RunTestSequence::sleepUntil(qint64 deadline) {
+    qint64 remaining;
+    while (((remaining = deadline - timer.nsecsElapsed()) > 0) && !isCancelled()) {
+        qint64 remainingMs = remaining / 1000000;
+        if (remainingMs > TEST_SEQUENCE_SPIN_TIME) {
+            QThread::msleep(remainingMs - TEST_SEQUENCE_SPIN_TIME);
+        } else {
+            QThread::yieldCurrentThread();
+        }
+    }
+}
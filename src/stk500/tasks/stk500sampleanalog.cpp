@@ -0,0 +1,57 @@
+#include "../stk500task.h"
+#include <QElapsedTimer>
+
+void stk500SampleAnalog::run() {
+    if (channels.isEmpty()) {
+        return;
+    }
+
+    /*
+     * Channels are read in turn, as many at once as the pipeline allows
+     * If the device can not keep up with pipelined commands, fall back to one at a time
+     */
+    int depth = qMax(1, protocol->getPipelineDepth());
+    QVector<quint8> pins(depth);
+    QVector<quint16> values(depth);
+    QVector<AnalogSample> samples(depth);
+    QElapsedTimer timer;
+    timer.start();
+    qint64 lastStatusTime = 0;
+    int channelIdx = 0;
+    while (!isCancelled()) {
+        for (int i = 0; i < depth; i++) {
+            pins[i] = (quint8) channels[(channelIdx + i) % channels.count()];
+        }
+
+        qint64 startTime = timer.nsecsElapsed() / 1000;
+        try {
+            protocol->ANALOG_readBatch(pins.data(), values.data(), depth);
+        } catch (ProtocolException &) {
+            if ((depth == 1) || isCancelled()) {
+                throw;
+            }
+            depth = 1;
+            continue;
+        }
+        qint64 endTime = timer.nsecsElapsed() / 1000;
+
+        // Spread the timestamps over the time the batch took
+        for (int i = 0; i < depth; i++) {
+            samples[i].time = startTime + (endTime - startTime) * (i + 1) / depth;
+            samples[i].channel = pins[i];
+            samples[i].value = values[i];
+        }
+        buffer->append(samples.data(), depth);
+        channelIdx = (channelIdx + depth) % channels.count();
+
+        // Show the sample rate every now and then
+        if ((endTime - lastStatusTime) >= 1000000) {
+            double rate = (double) buffer->total() * 1000000.0 / qMax((qint64) 1, endTime);
+            setStatus(QString("Sampling analog inputs: %1 samples/s").arg(rate, 0, 'f', 0));
+            lastStatusTime = endTime;
+        }
+
+        // Let register updates run in between
+        yield();
+    }
+}
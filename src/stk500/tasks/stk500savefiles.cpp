@@ -17,62 +17,72 @@ void stk500SaveFiles::saveFile(DirectoryEntry fileEntry, QString sourceFilePath,
     }
 
     /* Proceed to read in data */
+    /* When cancelled, reading may abort halfway; the file is then deleted below */
     quint32 cluster = fileEntry.firstCluster();
     if (cluster) {
-        char buff[512];
-        quint32 remaining = fileEntry.fileSize;
-        quint32 done = 0;
-        qint64 startTime = QDateTime::currentMSecsSinceEpoch();
-        qint64 time = startTime;
-        qint64 timeElapsed = 0;
-        while (remaining > 0) {
-            quint32 block = protocol->sd().getClusterBlock(cluster);
-            for (int i = 0; i < protocol->sd().volume().blocksPerCluster; i++) {
-                protocol->sd().read(block + i, 0, buff, 512);
-
-                /* If cancelled, stop reading/writing by setting remaining to 0 */
-                if (isCancelled()) {
-                    remaining = 0;
+        try {
+            char buff[512];
+            quint32 remaining = fileEntry.fileSize;
+            quint32 done = 0;
+            qint64 startTime = QDateTime::currentMSecsSinceEpoch();
+            qint64 time = startTime;
+            qint64 timeElapsed = 0;
+            while (remaining > 0) {
+                quint32 block = protocol->sd().getClusterBlock(cluster);
+                for (int i = 0; i < protocol->sd().volume().blocksPerCluster; i++) {
+                    protocol->sd().read(block + i, 0, buff, 512);
+
+                    /* If cancelled, stop reading/writing by setting remaining to 0 */
+                    if (isCancelled()) {
+                        remaining = 0;
+                    }
+
+                    time = QDateTime::currentMSecsSinceEpoch();
+                    timeElapsed = (time - startTime) / 1000;
+                    done = (fileEntry.fileSize - remaining);
+                    int speed_ps;
+                    if (timeElapsed == 0 || done == 0) {
+                        speed_ps = 6000;
+                    } else {
+                        speed_ps = done / timeElapsed;
+                    }
+
+                    /* Update progress */
+                    setProgress(progStart + progTotal * ((double) done / (double) fileEntry.fileSize));
+
+                    /* Update the status info */
+                    QString newStatus;
+                    newStatus.append("Reading ").append(sourceFilePath).append(": ");
+                    newStatus.append(stk500::getSizeText(remaining)).append(" remaining (");
+                    newStatus.append(stk500::getSizeText(speed_ps)).append("/s)\n");
+                    newStatus.append("Elapsed: ").append(stk500::getTimeText(timeElapsed));
+                    newStatus.append(", estimated ").append(stk500::getTimeText(remaining / speed_ps));
+                    newStatus.append(" remaining");
+                    setStatus(newStatus);
+
+                    /* Write the 512 or less bytes of buffered data to the file */
+                    if (remaining < 512) {
+                        destFile.write(buff, remaining);
+                        remaining = 0;
+                        break;
+                    } else {
+                        destFile.write(buff, 512);
+                        remaining -= 512;
+                    }
                 }
 
-                time = QDateTime::currentMSecsSinceEpoch();
-                timeElapsed = (time - startTime) / 1000;
-                done = (fileEntry.fileSize - remaining);
-                int speed_ps;
-                if (timeElapsed == 0 || done == 0) {
-                    speed_ps = 6000;
-                } else {
-                    speed_ps = done / timeElapsed;
-                }
-
-                /* Update progress */
-                setProgress(progStart + progTotal * ((double) done / (double) fileEntry.fileSize));
-
-                /* Update the status info */
-                QString newStatus;
-                newStatus.append("Reading ").append(sourceFilePath).append(": ");
-                newStatus.append(stk500::getSizeText(remaining)).append(" remaining (");
-                newStatus.append(stk500::getSizeText(speed_ps)).append("/s)\n");
-                newStatus.append("Elapsed: ").append(stk500::getTimeText(timeElapsed));
-                newStatus.append(", estimated ").append(stk500::getTimeText(remaining / speed_ps));
-                newStatus.append(" remaining");
-                setStatus(newStatus);
-
-                /* Write the 512 or less bytes of buffered data to the file */
-                if (remaining < 512) {
-                    destFile.write(buff, remaining);
-                    remaining = 0;
+                // Next cluster, if end of chain no more clusters follow
+                cluster = protocol->sd().fatGet(cluster);
+                if (protocol->sd().isEOC(cluster)) {
                     break;
-                } else {
-                    destFile.write(buff, 512);
-                    remaining -= 512;
                 }
-            }
 
-            // Next cluster, if end of chain no more clusters follow
-            cluster = protocol->sd().fatGet(cluster);
-            if (protocol->sd().isEOC(cluster)) {
-                break;
+                // Let other short tasks run in between clusters
+                yield();
+            }
+        } catch (ProtocolException&) {
+            if (!isCancelled()) {
+                throw;
             }
         }
     }
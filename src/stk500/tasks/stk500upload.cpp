@@ -1,4 +1,8 @@
 #include "../stk500task.h"
+#include <QElapsedTimer>
+
+#define UPLOAD_BATCH_PAGES    16   // Amount of pages read or written in a single pipeline
+#define UPLOAD_RETRY_LIMIT     2   // Amount of times a page failing verification is written again
 
 void stk500Upload::init() {
     setUsesFirmware(!data.hasFirmwareData());
@@ -30,6 +34,9 @@ void stk500Upload::run() {
             }
         }
 
+        /* Once the service routine is started, it must be completed; it can not be cancelled */
+        stk500CancelSuppressor suppress(this);
+
         /* Initialize service routine */
         setStatus("Initializing service routine");
         protocol->service().begin();
@@ -87,30 +94,99 @@ void stk500Upload::run() {
 
     /* Program sketch data using STK500 protocol */
     if (data.hasSketchData()) {
-        quint32 pageAddress = 0;
         quint32 programSize = data.sketchSize();
-        do {
-            /* Update status */
+
+        /* Progress of the sketch upload is spread over the part left after the firmware */
+        double progressStart = (halfProgress ? 0.5 : 0.0);
+        double progressScale = (halfProgress ? 0.5 : 1.0);
+        double writeStart = (differential ? 0.25 : 0.0);
+        double writeScale = (differential ? 0.75 : 1.0);
+
+        /* Find the pages that differ from what is on the device, or write all of them */
+        QVector<quint32> pages;
+        bool compared = false;
+        if (differential) {
+            try {
+                quint32 pageAddress = 0;
+                do {
+                    QString status("Comparing sketch data: ");
+                    status += QString::number(pageAddress);
+                    status += " / ";
+                    status += QString::number((int) programSize);
+                    setStatus(status);
+                    setProgress(progressStart + progressScale * writeStart * ((double) pageAddress / (double) programSize));
+
+                    quint32 endAddress = std::min(programSize, pageAddress + UPLOAD_BATCH_PAGES * 256);
+                    pages += protocol->FLASH_changedPages(data, pageAddress, endAddress);
+                    pageAddress = endAddress;
+
+                    /* Let other short tasks run in between reads */
+                    yield();
+
+                } while ((pageAddress < programSize) && !isCancelled());
+                compared = true;
+            } catch (ProtocolException &) {
+                /* Reading back failed; fall back to writing all pages */
+                if (isCancelled()) {
+                    throw;
+                }
+            }
+        }
+        if (!compared) {
+            pages.clear();
+            for (quint32 pageAddress = 0; pageAddress < programSize; pageAddress += 256) {
+                pages.append(pageAddress);
+            }
+        }
+
+        /* Write the pages and read them back, in batches of pages */
+        QVector<quint32> retryPages;
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; (i < pages.count()) && !isCancelled(); i += UPLOAD_BATCH_PAGES) {
+            int count = std::min(UPLOAD_BATCH_PAGES, pages.count() - i);
+
+            /* Update status, with the speed and time left once known */
             QString status("Writing sketch data: ");
-            status += QString::number(pageAddress);
+            status += QString::number(i * 256);
             status += " / ";
-            status += QString::number((int) programSize);
+            status += QString::number(pages.count() * 256);
+            qint64 elapsed = timer.elapsed();
+            if ((i > 0) && (elapsed > 0)) {
+                int bytesPerSecond = (int) ((qint64) i * 256 * 1000 / elapsed);
+                int secondsLeft = (int) ((qint64) (pages.count() - i) * 256 / std::max(1, bytesPerSecond));
+                status += QString(" (%1 bytes/s, %2 s left)").arg(bytesPerSecond).arg(secondsLeft);
+            }
             setStatus(status);
-            if (halfProgress) {
-                setProgress(0.5 + 0.5 * ((double) pageAddress / (double) programSize));
-            } else {
-                setProgress((double) pageAddress / (double) programSize);
+            setProgress(progressStart + progressScale * (writeStart + writeScale * ((double) i / pages.count())));
+
+            /* Compose the pages of data, padded with 0xFF */
+            QByteArray batchData(count * 256, (char) 0xFF);
+            for (int j = 0; j < count; j++) {
+                quint32 pageAddress = pages[i + j];
+                int len = std::min(256, (int) (programSize - pageAddress));
+                memcpy(batchData.data() + j * 256, data.sketchPage(pageAddress), len);
             }
+            retryPages += protocol->FLASH_writeVerifyBatch(pages.constData() + i, batchData.constData(), count);
 
-            /* Prepare and write the page of data */
-            int len = std::min(256, (int) (programSize - pageAddress));
-            memcpy(pageData, data.sketchPage(pageAddress), len);
-            memset(pageData+len, 0xFF, 256-len);
-            protocol->FLASH_writePage(pageAddress, pageData, 256);
-
-            /* Next page */
-            pageAddress += 256;
+            /* Let other short tasks run in between batches */
+            yield();
+        }
 
-        } while ((pageAddress < programSize) && !isCancelled());
+        /* Pages that did not verify are written again, a limited amount of times */
+        for (int retry = 0; !retryPages.isEmpty() && !isCancelled(); retry++) {
+            if (retry == UPLOAD_RETRY_LIMIT) {
+                QString err = QString("Failed to write page at address %0"
+                                      ": verification error.").arg(QString::number(retryPages.first()));
+                throw ProtocolException(err);
+            }
+            setStatus(QString("Writing sketch data: retrying %1 pages").arg(retryPages.count()));
+            QByteArray retryData(retryPages.count() * 256, (char) 0xFF);
+            for (int j = 0; j < retryPages.count(); j++) {
+                int len = std::min(256, (int) (programSize - retryPages[j]));
+                memcpy(retryData.data() + j * 256, data.sketchPage(retryPages[j]), len);
+            }
+            retryPages = protocol->FLASH_writeVerifyBatch(retryPages.constData(), retryData.constData(), retryPages.count());
+        }
     }
 }